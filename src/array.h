@@ -43,6 +43,7 @@ typedef struct {
 	DATA_UNSET;
 
 	buffer *value;
+	int ext; /* enum http_header_e of key, if element of an HTTP header array */
 } data_string;
 
 data_string *data_string_init(void);
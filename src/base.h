@@ -25,6 +25,7 @@
 #include "keyvalue.h"
 #include "sys-socket.h"
 #include "etag.h"
+#include "http_header.h"
 
 struct fdevents;        /* declaration */
 struct stat_cache;      /* declaration */
@@ -147,6 +148,7 @@ typedef struct {
 	const char   *http_if_none_match;
 
 	array  *headers;
+	http_header_index hindex; /* known headers in headers */
 
 	/* CONTENT */
 	off_t content_length; /* returned by strtoll() */
@@ -164,6 +166,7 @@ typedef struct {
 	int     keep_alive;               /* used by  the subrequests in proxy, cgi and fcgi to say the subrequest was keep-alive or not */
 
 	array  *headers;
+	http_header_index hindex; /* known headers in headers */
 
 	enum {
 		HTTP_TRANSFER_ENCODING_IDENTITY, HTTP_TRANSFER_ENCODING_CHUNKED
@@ -200,13 +203,23 @@ typedef struct {
 
 	time_t stat_ts;
 
+	uint32_t hash;   /* stat cache key: hash of name and follow-symlink flag */
+	char referenced; /* CLOCK reference bit, cleared by the eviction hand */
+
+	int fd;          /* cached read-only fd of a regular file, or -1 */
+	int refcnt;      /* stat cache + chunks sharing fd or content */
+	buffer *content; /* content of a small regular file, or NULL */
+
 #ifdef HAVE_LSTAT
 	char is_symlink;
 #endif
 
-#ifdef HAVE_FAM_H
+#if defined(HAVE_FAM_H) || defined(HAVE_SYS_INOTIFY_H)
 	int    dir_version;
 #endif
+#ifdef HAVE_SYS_INOTIFY_H
+	void  *inotify_dir; /* watched directory the entry is counted in */
+#endif
 
 	buffer *content_type;
 } stat_cache_entry;
@@ -220,6 +233,7 @@ typedef struct {
 	buffer *error_handler;
 	buffer *error_handler_404;
 	buffer *server_tag;
+	buffer *server_tag_hdr; /* "\r\nServer: " + encoded server_tag, or empty */
 	buffer *dirlist_encoding;
 	buffer *errorfile_prefix;
 	buffer *socket_perms;
@@ -303,6 +317,25 @@ typedef enum {
 	CON_STATE_CLOSE
 } connection_state_t;
 
+/* request timing (if srvconf.request_timing): time when a request first
+ * reached each point; the time spent in a stage is the time from the
+ * previous point reached (or from request_start_hp) */
+typedef enum {
+	CON_TIMING_READ,           /* request headers received */
+	CON_TIMING_PARSE,          /* request parsed (CON_STATE_READ_POST or
+	                            * CON_STATE_HANDLE_REQUEST) */
+	CON_TIMING_BODY,           /* request handling starts (request body
+	                            * received, unless it is streamed) */
+	CON_TIMING_CONFIG,         /* config conditions evaluated */
+	CON_TIMING_URI,            /* handle_uri_raw, handle_uri_clean done */
+	CON_TIMING_PHYSICAL,       /* handle_docroot, handle_physical done */
+	CON_TIMING_HANDLER,        /* handle_subrequest_start done */
+	CON_TIMING_BACKEND,        /* response available (CON_STATE_RESPONSE_START) */
+	CON_TIMING_RESPONSE_START, /* response headers created (CON_STATE_WRITE) */
+	CON_TIMING_WRITE,          /* response written (CON_STATE_RESPONSE_END) */
+	CON_TIMING_MAX
+} con_timing_t;
+
 typedef enum {
 	/* condition not active at the moment because itself or some
 	 * pre-condition depends on data not available yet
@@ -337,9 +370,15 @@ struct connection {
 	time_t close_timeout_ts;
 	time_t write_request_ts;
 
+	/* timer wheel linkage (see connections.c); timer_ts == 0 if unscheduled */
+	time_t timer_ts;
+	struct connection *timer_next;
+	struct connection *timer_prev;
+
 	time_t connection_start;
 	time_t request_start;
 	struct timespec request_start_hp;
+	struct timespec timing[CON_TIMING_MAX]; /* (tv_sec == 0 if not reached) */
 
 	size_t request_count;        /* number of requests handled in this connection */
 	size_t loops_per_request;    /* to catch endless loops in a single request
@@ -445,6 +484,8 @@ typedef struct {
 
 	buffer *errorlog_file;
 	unsigned short errorlog_use_syslog;
+	unsigned short errorlog_async;
+	unsigned int errorlog_rate_limit; /* messages per second per source line */
 	buffer *breakagelog_file;
 
 	unsigned short dont_daemonize;
@@ -463,8 +504,13 @@ typedef struct {
 	array *upload_tempdirs;
 	unsigned int upload_temp_file_size;
 	unsigned int max_request_field_size;
+	unsigned int stat_cache_max_entries;
+	unsigned int stat_cache_max_fds;
+	unsigned int stat_cache_content_max_size;
+	unsigned int stat_cache_content_memory; /* kbytes */
 
 	unsigned short max_worker;
+	unsigned short reuse_port;
 	unsigned short max_fds;
 	unsigned short max_conns;
 
@@ -476,6 +522,9 @@ typedef struct {
 			STAT_CACHE_ENGINE_SIMPLE
 #ifdef HAVE_FAM_H
 			, STAT_CACHE_ENGINE_FAM
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+			, STAT_CACHE_ENGINE_INOTIFY
 #endif
 	} stat_cache_engine;
 	unsigned short enable_cores;
@@ -486,9 +535,11 @@ typedef struct {
 	unsigned short http_host_strict;
 	unsigned short http_host_normalize;
 	unsigned short high_precision_timestamps;
+	unsigned short request_timing; /* set by modules using con->timing */
 	time_t loadts;
 	double loadavg[3];
 	buffer *syslog_facility;
+	buffer *statistics_file;
 } server_config;
 
 typedef struct server_socket {
@@ -498,6 +549,7 @@ typedef struct server_socket {
 
 	unsigned short is_ssl;
 	unsigned short sidx;
+	unsigned short worker; /* 0 if shared; else only used by worker n (server.reuse-port) */
 
 	buffer *srv_token;
 } server_socket;
@@ -516,6 +568,8 @@ struct server {
 	int errorlog_fd;
 	enum { ERRORLOG_FILE, ERRORLOG_FD, ERRORLOG_SYSLOG, ERRORLOG_PIPE } errorlog_mode;
 	buffer *errorlog_buf;
+	struct log_error_st *errorlog_st; /* see log.c */
+	unsigned int errorlog_dropped; /* messages not logged (rate limit, queue full) */
 
 	struct fdevents *ev;
 
@@ -528,6 +582,8 @@ struct server {
 	int con_written;
 	int con_closed;
 
+	off_t bytes_written_cur_second; /* all connections; reset once a second */
+
 	int max_fds;    /* max possible fds */
 	int cur_fds;    /* currently used fds */
 	int want_fds;   /* waiting fds */
@@ -559,7 +615,7 @@ struct server {
 	time_t startup_ts;
 
 	buffer *ts_debug_str;
-	buffer *ts_date_str;
+	buffer *ts_date_str; /* "\r\nDate: " + HTTP-date of last_generated_date_ts */
 
 	/* config-file */
 	array *config_touched;
@@ -576,22 +632,20 @@ struct server {
 	connections *joblist;
 	connections *fdwaitqueue;
 
+	/* connection timeouts, indexed by deadline (see connections.c) */
+	connection *timer_wheel[CONNECTION_TIMER_SLOTS];
+	time_t timer_wheel_ts; /* last second processed */
+
 	struct stat_cache *stat_cache;
 
-	/**
-	 * The status array can carry all the status information you want
-	 * the key to the array is <module-prefix>.<name>
-	 * and the values are counters
-	 *
-	 * example:
-	 *   fastcgi.backends        = 10
-	 *   fastcgi.active-backends = 6
-	 *   fastcgi.backend.<key>.load = 24
-	 *   fastcgi.backend.<key>....
-	 *
-	 *   fastcgi.backend.<key>.disconnects = ...
-	 */
-	array *status;
+	/* status counters (see status_counter.h) */
+	array *status;         /* name -> slot, of counters used by this process */
+	int64_t *status_values;/* values of this process, indexed by slot */
+	array *status_totals;  /* see status_counter_totals() */
+	struct status_counter_hdr *status_shm;
+	size_t status_shm_size;
+	int status_shm_mapped;
+	int status_fd;         /* server.statistics-file until mapped */
 
 	int event_handler;
 
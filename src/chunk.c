@@ -26,6 +26,22 @@
 #define DEFAULT_TEMPFILE_SIZE (1 * 1024 * 1024)
 #define MAX_TEMPFILE_SIZE (128 * 1024 * 1024)
 
+/* chunks are pooled server-wide and shared by all chunkqueues
+ * - the buffer storage of a released chunk is kept up to CHUNK_POOL_BUF_MAX
+ * - chunks with storage >= CHUNK_POOL_BUF_MIN (e.g. used for reading from a
+ *   socket) are kept in a separate list, handed out for chunkqueue_get_memory()
+ * - chunkqueue_chunk_pool_trim() (once a second) frees half of the chunks
+ *   which stayed unused since the last call
+ */
+#define CHUNK_POOL_BUF_MIN (4 * 1024)
+#define CHUNK_POOL_BUF_MAX (16 * 1024 + 64)
+
+static struct {
+	chunk *first;
+	size_t used;
+	size_t low; /* lowest "used" since last trim */
+} chunk_pool[2]; /* [0]: small buffer storage, [1]: >= CHUNK_POOL_BUF_MIN */
+
 static array *chunkqueue_default_tempdirs = NULL;
 static unsigned int chunkqueue_default_tempfile_size = DEFAULT_TEMPFILE_SIZE;
 
@@ -44,8 +60,6 @@ chunkqueue *chunkqueue_init(void) {
 	cq->first = NULL;
 	cq->last = NULL;
 
-	cq->unused = NULL;
-
 	cq->tempdirs              = chunkqueue_default_tempdirs;
 	cq->upload_temp_file_size = chunkqueue_default_tempfile_size;
 
@@ -66,6 +80,9 @@ static chunk *chunk_init(void) {
 	c->file.mmap.start = MAP_FAILED;
 	c->file.mmap.length = 0;
 	c->file.is_temp = 0;
+	c->ref = NULL;
+	c->refchg = NULL;
+	c->mem_own = NULL;
 	c->offset = 0;
 	c->next = NULL;
 
@@ -75,9 +92,29 @@ static chunk *chunk_init(void) {
 static void chunk_reset(chunk *c) {
 	if (NULL == c) return;
 
+	if (NULL != c->refchg) {
+		c->refchg(c->ref, -1);
+		c->refchg = NULL;
+		c->ref = NULL;
+		if (MEM_CHUNK == c->type) {
+			c->mem = c->mem_own;
+			c->mem_own = NULL;
+		} else {
+			c->file.fd = -1;
+		}
+	}
+
 	c->type = MEM_CHUNK;
 
-	buffer_reset(c->mem);
+	/*(like buffer_reset(), but keep larger storage for reuse)*/
+	if (c->mem->size > CHUNK_POOL_BUF_MAX) {
+		free(c->mem->ptr);
+		c->mem->ptr = NULL;
+		c->mem->size = 0;
+	} else if (c->mem->size > 0) {
+		c->mem->ptr[0] = '\0';
+	}
+	c->mem->used = 0;
 
 	if (c->file.is_temp && !buffer_string_is_empty(c->file.name)) {
 		unlink(c->file.name->ptr);
@@ -128,57 +165,81 @@ static off_t chunk_remaining_length(const chunk *c) {
 	return len - c->offset;
 }
 
-void chunkqueue_free(chunkqueue *cq) {
-	chunk *c, *pc;
+static void chunk_release(chunk *c) {
+	int i;
 
-	if (NULL == cq) return;
+	force_assert(NULL != c);
 
-	for (c = cq->first; c; ) {
-		pc = c;
-		c = c->next;
-		chunk_free(pc);
-	}
+	chunk_reset(c);
 
-	for (c = cq->unused; c; ) {
-		pc = c;
-		c = c->next;
-		chunk_free(pc);
+	i = (c->mem->size >= CHUNK_POOL_BUF_MIN);
+	c->next = chunk_pool[i].first;
+	chunk_pool[i].first = c;
+	chunk_pool[i].used++;
+}
+
+/* get a chunk from the pool; prefer one with buffer storage of at least
+ * "sz" bytes if sz >= CHUNK_POOL_BUF_MIN, else one with small storage */
+static chunk *chunk_acquire(size_t sz) {
+	int i = (sz >= CHUNK_POOL_BUF_MIN && sz < CHUNK_POOL_BUF_MAX);
+	chunk *c;
+
+	if (NULL == chunk_pool[i].first) i = !i;
+	if (NULL == chunk_pool[i].first) return chunk_init();
+
+	/* take the first element from the list (a stack) */
+	c = chunk_pool[i].first;
+	chunk_pool[i].first = c->next;
+	c->next = NULL;
+	if (--chunk_pool[i].used < chunk_pool[i].low) {
+		chunk_pool[i].low = chunk_pool[i].used;
 	}
 
-	free(cq);
+	return c;
 }
 
-static void chunkqueue_push_unused_chunk(chunkqueue *cq, chunk *c) {
-	force_assert(NULL != cq && NULL != c);
+void chunkqueue_chunk_pool_trim(void) {
+	int i;
 
-	/* keep at max 4 chunks in the 'unused'-cache */
-	if (cq->unused_chunks > 4) {
-		chunk_free(c);
-	} else {
-		chunk_reset(c);
-		c->next = cq->unused;
-		cq->unused = c;
-		cq->unused_chunks++;
+	for (i = 0; i < 2; ++i) {
+		size_t n = chunk_pool[i].low / 2;
+		while (n--) {
+			chunk *c = chunk_pool[i].first;
+			chunk_pool[i].first = c->next;
+			chunk_pool[i].used--;
+			chunk_free(c);
+		}
+		chunk_pool[i].low = chunk_pool[i].used;
 	}
 }
 
-static chunk *chunkqueue_get_unused_chunk(chunkqueue *cq) {
-	chunk *c;
+void chunkqueue_chunk_pool_clear(void) {
+	int i;
 
-	force_assert(NULL != cq);
+	for (i = 0; i < 2; ++i) {
+		chunk *c, *next;
+		for (c = chunk_pool[i].first; c; c = next) {
+			next = c->next;
+			chunk_free(c);
+		}
+		chunk_pool[i].first = NULL;
+		chunk_pool[i].used = 0;
+		chunk_pool[i].low = 0;
+	}
+}
 
-	/* check if we have a unused chunk */
-	if (0 == cq->unused) {
-		c = chunk_init();
-	} else {
-		/* take the first element from the list (a stack) */
-		c = cq->unused;
-		cq->unused = c->next;
-		c->next = NULL;
-		cq->unused_chunks--;
+void chunkqueue_free(chunkqueue *cq) {
+	chunk *c, *pc;
+
+	if (NULL == cq) return;
+
+	for (c = cq->first; c; ) {
+		pc = c;
+		c = c->next;
+		chunk_release(pc);
 	}
 
-	return c;
+	free(cq);
 }
 
 static void chunkqueue_prepend_chunk(chunkqueue *cq, chunk *c) {
@@ -211,7 +272,7 @@ void chunkqueue_reset(chunkqueue *cq) {
 
 	while (NULL != cur) {
 		chunk *next = cur->next;
-		chunkqueue_push_unused_chunk(cq, cur);
+		chunk_release(cur);
 		cur = next;
 	}
 
@@ -228,7 +289,25 @@ void chunkqueue_append_file_fd(chunkqueue *cq, buffer *fn, int fd, off_t offset,
 		return;
 	}
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
+
+	c->type = FILE_CHUNK;
+
+	buffer_copy_buffer(c->file.name, fn);
+	c->file.start = offset;
+	c->file.length = len;
+	c->file.fd = fd;
+	c->offset = 0;
+
+	chunkqueue_append_chunk(cq, c);
+}
+
+void chunkqueue_append_file_ref(chunkqueue *cq, buffer *fn, int fd, off_t offset, off_t len, void *ref, void (*refchg)(void *, int)) {
+	chunk *c;
+
+	if (0 == len) return;
+
+	c = chunk_acquire(0);
 
 	c->type = FILE_CHUNK;
 
@@ -236,6 +315,9 @@ void chunkqueue_append_file_fd(chunkqueue *cq, buffer *fn, int fd, off_t offset,
 	c->file.start = offset;
 	c->file.length = len;
 	c->file.fd = fd;
+	c->ref = ref;
+	c->refchg = refchg;
+	refchg(ref, 1);
 	c->offset = 0;
 
 	chunkqueue_append_chunk(cq, c);
@@ -246,7 +328,7 @@ void chunkqueue_append_file(chunkqueue *cq, buffer *fn, off_t offset, off_t len)
 
 	if (0 == len) return;
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
 
 	c->type = FILE_CHUNK;
 
@@ -263,7 +345,7 @@ void chunkqueue_append_buffer(chunkqueue *cq, buffer *mem) {
 
 	if (buffer_string_is_empty(mem)) return;
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
 	c->type = MEM_CHUNK;
 	force_assert(NULL != c->mem);
 	buffer_move(c->mem, mem);
@@ -276,7 +358,7 @@ void chunkqueue_prepend_buffer(chunkqueue *cq, buffer *mem) {
 
 	if (buffer_string_is_empty(mem)) return;
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
 	c->type = MEM_CHUNK;
 	force_assert(NULL != c->mem);
 	buffer_move(c->mem, mem);
@@ -285,18 +367,48 @@ void chunkqueue_prepend_buffer(chunkqueue *cq, buffer *mem) {
 }
 
 
+buffer * chunkqueue_prepend_buffer_open(chunkqueue *cq) {
+	chunk *c = chunk_acquire(0);
+	c->type = MEM_CHUNK;
+	force_assert(NULL != c->mem);
+	chunkqueue_prepend_chunk(cq, c);
+	return c->mem;
+}
+
+
+void chunkqueue_prepend_buffer_commit(chunkqueue *cq) {
+	cq->bytes_in += buffer_string_length(cq->first->mem);
+}
+
+
 void chunkqueue_append_mem(chunkqueue *cq, const char * mem, size_t len) {
 	chunk *c;
 
 	if (0 == len) return;
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
 	c->type = MEM_CHUNK;
 	buffer_copy_string_len(c->mem, mem, len);
 
 	chunkqueue_append_chunk(cq, c);
 }
 
+void chunkqueue_append_mem_ref(chunkqueue *cq, buffer *mem, void *ref, void (*refchg)(void *, int)) {
+	chunk *c;
+
+	if (buffer_string_is_empty(mem)) return;
+
+	c = chunk_acquire(0);
+	c->type = MEM_CHUNK;
+	c->mem_own = c->mem;
+	c->mem = mem;
+	c->ref = ref;
+	c->refchg = refchg;
+	refchg(ref, 1);
+
+	chunkqueue_append_chunk(cq, c);
+}
+
 
 void chunkqueue_append_chunkqueue(chunkqueue *cq, chunkqueue *src) {
 	if (src == NULL || NULL == src->first) return;
@@ -331,7 +443,7 @@ void chunkqueue_get_memory(chunkqueue *cq, char **mem, size_t *len, size_t min_s
 	if (0 == alloc_size) alloc_size = 4096;
 	if (alloc_size < min_size) alloc_size = min_size;
 
-	if (NULL != cq->last && MEM_CHUNK == cq->last->type) {
+	if (NULL != cq->last && MEM_CHUNK == cq->last->type && NULL == cq->last->ref) {
 		size_t have;
 
 		b = cq->last->mem;
@@ -364,7 +476,7 @@ void chunkqueue_get_memory(chunkqueue *cq, char **mem, size_t *len, size_t min_s
 	}
 
 	/* allocate new chunk */
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(alloc_size);
 	c->type = MEM_CHUNK;
 	chunkqueue_append_chunk(cq, c);
 
@@ -425,7 +537,7 @@ void chunkqueue_steal(chunkqueue *dest, chunkqueue *src, off_t len) {
 			/* drop empty chunk */
 			src->first = c->next;
 			if (c == src->last) src->last = NULL;
-			chunkqueue_push_unused_chunk(src, c);
+			chunk_release(c);
 			continue;
 		}
 
@@ -447,7 +559,11 @@ void chunkqueue_steal(chunkqueue *dest, chunkqueue *src, off_t len) {
 				break;
 			case FILE_CHUNK:
 				/* tempfile flag is in "last" chunk after the split */
-				chunkqueue_append_file(dest, c->file.name, c->file.start + c->offset, use);
+				if (NULL != c->refchg) {
+					chunkqueue_append_file_ref(dest, c->file.name, c->file.fd, c->file.start + c->offset, use, c->ref, c->refchg);
+				} else {
+					chunkqueue_append_file(dest, c->file.name, c->file.start + c->offset, use);
+				}
 				break;
 			}
 
@@ -510,7 +626,7 @@ static chunk *chunkqueue_get_append_tempfile(server *srv, chunkqueue *cq) {
 	}
 	fdevent_setfd_cloexec(fd);
 
-	c = chunkqueue_get_unused_chunk(cq);
+	c = chunk_acquire(0);
 	c->type = FILE_CHUNK;
 	c->file.fd = fd;
 	c->file.is_temp = 1;
@@ -634,7 +750,7 @@ int chunkqueue_steal_with_tempfiles(server *srv, chunkqueue *dest, chunkqueue *s
 			/* drop empty chunk */
 			src->first = c->next;
 			if (c == src->last) src->last = NULL;
-			chunkqueue_push_unused_chunk(src, c);
+			chunk_release(c);
 			continue;
 		}
 
@@ -668,7 +784,7 @@ int chunkqueue_steal_with_tempfiles(server *srv, chunkqueue *dest, chunkqueue *s
 				/* finished chunk */
 				src->first = c->next;
 				if (c == src->last) src->last = NULL;
-				chunkqueue_push_unused_chunk(src, c);
+				chunk_release(c);
 			} else {
 				/* partial chunk */
 				c->offset += use;
@@ -715,7 +831,7 @@ void chunkqueue_mark_written(chunkqueue *cq, off_t len) {
 			cq->first = c->next;
 			if (c == cq->last) cq->last = NULL;
 
-			chunkqueue_push_unused_chunk(cq, c);
+			chunk_release(c);
 		} else { /* partial chunk */
 			c->offset += written;
 			written = 0;
@@ -736,7 +852,7 @@ void chunkqueue_remove_finished_chunks(chunkqueue *cq) {
 		cq->first = c->next;
 		if (c == cq->last) cq->last = NULL;
 
-		chunkqueue_push_unused_chunk(cq, c);
+		chunk_release(c);
 	}
 }
 
@@ -751,7 +867,7 @@ static void chunkqueue_remove_empty_chunks(chunkqueue *cq) {
 			c->next = empty->next;
 			if (empty == cq->last) cq->last = c;
 
-			chunkqueue_push_unused_chunk(cq, empty);
+			chunk_release(empty);
 		}
 	}
 }
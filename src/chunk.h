@@ -30,6 +30,13 @@ typedef struct chunk {
 		int is_temp; /* file is temporary and will be deleted if on cleanup */
 	} file;
 
+	/* the data (mem of a mem-chunk, or file.fd) is shared, read-only and
+	 * owned by "ref" (e.g. a stat_cache_entry); refchg(ref, +1/-1) instead
+	 * of freeing it. "mem_own" keeps the chunk's own buffer meanwhile. */
+	void *ref;
+	void (*refchg)(void *ref, int mod);
+	buffer *mem_own;
+
 	/* the size of the chunk is either:
 	 * - mem-chunk: buffer_string_length(chunk::mem)
 	 * - file-chunk: chunk::file.length
@@ -43,9 +50,6 @@ typedef struct {
 	chunk *first;
 	chunk *last;
 
-	chunk *unused;
-	size_t unused_chunks;
-
 	off_t bytes_in, bytes_out;
 
 	array *tempdirs;
@@ -58,9 +62,17 @@ void chunkqueue_set_tempdirs_default_reset (void);
 void chunkqueue_set_tempdirs_default (array *tempdirs, unsigned int upload_temp_file_size);
 void chunkqueue_append_file(chunkqueue *cq, buffer *fn, off_t offset, off_t len); /* copies "fn" */
 void chunkqueue_append_file_fd(chunkqueue *cq, buffer *fn, int fd, off_t offset, off_t len); /* copies "fn" */
+void chunkqueue_append_file_ref(chunkqueue *cq, buffer *fn, int fd, off_t offset, off_t len, void *ref, void (*refchg)(void *, int)); /* copies "fn", takes a reference */
 void chunkqueue_append_mem(chunkqueue *cq, const char *mem, size_t len); /* copies memory */
+void chunkqueue_append_mem_ref(chunkqueue *cq, buffer *mem, void *ref, void (*refchg)(void *, int)); /* shares "mem", takes a reference */
 void chunkqueue_append_buffer(chunkqueue *cq, buffer *mem); /* may reset "mem" */
 void chunkqueue_prepend_buffer(chunkqueue *cq, buffer *mem); /* may reset "mem" */
+
+/* prepend an empty mem chunk from the chunk pool and return its buffer for
+ * the caller to fill in place; must be followed by
+ * chunkqueue_prepend_buffer_commit() before the chunkqueue is used again */
+buffer * chunkqueue_prepend_buffer_open(chunkqueue *cq);
+void chunkqueue_prepend_buffer_commit(chunkqueue *cq);
 void chunkqueue_append_chunkqueue(chunkqueue *cq, chunkqueue *src);
 
 struct server; /*(declaration)*/
@@ -96,6 +108,8 @@ int chunkqueue_open_file_chunk(struct server *srv, chunkqueue *cq);
 
 off_t chunkqueue_length(chunkqueue *cq);
 void chunkqueue_free(chunkqueue *cq);
+void chunkqueue_chunk_pool_trim(void);
+void chunkqueue_chunk_pool_clear(void);
 void chunkqueue_reset(chunkqueue *cq);
 
 int chunkqueue_is_empty(chunkqueue *cq);
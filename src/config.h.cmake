@@ -15,6 +15,7 @@
 /* System */
 #cmakedefine  HAVE_SYS_DEVPOLL_H
 #cmakedefine  HAVE_SYS_EPOLL_H
+#cmakedefine  HAVE_LINUX_IO_URING_H
 #cmakedefine  HAVE_SYS_EVENT_H
 #cmakedefine  HAVE_SYS_MMAN_H
 #cmakedefine  HAVE_SYS_POLL_H
@@ -32,6 +33,7 @@
 #cmakedefine HAVE_PTHREAD_H
 #cmakedefine HAVE_IPV6
 #cmakedefine HAVE_WEAK_SYMBOLS
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIM
 
 /* XATTR */
 #cmakedefine HAVE_ATTR_ATTRIBUTES_H
@@ -165,6 +165,14 @@ static int config_insert(server *srv) {
 		{ "server.error-intercept",            NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 79 */
 		{ "server.syslog-facility",            NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_SERVER     }, /* 80 */
 		{ "server.socket-perms",               NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_CONNECTION }, /* 81 */
+		{ "server.reuse-port",                 NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER     }, /* 82 */
+		{ "server.stat-cache-max-entries",     NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER     }, /* 83 */
+		{ "server.stat-cache-max-fds",         NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER     }, /* 84 */
+		{ "server.stat-cache-content-max-size",NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER     }, /* 85 */
+		{ "server.stat-cache-content-memory",  NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER     }, /* 86 */
+		{ "server.errorlog-async",             NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER     }, /* 87 */
+		{ "server.errorlog-rate-limit",        NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER     }, /* 88 */
+		{ "server.statistics-file",            NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_SERVER     }, /* 89 */
 
 		{ NULL,                                NULL, T_CONFIG_UNSET,   T_CONFIG_SCOPE_UNSET      }
 	};
@@ -205,6 +213,14 @@ static int config_insert(server *srv) {
 	cv[74].destination = &(srv->srvconf.http_host_normalize);
 	cv[78].destination = &(srv->srvconf.max_request_field_size);
 	cv[80].destination = srv->srvconf.syslog_facility;
+	cv[82].destination = &(srv->srvconf.reuse_port);
+	cv[83].destination = &(srv->srvconf.stat_cache_max_entries);
+	cv[84].destination = &(srv->srvconf.stat_cache_max_fds);
+	cv[85].destination = &(srv->srvconf.stat_cache_content_max_size);
+	cv[86].destination = &(srv->srvconf.stat_cache_content_memory);
+	cv[87].destination = &(srv->srvconf.errorlog_async);
+	cv[88].destination = &(srv->srvconf.errorlog_rate_limit);
+	cv[89].destination = srv->srvconf.statistics_file;
 
 	srv->config_storage = calloc(1, srv->config_context->used * sizeof(specific_config *));
 
@@ -224,6 +240,7 @@ static int config_insert(server *srv) {
 		s->error_handler = buffer_init();
 		s->error_handler_404 = buffer_init();
 		s->server_tag    = buffer_init();
+		s->server_tag_hdr = buffer_init();
 		s->errorfile_prefix = buffer_init();
 	      #if defined(__FreeBSD__) || defined(__NetBSD__) \
 	       || defined(__OpenBSD__) || defined(__DragonFly__)
@@ -373,6 +390,10 @@ static int config_insert(server *srv) {
 #ifdef HAVE_FAM_H
 	} else if (buffer_is_equal_string(stat_cache_string, CONST_STR_LEN("fam"))) {
 		srv->srvconf.stat_cache_engine = STAT_CACHE_ENGINE_FAM;
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+	} else if (buffer_is_equal_string(stat_cache_string, CONST_STR_LEN("inotify"))) {
+		srv->srvconf.stat_cache_engine = STAT_CACHE_ENGINE_INOTIFY;
 #endif
 	} else if (buffer_is_equal_string(stat_cache_string, CONST_STR_LEN("disable"))) {
 		srv->srvconf.stat_cache_engine = STAT_CACHE_ENGINE_NONE;
@@ -381,6 +402,9 @@ static int config_insert(server *srv) {
 				"server.stat-cache-engine can be one of \"disable\", \"simple\","
 #ifdef HAVE_FAM_H
 				" \"fam\","
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+				" \"inotify\","
 #endif
 				" but not:", stat_cache_string);
 		ret = HANDLER_ERROR;
@@ -544,6 +568,7 @@ int config_setup_connection(server *srv, connection *con) {
 	PATCH(follow_symlink);
 #endif
 	PATCH(server_tag);
+	PATCH(server_tag_hdr);
 	PATCH(kbytes_per_second);
 	PATCH(global_kbytes_per_second);
 	PATCH(global_bytes_per_second_cnt);
@@ -627,6 +652,7 @@ int config_patch_connection(server *srv, connection *con) {
 				buffer_copy_buffer(con->server_name, s->server_name);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.tag"))) {
 				PATCH(server_tag);
+				PATCH(server_tag_hdr);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.stream-request-body"))) {
 				PATCH(stream_request_body);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.stream-response-body"))) {
@@ -1394,6 +1420,9 @@ int config_set_defaults(server *srv) {
 #ifdef USE_LINUX_EPOLL
 		{ FDEVENT_HANDLER_LINUX_SYSEPOLL, "linux-sysepoll" },
 #endif
+#ifdef USE_LINUX_IOURING
+		{ FDEVENT_HANDLER_LINUX_IOURING,  "linux-iouring" },
+#endif
 #ifdef USE_POLL
 		{ FDEVENT_HANDLER_POLL,           "poll" },
 #endif
@@ -42,13 +42,85 @@ const char *connection_get_short_state(connection_state_t state) {
 }
 
 int connection_set_state(server *srv, connection *con, connection_state_t state) {
-	UNUSED(srv);
-
 	con->state = state;
 
+	if (srv->srvconf.request_timing) {
+		switch (state) {
+		case CON_STATE_REQUEST_END:
+			connection_timing(srv, con, CON_TIMING_READ);
+			break;
+		case CON_STATE_READ_POST:
+		case CON_STATE_HANDLE_REQUEST:
+			connection_timing(srv, con, CON_TIMING_PARSE);
+			break;
+		case CON_STATE_RESPONSE_START:
+			connection_timing(srv, con, CON_TIMING_BACKEND);
+			break;
+		case CON_STATE_WRITE:
+			connection_timing(srv, con, CON_TIMING_RESPONSE_START);
+			break;
+		case CON_STATE_RESPONSE_END:
+			connection_timing(srv, con, CON_TIMING_WRITE);
+			break;
+		default:
+			break;
+		}
+	}
+
 	return 0;
 }
 
+static const char * const con_timing_names[] = {
+	"read",
+	"parse",
+	"body",
+	"config",
+	"uri",
+	"physical",
+	"handler",
+	"backend",
+	"response-start",
+	"write"
+};
+
+/* record time when request first reached point t */
+void connection_timing(server *srv, connection *con, con_timing_t t) {
+	if (!srv->srvconf.request_timing || 0 != con->timing[t].tv_sec) return;
+	log_clock_gettime_realtime(&con->timing[t]);
+}
+
+/* time spent in the stage ending at point t, or -1 if t was not reached */
+int64_t connection_timing_usec(const connection *con, con_timing_t t) {
+	const struct timespec *ts = &con->request_start_hp;
+	int64_t usec;
+	int i;
+
+	if (0 == con->timing[t].tv_sec) return -1;
+	for (i = (int)t - 1; i >= 0; --i) {
+		if (0 != con->timing[i].tv_sec) {
+			ts = &con->timing[i];
+			break;
+		}
+	}
+
+	usec = (int64_t)(con->timing[t].tv_sec - ts->tv_sec) * 1000000
+	     + (con->timing[t].tv_nsec - ts->tv_nsec) / 1000;
+	return usec > 0 ? usec : 0;
+}
+
+const char * connection_timing_name(con_timing_t t) {
+	return con_timing_names[t];
+}
+
+/* returns con_timing_t of stage name, or -1 */
+int connection_timing_from_name(const char *name, size_t len) {
+	int i;
+	for (i = 0; i < CON_TIMING_MAX; ++i) {
+		if (0 == strncmp(con_timing_names[i], name, len) && '\0' == con_timing_names[i][len]) return i;
+	}
+	return -1;
+}
+
 static int connection_handle_read_post_cq_compact(chunkqueue *cq) {
     /* combine first mem chunk with next non-empty mem chunk
      * (loop if next chunk is empty) */
@@ -321,8 +393,10 @@ int connection_write_chunkqueue(server *srv, connection *con, chunkqueue *cq, of
       #ifdef TCP_CORK
 	/* Linux: put a cork into the socket as we want to combine the write() calls
 	 * but only if we really have multiple chunks, and only if TCP socket
+	 * (not with linux-iouring, which queues the chunks as one write)
 	 */
-	if (cq->first && cq->first->next) {
+	if (cq->first && cq->first->next
+	    && srv->event_handler != FDEVENT_HANDLER_LINUX_IOURING) {
 		const int sa_family = con->srv_socket->addr.plain.sa_family;
 		if (sa_family == AF_INET || sa_family == AF_INET6) {
 			corked = 1;
@@ -347,6 +421,7 @@ int connection_write_chunkqueue(server *srv, connection *con, chunkqueue *cq, of
 	written = cq->bytes_out - written;
 	con->bytes_written += written;
 	con->bytes_written_cur_second += written;
+	srv->bytes_written_cur_second += written;
 	*(con->conf.global_bytes_per_second_cnt_ptr) += written;
 
 	return ret;
@@ -376,6 +451,7 @@ static int connection_write_100_continue(server *srv, connection *con) {
 	written = cq->bytes_out - written;
 	con->bytes_written += written;
 	con->bytes_written_cur_second += written;
+	srv->bytes_written_cur_second += written;
 	*(con->conf.global_bytes_per_second_cnt_ptr) += written;
 
 	if (rc < 0) {
@@ -427,7 +503,7 @@ handler_t connection_handle_read_post_state(server *srv, connection *con) {
 	if (chunkqueue_is_empty(cq) && 0 == dst_cq->bytes_in
 	    && con->request.http_version != HTTP_VERSION_1_0
 	    && chunkqueue_is_empty(con->write_queue) && con->is_writable) {
-		data_string *ds = (data_string *)array_get_element(con->request.headers, "Expect");
+		data_string *ds = http_header_request_get(con, HTTP_HEADER_EXPECT, CONST_STR_LEN("Expect"));
 		if (NULL != ds && 0 == buffer_caseless_compare(CONST_BUF_LEN(ds->value), CONST_STR_LEN("100-continue"))) {
 			buffer_reset(ds->value); /* unset value in request headers */
 			if (!connection_write_100_continue(srv, con)) {
@@ -493,6 +569,6 @@ void connection_response_reset(server *srv, connection *con) {
 		buffer_reset(con->physical.rel_path);
 		buffer_reset(con->physical.etag);
 	}
-	array_reset(con->response.headers);
+	http_header_reset(con->response.headers, &con->response.hindex);
 	chunkqueue_reset(con->write_queue);
 }
@@ -17,6 +17,7 @@
 #include "plugin.h"
 
 #include "inet_ntop_cache.h"
+#include "status_counter.h"
 
 #include <sys/stat.h>
 
@@ -70,6 +71,75 @@ static connection *connections_get_new_connection(server *srv) {
 	return conns->ptr[conns->used++];
 }
 
+/* connection timeouts are kept in a hashed timer wheel with one slot per
+ * second, so that the once-per-second maintenance only visits connections
+ * whose deadline has (possibly) passed, instead of every open connection.
+ * Deadlines are recalculated lazily: timestamps such as read_idle_ts only
+ * move forward, so a connection found in an expired slot is re-checked and
+ * rescheduled if it has been active since it was added to the wheel. */
+
+static void connection_timer_unlink(server *srv, connection *con) {
+	if (0 == con->timer_ts) return;
+
+	if (con->timer_prev) {
+		con->timer_prev->timer_next = con->timer_next;
+	} else {
+		srv->timer_wheel[con->timer_ts & (CONNECTION_TIMER_SLOTS-1)] = con->timer_next;
+	}
+	if (con->timer_next) {
+		con->timer_next->timer_prev = con->timer_prev;
+	}
+
+	con->timer_next = NULL;
+	con->timer_prev = NULL;
+	con->timer_ts = 0;
+}
+
+static time_t connection_timer_deadline(server *srv, connection *con) {
+	const int waitevents = fdevent_event_get_interest(srv->ev, con->fd);
+	time_t ts = 0;
+
+	if (con->state == CON_STATE_CLOSE) {
+		ts = con->close_timeout_ts + HTTP_LINGER_TIMEOUT + 1;
+	} else if (waitevents & FDEVENT_IN) {
+		if (con->request_count == 1 || con->state != CON_STATE_READ) {
+			ts = con->read_idle_ts + con->conf.max_read_idle + 1;
+		} else {
+			ts = con->read_idle_ts + con->keep_alive_idle + 1;
+		}
+	}
+
+	if (con->state == CON_STATE_WRITE && con->write_request_ts != 0) {
+		time_t wts = con->write_request_ts + con->conf.max_write_idle + 1;
+		if (0 == ts || wts < ts) ts = wts;
+	}
+
+	/* rate limit is re-evaluated (and reset) every second */
+	if (con->traffic_limit_reached || con->bytes_written_cur_second) {
+		ts = srv->cur_ts + 1;
+	}
+
+	return ts;
+}
+
+static void connection_timer_update(server *srv, connection *con) {
+	time_t ts = connection_timer_deadline(srv, con);
+	connection **slot;
+
+	if (0 != ts && ts <= srv->timer_wheel_ts) ts = srv->timer_wheel_ts + 1;
+	if (ts == con->timer_ts) return;
+
+	connection_timer_unlink(srv, con);
+	if (0 == ts) return;
+
+	slot = &srv->timer_wheel[ts & (CONNECTION_TIMER_SLOTS-1)];
+	con->timer_ts = ts;
+	con->timer_prev = NULL;
+	con->timer_next = *slot;
+	if (*slot) (*slot)->timer_prev = con;
+	*slot = con;
+}
+
 static int connection_del(server *srv, connection *con) {
 	size_t i;
 	connections *conns = srv->conns;
@@ -79,6 +149,8 @@ static int connection_del(server *srv, connection *con) {
 
 	if (-1 == con->ndx) return -1;
 
+	connection_timer_unlink(srv, con);
+
 	buffer_reset(con->uri.authority);
 	buffer_reset(con->uri.path);
 	buffer_reset(con->uri.query);
@@ -191,7 +263,7 @@ static void connection_handle_shutdown(server *srv, connection *con) {
 	connection_reset(srv, con);
 
 	/* close the connection */
-	if (con->fd >= 0 && 0 == shutdown(con->fd, SHUT_WR)) {
+	if (con->fd >= 0 && 0 == fdevent_shutdown_wr(srv->ev, con->fd)) {
 		con->close_timeout_ts = srv->cur_ts;
 		connection_set_state(srv, con, CON_STATE_CLOSE);
 
@@ -237,7 +309,7 @@ static void connection_handle_errdoc_init(server *srv, connection *con) {
 	 * mod_auth WWW-Authenticate response header. */
 	buffer *www_auth = NULL;
 	if (401 == con->http_status) {
-		data_string *ds = (data_string *)array_get_element(con->response.headers, "WWW-Authenticate");
+		data_string *ds = http_header_response_get(con, HTTP_HEADER_WWW_AUTHENTICATE, CONST_STR_LEN("WWW-Authenticate"));
 		if (NULL != ds) {
 			www_auth = buffer_init_buffer(ds->value);
 		}
@@ -245,7 +317,7 @@ static void connection_handle_errdoc_init(server *srv, connection *con) {
 
 	con->response.transfer_encoding = 0;
 	buffer_reset(con->physical.path);
-	array_reset(con->response.headers);
+	http_header_reset(con->response.headers, &con->response.hindex);
 	chunkqueue_reset(con->write_queue);
 
 	if (NULL != www_auth) {
@@ -401,7 +473,7 @@ static int connection_handle_write_prepare(server *srv, connection *con) {
 			    con->http_status == 304) {
 				data_string *ds;
 				/* no Content-Body, no Content-Length */
-				if (NULL != (ds = (data_string*) array_get_element(con->response.headers, "Content-Length"))) {
+				if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length")))) {
 					buffer_reset(ds->value); /* Headers with empty values are ignored for output */
 				}
 			} else if (qlen > 0 || con->request.http_method != HTTP_METHOD_HEAD) {
@@ -470,7 +542,7 @@ static int connection_handle_write_prepare(server *srv, connection *con) {
 		con->response.transfer_encoding &= ~HTTP_TRANSFER_ENCODING_CHUNKED;
 		if (con->parsed_response & HTTP_TRANSFER_ENCODING) {
 			data_string *ds;
-			if (NULL != (ds = (data_string*) array_get_element(con->response.headers, "Transfer-Encoding"))) {
+			if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_TRANSFER_ENCODING, CONST_STR_LEN("Transfer-Encoding")))) {
 				buffer_reset(ds->value); /* Headers with empty values are ignored for output */
 			}
 		}
@@ -642,6 +714,7 @@ int connection_reset(server *srv, connection *con) {
 	con->bytes_read = 0;
 	con->bytes_header = 0;
 	con->loops_per_request = 0;
+	memset(con->timing, 0, sizeof(con->timing));
 
 	con->request.http_method = HTTP_METHOD_UNSET;
 	con->request.http_version = HTTP_VERSION_UNSET;
@@ -686,7 +759,7 @@ int connection_reset(server *srv, connection *con) {
 	con->request.content_length = 0;
 	con->request.te_chunked = 0;
 
-	array_reset(con->request.headers);
+	http_header_reset(con->request.headers, &con->request.hindex);
 	array_reset(con->environment);
 
 	chunkqueue_reset(con->request_content_queue);
@@ -1390,7 +1463,117 @@ int connection_state_machine(server *srv, connection *con) {
 			}
 			fdevent_event_set(srv->ev, &con->fde_ndx, con->fd, r);
 		}
+
+		if (-1 != con->ndx) connection_timer_update(srv, con);
 	}
 
 	return 0;
 }
+
+static int connection_check_timeout(server *srv, connection *con) {
+	const int waitevents = fdevent_event_get_interest(srv->ev, con->fd);
+	int changed = 0;
+	int t_diff;
+
+	if (con->state == CON_STATE_CLOSE) {
+		if (srv->cur_ts - con->close_timeout_ts > HTTP_LINGER_TIMEOUT) {
+			changed = 1;
+		}
+	} else if (waitevents & FDEVENT_IN) {
+		if (con->request_count == 1 || con->state != CON_STATE_READ) { /* e.g. CON_STATE_READ_POST || CON_STATE_WRITE */
+			if (srv->cur_ts - con->read_idle_ts > con->conf.max_read_idle) {
+				/* time - out */
+				if (con->conf.log_request_handling) {
+					log_error_write(srv, __FILE__, __LINE__, "sd",
+						"connection closed - read timeout:", con->fd);
+				}
+
+				connection_set_state(srv, con, CON_STATE_ERROR);
+				changed = 1;
+			}
+		} else {
+			if (srv->cur_ts - con->read_idle_ts > con->keep_alive_idle) {
+				/* time - out */
+				if (con->conf.log_request_handling) {
+					log_error_write(srv, __FILE__, __LINE__, "sd",
+						"connection closed - keep-alive timeout:", con->fd);
+				}
+
+				connection_set_state(srv, con, CON_STATE_ERROR);
+				changed = 1;
+			}
+		}
+	}
+
+	/* max_write_idle timeout currently functions as backend timeout,
+	 * too, after response has been started.
+	 * future: have separate backend timeout, and then change this
+	 * to check for write interest before checking for timeout */
+	/*if (waitevents & FDEVENT_OUT)*/
+	if ((con->state == CON_STATE_WRITE) &&
+	    (con->write_request_ts != 0)) {
+		if (srv->cur_ts - con->write_request_ts > con->conf.max_write_idle) {
+			/* time - out */
+			if (con->conf.log_timeouts) {
+				log_error_write(srv, __FILE__, __LINE__, "sbsbsosds",
+					"NOTE: a request from",
+					con->dst_addr_buf,
+					"for",
+					con->request.uri,
+					"timed out after writing",
+					con->bytes_written,
+					"bytes. We waited",
+					(int)con->conf.max_write_idle,
+					"seconds. If this a problem increase server.max-write-idle");
+			}
+			connection_set_state(srv, con, CON_STATE_ERROR);
+			changed = 1;
+		}
+	}
+
+	/* we don't like div by zero */
+	if (0 == (t_diff = srv->cur_ts - con->connection_start)) t_diff = 1;
+
+	if (con->traffic_limit_reached &&
+	    (con->conf.kbytes_per_second == 0 ||
+	     ((con->bytes_written / t_diff) < con->conf.kbytes_per_second * 1024))) {
+		/* enable connection again */
+		con->traffic_limit_reached = 0;
+
+		changed = 1;
+	}
+
+	con->bytes_written_cur_second = 0;
+
+	return changed;
+}
+
+void connection_periodic_maint(server *srv, time_t cur_ts) {
+	time_t ts = srv->timer_wheel_ts;
+	int fired = 0;
+
+	/* visit each slot at most once, even after a large clock jump */
+	if (cur_ts - ts > CONNECTION_TIMER_SLOTS) ts = cur_ts - CONNECTION_TIMER_SLOTS;
+
+	/* (connections rescheduled below are placed after cur_ts) */
+	srv->timer_wheel_ts = cur_ts;
+
+	while (ts < cur_ts) {
+		connection *con, *next;
+		++ts;
+		for (con = srv->timer_wheel[ts & (CONNECTION_TIMER_SLOTS-1)]; con; con = next) {
+			next = con->timer_next;
+			if (con->timer_ts > cur_ts) continue; /* later turn of the wheel */
+
+			++fired;
+			connection_timer_unlink(srv, con);
+			if (connection_check_timeout(srv, con)) {
+				connection_state_machine(srv, con);
+			} else {
+				connection_timer_update(srv, con);
+			}
+		}
+	}
+
+	status_counter_set(srv, CONST_STR_LEN("server.timers-fired"), fired);
+}
@@ -15,10 +15,15 @@ connection * connection_accepted(server *srv, server_socket *srv_socket, sock_ad
 int connection_set_state(server *srv, connection *con, connection_state_t state);
 const char * connection_get_state(connection_state_t state);
 const char * connection_get_short_state(connection_state_t state);
+void connection_timing(server *srv, connection *con, con_timing_t t);
+int64_t connection_timing_usec(const connection *con, con_timing_t t);
+const char * connection_timing_name(con_timing_t t);
+int connection_timing_from_name(const char *name, size_t len);
 int connection_state_machine(server *srv, connection *con);
 handler_t connection_handle_read_post_state(server *srv, connection *con);
 handler_t connection_handle_read_post_error(server *srv, connection *con, int http_status);
 int connection_write_chunkqueue(server *srv, connection *con, chunkqueue *c, off_t max_bytes);
 void connection_response_reset(server *srv, connection *con);
+void connection_periodic_maint(server *srv, time_t cur_ts);
 
 #endif
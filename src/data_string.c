@@ -13,6 +13,7 @@ static data_unset *data_string_copy(const data_unset *s) {
 	buffer_copy_buffer(ds->key, src->key);
 	buffer_copy_buffer(ds->value, src->value);
 	ds->is_index_key = src->is_index_key;
+	ds->ext = src->ext;
 	return (data_unset *)ds;
 }
 
@@ -31,6 +32,7 @@ static void data_string_reset(data_unset *d) {
 	/* reused array elements */
 	buffer_reset(ds->key);
 	buffer_reset(ds->value);
+	ds->ext = 0;
 }
 
 static int data_string_insert_dup(data_unset *dst, data_unset *src) {
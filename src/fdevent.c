@@ -70,6 +70,20 @@ fdevents *fdevent_init(server *srv, size_t maxfds, int type) {
 			goto error;
 		}
 		return ev;
+	case FDEVENT_HANDLER_LINUX_IOURING:
+		if (0 == fdevent_linux_iouring_init(ev)) {
+			return ev;
+		}
+		/* fall back to epoll on kernels without (usable) io_uring */
+		log_error_write(srv, __FILE__, __LINE__, "S",
+			"event-handler linux-iouring failed, falling back to linux-sysepoll");
+		if (0 != fdevent_linux_sysepoll_init(ev)) {
+			log_error_write(srv, __FILE__, __LINE__, "S",
+				"event-handler linux-sysepoll failed, try to set server.event-handler = \"poll\" or \"select\"");
+			goto error;
+		}
+		srv->event_handler = FDEVENT_HANDLER_LINUX_SYSEPOLL;
+		return ev;
 	case FDEVENT_HANDLER_SOLARIS_DEVPOLL:
 		if (0 != fdevent_solaris_devpoll_init(ev)) {
 			log_error_write(srv, __FILE__, __LINE__, "S",
@@ -781,3 +795,13 @@ int fdevent_is_tcp_half_closed(int fd) {
     return 0; /* false (not half-closed) or TCP state unknown */
   #endif
 }
+
+int fdevent_shutdown_wr(fdevents *ev, int fd) {
+  #ifdef USE_LINUX_IOURING
+    if (ev->type == FDEVENT_HANDLER_LINUX_IOURING)
+        return fdevent_linux_iouring_shutdown_wr(ev, fd);
+  #else
+    UNUSED(ev);
+  #endif
+    return shutdown(fd, SHUT_WR);
+}
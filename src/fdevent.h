@@ -19,6 +19,11 @@
 struct epoll_event;     /* declaration */
 #endif
 
+#if defined(HAVE_LINUX_IO_URING_H) && defined(USE_LINUX_EPOLL)
+# define USE_LINUX_IOURING
+struct fdevent_iouring; /* declaration */
+#endif
+
 /* MacOS 10.3.x has poll.h under /usr/include/, all other unixes
  * under /usr/include/sys/ */
 #if defined HAVE_POLL && (defined(HAVE_SYS_POLL_H) || defined(HAVE_POLL_H))
@@ -91,7 +96,8 @@ typedef enum { FDEVENT_HANDLER_UNSET,
 		FDEVENT_HANDLER_SOLARIS_DEVPOLL,
 		FDEVENT_HANDLER_SOLARIS_PORT,
 		FDEVENT_HANDLER_FREEBSD_KQUEUE,
-		FDEVENT_HANDLER_LIBEV
+		FDEVENT_HANDLER_LIBEV,
+		FDEVENT_HANDLER_LINUX_IOURING
 } fdevent_handler_t;
 
 
@@ -131,6 +137,9 @@ typedef struct fdevents {
 	int epoll_fd;
 	struct epoll_event *epoll_events;
 #endif
+#ifdef USE_LINUX_IOURING
+	struct fdevent_iouring *iouring;
+#endif
 #ifdef USE_POLL
 	struct pollfd *pollfds;
 
@@ -230,6 +239,14 @@ void fdevent_breakagelog_logger_pipe(int fd);
 int fdevent_select_init(fdevents *ev);
 int fdevent_poll_init(fdevents *ev);
 int fdevent_linux_sysepoll_init(fdevents *ev);
+int fdevent_linux_iouring_init(fdevents *ev);
+#ifdef USE_LINUX_IOURING
+struct iovec;           /* declaration */
+/* batched writes (see network_linux_iouring.c) */
+ssize_t fdevent_linux_iouring_write(fdevents *ev, int fd, const struct iovec *iov, int iovcnt);
+int fdevent_linux_iouring_write_pending(fdevents *ev, int fd);
+int fdevent_linux_iouring_shutdown_wr(fdevents *ev, int fd);
+#endif
 int fdevent_solaris_devpoll_init(fdevents *ev);
 int fdevent_solaris_port_init(fdevents *ev);
 int fdevent_freebsd_kqueue_init(fdevents *ev);
@@ -242,4 +259,7 @@ int fdevent_connect_status(int fd);
 /* fd must be TCP socket (AF_INET, AF_INET6), end-of-stream recv() 0 bytes */
 int fdevent_is_tcp_half_closed(int fd);
 
+/* shutdown(fd, SHUT_WR) once data written through the event handler is sent */
+int fdevent_shutdown_wr(fdevents *ev, int fd);
+
 #endif
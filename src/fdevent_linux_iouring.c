@@ -0,0 +1,650 @@
+#include "first.h"
+
+#include "base.h"
+#include "fdevent.h"
+#include "buffer.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "sys-socket.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef USE_LINUX_IOURING
+
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <poll.h>
+
+/* io_uring is used as a (batched) readiness notification mechanism:
+ * interest in an fd is expressed with a one-shot IORING_OP_POLL_ADD, and
+ * all (re-)arm and remove requests queued during one iteration of the
+ * event loop are submitted together with the wait for completions in a
+ * single io_uring_enter(), instead of one epoll_ctl() per change.
+ *
+ * One-shot polls are re-armed on the next call to poll() for fds which
+ * reported an event and still have interest registered, which provides
+ * the level-triggered semantics expected by the connection state machine.
+ *
+ * Each fd carries a generation counter, encoded in the user_data of its
+ * POLL_ADD, so that completions of polls which have since been removed or
+ * replaced (possibly on a reused fd number) are ignored.
+ *
+ * Writes (see network_linux_iouring.c) are queued as IORING_OP_WRITE and
+ * submitted with the same io_uring_enter().  The data is copied, and is
+ * considered written once queued (as if copied into the socket buffer by
+ * write()), so that a response is usually complete before the next call to
+ * poll().  At most one write per fd is in flight; short writes are
+ * resubmitted.  Further writes fail with EAGAIN until the write completed;
+ * FDEVENT_OUT is then reported if it was requested (no POLLOUT is armed
+ * meanwhile).  An error of the write is returned by the next write.
+ *
+ * If the fd is removed (and closed) while the write is in flight, the
+ * write continues (the socket is closed when it completes, as close() would
+ * with data in the socket buffer), but is cancelled after
+ * FDEVENT_IOURING_ORPHAN_TIMEOUT seconds. */
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+ && defined(IORING_FEAT_EXT_ARG)
+
+#define FDEVENT_IOURING_SQ_ENTRIES 1024
+#define FDEVENT_IOURING_UD_REMOVE  (~(uint64_t)0) /* POLL_REMOVE, ASYNC_CANCEL */
+#define FDEVENT_IOURING_UD_POLL    ((uint64_t)1 << 63)
+#define FDEVENT_IOURING_GEN_MASK   0x7fffffffu
+/* user_data of a POLL_ADD:  UD_POLL | (gen << 32) | fd
+ * user_data of a WRITE:     fdevent_iouring_write * (bit 63 is clear) */
+
+#define FDEVENT_IOURING_ORPHAN_TIMEOUT 30
+
+typedef struct fdevent_iouring_write {
+	int fd;         /* -1 if the fd was removed while write in flight */
+	int shut_wr;    /* shutdown(fd, SHUT_WR) once written */
+	size_t len;
+	size_t off;     /* bytes written */
+	time_t ts;      /* when fd was removed */
+	struct fdevent_iouring_write *prev; /* list of writes of removed fds */
+	struct fdevent_iouring_write *next;
+	char data[];
+} fdevent_iouring_write;
+
+typedef struct fdevent_iouring {
+	int ring_fd;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int  sq_entries;
+	unsigned int  sq_pending;
+	struct io_uring_sqe *sqes;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void  *sq_ring;
+	size_t sq_ring_sz;
+	void  *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+
+	int *want;      /* registered interest per fd; -1 if none */
+	int *armed;     /* interest of pending POLL_ADD per fd; -1 if none */
+	uint32_t *gen;  /* generation of pending POLL_ADD per fd */
+	fdevent_iouring_write **wr; /* write in flight per fd */
+	int *werr;      /* errno of failed write per fd; 0 if none */
+	fdevent_iouring_write *orphans; /* writes in flight of removed fds */
+	int nwrites;    /* writes in flight, including orphans */
+
+	struct { int fd; int revents; } *results;
+	int *resndx;    /* index into results per fd */
+	int nresults;
+} fdevent_iouring;
+
+static int fdevent_iouring_setup(unsigned int entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int fdevent_iouring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz) {
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int fdevent_iouring_submit(fdevent_iouring *ur) {
+	while (ur->sq_pending) {
+		int n = fdevent_iouring_enter(ur->ring_fd, ur->sq_pending, 0, 0, NULL, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		ur->sq_pending -= (unsigned int)n;
+	}
+	return 0;
+}
+
+static struct io_uring_sqe *fdevent_iouring_get_sqe(fdevents *ev) {
+	fdevent_iouring *ur = ev->iouring;
+	unsigned int tail = *ur->sq_tail;
+	unsigned int head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (tail - head >= ur->sq_entries) {
+		/* submission queue full; flush before queueing more */
+		if (0 != fdevent_iouring_submit(ur)) {
+			log_error_write(ev->srv, __FILE__, __LINE__, "SSS",
+				"io_uring_enter failed: ", strerror(errno), ", dying");
+
+			SEGFAULT();
+		}
+		head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	sqe = &ur->sqes[tail & *ur->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[tail & *ur->sq_mask] = tail & *ur->sq_mask;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ur->sq_pending;
+	return sqe;
+}
+
+static void fdevent_iouring_poll_remove(fdevents *ev, int fd) {
+	fdevent_iouring *ur = ev->iouring;
+	struct io_uring_sqe *sqe = fdevent_iouring_get_sqe(ev);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = FDEVENT_IOURING_UD_POLL | ((uint64_t)ur->gen[fd] << 32) | (uint32_t)fd;
+	sqe->user_data = FDEVENT_IOURING_UD_REMOVE;
+	ur->armed[fd] = -1;
+	ur->gen[fd] = (ur->gen[fd] + 1) & FDEVENT_IOURING_GEN_MASK;
+}
+
+static void fdevent_iouring_poll_add(fdevents *ev, int fd, int events) {
+	fdevent_iouring *ur = ev->iouring;
+	struct io_uring_sqe *sqe = fdevent_iouring_get_sqe(ev);
+	unsigned int mask = 0;
+
+	if (events & FDEVENT_IN)  mask |= POLLIN;
+	if (events & FDEVENT_OUT) mask |= POLLOUT;
+	/* (POLLERR and POLLHUP are always reported) */
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+  #if __BYTE_ORDER == __BIG_ENDIAN
+	mask = (mask << 16) | (mask >> 16);
+  #endif
+	sqe->poll32_events = mask;
+	sqe->user_data = FDEVENT_IOURING_UD_POLL | ((uint64_t)ur->gen[fd] << 32) | (uint32_t)fd;
+	ur->armed[fd] = events;
+}
+
+/* arm poll for interest in fd, except for FDEVENT_OUT while a write is in
+ * flight (its completion is reported as FDEVENT_OUT) */
+static void fdevent_iouring_update(fdevents *ev, int fd) {
+	fdevent_iouring *ur = ev->iouring;
+	int events = ur->want[fd];
+
+	if (-1 != events && NULL != ur->wr[fd]) events &= ~FDEVENT_OUT;
+	if (ur->armed[fd] == events) return;
+
+	if (-1 != ur->armed[fd]) fdevent_iouring_poll_remove(ev, fd);
+	if (-1 != events && (0 != events || NULL == ur->wr[fd])) {
+		fdevent_iouring_poll_add(ev, fd, events);
+	}
+}
+
+static void fdevent_iouring_result(fdevent_iouring *ur, int fd, int revents) {
+	const int ndx = ur->resndx[fd];
+	if (ndx < ur->nresults && ur->results[ndx].fd == fd) {
+		ur->results[ndx].revents |= revents;
+	} else {
+		ur->resndx[fd] = ur->nresults;
+		ur->results[ur->nresults].fd = fd;
+		ur->results[ur->nresults].revents = revents;
+		++ur->nresults;
+	}
+}
+
+static void fdevent_iouring_write_submit(fdevents *ev, fdevent_iouring_write *w) {
+	struct io_uring_sqe *sqe = fdevent_iouring_get_sqe(ev);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = w->fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)(w->data + w->off);
+	sqe->len = (uint32_t)(w->len - w->off);
+	sqe->user_data = (uint64_t)(uintptr_t)w;
+}
+
+static void fdevent_iouring_write_cancel(fdevents *ev, fdevent_iouring_write *w) {
+	struct io_uring_sqe *sqe = fdevent_iouring_get_sqe(ev);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)w;
+	sqe->user_data = FDEVENT_IOURING_UD_REMOVE;
+}
+
+static void fdevent_iouring_write_complete(fdevents *ev, fdevent_iouring_write *w, int res) {
+	fdevent_iouring *ur = ev->iouring;
+	const int fd = w->fd;
+
+	if (res > 0 && (w->off += (size_t)res) < w->len && -1 != fd) {
+		fdevent_iouring_write_submit(ev, w); /* short write */
+		return;
+	}
+
+	--ur->nwrites;
+	if (-1 == fd) {
+		if (w->prev) w->prev->next = w->next; else ur->orphans = w->next;
+		if (w->next) w->next->prev = w->prev;
+		free(w);
+		return;
+	}
+
+	ur->wr[fd] = NULL;
+	if (w->off < w->len) {
+		ur->werr[fd] = res < 0 ? -res : EPIPE;
+	} else if (w->shut_wr) {
+		shutdown(fd, SHUT_WR);
+	}
+	free(w);
+
+	/* waiting to write more (or to notice the error)? */
+	if (-1 != ur->want[fd] && (ur->want[fd] & FDEVENT_OUT)) {
+		fdevent_iouring_result(ur, fd, FDEVENT_OUT);
+	}
+}
+
+/* fd is about to be closed */
+static void fdevent_iouring_write_orphan(fdevents *ev, int fd) {
+	fdevent_iouring *ur = ev->iouring;
+	fdevent_iouring_write * const w = ur->wr[fd];
+
+	ur->wr[fd] = NULL;
+	w->fd = -1;
+	w->ts = ev->srv->cur_ts;
+	w->prev = NULL;
+	w->next = ur->orphans;
+	if (w->next) w->next->prev = w;
+	ur->orphans = w;
+
+	/* submit write (if still queued) before fd is closed */
+	if (0 != fdevent_iouring_submit(ur)) {
+		log_error_write(ev->srv, __FILE__, __LINE__, "SSS",
+			"io_uring_enter failed: ", strerror(errno), ", dying");
+
+		SEGFAULT();
+	}
+}
+
+/* queue write of the data in iov to fd; returns number of bytes queued,
+ * or -1 and errno (EAGAIN while the previous write is in flight) */
+ssize_t fdevent_linux_iouring_write(fdevents *ev, int fd, const struct iovec *iov, int iovcnt) {
+	fdevent_iouring *ur = ev->iouring;
+	fdevent_iouring_write *w;
+	size_t len = 0;
+	char *d;
+	int i;
+
+	if (0 != ur->werr[fd]) {
+		errno = ur->werr[fd];
+		ur->werr[fd] = 0;
+		return -1;
+	}
+	if (NULL != ur->wr[fd]) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	for (i = 0; i < iovcnt; ++i) len += iov[i].iov_len;
+	if (0 == len) return 0;
+	w = malloc(sizeof(*w) + len);
+	force_assert(NULL != w);
+	w->fd = fd;
+	w->shut_wr = 0;
+	w->len = len;
+	w->off = 0;
+	for (d = w->data, i = 0; i < iovcnt; d += iov[i].iov_len, ++i) {
+		memcpy(d, iov[i].iov_base, iov[i].iov_len);
+	}
+
+	fdevent_iouring_write_submit(ev, w);
+	ur->wr[fd] = w;
+	++ur->nwrites;
+	fdevent_iouring_update(ev, fd);
+
+	return (ssize_t)len;
+}
+
+int fdevent_linux_iouring_write_pending(fdevents *ev, int fd) {
+	return NULL != ev->iouring->wr[fd];
+}
+
+/* shutdown(fd, SHUT_WR) once queued data is written */
+int fdevent_linux_iouring_shutdown_wr(fdevents *ev, int fd) {
+	fdevent_iouring_write * const w = ev->iouring->wr[fd];
+	if (NULL == w) return shutdown(fd, SHUT_WR);
+	w->shut_wr = 1;
+	return 0;
+}
+
+static void fdevent_linux_iouring_free(fdevents *ev) {
+	fdevent_iouring *ur = ev->iouring;
+	fdevent_iouring_write *w;
+	size_t i;
+	int n;
+	if (NULL == ur) return;
+
+	/* cancel writes in flight, and wait until the kernel no longer uses
+	 * their data (the poll completions are not needed anymore) */
+	for (i = 0; NULL != ur->wr && i < ev->maxfds; ++i) {
+		if (NULL != ur->wr[i]) fdevent_iouring_write_orphan(ev, (int)i);
+	}
+	for (w = ur->orphans; NULL != w; w = w->next) {
+		fdevent_iouring_write_cancel(ev, w);
+	}
+	for (n = 0; ur->nwrites > 0 && n < 10; ++n) {
+		struct __kernel_timespec ts = { 1, 0 };
+		struct io_uring_getevents_arg arg;
+		unsigned int head, tail;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		fdevent_iouring_enter(ur->ring_fd, ur->sq_pending, 1,
+				      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				      &arg, sizeof(arg));
+		ur->sq_pending = 0;
+		head = *ur->cq_head;
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+			if (FDEVENT_IOURING_UD_REMOVE == cqe->user_data) continue;
+			if (cqe->user_data & FDEVENT_IOURING_UD_POLL) continue;
+			fdevent_iouring_write_complete(ev, (fdevent_iouring_write *)(uintptr_t)cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	if (ur->sqes) munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring && ur->cq_ring != ur->sq_ring) munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring) munmap(ur->sq_ring, ur->sq_ring_sz);
+	if (ur->ring_fd >= 0) close(ur->ring_fd);
+
+	free(ur->want);
+	free(ur->armed);
+	free(ur->gen);
+	free(ur->wr);
+	free(ur->werr);
+	free(ur->results);
+	free(ur->resndx);
+	free(ur);
+	ev->iouring = NULL;
+}
+
+static int fdevent_linux_iouring_event_del(fdevents *ev, int fde_ndx, int fd) {
+	fdevent_iouring *ur = ev->iouring;
+
+	if (NULL != ur->wr[fd]) fdevent_iouring_write_orphan(ev, fd);
+	ur->werr[fd] = 0;
+
+	if (fde_ndx < 0) return -1;
+
+	if (-1 != ur->armed[fd]) fdevent_iouring_poll_remove(ev, fd);
+	ur->want[fd] = -1;
+
+	return -1;
+}
+
+static int fdevent_linux_iouring_event_set(fdevents *ev, int fde_ndx, int fd, int events) {
+	fdevent_iouring *ur = ev->iouring;
+
+	UNUSED(fde_ndx);
+
+	ur->want[fd] = events;
+	fdevent_iouring_update(ev, fd);
+
+	return fd;
+}
+
+static int fdevent_linux_iouring_poll(fdevents *ev, int timeout_ms) {
+	fdevent_iouring *ur = ev->iouring;
+	fdevent_iouring_write *w;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int head, tail;
+	int i, n;
+
+	/* re-arm one-shot polls which completed in the previous round
+	 * (and FDEVENT_OUT of fds with a completed write) */
+	for (i = 0; i < ur->nresults; ++i) {
+		const int fd = ur->results[i].fd;
+		fdnode * const fdn = ev->fdarray[fd];
+		if (NULL == fdn || ((uintptr_t)fdn & 0x3)) continue;
+		if (-1 == ur->want[fd]) continue;
+		fdevent_iouring_update(ev, fd);
+	}
+	ur->nresults = 0;
+
+	/* cancel writes to (closed) fds which do not progress */
+	for (w = ur->orphans; NULL != w; w = w->next) {
+		if (0 != w->ts
+		    && ev->srv->cur_ts - w->ts > FDEVENT_IOURING_ORPHAN_TIMEOUT) {
+			fdevent_iouring_write_cancel(ev, w);
+			w->ts = 0; /* cancel once */
+		}
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0) {
+		ts.tv_sec  = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+
+	n = fdevent_iouring_enter(ur->ring_fd, ur->sq_pending, 1,
+				  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				  &arg, sizeof(arg));
+	if (n >= 0) {
+		ur->sq_pending -= (unsigned int)n;
+	} else if (errno == ETIME) {
+		return 0;
+	} else if (errno != EBUSY) {
+		return -1;
+	}
+
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+		const uint64_t ud = cqe->user_data;
+		int fd, revents = 0;
+
+		if (FDEVENT_IOURING_UD_REMOVE == ud) continue;
+		if (!(ud & FDEVENT_IOURING_UD_POLL)) {
+			fdevent_iouring_write_complete(ev, (fdevent_iouring_write *)(uintptr_t)ud, cqe->res);
+			continue;
+		}
+		fd = (int)(uint32_t)ud;
+		if (((uint32_t)(ud >> 32) & FDEVENT_IOURING_GEN_MASK) != ur->gen[fd]
+		    || -1 == ur->armed[fd]) continue;
+
+		ur->armed[fd] = -1;
+		ur->gen[fd] = (ur->gen[fd] + 1) & FDEVENT_IOURING_GEN_MASK;
+
+		if (cqe->res < 0) {
+			if (-ECANCELED == cqe->res) continue;
+			revents = FDEVENT_ERR;
+		} else {
+			if (cqe->res & POLLIN)   revents |= FDEVENT_IN;
+			if (cqe->res & POLLOUT)  revents |= FDEVENT_OUT;
+			if (cqe->res & POLLERR)  revents |= FDEVENT_ERR;
+			if (cqe->res & POLLHUP)  revents |= FDEVENT_HUP;
+			if (cqe->res & POLLPRI)  revents |= FDEVENT_PRI;
+			if (cqe->res & POLLNVAL) revents |= FDEVENT_NVAL;
+		}
+
+		fdevent_iouring_result(ur, fd, revents);
+	}
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+	return ur->nresults;
+}
+
+static int fdevent_linux_iouring_event_get_revent(fdevents *ev, size_t ndx) {
+	return ev->iouring->results[ndx].revents;
+}
+
+static int fdevent_linux_iouring_event_get_fd(fdevents *ev, size_t ndx) {
+	return ev->iouring->results[ndx].fd;
+}
+
+static int fdevent_linux_iouring_event_next_fdndx(fdevents *ev, int ndx) {
+	size_t i;
+
+	UNUSED(ev);
+
+	i = (ndx < 0) ? 0 : ndx + 1;
+
+	return i;
+}
+
+int fdevent_linux_iouring_init(fdevents *ev) {
+	fdevent_iouring *ur;
+	struct io_uring_params p;
+	unsigned int cq_entries;
+	size_t i;
+
+	ev->type = FDEVENT_HANDLER_LINUX_IOURING;
+#define SET(x) \
+	ev->x = fdevent_linux_iouring_##x;
+
+	SET(free);
+	SET(poll);
+
+	SET(event_del);
+	SET(event_set);
+
+	SET(event_next_fdndx);
+	SET(event_get_fd);
+	SET(event_get_revent);
+
+	ur = ev->iouring = calloc(1, sizeof(*ur));
+	force_assert(NULL != ur);
+	ur->ring_fd = -1;
+
+	/* each fd has at most one pending poll and one pending remove */
+	for (cq_entries = 2 * FDEVENT_IOURING_SQ_ENTRIES; cq_entries < 2 * ev->maxfds && cq_entries < 65536; cq_entries <<= 1) ;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = cq_entries;
+	if (-1 == (ur->ring_fd = fdevent_iouring_setup(FDEVENT_IOURING_SQ_ENTRIES, &p))) {
+		log_error_write(ev->srv, __FILE__, __LINE__, "SSS",
+			"io_uring_setup failed (", strerror(errno), ")");
+		goto error;
+	}
+	fdevent_setfd_cloexec(ur->ring_fd);
+
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+		log_error_write(ev->srv, __FILE__, __LINE__, "S",
+			"io_uring: kernel too old (need IORING_FEAT_EXT_ARG, Linux 5.11)");
+		goto error;
+	}
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_sz > ur->sq_ring_sz) ur->sq_ring_sz = ur->cq_ring_sz;
+		ur->cq_ring_sz = ur->sq_ring_sz;
+	}
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ur->sq_ring) { ur->sq_ring = NULL; goto error_mmap; }
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ur->cq_ring) { ur->cq_ring = NULL; goto error_mmap; }
+	}
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+	if (MAP_FAILED == ur->sqes) { ur->sqes = NULL; goto error_mmap; }
+
+	ur->sq_head  = (unsigned int *)((char *)ur->sq_ring + p.sq_off.head);
+	ur->sq_tail  = (unsigned int *)((char *)ur->sq_ring + p.sq_off.tail);
+	ur->sq_mask  = (unsigned int *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)((char *)ur->sq_ring + p.sq_off.array);
+	ur->sq_entries = p.sq_entries;
+	ur->cq_head  = (unsigned int *)((char *)ur->cq_ring + p.cq_off.head);
+	ur->cq_tail  = (unsigned int *)((char *)ur->cq_ring + p.cq_off.tail);
+	ur->cq_mask  = (unsigned int *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+	ur->cqes     = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+
+	ur->want    = malloc(ev->maxfds * sizeof(*ur->want));
+	ur->armed   = malloc(ev->maxfds * sizeof(*ur->armed));
+	ur->gen     = calloc(ev->maxfds, sizeof(*ur->gen));
+	ur->wr      = calloc(ev->maxfds, sizeof(*ur->wr));
+	ur->werr    = calloc(ev->maxfds, sizeof(*ur->werr));
+	ur->results = malloc(ev->maxfds * sizeof(*ur->results));
+	ur->resndx  = calloc(ev->maxfds, sizeof(*ur->resndx));
+	force_assert(NULL != ur->want && NULL != ur->armed);
+	force_assert(NULL != ur->gen && NULL != ur->wr && NULL != ur->werr);
+	force_assert(NULL != ur->results && NULL != ur->resndx);
+	for (i = 0; i < ev->maxfds; ++i) {
+		ur->want[i] = -1;
+		ur->armed[i] = -1;
+	}
+
+	return 0;
+
+error_mmap:
+	log_error_write(ev->srv, __FILE__, __LINE__, "SSS",
+		"io_uring mmap failed (", strerror(errno), ")");
+error:
+	fdevent_linux_iouring_free(ev);
+	return -1;
+}
+
+#else /* !(__NR_io_uring_setup && IORING_FEAT_EXT_ARG) */
+
+int fdevent_linux_iouring_init(fdevents *ev) {
+	log_error_write(ev->srv, __FILE__, __LINE__, "S",
+		"linux-iouring not supported by system headers");
+
+	return -1;
+}
+
+ssize_t fdevent_linux_iouring_write(fdevents *ev, int fd, const struct iovec *iov, int iovcnt) {
+	UNUSED(ev);
+	UNUSED(fd);
+	UNUSED(iov);
+	UNUSED(iovcnt);
+	errno = ENOSYS;
+	return -1;
+}
+
+int fdevent_linux_iouring_write_pending(fdevents *ev, int fd) {
+	UNUSED(ev);
+	UNUSED(fd);
+	return 0;
+}
+
+int fdevent_linux_iouring_shutdown_wr(fdevents *ev, int fd) {
+	UNUSED(ev);
+	return shutdown(fd, SHUT_WR);
+}
+
+#endif
+
+#else
+int fdevent_linux_iouring_init(fdevents *ev) {
+	UNUSED(ev);
+
+	log_error_write(ev->srv, __FILE__, __LINE__, "S",
+		"linux-iouring not supported, try to set server.event-handler = \"linux-sysepoll\" or \"poll\"");
+
+	return -1;
+}
+#endif
@@ -31,8 +31,10 @@
 
 #include "status_counter.h"
 
-static data_integer * gw_status_get_di(server *srv, gw_host *host, gw_proc *proc, const char *tag, size_t len) {
+/* register status counter gw.backend.<host id>[.<proc id>]<tag>, value 0 */
+static int gw_status_slot(server *srv, gw_host *host, gw_proc *proc, const char *tag, size_t len) {
     buffer *b = srv->tmp_buf;
+    int slot;
     buffer_copy_string_len(b, CONST_STR_LEN("gw.backend."));
     buffer_append_string_buffer(b, host->id);
     if (proc) {
@@ -40,46 +42,56 @@ static data_integer * gw_status_get_di(server *srv, gw_host *host, gw_proc *proc
         buffer_append_int(b, proc->id);
     }
     buffer_append_string_len(b, tag, len);
-    return status_counter_get_counter(srv, CONST_BUF_LEN(b));
-}
-
-static void gw_proc_tag_inc(server *srv, gw_host *host, gw_proc *proc, const char *tag, size_t len) {
-    data_integer *di = gw_status_get_di(srv, host, proc, tag, len);
-    ++di->value;
+    slot = status_counter_slot(srv, CONST_BUF_LEN(b));
+    status_counter_slot_set(srv, slot, 0);
+    return slot;
 }
 
 static void gw_proc_load_inc(server *srv, gw_host *host, gw_proc *proc) {
-    data_integer *di = gw_status_get_di(srv,host,proc,CONST_STR_LEN(".load"));
-    di->value = ++proc->load;
-
-    status_counter_inc(srv, CONST_STR_LEN("gw.active-requests"));
+    status_counter_slot_set(srv, proc->stat_load, ++proc->load);
+    status_counter_slot_add(srv, host->stat_active_requests, 1);
 }
 
 static void gw_proc_load_dec(server *srv, gw_host *host, gw_proc *proc) {
-    data_integer *di = gw_status_get_di(srv,host,proc,CONST_STR_LEN(".load"));
-    di->value = --proc->load;
-
-    status_counter_dec(srv, CONST_STR_LEN("gw.active-requests"));
+    status_counter_slot_set(srv, proc->stat_load, --proc->load);
+    status_counter_slot_add(srv, host->stat_active_requests, -1);
 }
 
 static void gw_host_assign(server *srv, gw_host *host) {
-    data_integer *di = gw_status_get_di(srv,host,NULL,CONST_STR_LEN(".load"));
-    di->value = ++host->load;
+    status_counter_slot_set(srv, host->stat_load, ++host->load);
 }
 
 static void gw_host_reset(server *srv, gw_host *host) {
-    data_integer *di = gw_status_get_di(srv,host,NULL,CONST_STR_LEN(".load"));
-    di->value = --host->load;
+    status_counter_slot_set(srv, host->stat_load, --host->load);
 }
 
-static int gw_status_init(server *srv, gw_host *host, gw_proc *proc) {
-    gw_status_get_di(srv, host, proc, CONST_STR_LEN(".disabled"))->value = 0;
-    gw_status_get_di(srv, host, proc, CONST_STR_LEN(".died"))->value = 0;
-    gw_status_get_di(srv, host, proc, CONST_STR_LEN(".overloaded"))->value = 0;
-    gw_status_get_di(srv, host, proc, CONST_STR_LEN(".connected"))->value = 0;
-    gw_status_get_di(srv, host, proc, CONST_STR_LEN(".load"))->value = 0;
+/* register the status counters of host and proc, so that they are
+ * updated by slot instead of by name for each request */
+static int gw_status_init_host(server *srv, gw_host *host) {
+    buffer *b;
+    int rc;
+    if (0 != host->stat_load) return 0; /*(host already init'd)*/
+    host->stat_load = gw_status_slot(srv, host, NULL, CONST_STR_LEN(".load"));
+    host->stat_connect_errors =
+      gw_status_slot(srv, host, NULL, CONST_STR_LEN(".connect-errors"));
+    host->stat_spawned = gw_status_slot(srv, host, NULL, CONST_STR_LEN(".spawned"));
+    host->stat_active_requests =
+      status_counter_slot(srv, CONST_STR_LEN("gw.active-requests"));
+
+    /* request duration (see gw_connection_close()) */
+    b = buffer_init_string("gw.backend.");
+    buffer_append_string_buffer(b, host->id);
+    rc = status_counter_histogram_init(srv, &host->stat_duration, CONST_BUF_LEN(b));
+    buffer_free(b);
+    return rc;
+}
 
-    gw_status_get_di(srv, host, NULL, CONST_STR_LEN(".load"))->value = 0;
+static int gw_status_init(server *srv, gw_host *host, gw_proc *proc) {
+    gw_status_slot(srv, host, proc, CONST_STR_LEN(".disabled"));
+    proc->stat_died       = gw_status_slot(srv, host, proc, CONST_STR_LEN(".died"));
+    proc->stat_overloaded = gw_status_slot(srv, host, proc, CONST_STR_LEN(".overloaded"));
+    proc->stat_connected  = gw_status_slot(srv, host, proc, CONST_STR_LEN(".connected"));
+    proc->stat_load       = gw_status_slot(srv, host, proc, CONST_STR_LEN(".load"));
 
     return 0;
 }
@@ -117,6 +129,9 @@ static void gw_proc_free(gw_proc *f) {
 
     gw_proc_free(f->next);
 
+    for (size_t i = 0; i < f->idle_used; ++i) close(f->idle[i].fd);
+    free(f->idle);
+
     buffer_free(f->unixsocket);
     buffer_free(f->connection_name);
     free(f->saddr);
@@ -226,8 +241,76 @@ static int gw_extension_insert(gw_exts *ext, buffer *key, gw_host *fh) {
     return 0;
 }
 
-static void gw_proc_connect_success(server *srv, gw_host *host, gw_proc *proc, int debug) {
-    gw_proc_tag_inc(srv, host, proc, CONST_STR_LEN(".connected"));
+static void gw_idle_conn_close(server *srv, int fd) {
+    /* (idle fd is not registered with fdevent; close immediately) */
+    if (0 != close(fd)) {
+        log_error_write(srv, __FILE__, __LINE__, "sds",
+                        "close failed ", fd, strerror(errno));
+    }
+    --srv->cur_fds;
+}
+
+static void gw_proc_idle_flush(server *srv, gw_proc *proc) {
+    for (size_t i = 0; i < proc->idle_used; ++i) {
+        gw_idle_conn_close(srv, proc->idle[i].fd);
+    }
+    proc->idle_used = 0;
+}
+
+static void gw_proc_idle_expire(server *srv, gw_host *host, gw_proc *proc) {
+    /* close connections idle for keep-alive-timeout (oldest are first) */
+    size_t i;
+    for (i = 0; i < proc->idle_used; ++i) {
+        if (srv->cur_ts - proc->idle[i].ts < host->keep_alive_timeout) break;
+        gw_idle_conn_close(srv, proc->idle[i].fd);
+    }
+    if (0 == i) return;
+    proc->idle_used -= i;
+    memmove(proc->idle, proc->idle+i, proc->idle_used * sizeof(gw_idle_conn));
+}
+
+static int gw_proc_idle_put(server *srv, gw_host *host, gw_proc *proc, int fd) {
+    if (0 == host->keep_alive_max_idle) return 0;
+    if (proc->state != PROC_STATE_RUNNING) return 0;
+
+    if (NULL == proc->idle) {
+        proc->idle = malloc(host->keep_alive_max_idle * sizeof(gw_idle_conn));
+        force_assert(proc->idle);
+    }
+    else if (proc->idle_used == host->keep_alive_max_idle) {
+        /* pool is full; replace the connection closest to timing out */
+        gw_idle_conn_close(srv, proc->idle[0].fd);
+        --proc->idle_used;
+        memmove(proc->idle, proc->idle+1, proc->idle_used*sizeof(gw_idle_conn));
+    }
+
+    proc->idle[proc->idle_used].fd = fd;
+    proc->idle[proc->idle_used].ts = srv->cur_ts;
+    ++proc->idle_used;
+    return 1;
+}
+
+static int gw_proc_idle_get(server *srv, gw_host *host, gw_proc *proc) {
+    /* most recently used connection is least likely to have been closed */
+    while (proc->idle_used) {
+        gw_idle_conn *ic = proc->idle + --proc->idle_used;
+        char c;
+        if (srv->cur_ts - ic->ts < host->keep_alive_timeout) {
+            /* a healthy idle connection has nothing to read: not EOF from
+             * backend closing the connection and no unsolicited data */
+            ssize_t rd = recv(ic->fd, &c, 1, MSG_PEEK);
+            if (rd < 0 && errno == EAGAIN) return ic->fd;
+          #if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+            if (rd < 0 && errno == EWOULDBLOCK) return ic->fd;
+          #endif
+        }
+        gw_idle_conn_close(srv, ic->fd);
+    }
+    return -1;
+}
+
+static void gw_proc_connect_success(server *srv, gw_proc *proc, int debug) {
+    status_counter_slot_add(srv, proc->stat_connected, 1);
     proc->last_used = srv->cur_ts;
 
     if (debug) {
@@ -244,6 +327,8 @@ static void gw_proc_connect_error(server *srv, gw_host *host, gw_proc *proc, pid
                     "establishing connection failed:", strerror(errnum),
                     "socket:", proc->connection_name);
 
+    gw_proc_idle_flush(srv, proc);
+
     if (!proc->is_local) {
         proc->disabled_until = srv->cur_ts + host->disable_time;
         gw_proc_set_state(host, proc, PROC_STATE_OVERLOADED);
@@ -288,11 +373,12 @@ static void gw_proc_connect_error(server *srv, gw_host *host, gw_proc *proc, pid
         }
     }
 
+    status_counter_slot_add(srv, host->stat_connect_errors, 1);
     if (EAGAIN == errnum) {
-        gw_proc_tag_inc(srv, host, proc, CONST_STR_LEN(".overloaded"));
+        status_counter_slot_add(srv, proc->stat_overloaded, 1);
     }
     else {
-        gw_proc_tag_inc(srv, host, proc, CONST_STR_LEN(".died"));
+        status_counter_slot_add(srv, proc->stat_died, 1);
     }
 }
 
@@ -586,6 +672,7 @@ static int gw_spawn_connection(server *srv, gw_host *host, gw_proc *proc, int de
         /* register process */
         proc->last_used = srv->cur_ts;
         proc->is_local = 1;
+        status_counter_slot_add(srv, host->stat_spawned, 1);
 
         /* wait */
         select(0, NULL, NULL, NULL, &tv);
@@ -633,6 +720,7 @@ static void gw_proc_spawn(server *srv, gw_host *host, int debug) {
     } else {
         proc = gw_proc_init();
         proc->id = host->max_id++;
+        gw_status_init(srv, host, proc);
     }
 
     ++host->num_procs;
@@ -669,7 +757,7 @@ static void gw_proc_spawn(server *srv, gw_host *host, int debug) {
 }
 
 static void gw_proc_kill(server *srv, gw_host *host, gw_proc *proc) {
-    UNUSED(srv);
+    gw_proc_idle_flush(srv, proc);
     if (proc->next) proc->next->prev = proc->prev;
     if (proc->prev) proc->prev->next = proc->next;
 
@@ -1100,6 +1188,8 @@ static void handler_ctx_clear(gw_handler_ctx *hctx) {
     hctx->reconnects = 0;
     hctx->request_id = 0;
     hctx->send_content_body = 1;
+    hctx->reused = 0;
+    hctx->keep_alive = 0;
 
     /*plugin_config conf;*//*(no need to reset for same request)*/
 
@@ -1242,6 +1332,8 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, data_unset *du, size
                 { "listen-backlog",    NULL, T_CONFIG_INT,   T_CONFIG_SCOPE_CONNECTION },        /* 19 */
                 { "x-sendfile",        NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },      /* 20 */
                 { "x-sendfile-docroot",NULL, T_CONFIG_ARRAY,  T_CONFIG_SCOPE_CONNECTION },       /* 21 */
+                { "keep-alive-max-idle", NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },      /* 22 */
+                { "keep-alive-timeout",  NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },      /* 23 */
 
                 { NULL,                NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
             };
@@ -1271,6 +1363,8 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, data_unset *du, size
             host->fix_root_path_name = 0;
             host->listen_backlog = 1024;
             host->xsendfile_allow = 0;
+            host->keep_alive_max_idle = 0;
+            host->keep_alive_timeout = 4;
             host->refcount = 0;
 
             fcv[0].destination = host->host;
@@ -1297,6 +1391,8 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, data_unset *du, size
             fcv[19].destination = &(host->listen_backlog);
             fcv[20].destination = &(host->xsendfile_allow);
             fcv[21].destination = host->xsendfile_docroot;
+            fcv[22].destination = &(host->keep_alive_max_idle);
+            fcv[23].destination = &(host->keep_alive_timeout);
 
             if (0 != config_insert_values_internal(srv, da_host->value, fcv, T_CONFIG_SCOPE_CONNECTION)) {
                 goto error;
@@ -1378,6 +1474,8 @@ int gw_set_defaults_backend(server *srv, gw_plugin_data *p, data_unset *du, size
                   : AF_INET;
             }
 
+            if (0 != gw_status_init_host(srv, host)) goto error;
+
             if (host->refcount) {
                 /* already init'd; skip spawning */
             } else if (!buffer_string_is_empty(host->bin_path)) {
@@ -1631,10 +1729,22 @@ static void gw_backend_close(server *srv, gw_handler_ctx *hctx) {
     if (hctx->fd >= 0) {
         fdevent_event_del(srv->ev, &(hctx->fde_ndx), hctx->fd);
         fdevent_unregister(srv->ev, hctx->fd);
-        fdevent_sched_close(srv->ev, hctx->fd, 1);
+        /* return connection to pool only if module flagged complete response
+         * and the complete request was sent (state not GW_STATE_WRITE) */
+        if (!hctx->keep_alive || hctx->state != GW_STATE_READ || !hctx->proc
+            || !gw_proc_idle_put(srv, hctx->host, hctx->proc, hctx->fd)) {
+            fdevent_sched_close(srv->ev, hctx->fd, 1);
+        }
+        else if (hctx->conf.debug > 1) {
+            log_error_write(srv, __FILE__, __LINE__, "sdsb",
+                            "keep idle connection:", hctx->fd,
+                            "socket:", hctx->proc->connection_name);
+        }
         hctx->fd = -1;
         hctx->fde_ndx = -1;
     }
+    hctx->keep_alive = 0;
+    hctx->reused = 0;
 
     if (hctx->host) {
         if (hctx->proc) {
@@ -1651,6 +1761,11 @@ static void gw_connection_close(server *srv, gw_handler_ctx *hctx) {
     gw_plugin_data *p = hctx->plugin_data;
     connection *con = hctx->remote_conn;
 
+    if (hctx->host) {
+        status_counter_histogram_since(srv, &hctx->host->stat_duration,
+                                       &con->request_start_hp);
+    }
+
     gw_backend_close(srv, hctx);
     handler_ctx_free(hctx);
     con->plugin_ctx[p->id] = NULL;
@@ -1660,6 +1775,28 @@ static void gw_connection_close(server *srv, gw_handler_ctx *hctx) {
     }
 }
 
+static int gw_reused_conn_stale(server *srv, gw_handler_ctx *hctx) {
+    /* backend may close an idle keep-alive connection at any time, including
+     * just as it was reused.  Request may be retried on new connection if
+     * nothing was received and the request has no body (since request body
+     * is not retained once sent) */
+    connection *con = hctx->remote_conn;
+    if (!hctx->reused || con->file_started || con->request.content_length)
+        return 0;
+    if (!buffer_string_is_empty(hctx->response)) return 0;
+    if (hctx->rb && !chunkqueue_is_empty(hctx->rb)) return 0;
+
+    if (hctx->conf.debug) {
+        log_error_write(srv, __FILE__, __LINE__, "sb",
+                        "idle connection closed by backend; retrying on socket:",
+                        hctx->proc->connection_name);
+    }
+    gw_proc_idle_flush(srv, hctx->proc);
+    chunkqueue_reset(hctx->wb);
+    hctx->wb_reqlen = 0;
+    return 1;
+}
+
 static handler_t gw_reconnect(server *srv, gw_handler_ctx *hctx) {
     gw_backend_close(srv, hctx);
 
@@ -1711,6 +1848,23 @@ static handler_t gw_write_request(server *srv, gw_handler_ctx *hctx) {
 
         gw_proc_load_inc(srv, hctx->host, hctx->proc);
 
+        hctx->fd = gw_proc_idle_get(srv, hctx->host, hctx->proc);
+        if (-1 != hctx->fd) {
+            /* reuse idle keep-alive connection; already connected */
+            hctx->reused = 1;
+            fdevent_register(srv->ev, hctx->fd, gw_handle_fdevent, hctx);
+            if (hctx->proc->is_local) {
+                hctx->pid = hctx->proc->pid;
+            }
+            hctx->proc->last_used = srv->cur_ts;
+            if (hctx->conf.debug > 1) {
+                log_error_write(srv, __FILE__, __LINE__, "sd",
+                                "reuse idle connection:", hctx->fd);
+            }
+            gw_set_state(srv, hctx, GW_STATE_PREPARE_WRITE);
+            return gw_write_request(srv, hctx);
+        }
+
         hctx->fd = fdevent_socket_nb_cloexec(hctx->host->family,SOCK_STREAM,0);
         if (-1 == hctx->fd) {
             if (errno == EMFILE || errno == EINTR) {
@@ -1758,7 +1912,7 @@ static handler_t gw_write_request(server *srv, gw_handler_ctx *hctx) {
             /* go on with preparing the request */
         }
 
-        gw_proc_connect_success(srv, hctx->host, hctx->proc, hctx->conf.debug);
+        gw_proc_connect_success(srv, hctx->proc, hctx->conf.debug);
 
         gw_set_state(srv, hctx, GW_STATE_PREPARE_WRITE);
         /* fall through */
@@ -1857,6 +2011,9 @@ static handler_t gw_write_error(server *srv, gw_handler_ctx *hctx) {
         /* cleanup this request and let request handler start request again */
         if (hctx->reconnects++ < 5) return gw_reconnect(srv, hctx);
     }
+    else if (gw_reused_conn_stale(srv, hctx) && hctx->reconnects++ < 5) {
+        return gw_reconnect(srv, hctx);
+    }
 
     if (hctx->backend_error) hctx->backend_error(hctx);
     gw_connection_close(srv, hctx);
@@ -2047,6 +2204,10 @@ static handler_t gw_recv_response(server *srv, gw_handler_ctx *hctx) {
         if (con->file_started == 0) {
             /* nothing has been sent out yet, try to use another child */
 
+            if (gw_reused_conn_stale(srv, hctx) && hctx->reconnects++ < 5) {
+                return gw_reconnect(srv, hctx);
+            }
+
             if (hctx->wb->bytes_out == 0 &&
                 hctx->reconnects++ < 5) {
 
@@ -2380,6 +2541,7 @@ static void gw_handle_trigger_host(server *srv, gw_host *host, int debug) {
 
     for (proc = host->first; proc; proc = proc->next) {
         gw_proc_waitpid(srv, host, proc);
+        if (proc->idle_used) gw_proc_idle_expire(srv, host, proc);
     }
 
     gw_restart_dead_procs(srv, host, debug);
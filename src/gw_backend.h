@@ -8,6 +8,7 @@
 
 #include "array.h"
 #include "buffer.h"
+#include "status_counter.h"
 
 typedef struct {
     char **ptr;
@@ -16,6 +17,11 @@ typedef struct {
     size_t used;
 } char_array;
 
+typedef struct {
+    int fd;
+    time_t ts; /* time connection was returned to pool */
+} gw_idle_conn;
+
 typedef struct gw_proc {
     size_t id; /* id will be between 1 and max_procs */
     buffer *unixsocket; /* config.socket + "-" + id */
@@ -37,8 +43,19 @@ typedef struct gw_proc {
 
     time_t disabled_until; /* proc disabled until given time */
 
+    /* idle keep-alive connections to this proc (oldest first)
+     * (sized by host->keep_alive_max_idle; allocated when first needed) */
+    gw_idle_conn *idle;
+    size_t idle_used;
+
     int is_local;
 
+    /* status counter slots (see gw_status_init()) */
+    int stat_connected;
+    int stat_died;
+    int stat_overloaded;
+    int stat_load;
+
     enum {
         PROC_STATE_RUNNING,    /* alive */
         PROC_STATE_OVERLOADED, /* listen-queue is full */
@@ -77,6 +94,13 @@ typedef struct {
     size_t num_procs;    /* how many procs are started */
     size_t active_procs; /* how many procs in state PROC_STATE_RUNNING */
 
+    /* status counter slots (see gw_status_init_host()) */
+    int stat_load;
+    int stat_active_requests;
+    int stat_connect_errors;
+    int stat_spawned;
+    status_counter_histogram stat_duration;
+
     unsigned short max_load_per_proc;
 
     /*
@@ -105,6 +129,16 @@ typedef struct {
      */
     size_t max_requests_per_proc;
 
+    /*
+     * keep up to keep_alive_max_idle connections to each proc open
+     * after a request has completed and reuse them for later requests;
+     * idle connections are closed after keep_alive_timeout seconds.
+     * (only used by modules which can frame the backend response,
+     *  i.e. mod_proxy and mod_fastcgi (FCGI_KEEP_CONN))
+     */
+    unsigned short keep_alive_max_idle;
+    unsigned short keep_alive_timeout;
+
 
     /* config */
 
@@ -317,6 +351,9 @@ typedef struct gw_handler_ctx {
     int       request_id;
     int       send_content_body;
 
+    int       reused;     /* fd taken from proc idle connection pool */
+    int       keep_alive; /* set by module when fd may return to the pool */
+
     http_response_opts opts;
     gw_plugin_config conf;
 
@@ -21,50 +21,60 @@
 #include <unistd.h>
 
 
-int response_header_insert(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen) {
+static void response_header_insert_id(connection *con, enum http_header_e id, const char *key, size_t keylen, const char *value, size_t vallen) {
 	data_string *ds;
 
-	UNUSED(srv);
-
 	if (NULL == (ds = (data_string *)array_get_unused_element(con->response.headers, TYPE_STRING))) {
 		ds = data_response_init();
 	}
 	buffer_copy_string_len(ds->key, key, keylen);
 	buffer_copy_string_len(ds->value, value, vallen);
 
-	array_insert_unique(con->response.headers, (data_unset *)ds);
+	http_header_response_insert(con, id, ds);
+}
+
+int response_header_insert(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen) {
+	UNUSED(srv);
+
+	response_header_insert_id(con, http_header_hkey_get(key, keylen), key, keylen, value, vallen);
 
 	return 0;
 }
 
 int response_header_overwrite(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen) {
 	data_string *ds;
+	const enum http_header_e id = http_header_hkey_get(key, keylen);
 
 	UNUSED(srv);
 
 	/* if there already is a key by this name overwrite the value */
-	if (NULL != (ds = (data_string *)array_get_element_klen(con->response.headers, key, keylen))) {
+	if (NULL != (ds = http_header_response_get(con, id, key, keylen))) {
 		buffer_copy_string_len(ds->value, value, vallen);
 
 		return 0;
 	}
 
-	return response_header_insert(srv, con, key, keylen, value, vallen);
+	response_header_insert_id(con, id, key, keylen, value, vallen);
+
+	return 0;
 }
 
 int response_header_append(server *srv, connection *con, const char *key, size_t keylen, const char *value, size_t vallen) {
 	data_string *ds;
+	const enum http_header_e id = http_header_hkey_get(key, keylen);
 
 	UNUSED(srv);
 
 	/* if there already is a key by this name append the value */
-	if (NULL != (ds = (data_string *)array_get_element_klen(con->response.headers, key, keylen))) {
+	if (NULL != (ds = http_header_response_get(con, id, key, keylen))) {
 		buffer_append_string_len(ds->value, CONST_STR_LEN(", "));
 		buffer_append_string_len(ds->value, value, vallen);
 		return 0;
 	}
 
-	return response_header_insert(srv, con, key, keylen, value, vallen);
+	response_header_insert_id(con, id, key, keylen, value, vallen);
+
+	return 0;
 }
 
 int http_response_redirect_to_directory(server *srv, connection *con) {
@@ -128,27 +138,17 @@ int http_response_redirect_to_directory(server *srv, connection *con) {
 }
 
 buffer * strftime_cache_get(server *srv, time_t last_mod) {
-	struct tm *tm;
-	size_t i;
+	/* direct-mapped: (Fibonacci) hash of mtime selects the only slot */
+	const uint32_t h = (uint32_t)((uint64_t)last_mod * 0x9E3779B97F4A7C15ULL >> 32);
+	mtime_cache_type * const mc = srv->mtime_cache + (h & (FILE_CACHE_MAX-1));
 
-	for (i = 0; i < FILE_CACHE_MAX; i++) {
-		/* found cache-entry */
-		if (srv->mtime_cache[i].mtime == last_mod) return srv->mtime_cache[i].str;
+	if (mc->mtime == last_mod && !buffer_string_is_empty(mc->str)) return mc->str;
 
-		/* found empty slot */
-		if (srv->mtime_cache[i].mtime == 0) break;
-	}
+	mc->mtime = last_mod;
+	buffer_string_prepare_copy(mc->str, 63);
+	buffer_append_strftime(mc->str, "%a, %d %b %Y %H:%M:%S GMT", gmtime(&(mc->mtime)));
 
-	if (i == FILE_CACHE_MAX) {
-		i = 0;
-	}
-
-	srv->mtime_cache[i].mtime = last_mod;
-	buffer_string_prepare_copy(srv->mtime_cache[i].str, 1023);
-	tm = gmtime(&(srv->mtime_cache[i].mtime));
-	buffer_append_strftime(srv->mtime_cache[i].str, "%a, %d %b %Y %H:%M:%S GMT", tm);
-
-	return srv->mtime_cache[i].str;
+	return mc->str;
 }
 
 
@@ -245,7 +245,7 @@ static int http_response_parse_range(server *srv, connection *con, buffer *path,
 
 	con->response.content_length = 0;
 
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, "Content-Type"))) {
+	if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_CONTENT_TYPE, CONST_STR_LEN("Content-Type")))) {
 		content_type = ds->value;
 	}
 
@@ -474,7 +474,7 @@ void http_response_send_file (server *srv, connection *con, buffer *path) {
 
 	/* set response content-type, if not set already */
 
-	if (NULL == array_get_element(con->response.headers, "Content-Type")) {
+	if (NULL == http_header_response_get(con, HTTP_HEADER_CONTENT_TYPE, CONST_STR_LEN("Content-Type"))) {
 		if (buffer_string_is_empty(sce->content_type)) {
 			/* we are setting application/octet-stream, but also announce that
 			 * this header field might change in the seconds few requests
@@ -496,7 +496,7 @@ void http_response_send_file (server *srv, connection *con, buffer *path) {
 
 	if (allow_caching) {
 		if (con->etag_flags != 0 && !buffer_string_is_empty(sce->etag)) {
-			if (NULL == array_get_element(con->response.headers, "ETag")) {
+			if (NULL == http_header_response_get(con, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"))) {
 				/* generate e-tag */
 				etag_mutate(con->physical.etag, sce->etag);
 
@@ -505,7 +505,7 @@ void http_response_send_file (server *srv, connection *con, buffer *path) {
 		}
 
 		/* prepare header */
-		if (NULL == (ds = (data_string *)array_get_element(con->response.headers, "Last-Modified"))) {
+		if (NULL == (ds = http_header_response_get(con, HTTP_HEADER_LAST_MODIFIED, CONST_STR_LEN("Last-Modified")))) {
 			mtime = strftime_cache_get(srv, sce->st.st_mtime);
 			response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), CONST_BUF_LEN(mtime));
 		} else {
@@ -519,11 +519,11 @@ void http_response_send_file (server *srv, connection *con, buffer *path) {
 
 	if (con->request.http_range && con->conf.range_requests
 	    && (200 == con->http_status || 0 == con->http_status)
-	    && NULL == array_get_element(con->response.headers, "Content-Encoding")) {
+	    && NULL == http_header_response_get(con, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding"))) {
 		int do_range_request = 1;
 		/* check if we have a conditional GET */
 
-		if (NULL != (ds = (data_string *)array_get_element(con->request.headers, "If-Range"))) {
+		if (NULL != (ds = http_header_request_get(con, HTTP_HEADER_IF_RANGE, CONST_STR_LEN("If-Range")))) {
 			/* if the value is the same as our ETag, we do a Range-request,
 			 * otherwise a full 200 */
 
@@ -582,7 +582,7 @@ static void http_response_xsendfile (server *srv, connection *con, buffer *path,
 	 * determined by open(), fstat() to reduces race conditions if the file
 	 * is modified between stat() (stat_cache_get_entry()) and open(). */
 	if (con->parsed_response & HTTP_CONTENT_LENGTH) {
-		data_string *ds = (data_string *) array_get_element(con->response.headers, "Content-Length");
+		data_string *ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
 		if (ds) buffer_reset(ds->value);
 		con->parsed_response &= ~HTTP_CONTENT_LENGTH;
 		con->response.content_length = -1;
@@ -636,8 +636,7 @@ static void http_response_xsendfile2(server *srv, connection *con, const buffer
 
     /* reset Content-Length, if set by backend */
     if (con->parsed_response & HTTP_CONTENT_LENGTH) {
-        data_string *ds = (data_string *)
-          array_get_element(con->response.headers, "Content-Length");
+        data_string *ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
         if (ds) buffer_reset(ds->value);
         con->parsed_response &= ~HTTP_CONTENT_LENGTH;
         con->response.content_length = -1;
@@ -841,8 +840,7 @@ static handler_t http_response_process_local_redir(server *srv, connection *con,
 
     /* con->http_status >= 300 && con->http_status < 400) */
     size_t ulen = buffer_string_length(con->uri.path);
-    data_string *ds = (data_string *)
-      array_get_element(con->response.headers, "Location");
+    data_string *ds = http_header_response_get(con, HTTP_HEADER_LOCATION, CONST_STR_LEN("Location"));
     if (NULL != ds
         && ds->value->ptr[0] == '/'
         && (0 != strncmp(ds->value->ptr, con->uri.path->ptr, ulen)
@@ -897,6 +895,7 @@ static int http_response_process_headers(server *srv, connection *con, http_resp
     for (s = hdrs->ptr; NULL != (ns = strchr(s, '\n')); s = ns + 1, ++line) {
         const char *key, *value;
         int key_len;
+        enum http_header_e id;
         data_string *ds;
 
         /* strip the \n */
@@ -959,14 +958,10 @@ static int http_response_process_headers(server *srv, connection *con, http_resp
             }
         }
 
-        switch(key_len) {
-        case 4:
-            if (0 == strncasecmp(key, "Date", key_len)) {
-                con->parsed_response |= HTTP_DATE;
-            }
-            break;
-        case 6:
-            if (0 == strncasecmp(key, "Status", key_len)) {
+        id = http_header_hkey_get(key, key_len);
+        switch (id) {
+        case HTTP_HEADER_OTHER:
+            if (6 == key_len && 0 == strncasecmp(key, "Status", key_len)) {
                 int status;
                 if (opts->backend == BACKEND_PROXY) break; /*(pass w/o parse)*/
                 status = strtol(value, NULL, 10);
@@ -980,48 +975,39 @@ static int http_response_process_headers(server *srv, connection *con, http_resp
                 continue; /* do not send Status to client */
             }
             break;
-        case 7:
-            if (0 == strncasecmp(key, "Upgrade", key_len)) {
-                /*(technically, should also verify Connection: upgrade)*/
-                /*(flag only for mod_proxy and mod_cgi (for now))*/
-                if (opts->backend == BACKEND_PROXY
-                    || opts->backend == BACKEND_CGI) {
-                    con->parsed_response |= HTTP_UPGRADE;
-                }
-            }
+        case HTTP_HEADER_DATE:
+            con->parsed_response |= HTTP_DATE;
             break;
-        case 8:
-            if (0 == strncasecmp(key, "Location", key_len)) {
-                con->parsed_response |= HTTP_LOCATION;
+        case HTTP_HEADER_UPGRADE:
+            /*(technically, should also verify Connection: upgrade)*/
+            /*(flag only for mod_proxy and mod_cgi (for now))*/
+            if (opts->backend == BACKEND_PROXY
+                || opts->backend == BACKEND_CGI) {
+                con->parsed_response |= HTTP_UPGRADE;
             }
             break;
-        case 10:
-            if (0 == strncasecmp(key, "Connection", key_len)) {
-                if (opts->backend == BACKEND_PROXY) continue;
-                con->response.keep_alive =
-                  (0 == strcasecmp(value, "Keep-Alive")) ? 1 : 0;
-                con->parsed_response |= HTTP_CONNECTION;
-            }
-            else if (0 == strncasecmp(key, "Set-Cookie", key_len)) {
-                con->parsed_response |= HTTP_SET_COOKIE;
-            }
+        case HTTP_HEADER_LOCATION:
+            con->parsed_response |= HTTP_LOCATION;
             break;
-        case 14:
-            if (0 == strncasecmp(key, "Content-Length", key_len)) {
-                con->response.content_length = strtoul(value, NULL, 10);
-                con->parsed_response |= HTTP_CONTENT_LENGTH;
-            }
+        case HTTP_HEADER_CONNECTION:
+            if (opts->backend == BACKEND_PROXY) continue;
+            con->response.keep_alive =
+              (0 == strcasecmp(value, "Keep-Alive")) ? 1 : 0;
+            con->parsed_response |= HTTP_CONNECTION;
             break;
-        case 16:
-            if (0 == strncasecmp(key, "Content-Location", key_len)) {
-                con->parsed_response |= HTTP_CONTENT_LOCATION;
-            }
+        case HTTP_HEADER_SET_COOKIE:
+            con->parsed_response |= HTTP_SET_COOKIE;
             break;
-        case 17:
-            if (0 == strncasecmp(key, "Transfer-Encoding", key_len)) {
-                if (opts->backend == BACKEND_PROXY) continue;
-                con->parsed_response |= HTTP_TRANSFER_ENCODING;
-            }
+        case HTTP_HEADER_CONTENT_LENGTH:
+            con->response.content_length = strtoul(value, NULL, 10);
+            con->parsed_response |= HTTP_CONTENT_LENGTH;
+            break;
+        case HTTP_HEADER_CONTENT_LOCATION:
+            con->parsed_response |= HTTP_CONTENT_LOCATION;
+            break;
+        case HTTP_HEADER_TRANSFER_ENCODING:
+            if (opts->backend == BACKEND_PROXY) continue;
+            con->parsed_response |= HTTP_TRANSFER_ENCODING;
             break;
         default:
             break;
@@ -1033,7 +1019,7 @@ static int http_response_process_headers(server *srv, connection *con, http_resp
         buffer_copy_string_len(ds->key, key, key_len);
         buffer_copy_string(ds->value, value);
 
-        array_insert_unique(con->response.headers, (data_unset *)ds);
+        http_header_response_insert(con, id, ds);
     }
 
     /* CGI/1.1 rev 03 - 7.2.1.2 */
@@ -1170,14 +1156,14 @@ handler_t http_response_parse_headers(server *srv, connection *con, http_respons
         data_string *ds;
         /* X-Sendfile2 is deprecated; historical for fastcgi */
         if (opts->backend == BACKEND_FASTCGI
-            && NULL != (ds = (data_string *) array_get_element(con->response.headers, "X-Sendfile2"))) {
+            && NULL != (ds = http_header_response_get(con, HTTP_HEADER_X_SENDFILE2, CONST_STR_LEN("X-Sendfile2")))) {
             http_response_xsendfile2(srv, con, ds->value, opts->xsendfile_docroot);
             buffer_reset(ds->value); /*(do not send to client)*/
             if (con->mode == DIRECT) con->file_started = 0;
             return HANDLER_FINISHED;
-        } else if (NULL != (ds = (data_string *) array_get_element(con->response.headers, "X-Sendfile"))
+        } else if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_X_SENDFILE, CONST_STR_LEN("X-Sendfile")))
                    || (opts->backend == BACKEND_FASTCGI /* X-LIGHTTPD-send-file is deprecated; historical for fastcgi */
-                       && NULL != (ds = (data_string *) array_get_element(con->response.headers, "X-LIGHTTPD-send-file")))) {
+                       && NULL != (ds = http_header_response_get(con, HTTP_HEADER_X_LIGHTTPD_SEND_FILE, CONST_STR_LEN("X-LIGHTTPD-send-file"))))) {
             http_response_xsendfile(srv, con, ds->value, opts->xsendfile_docroot);
             buffer_reset(ds->value); /*(do not send to client)*/
             if (con->mode == DIRECT) con->file_started = 0;
@@ -36,24 +36,38 @@ static void http_chunk_append_len(server *srv, connection *con, uintmax_t len) {
 	chunkqueue_append_buffer(con->write_queue, b);
 }
 
-static int http_chunk_append_file_open_fstat(server *srv, connection *con, buffer *fn, struct stat *st) {
-	if (!con->conf.follow_symlink) {
+static int http_chunk_append_file_open_fstat(server *srv, connection *con, buffer *fn, struct stat *st, stat_cache_entry **psce) {
+	*psce = NULL;
+
+	if (!con->conf.follow_symlink || srv->srvconf.stat_cache_max_fds) {
 		/*(preserve existing stat_cache symlink checks)*/
 		stat_cache_entry *sce;
+		int fd;
 		if (HANDLER_ERROR == stat_cache_get_entry(srv, con, fn, &sce)) return -1;
+
+		/* share fd kept open in stat_cache, if any */
+		if (-1 != (fd = stat_cache_entry_open(srv, con, sce))) {
+			*st = sce->st;
+			*psce = sce;
+			return fd;
+		}
 	}
 
 	return stat_cache_open_rdonly_fstat(srv, con, fn, st);
 }
 
-static void http_chunk_append_file_fd_range(server *srv, connection *con, buffer *fn, int fd, off_t offset, off_t len) {
+static void http_chunk_append_file_fd_range(server *srv, connection *con, buffer *fn, int fd, off_t offset, off_t len, stat_cache_entry *sce) {
 	chunkqueue *cq = con->write_queue;
 
 	if (con->response.transfer_encoding & HTTP_TRANSFER_ENCODING_CHUNKED) {
 		http_chunk_append_len(srv, con, (uintmax_t)len);
 	}
 
-	chunkqueue_append_file_fd(cq, fn, fd, offset, len);
+	if (NULL != sce) {
+		chunkqueue_append_file_ref(cq, fn, fd, offset, len, sce, stat_cache_entry_refchg);
+	} else {
+		chunkqueue_append_file_fd(cq, fn, fd, offset, len);
+	}
 
 	if (con->response.transfer_encoding & HTTP_TRANSFER_ENCODING_CHUNKED) {
 		chunkqueue_append_mem(cq, CONST_STR_LEN("\r\n"));
@@ -62,32 +76,60 @@ static void http_chunk_append_file_fd_range(server *srv, connection *con, buffer
 
 int http_chunk_append_file_range(server *srv, connection *con, buffer *fn, off_t offset, off_t len) {
 	struct stat st;
-	const int fd = http_chunk_append_file_open_fstat(srv, con, fn, &st);
+	stat_cache_entry *sce;
+	const int fd = http_chunk_append_file_open_fstat(srv, con, fn, &st, &sce);
 	if (fd < 0) return -1;
 
 	if (-1 == len) {
 		if (offset >= st.st_size) {
-			close(fd);
+			if (NULL == sce) close(fd);
 			return (offset == st.st_size) ? 0 : -1;
 		}
 		len = st.st_size - offset;
 	} else if (st.st_size - offset < len) {
-		close(fd);
+		if (NULL == sce) close(fd);
 		return -1;
 	}
 
-	http_chunk_append_file_fd_range(srv, con, fn, fd, offset, len);
+	http_chunk_append_file_fd_range(srv, con, fn, fd, offset, len, sce);
+	return 0;
+}
+
+static int http_chunk_append_file_content(server *srv, connection *con, buffer *fn) {
+	chunkqueue *cq = con->write_queue;
+	stat_cache_entry *sce;
+	buffer *b;
+
+	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, fn, &sce)) return -1;
+	if (NULL == (b = stat_cache_entry_content(srv, con, sce))) return -1;
+
+	if (con->response.transfer_encoding & HTTP_TRANSFER_ENCODING_CHUNKED) {
+		http_chunk_append_len(srv, con, buffer_string_length(b));
+	}
+
+	/* share the copy kept in stat_cache instead of reading the file */
+	chunkqueue_append_mem_ref(cq, b, sce, stat_cache_entry_refchg);
+
+	if (con->response.transfer_encoding & HTTP_TRANSFER_ENCODING_CHUNKED) {
+		chunkqueue_append_mem(cq, CONST_STR_LEN("\r\n"));
+	}
 	return 0;
 }
 
 int http_chunk_append_file(server *srv, connection *con, buffer *fn) {
 	struct stat st;
-	const int fd = http_chunk_append_file_open_fstat(srv, con, fn, &st);
+	stat_cache_entry *sce;
+	int fd;
+
+	if (srv->srvconf.stat_cache_content_max_size
+	    && 0 == http_chunk_append_file_content(srv, con, fn)) return 0;
+
+	fd = http_chunk_append_file_open_fstat(srv, con, fn, &st, &sce);
 	if (fd < 0) return -1;
 
 	if (0 != st.st_size) {
-		http_chunk_append_file_fd_range(srv, con, fn, fd, 0, st.st_size);
-	} else {
+		http_chunk_append_file_fd_range(srv, con, fn, fd, 0, st.st_size, sce);
+	} else if (NULL == sce) {
 		close(fd);
 	}
 	return 0;
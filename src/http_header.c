@@ -0,0 +1,209 @@
+#include "first.h"
+
+#include "http_header.h"
+#include "base.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* compare s to lowercase name of length len without regard to case
+ * (only letters are folded; other chars must match exactly) */
+static int http_header_str_eq_lc(const char *s, const char *name, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        const char c = s[i], n = name[i];
+        if (c != n && ((c | 0x20) != n || (unsigned char)(n - 'a') > 'z' - 'a'))
+            return 0;
+    }
+    return 1;
+}
+
+enum http_header_e http_header_hkey_get(const char *s, size_t slen) {
+    /* switch on (length, first char); at most two string compares */
+    #define HKEY(str, id) \
+        if (http_header_str_eq_lc(s+1, (str)+1, sizeof(str)-2)) return (id)
+    switch (slen) {
+      case 4:
+        switch (s[0] | 0x20) {
+          case 'd': HKEY("date", HTTP_HEADER_DATE); break;
+          case 'e': HKEY("etag", HTTP_HEADER_ETAG); break;
+          case 'h': HKEY("host", HTTP_HEADER_HOST); break;
+          case 'v': HKEY("vary", HTTP_HEADER_VARY); break;
+          default:  break;
+        }
+        break;
+      case 5:
+        if ((s[0] | 0x20) == 'r') HKEY("range", HTTP_HEADER_RANGE);
+        break;
+      case 6:
+        switch (s[0] | 0x20) {
+          case 'c': HKEY("cookie", HTTP_HEADER_COOKIE); break;
+          case 'e': HKEY("expect", HTTP_HEADER_EXPECT); break;
+          case 's': HKEY("server", HTTP_HEADER_SERVER); break;
+          default:  break;
+        }
+        break;
+      case 7:
+        if ((s[0] | 0x20) == 'u') HKEY("upgrade", HTTP_HEADER_UPGRADE);
+        break;
+      case 8:
+        switch (s[0] | 0x20) {
+          case 'i': HKEY("if-range", HTTP_HEADER_IF_RANGE); break;
+          case 'l': HKEY("location", HTTP_HEADER_LOCATION); break;
+          default:  break;
+        }
+        break;
+      case 9:
+        if ((s[0] | 0x20) == 'f') HKEY("forwarded", HTTP_HEADER_FORWARDED);
+        break;
+      case 10:
+        switch (s[0] | 0x20) {
+          case 'c': HKEY("connection", HTTP_HEADER_CONNECTION); break;
+          case 's': HKEY("set-cookie", HTTP_HEADER_SET_COOKIE); break;
+          case 'x': HKEY("x-sendfile", HTTP_HEADER_X_SENDFILE); break;
+          default:  break;
+        }
+        break;
+      case 11:
+        if ((s[0] | 0x20) == 'x') HKEY("x-sendfile2", HTTP_HEADER_X_SENDFILE2);
+        break;
+      case 12:
+        if ((s[0] | 0x20) == 'c') HKEY("content-type", HTTP_HEADER_CONTENT_TYPE);
+        break;
+      case 13:
+        switch (s[0] | 0x20) {
+          case 'a': HKEY("authorization", HTTP_HEADER_AUTHORIZATION); break;
+          case 'c': HKEY("cache-control", HTTP_HEADER_CACHE_CONTROL); break;
+          case 'i': HKEY("if-none-match", HTTP_HEADER_IF_NONE_MATCH); break;
+          case 'l': HKEY("last-modified", HTTP_HEADER_LAST_MODIFIED); break;
+          default:  break;
+        }
+        break;
+      case 14:
+        if ((s[0] | 0x20) == 'c') HKEY("content-length", HTTP_HEADER_CONTENT_LENGTH);
+        break;
+      case 15:
+        switch (s[0] | 0x20) {
+          case 'a': HKEY("accept-encoding", HTTP_HEADER_ACCEPT_ENCODING); break;
+          case 'x': HKEY("x-forwarded-for", HTTP_HEADER_X_FORWARDED_FOR); break;
+          default:  break;
+        }
+        break;
+      case 16:
+        switch (s[0] | 0x20) {
+          case 'c':
+            HKEY("content-encoding", HTTP_HEADER_CONTENT_ENCODING);
+            HKEY("content-location", HTTP_HEADER_CONTENT_LOCATION);
+            break;
+          case 'w': HKEY("www-authenticate", HTTP_HEADER_WWW_AUTHENTICATE); break;
+          default:  break;
+        }
+        break;
+      case 17:
+        switch (s[0] | 0x20) {
+          case 'i': HKEY("if-modified-since", HTTP_HEADER_IF_MODIFIED_SINCE); break;
+          case 't': HKEY("transfer-encoding", HTTP_HEADER_TRANSFER_ENCODING); break;
+          case 'x': HKEY("x-forwarded-proto", HTTP_HEADER_X_FORWARDED_PROTO); break;
+          default:  break;
+        }
+        break;
+      case 20:
+        if ((s[0] | 0x20) == 'x') HKEY("x-lighttpd-send-file", HTTP_HEADER_X_LIGHTTPD_SEND_FILE);
+        break;
+      default:
+        break;
+    }
+    #undef HKEY
+    return HTTP_HEADER_OTHER;
+}
+
+data_string * http_header_get(array *hdrs, const http_header_index *hx, enum http_header_e id, const char *k, size_t klen) {
+    if (id != HTTP_HEADER_OTHER)
+        return (hx->htags & HTTP_HEADER_BIT(id)) ? hx->slot[id] : NULL;
+    return (data_string *)array_get_element_klen(hdrs, k, klen);
+}
+
+void http_header_insert(array *hdrs, http_header_index *hx, enum http_header_e id, data_string *ds) {
+    ds->ext = id;
+    if (id != HTTP_HEADER_OTHER) {
+        if (hx->htags & HTTP_HEADER_BIT(id)) {
+            /* merge into existing element (and free ds) */
+            data_string * const old = hx->slot[id];
+            ds->insert_dup((data_unset *)old, (data_unset *)ds);
+            return;
+        }
+        hx->htags |= HTTP_HEADER_BIT(id);
+        hx->slot[id] = ds;
+    }
+    array_insert_unique(hdrs, (data_unset *)ds);
+}
+
+data_string * http_header_set(array *hdrs, http_header_index *hx, enum http_header_e id, const char *k, size_t klen, const char *v, size_t vlen) {
+    data_string *ds = http_header_get(hdrs, hx, id, k, klen);
+    if (NULL != ds) {
+        buffer_copy_string_len(ds->value, v, vlen);
+        return ds;
+    }
+
+    if (NULL == (ds = (data_string *)array_get_unused_element(hdrs, TYPE_STRING))) {
+        ds = data_string_init();
+    }
+    buffer_copy_string_len(ds->key, k, klen);
+    buffer_copy_string_len(ds->value, v, vlen);
+    http_header_insert(hdrs, hx, id, ds);
+    return ds;
+}
+
+void http_header_reset(array *hdrs, http_header_index *hx) {
+    array_reset(hdrs);
+    hx->htags = 0;
+}
+
+data_string * http_header_request_get(connection *con, enum http_header_e id, const char *k, size_t klen) {
+    return http_header_get(con->request.headers, &con->request.hindex, id, k, klen);
+}
+
+void http_header_request_insert(connection *con, enum http_header_e id, data_string *ds) {
+    http_header_insert(con->request.headers, &con->request.hindex, id, ds);
+}
+
+data_string * http_header_request_set(connection *con, enum http_header_e id, const char *k, size_t klen, const char *v, size_t vlen) {
+    return http_header_set(con->request.headers, &con->request.hindex, id, k, klen, v, vlen);
+}
+
+data_string * http_header_response_get(connection *con, enum http_header_e id, const char *k, size_t klen) {
+    return http_header_get(con->response.headers, &con->response.hindex, id, k, klen);
+}
+
+void http_header_response_insert(connection *con, enum http_header_e id, data_string *ds) {
+    http_header_insert(con->response.headers, &con->response.hindex, id, ds);
+}
+
+size_t http_header_scan_ctl_scalar(const char *s, size_t len) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        const unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 && c != '\t') break;
+    }
+    return i;
+}
+
+size_t http_header_scan_ctl(const char *s, size_t len) {
+  #if defined(__SSE2__)
+    /* 16 bytes at a time: (c <= 0x1f) && (c != '\t'), unsigned compare */
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        const __m128i lo = _mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x);
+        const int m = _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(x, tab), lo));
+        if (m) return i + (size_t)__builtin_ctz((unsigned int)m);
+    }
+    return i + http_header_scan_ctl_scalar(s + i, len - i);
+  #else
+    return http_header_scan_ctl_scalar(s, len);
+  #endif
+}
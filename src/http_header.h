@@ -0,0 +1,85 @@
+#ifndef INCLUDED_HTTP_HEADER_H
+#define INCLUDED_HTTP_HEADER_H
+#include "first.h"
+
+#include <sys/types.h>
+
+#include "base_decls.h"
+#include "array.h"
+
+/* ids of HTTP header field names that lighttpd inspects itself
+ * (all other field names map to HTTP_HEADER_OTHER) */
+enum http_header_e {
+  HTTP_HEADER_OTHER = 0
+ ,HTTP_HEADER_ACCEPT_ENCODING
+ ,HTTP_HEADER_AUTHORIZATION
+ ,HTTP_HEADER_CACHE_CONTROL
+ ,HTTP_HEADER_CONNECTION
+ ,HTTP_HEADER_CONTENT_ENCODING
+ ,HTTP_HEADER_CONTENT_LENGTH
+ ,HTTP_HEADER_CONTENT_LOCATION
+ ,HTTP_HEADER_CONTENT_TYPE
+ ,HTTP_HEADER_COOKIE
+ ,HTTP_HEADER_DATE
+ ,HTTP_HEADER_ETAG
+ ,HTTP_HEADER_EXPECT
+ ,HTTP_HEADER_FORWARDED
+ ,HTTP_HEADER_HOST
+ ,HTTP_HEADER_IF_MODIFIED_SINCE
+ ,HTTP_HEADER_IF_NONE_MATCH
+ ,HTTP_HEADER_IF_RANGE
+ ,HTTP_HEADER_LAST_MODIFIED
+ ,HTTP_HEADER_LOCATION
+ ,HTTP_HEADER_RANGE
+ ,HTTP_HEADER_SERVER
+ ,HTTP_HEADER_SET_COOKIE
+ ,HTTP_HEADER_TRANSFER_ENCODING
+ ,HTTP_HEADER_UPGRADE
+ ,HTTP_HEADER_VARY
+ ,HTTP_HEADER_WWW_AUTHENTICATE
+ ,HTTP_HEADER_X_FORWARDED_FOR
+ ,HTTP_HEADER_X_FORWARDED_PROTO
+ ,HTTP_HEADER_X_LIGHTTPD_SEND_FILE
+ ,HTTP_HEADER_X_SENDFILE
+ ,HTTP_HEADER_X_SENDFILE2
+ ,HTTP_HEADER_MAX /* (count of ids; must stay <= 64) */
+};
+
+#define HTTP_HEADER_BIT(id) ((uint64_t)1 << (id))
+
+/* index of the known headers in an array of HTTP headers:
+ * bit (1 << id) of htags is set if slot[id] points to the array element
+ * holding header id.  The index is only valid as long as every insert into
+ * and reset of the array goes through the http_header_* functions below. */
+typedef struct http_header_index {
+	uint64_t htags;
+	data_string *slot[HTTP_HEADER_MAX];
+} http_header_index;
+
+enum http_header_e http_header_hkey_get(const char *s, size_t slen);
+
+/* lookup header by id; HTTP_HEADER_OTHER falls back to lookup by name k */
+data_string * http_header_get(array *hdrs, const http_header_index *hx, enum http_header_e id, const char *k, size_t klen);
+
+/* insert ds (key and value set by caller) into hdrs; merges with an existing
+ * header of the same name as array_insert_unique() does.  id must be
+ * http_header_hkey_get() of ds->key. */
+void http_header_insert(array *hdrs, http_header_index *hx, enum http_header_e id, data_string *ds);
+
+/* set header to value, replacing the value of an existing header */
+data_string * http_header_set(array *hdrs, http_header_index *hx, enum http_header_e id, const char *k, size_t klen, const char *v, size_t vlen);
+
+void http_header_reset(array *hdrs, http_header_index *hx);
+
+data_string * http_header_request_get(connection *con, enum http_header_e id, const char *k, size_t klen);
+void http_header_request_insert(connection *con, enum http_header_e id, data_string *ds);
+data_string * http_header_request_set(connection *con, enum http_header_e id, const char *k, size_t klen, const char *v, size_t vlen);
+data_string * http_header_response_get(connection *con, enum http_header_e id, const char *k, size_t klen);
+void http_header_response_insert(connection *con, enum http_header_e id, data_string *ds);
+
+/* return offset of first byte in s[0..len) which is a control char other
+ * than HTAB (i.e. '\r', '\n', '\0', ...), or len if there is none */
+size_t http_header_scan_ctl(const char *s, size_t len);
+size_t http_header_scan_ctl_scalar(const char *s, size_t len);
+
+#endif
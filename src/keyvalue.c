@@ -56,59 +56,65 @@ static const keyvalue http_methods[] = {
 	{ HTTP_METHOD_UNSET, NULL }
 };
 
-static const keyvalue http_status[] = {
-	{ 100, "Continue" },
-	{ 101, "Switching Protocols" },
-	{ 102, "Processing" }, /* WebDAV */
-	{ 200, "OK" },
-	{ 201, "Created" },
-	{ 202, "Accepted" },
-	{ 203, "Non-Authoritative Information" },
-	{ 204, "No Content" },
-	{ 205, "Reset Content" },
-	{ 206, "Partial Content" },
-	{ 207, "Multi-status" }, /* WebDAV */
-	{ 300, "Multiple Choices" },
-	{ 301, "Moved Permanently" },
-	{ 302, "Found" },
-	{ 303, "See Other" },
-	{ 304, "Not Modified" },
-	{ 305, "Use Proxy" },
-	{ 306, "(Unused)" },
-	{ 307, "Temporary Redirect" },
-	{ 308, "Permanent Redirect" },
-	{ 400, "Bad Request" },
-	{ 401, "Unauthorized" },
-	{ 402, "Payment Required" },
-	{ 403, "Forbidden" },
-	{ 404, "Not Found" },
-	{ 405, "Method Not Allowed" },
-	{ 406, "Not Acceptable" },
-	{ 407, "Proxy Authentication Required" },
-	{ 408, "Request Timeout" },
-	{ 409, "Conflict" },
-	{ 410, "Gone" },
-	{ 411, "Length Required" },
-	{ 412, "Precondition Failed" },
-	{ 413, "Request Entity Too Large" },
-	{ 414, "Request-URI Too Long" },
-	{ 415, "Unsupported Media Type" },
-	{ 416, "Requested Range Not Satisfiable" },
-	{ 417, "Expectation Failed" },
-	{ 422, "Unprocessable Entity" }, /* WebDAV */
-	{ 423, "Locked" }, /* WebDAV */
-	{ 424, "Failed Dependency" }, /* WebDAV */
-	{ 426, "Upgrade Required" }, /* TLS */
-	{ 500, "Internal Server Error" },
-	{ 501, "Not Implemented" },
-	{ 502, "Bad Gateway" },
-	{ 503, "Service Not Available" },
-	{ 504, "Gateway Timeout" },
-	{ 505, "HTTP Version Not Supported" },
-	{ 507, "Insufficient Storage" }, /* WebDAV */
-
-	{ -1, NULL }
+/* status codes with pre-rendered "NNN Reason-Phrase" (sorted by status) */
+#define HTTP_STATUS_LINE(status, reason) \
+	{ status, sizeof(#status " " reason)-1, #status " " reason }
+static const struct http_status_line {
+	int status;
+	unsigned int len;
+	const char *line;
+} http_status[] = {
+	HTTP_STATUS_LINE(100, "Continue"),
+	HTTP_STATUS_LINE(101, "Switching Protocols"),
+	HTTP_STATUS_LINE(102, "Processing"), /* WebDAV */
+	HTTP_STATUS_LINE(200, "OK"),
+	HTTP_STATUS_LINE(201, "Created"),
+	HTTP_STATUS_LINE(202, "Accepted"),
+	HTTP_STATUS_LINE(203, "Non-Authoritative Information"),
+	HTTP_STATUS_LINE(204, "No Content"),
+	HTTP_STATUS_LINE(205, "Reset Content"),
+	HTTP_STATUS_LINE(206, "Partial Content"),
+	HTTP_STATUS_LINE(207, "Multi-status"), /* WebDAV */
+	HTTP_STATUS_LINE(300, "Multiple Choices"),
+	HTTP_STATUS_LINE(301, "Moved Permanently"),
+	HTTP_STATUS_LINE(302, "Found"),
+	HTTP_STATUS_LINE(303, "See Other"),
+	HTTP_STATUS_LINE(304, "Not Modified"),
+	HTTP_STATUS_LINE(305, "Use Proxy"),
+	HTTP_STATUS_LINE(306, "(Unused)"),
+	HTTP_STATUS_LINE(307, "Temporary Redirect"),
+	HTTP_STATUS_LINE(308, "Permanent Redirect"),
+	HTTP_STATUS_LINE(400, "Bad Request"),
+	HTTP_STATUS_LINE(401, "Unauthorized"),
+	HTTP_STATUS_LINE(402, "Payment Required"),
+	HTTP_STATUS_LINE(403, "Forbidden"),
+	HTTP_STATUS_LINE(404, "Not Found"),
+	HTTP_STATUS_LINE(405, "Method Not Allowed"),
+	HTTP_STATUS_LINE(406, "Not Acceptable"),
+	HTTP_STATUS_LINE(407, "Proxy Authentication Required"),
+	HTTP_STATUS_LINE(408, "Request Timeout"),
+	HTTP_STATUS_LINE(409, "Conflict"),
+	HTTP_STATUS_LINE(410, "Gone"),
+	HTTP_STATUS_LINE(411, "Length Required"),
+	HTTP_STATUS_LINE(412, "Precondition Failed"),
+	HTTP_STATUS_LINE(413, "Request Entity Too Large"),
+	HTTP_STATUS_LINE(414, "Request-URI Too Long"),
+	HTTP_STATUS_LINE(415, "Unsupported Media Type"),
+	HTTP_STATUS_LINE(416, "Requested Range Not Satisfiable"),
+	HTTP_STATUS_LINE(417, "Expectation Failed"),
+	HTTP_STATUS_LINE(422, "Unprocessable Entity"), /* WebDAV */
+	HTTP_STATUS_LINE(423, "Locked"), /* WebDAV */
+	HTTP_STATUS_LINE(424, "Failed Dependency"), /* WebDAV */
+	HTTP_STATUS_LINE(426, "Upgrade Required"), /* TLS */
+	HTTP_STATUS_LINE(500, "Internal Server Error"),
+	HTTP_STATUS_LINE(501, "Not Implemented"),
+	HTTP_STATUS_LINE(502, "Bad Gateway"),
+	HTTP_STATUS_LINE(503, "Service Not Available"),
+	HTTP_STATUS_LINE(504, "Gateway Timeout"),
+	HTTP_STATUS_LINE(505, "HTTP Version Not Supported"),
+	HTTP_STATUS_LINE(507, "Insufficient Storage"), /* WebDAV */
 };
+#undef HTTP_STATUS_LINE
 
 static const keyvalue http_status_body[] = {
 	{ 400, "400.html" },
@@ -147,8 +153,27 @@ const char *get_http_version_name(int i) {
 	return keyvalue_get_value(http_versions, i);
 }
 
+const char *get_http_status_line(int i, size_t *len) {
+	/* binary search in http_status[] */
+	size_t lo = 0, hi = sizeof(http_status)/sizeof(http_status[0]);
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		if (http_status[mid].status < i) {
+			lo = mid + 1;
+		} else if (http_status[mid].status > i) {
+			hi = mid;
+		} else {
+			*len = http_status[mid].len;
+			return http_status[mid].line;
+		}
+	}
+	return NULL;
+}
+
 const char *get_http_status_name(int i) {
-	return keyvalue_get_value(http_status, i);
+	size_t len;
+	const char * const line = get_http_status_line(i, &len);
+	return NULL != line ? line + sizeof("NNN ")-1 : NULL;
 }
 
 const char *get_http_method_name(http_method_t i) {
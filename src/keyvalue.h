@@ -84,6 +84,8 @@ typedef struct {
 } pcre_keyvalue_buffer;
 
 const char *get_http_status_name(int i);
+/* "NNN Reason-Phrase" of status i (length in *len), or NULL if unknown */
+const char *get_http_status_line(int i, size_t *len);
 const char *get_http_version_name(int i);
 const char *get_http_method_name(http_method_t i);
 const char *get_http_status_body_name(int i);
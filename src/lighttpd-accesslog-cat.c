@@ -0,0 +1,242 @@
+#include "first.h"
+
+/**
+ * print binary access log records of mod_accesslog
+ * (accesslog.format-type = "binary") as text or as JSON, one line per record
+ *
+ * usage: lighttpd-accesslog-cat [-j] [file ...]
+ *
+ * text: the fields separated by spaces; strings are escaped as in the text
+ *       access log and enclosed in '"', missing values are logged as '-'
+ * JSON: the same output as accesslog.format-type = "json"
+ */
+
+#include "mod_accesslog.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void print_escaped(const unsigned char *s, size_t len) {
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		const unsigned char c = s[i];
+		if (c >= ' ' && c <= '~' && c != '"' && c != '\\') {
+			putchar(c);
+			continue;
+		}
+		switch (c) {
+		case '"':  fputs("\\\"", stdout); break;
+		case '\\': fputs("\\\\", stdout); break;
+		case '\b': fputs("\\b", stdout); break;
+		case '\n': fputs("\\n", stdout); break;
+		case '\r': fputs("\\r", stdout); break;
+		case '\t': fputs("\\t", stdout); break;
+		case '\v': fputs("\\v", stdout); break;
+		default:   printf("\\x%02X", c); break;
+		}
+	}
+}
+
+static void print_json_escaped(const unsigned char *s, size_t len) {
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		const unsigned char c = s[i];
+		if (c >= ' ' && c != '"' && c != '\\') {
+			putchar(c);
+			continue;
+		}
+		switch (c) {
+		case '"':  fputs("\\\"", stdout); break;
+		case '\\': fputs("\\\\", stdout); break;
+		case '\b': fputs("\\b", stdout); break;
+		case '\n': fputs("\\n", stdout); break;
+		case '\r': fputs("\\r", stdout); break;
+		case '\t': fputs("\\t", stdout); break;
+		default:   printf("\\u00%02X", c); break;
+		}
+	}
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uintmax_t *u) {
+	unsigned int shift = 0;
+	*u = 0;
+	while (*p < end && shift < sizeof(*u) * 8) {
+		const unsigned char c = *(*p)++;
+		*u |= (uintmax_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return 0;
+		shift += 7;
+	}
+	return -1;
+}
+
+/* print one record; returns -1 if record is malformed */
+static int print_record(const unsigned char *p, const unsigned char *end, int json) {
+	int first = 1;
+
+	if (json) putchar('{');
+
+	while (p < end) {
+		const unsigned char *name = NULL;
+		size_t nlen = 0;
+		const char *fname;
+		int type, key;
+
+		if (end - p < 2) return -1;
+		type = p[0] & ~ACCESSLOG_BIN_NAME;
+		key = p[1];
+		if (p[0] & ACCESSLOG_BIN_NAME) {
+			if (end - p < 3 || (size_t)(end - p - 3) < p[2]) return -1;
+			nlen = p[2];
+			name = p + 3;
+			p += 3 + nlen;
+		} else {
+			p += 2;
+		}
+
+		if (!first) putchar(json ? ',' : ' ');
+		first = 0;
+
+		if (json) {
+			fname = accesslog_field_name(key);
+			putchar('"');
+			if (fname) {
+				fputs(fname, stdout);
+			} else {
+				printf("%%%c", key);
+			}
+			if (nlen) {
+				putchar(':');
+				print_json_escaped(name, nlen);
+			}
+			fputs("\":", stdout);
+		}
+
+		switch (type) {
+		case ACCESSLOG_BIN_NONE:
+			fputs(json ? "null" : "-", stdout);
+			break;
+		case ACCESSLOG_BIN_INT: {
+			uintmax_t u;
+			if (0 != get_varint(&p, end, &u)) return -1;
+			/* zigzag: 0, 1, 2, 3, ... => 0, -1, 1, -2, ... */
+			if (u & 1) {
+				printf("-%ju", (u >> 1) + 1);
+			} else {
+				printf("%ju", u >> 1);
+			}
+			break;
+		}
+		case ACCESSLOG_BIN_STR: {
+			uintmax_t u;
+			if (0 != get_varint(&p, end, &u)) return -1;
+			if (u > (uintmax_t)(end - p)) return -1;
+			putchar('"');
+			if (json) {
+				print_json_escaped(p, (size_t)u);
+			} else {
+				print_escaped(p, (size_t)u);
+			}
+			putchar('"');
+			p += u;
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+
+	if (json) putchar('}');
+	putchar('\n');
+	return 0;
+}
+
+static int cat_file(FILE *fp, const char *fn, int json) {
+	unsigned char hdr[4];
+	unsigned char *buf = NULL;
+	size_t bufsz = 0;
+	off_t offset = 0;
+	int rc = 0;
+
+	for (;;) {
+		size_t rd = fread(hdr, 1, sizeof(hdr), fp);
+		uint32_t len;
+		if (0 == rd) break;
+		if (rd != sizeof(hdr)) {
+			fprintf(stderr, "%s: truncated record at offset %jd\n", fn, (intmax_t)offset);
+			rc = -1;
+			break;
+		}
+		len = (uint32_t)hdr[0] | (uint32_t)hdr[1] << 8
+		    | (uint32_t)hdr[2] << 16 | (uint32_t)hdr[3] << 24;
+		if (len > bufsz) {
+			unsigned char *nbuf = realloc(buf, len);
+			if (NULL == nbuf) {
+				fprintf(stderr, "%s: out of memory\n", fn);
+				rc = -1;
+				break;
+			}
+			buf = nbuf;
+			bufsz = len;
+		}
+		if (len != fread(buf, 1, len, fp)) {
+			fprintf(stderr, "%s: truncated record at offset %jd\n", fn, (intmax_t)offset);
+			rc = -1;
+			break;
+		}
+		if (0 != print_record(buf, buf + len, json)) {
+			fprintf(stderr, "%s: malformed record at offset %jd\n", fn, (intmax_t)offset);
+			rc = -1;
+			break;
+		}
+		offset += sizeof(hdr) + len;
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		rc = -1;
+	}
+
+	free(buf);
+	return rc;
+}
+
+int main(int argc, char **argv) {
+	int json = 0;
+	int rc = 0;
+	int o;
+
+	while (-1 != (o = getopt(argc, argv, "jh"))) {
+		switch (o) {
+		case 'j':
+			json = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j] [file ...]\n", argv[0]);
+			return 'h' == o ? 0 : 1;
+		}
+	}
+
+	if (optind == argc) {
+		rc = cat_file(stdin, "(stdin)", json);
+	} else {
+		for (; optind < argc; ++optind) {
+			FILE *fp = fopen(argv[optind], "rb");
+			if (NULL == fp) {
+				fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+				rc = -1;
+				continue;
+			}
+			if (0 != cat_file(fp, argv[optind], json)) rc = -1;
+			fclose(fp);
+		}
+	}
+
+	if (0 != fflush(stdout)) rc = -1;
+	return 0 == rc ? 0 : 1;
+}
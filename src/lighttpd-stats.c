@@ -0,0 +1,132 @@
+#include "first.h"
+
+/**
+ * print status counters of a running lighttpd from server.statistics-file,
+ * summed over all workers (as mod_status status.statistics-url), or with -w
+ * for each worker (block 0 is the server process itself)
+ *
+ * usage: lighttpd-stats [-w] file
+ */
+
+#include "status_counter.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "sys-mmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	const char *name;
+	uint32_t slot;
+} stats_entry;
+
+static int stats_entry_cmp(const void *a, const void *b) {
+	const stats_entry *x = a, *y = b;
+	int rc = strcmp(x->name, y->name);
+	return 0 != rc ? rc : (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+static const int64_t * stats_block(const status_counter_hdr *hdr, uint32_t n) {
+	return (const int64_t *)((const char *)hdr + hdr->blocks_offset + n * hdr->block_size);
+}
+
+static int stats_print(const status_counter_hdr *hdr, size_t size, int per_worker) {
+	const status_counter_name *names;
+	stats_entry *entries;
+	uint32_t i, n = 0, used;
+
+	if (size < sizeof(*hdr)
+	    || 0 != memcmp(hdr->magic, STATUS_COUNTER_MAGIC, sizeof(hdr->magic))
+	    || hdr->name_size != sizeof(status_counter_name)
+	    || hdr->names_offset + (uint64_t)hdr->nslots * hdr->name_size > hdr->blocks_offset
+	    || hdr->block_size < (uint64_t)hdr->nslots * sizeof(int64_t)
+	    || hdr->blocks_offset + (uint64_t)hdr->nblocks * hdr->block_size > size) {
+		return -1;
+	}
+
+	names = (const status_counter_name *)((const char *)hdr + hdr->names_offset);
+	used = hdr->used < hdr->nslots ? hdr->used : hdr->nslots;
+	entries = malloc(used * sizeof(*entries) + 1);
+	if (NULL == entries) return -1;
+
+	for (i = 1; i < used; ++i) {
+		if (!names[i].ready || NULL == memchr(names[i].name, '\0', sizeof(names[i].name))) continue;
+		entries[n].name = names[i].name;
+		entries[n].slot = i;
+		++n;
+	}
+	qsort(entries, n, sizeof(*entries), stats_entry_cmp);
+
+	/* the same counter might be registered in more than one slot */
+	for (i = 0; i < n; ) {
+		const char * const name = entries[i].name;
+		uint32_t j, k;
+		if (per_worker) {
+			for (j = 0; j < hdr->nblocks; ++j) {
+				int64_t v = 0;
+				for (k = i; k < n && 0 == strcmp(entries[k].name, name); ++k) {
+					v += stats_block(hdr, j)[entries[k].slot];
+				}
+				printf("%s[%" PRIu32 "]: %" PRId64 "\n", name, j, v);
+			}
+		} else {
+			int64_t v = 0;
+			for (k = i; k < n && 0 == strcmp(entries[k].name, name); ++k) {
+				for (j = 0; j < hdr->nblocks; ++j) v += stats_block(hdr, j)[entries[k].slot];
+			}
+			printf("%s: %" PRId64 "\n", name, v);
+		}
+		while (i < n && 0 == strcmp(entries[i].name, name)) ++i;
+	}
+
+	free(entries);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct stat st;
+	void *p;
+	int per_worker = 0;
+	int fd, o, rc;
+
+	while (-1 != (o = getopt(argc, argv, "wh"))) {
+		switch (o) {
+		case 'w':
+			per_worker = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-w] file\n", argv[0]);
+			return 'h' == o ? 0 : 1;
+		}
+	}
+	if (optind + 1 != argc) {
+		fprintf(stderr, "usage: %s [-w] file\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (-1 == fd || 0 != fstat(fd, &st)) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == p) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	rc = stats_print(p, (size_t)st.st_size, per_worker);
+	if (0 != rc) fprintf(stderr, "%s: not a lighttpd statistics file\n", argv[optind]);
+	munmap(p, (size_t)st.st_size);
+
+	if (0 != fflush(stdout)) rc = -1;
+	return 0 == rc ? 0 : 1;
+}
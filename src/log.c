@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
@@ -20,6 +22,63 @@
 #endif
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#define LOG_ERROR_ASYNC
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#ifdef LOG_ERROR_ASYNC
+/* log_error_write() may also be called from threads other than the server
+ * thread (mod_openssl ssl.handshake-threads) */
+static pthread_mutex_t log_error_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define log_error_lock()   pthread_mutex_lock(&log_error_mutex)
+#define log_error_unlock() pthread_mutex_unlock(&log_error_mutex)
+#else
+#define log_error_lock()   do { } while (0)
+#define log_error_unlock() do { } while (0)
+#endif
+
+/* number of source lines (file.line) tracked for server.errorlog-rate-limit */
+#define LOG_ERROR_LIMIT_SLOTS 64
+
+/* size of queue of writer thread (server.errorlog-async) */
+#define LOG_ERROR_RING_SIZE (256 * 1024)
+
+typedef struct {
+	const char *filename;
+	unsigned int line;
+	unsigned int count;      /* messages logged in second ts */
+	unsigned int suppressed; /* messages suppressed, not yet reported */
+	time_t ts;
+} log_error_limit;
+
+#ifdef LOG_ERROR_ASYNC
+typedef struct {
+	char *buf;          /* queued lines, each terminated by '\n' */
+	size_t rpos;
+	size_t used;
+	unsigned int dropped;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	server *srv;
+} log_error_async;
+#endif
+
+struct log_error_st {
+	buffer *last;            /* last message (without timestamp) */
+	const char *last_file;
+	unsigned int last_line;
+	unsigned int repeated;   /* repeats of last message, not yet reported */
+	buffer *b;               /* for reports of repeated/suppressed messages */
+	log_error_limit limits[LOG_ERROR_LIMIT_SLOTS];
+  #ifdef LOG_ERROR_ASYNC
+	log_error_async *async;
+  #endif
+};
+
 int log_clock_gettime_realtime (struct timespec *ts) {
       #ifdef HAVE_CLOCK_GETTIME
 	return clock_gettime(CLOCK_REALTIME, ts);
@@ -132,7 +191,10 @@ static void log_buffer_append_printf(buffer *out, const char *fmt, va_list ap) {
 	}
 }
 
+/* returns offset of message after timestamp, or -1 if nothing is logged */
 static int log_buffer_prepare(buffer *b, server *srv, const char *filename, unsigned int line) {
+	int offset = 0;
+
 	switch(srv->errorlog_mode) {
 	case ERRORLOG_PIPE:
 	case ERRORLOG_FILE:
@@ -148,6 +210,7 @@ static int log_buffer_prepare(buffer *b, server *srv, const char *filename, unsi
 
 		buffer_copy_buffer(b, srv->ts_debug_str);
 		buffer_append_string_len(b, CONST_STR_LEN(": ("));
+		offset = (int)buffer_string_length(b) - 1;
 		break;
 	case ERRORLOG_SYSLOG:
 		/* syslog is generating its own timestamps */
@@ -160,10 +223,86 @@ static int log_buffer_prepare(buffer *b, server *srv, const char *filename, unsi
 	buffer_append_int(b, line);
 	buffer_append_string_len(b, CONST_STR_LEN(") "));
 
-	return 0;
+	return offset;
+}
+
+#ifdef LOG_ERROR_ASYNC
+
+/* queue line for writer thread; drops line if queue is full */
+static void log_error_async_push(log_error_async *a, const char *s, size_t len) {
+	pthread_mutex_lock(&a->mutex);
+	if (len <= LOG_ERROR_RING_SIZE - a->used) {
+		size_t wpos = (a->rpos + a->used) % LOG_ERROR_RING_SIZE;
+		size_t n = LOG_ERROR_RING_SIZE - wpos;
+		if (n > len) n = len;
+		memcpy(a->buf + wpos, s, n);
+		memcpy(a->buf, s + n, len - n);
+		if (0 == a->used) pthread_cond_signal(&a->cond);
+		a->used += len;
+	} else {
+		++a->dropped;
+	}
+	pthread_mutex_unlock(&a->mutex);
 }
 
-static void log_write(server *srv, buffer *b) {
+static void * log_error_async_writer(void *arg) {
+	log_error_async * const a = arg;
+	server * const srv = a->srv;
+	char * const buf = malloc(LOG_ERROR_RING_SIZE);
+	force_assert(buf);
+
+	pthread_mutex_lock(&a->mutex);
+	for (;;) {
+		size_t len, n;
+
+		if (0 == a->used) {
+			if (a->stop) break;
+			pthread_cond_wait(&a->cond, &a->mutex);
+			continue;
+		}
+
+		/* take all queued lines and write them without holding the lock */
+		len = a->used;
+		n = LOG_ERROR_RING_SIZE - a->rpos;
+		if (n > len) n = len;
+		memcpy(buf, a->buf + a->rpos, n);
+		memcpy(buf + n, a->buf, len - n);
+		a->rpos = (a->rpos + len) % LOG_ERROR_RING_SIZE;
+		a->used = 0;
+		pthread_mutex_unlock(&a->mutex);
+
+		if (ERRORLOG_SYSLOG == srv->errorlog_mode) {
+		  #ifdef HAVE_SYSLOG_H
+			char *s = buf, *e;
+			for (; NULL != (e = memchr(s, '\n', (size_t)(buf + len - s))); s = e + 1) {
+				*e = '\0';
+				syslog(LOG_ERR, "%s", s);
+			}
+		  #endif
+		} else {
+			write_all(srv->errorlog_fd, buf, len);
+		}
+
+		pthread_mutex_lock(&a->mutex);
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	free(buf);
+	return NULL;
+}
+
+#endif
+
+static void log_emit(server *srv, buffer *b) {
+  #ifdef LOG_ERROR_ASYNC
+	log_error_st * const errh = srv->errorlog_st;
+	if (NULL != errh && NULL != errh->async) {
+		buffer_append_string_len(b, CONST_STR_LEN("\n"));
+		log_error_async_push(errh->async, CONST_BUF_LEN(b));
+		return;
+	}
+  #endif
+
 	switch(srv->errorlog_mode) {
 	case ERRORLOG_PIPE:
 	case ERRORLOG_FILE:
@@ -177,17 +316,91 @@ static void log_write(server *srv, buffer *b) {
 	}
 }
 
+static void log_error_repeated(server *srv) {
+	log_error_st * const errh = srv->errorlog_st;
+	buffer * const b = errh->b;
+	if (-1 == log_buffer_prepare(b, srv, errh->last_file, errh->last_line)) return;
+	buffer_append_string_len(b, CONST_STR_LEN("last message repeated "));
+	buffer_append_int(b, errh->repeated);
+	buffer_append_string_len(b, CONST_STR_LEN(" times"));
+	errh->repeated = 0;
+	log_emit(srv, b);
+}
+
+static void log_error_suppressed(server *srv, log_error_limit *l) {
+	buffer * const b = srv->errorlog_st->b;
+	if (-1 == log_buffer_prepare(b, srv, l->filename, l->line)) return;
+	buffer_append_int(b, l->suppressed);
+	buffer_append_string_len(b, CONST_STR_LEN(" messages suppressed by server.errorlog-rate-limit"));
+	l->suppressed = 0;
+	log_emit(srv, b);
+}
+
+/* server.errorlog-rate-limit: max messages per second from one source line;
+ * returns 1 if message is to be suppressed */
+static int log_error_rate_limit(server *srv, const char *filename, unsigned int line) {
+	log_error_st * const errh = srv->errorlog_st;
+	log_error_limit *l;
+	time_t ts;
+
+	if (0 == srv->srvconf.errorlog_rate_limit || NULL == errh) return 0;
+
+	/*(filename is __FILE__; compare pointers, not strings)*/
+	l = errh->limits + (((uintptr_t)filename >> 3) ^ line) % LOG_ERROR_LIMIT_SLOTS;
+	ts = time(NULL);
+	if (l->filename != filename || l->line != line || l->ts != ts) {
+		if (l->suppressed) log_error_suppressed(srv, l);
+		l->filename = filename;
+		l->line = line;
+		l->count = 0;
+		l->ts = ts;
+	}
+
+	if (++l->count <= srv->srvconf.errorlog_rate_limit) return 0;
+
+	++l->suppressed;
+	++srv->errorlog_dropped;
+	return 1;
+}
+
+/* write message; identical consecutive messages are coalesced and logged
+ * as "last message repeated N times" by the next different message or by
+ * log_error_trigger() */
+static void log_write(server *srv, buffer *b, int offset, const char *filename, unsigned int line) {
+	log_error_st * const errh = srv->errorlog_st;
+
+	if (NULL != errh) {
+		const char * const msg = b->ptr + offset;
+		const size_t len = buffer_string_length(b) - (size_t)offset;
+		if (buffer_is_equal_string(errh->last, msg, len)) {
+			++errh->repeated;
+			return;
+		}
+		if (errh->repeated) log_error_repeated(srv);
+		buffer_copy_string_len(errh->last, msg, len);
+		errh->last_file = filename;
+		errh->last_line = line;
+	}
+
+	log_emit(srv, b);
+}
+
 int log_error_write(server *srv, const char *filename, unsigned int line, const char *fmt, ...) {
 	va_list ap;
+	int offset;
 
-	if (-1 == log_buffer_prepare(srv->errorlog_buf, srv, filename, line)) return 0;
+	log_error_lock();
 
-	va_start(ap, fmt);
-	log_buffer_append_printf(srv->errorlog_buf, fmt, ap);
-	va_end(ap);
+	if (!log_error_rate_limit(srv, filename, line)
+	    && -1 != (offset = log_buffer_prepare(srv->errorlog_buf, srv, filename, line))) {
+		va_start(ap, fmt);
+		log_buffer_append_printf(srv->errorlog_buf, fmt, ap);
+		va_end(ap);
 
-	log_write(srv, srv->errorlog_buf);
+		log_write(srv, srv->errorlog_buf, offset, filename, line);
+	}
 
+	log_error_unlock();
 	return 0;
 }
 
@@ -196,10 +409,17 @@ int log_error_write_multiline_buffer(server *srv, const char *filename, unsigned
 	size_t prefix_len;
 	buffer *b = srv->errorlog_buf;
 	char *pos, *end, *current_line;
+	int offset;
 
 	if (buffer_string_is_empty(multiline)) return 0;
 
-	if (-1 == log_buffer_prepare(b, srv, filename, line)) return 0;
+	log_error_lock();
+
+	if (log_error_rate_limit(srv, filename, line)
+	    || -1 == (offset = log_buffer_prepare(b, srv, filename, line))) {
+		log_error_unlock();
+		return 0;
+	}
 
 	va_start(ap, fmt);
 	log_buffer_append_printf(b, fmt, ap);
@@ -220,7 +440,7 @@ int log_error_write_multiline_buffer(server *srv, const char *filename, unsigned
 				buffer_string_set_length(b, prefix_len);
 
 				buffer_append_string_len(b, current_line, pos - current_line);
-				log_write(srv, b);
+				log_write(srv, b, offset, filename, line);
 			}
 			current_line = pos + 1;
 			break;
@@ -229,5 +449,133 @@ int log_error_write_multiline_buffer(server *srv, const char *filename, unsigned
 		}
 	}
 
+	log_error_unlock();
+	return 0;
+}
+
+log_error_st * log_error_st_init(void) {
+	log_error_st * const errh = calloc(1, sizeof(*errh));
+	force_assert(errh);
+	errh->last = buffer_init();
+	errh->b = buffer_init();
+	return errh;
+}
+
+void log_error_st_free(log_error_st *errh) {
+	if (NULL == errh) return;
+  #ifdef LOG_ERROR_ASYNC
+	force_assert(NULL == errh->async); /*(log_error_async_stop() not called)*/
+  #endif
+	buffer_free(errh->last);
+	buffer_free(errh->b);
+	free(errh);
+}
+
+/* once a second: log repeated and suppressed messages not yet reported,
+ * and messages dropped by the writer thread */
+void log_error_trigger(server *srv) {
+	log_error_st * const errh = srv->errorlog_st;
+	if (NULL == errh) return;
+
+	log_error_lock();
+
+	if (errh->repeated) log_error_repeated(srv);
+
+	if (srv->srvconf.errorlog_rate_limit) {
+		size_t i;
+		for (i = 0; i < LOG_ERROR_LIMIT_SLOTS; ++i) {
+			if (errh->limits[i].suppressed) log_error_suppressed(srv, errh->limits+i);
+		}
+	}
+
+	log_error_unlock();
+
+  #ifdef LOG_ERROR_ASYNC
+	if (NULL != errh->async) {
+		log_error_async * const a = errh->async;
+		unsigned int dropped;
+		pthread_mutex_lock(&a->mutex);
+		dropped = a->dropped;
+		a->dropped = 0;
+		pthread_mutex_unlock(&a->mutex);
+		if (dropped) {
+			srv->errorlog_dropped += dropped;
+			log_error_write(srv, __FILE__, __LINE__, "sds",
+				"error log writer too slow;", (int)dropped, "messages dropped");
+		}
+	}
+  #endif
+}
+
+/* start writer thread (server.errorlog-async); in the process which writes
+ * the log, i.e. after daemonizing and after forking server.max-worker */
+int log_error_async_start(server *srv) {
+  #ifdef LOG_ERROR_ASYNC
+	log_error_st * const errh = srv->errorlog_st;
+	log_error_async *a;
+	sigset_t sigs, osigs;
+	int rc;
+
+	if (NULL == errh || NULL != errh->async) return 0;
+	if (ERRORLOG_SYSLOG != srv->errorlog_mode && -1 == srv->errorlog_fd) return 0;
+
+	a = calloc(1, sizeof(*a));
+	force_assert(a);
+	a->buf = malloc(LOG_ERROR_RING_SIZE);
+	force_assert(a->buf);
+	a->srv = srv;
+	pthread_mutex_init(&a->mutex, NULL);
+	pthread_cond_init(&a->cond, NULL);
+
+	/* signals are for the server thread */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_SETMASK, &sigs, &osigs);
+	rc = pthread_create(&a->thread, NULL, log_error_async_writer, a);
+	pthread_sigmask(SIG_SETMASK, &osigs, NULL);
+
+	if (0 != rc) {
+		pthread_cond_destroy(&a->cond);
+		pthread_mutex_destroy(&a->mutex);
+		free(a->buf);
+		free(a);
+		log_error_write(srv, __FILE__, __LINE__, "ss",
+			"starting error log writer thread failed; writing log directly:", strerror(rc));
+		return -1;
+	}
+
+	errh->async = a;
+	return 0;
+  #else
+	log_error_write(srv, __FILE__, __LINE__, "s",
+		"server.errorlog-async is not supported on this platform; writing log directly");
+	return -1;
+  #endif
+}
+
+/* write out queued messages and stop writer thread;
+ * returns 1 if writer thread was running, else 0 */
+int log_error_async_stop(server *srv) {
+  #ifdef LOG_ERROR_ASYNC
+	log_error_st * const errh = srv->errorlog_st;
+	log_error_async *a;
+
+	if (NULL == errh || NULL == (a = errh->async)) return 0;
+
+	pthread_mutex_lock(&a->mutex);
+	a->stop = 1;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->mutex);
+	pthread_join(a->thread, NULL);
+
+	errh->async = NULL;
+	srv->errorlog_dropped += a->dropped;
+	pthread_cond_destroy(&a->cond);
+	pthread_mutex_destroy(&a->mutex);
+	free(a->buf);
+	free(a);
+	return 1;
+  #else
+	UNUSED(srv);
 	return 0;
+  #endif
 }
@@ -14,4 +14,11 @@ ssize_t write_all(int fd, const void* buf, size_t count);
 int log_error_write(server *srv, const char *filename, unsigned int line, const char *fmt, ...);
 int log_error_write_multiline_buffer(server *srv, const char *filename, unsigned int line, buffer *multiline, const char *fmt, ...);
 
+typedef struct log_error_st log_error_st;
+log_error_st * log_error_st_init(void);
+void log_error_st_free(log_error_st *errh);
+void log_error_trigger(server *srv);
+int log_error_async_start(server *srv);
+int log_error_async_stop(server *srv);
+
 #endif
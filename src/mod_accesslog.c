@@ -1,11 +1,15 @@
 #include "first.h"
 
 #include "base.h"
+#include "connections.h"
 #include "fdevent.h"
 #include "log.h"
 #include "buffer.h"
 
 #include "plugin.h"
+#include "status_counter.h"
+
+#include "mod_accesslog.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -21,6 +25,17 @@
 # include <syslog.h>
 #endif
 
+#if defined(HAVE_PTHREAD_H) && defined(__ATOMIC_ACQUIRE)
+#define ACCESSLOG_ASYNC
+#include <pthread.h>
+#include <signal.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 typedef struct {
 	char key;
 	enum {
@@ -56,7 +71,8 @@ typedef struct {
 
 			FORMAT_KEEPALIVE_COUNT,
 			FORMAT_RESPONSE_HEADER,
-			FORMAT_NOTE
+			FORMAT_NOTE,
+			FORMAT_STAGE_TIME_US
 	} type;
 } format_mapping;
 
@@ -102,6 +118,7 @@ static const format_mapping fmap[] =
 	{ 'O', FORMAT_BYTES_OUT },
 
 	{ 'o', FORMAT_RESPONSE_HEADER },
+	{ 'S', FORMAT_STAGE_TIME_US }, /* %{stage}S, see connection_timing() */
 
 	{ '\0', FORMAT_UNSET }
 };
@@ -122,13 +139,44 @@ enum e_optflags_time {
 };
 
 
+typedef struct format_field format_field;
+typedef struct accesslog_req accesslog_req;
+
+enum {
+	ACCESSLOG_VALUE_STR,  /* string */
+	ACCESSLOG_VALUE_ESC,  /* string, escaped in text log */
+	ACCESSLOG_VALUE_INT,  /* integer */
+	ACCESSLOG_VALUE_NONE  /* "-" in text log */
+};
+
+/* value of a format field for the current request */
 typedef struct {
+	const char *ptr;
+	size_t len;  /* (ACCESSLOG_VALUE_INT: min number of digits in text log) */
+	intmax_t n;
+	int type;
+} accesslog_value;
+
+enum {
+	ACCESSLOG_FORMAT_TEXT,
+	ACCESSLOG_FORMAT_JSON,
+	ACCESSLOG_FORMAT_BINARY
+};
+
+/* sets value of field for request; selected by field and opt of the field
+ * when the format is parsed, see accesslog_compile_format() */
+typedef void (*accesslog_field_fn)(accesslog_value *v, const format_field *f, accesslog_req *r);
+
+struct format_field {
 	enum { FIELD_UNSET, FIELD_STRING, FIELD_FORMAT } type;
 
 	buffer *string;
 	int field;
 	int opt;
-} format_field;
+	accesslog_field_fn fn;
+	int key;          /* format-specifier of field logged as JSON/binary, else 0 */
+	buffer *json_key; /* "name":  or  "name:string": */
+};
 
 typedef struct {
 	format_field **ptr;
@@ -146,6 +194,8 @@ typedef struct {
 	unsigned short syslog_level;
 
 	buffer *format;
+	buffer *format_type_str;
+	int format_type;
 
 	time_t last_generated_accesslog_ts;
 	time_t *last_generated_accesslog_ts_ptr;
@@ -153,6 +203,13 @@ typedef struct {
 	buffer *ts_accesslog_str;
 
 	format_fields *parsed_format;
+
+	struct accesslog_ring *ring; /* lines to writer thread (accesslog.async) */
+
+	/* global only */
+	unsigned short async;
+	unsigned int async_buffer_size; /* kbytes of ring per log file */
+	buffer *async_overflow;
 } plugin_config;
 
 typedef struct {
@@ -162,8 +219,21 @@ typedef struct {
 	plugin_config conf;
 
 	buffer *syslog_logbuffer; /* syslog has global buffer. no caching, always written directly */
+
+	struct accesslog_async *async; /* writer thread (accesslog.async) */
+
+	accesslog_value *values; /* field values of current request */
+	size_t nvalues;
 } plugin_data;
 
+struct accesslog_req {
+	server *srv;
+	connection *con;
+	plugin_config *conf;
+	struct timespec ts; /* current time (high precision), if used */
+	int newts;          /* strftime timestamp regenerated */
+};
+
 INIT_FUNC(mod_accesslog_init) {
 	plugin_data *p;
 
@@ -180,63 +250,1049 @@ static void accesslog_write_all(server *srv, const buffer *filename, int fd, con
 	}
 }
 
-static void accesslog_append_escaped(buffer *dest, buffer *str) {
-	char *ptr, *start, *end;
+#ifdef ACCESSLOG_ASYNC
+
+/*
+ * accesslog.async: formatted lines are copied into a ring buffer per log file
+ * and written by a separate writer thread in large batches, so that a slow
+ * disk or a stalled piped logger does not stall the server.
+ *
+ * Each ring has a single producer (the server, which only advances head) and
+ * a single consumer (the writer thread, which only advances tail).  head and
+ * tail count bytes and never wrap; (x & (size-1)) is the offset into buf.
+ * The mutex is held by the writer thread except while it writes or sleeps;
+ * it protects fd_next and stop, and is needed to wait on the condition vars.
+ * The server does not take it for a line which fits in the ring.
+ */
+struct accesslog_ring {
+	char *buf;
+	size_t size; /* power of 2 */
+	size_t head;
+	size_t tail;
+	int fd;
+	int fd_next;     /* fd of cycled log; writer switches to it and closes fd */
+	int write_errno; /* set by writer on write error; reported by server */
+	size_t dropped;  /* lines dropped since last report */
+	struct accesslog_ring *next;
+};
+
+struct accesslog_async {
+	struct accesslog_ring *rings;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_data;  /* writer waits for lines */
+	pthread_cond_t cond_space; /* server waits for space in full ring */
+	int started; /* 1 writer thread running in this process, -1 failed */
+	int stop;
+	int drop;    /* drop lines instead of waiting if ring is full */
+	int dropped_total;
+};
+
+static void accesslog_ring_writev(struct accesslog_ring *r, int fd, struct iovec *iov, int iovcnt) {
+	while (iovcnt) {
+		ssize_t wr = writev(fd, iov, iovcnt);
+		if (wr < 0) {
+			if (errno == EINTR) continue;
+			/* lines are lost; the server reports the error */
+			__atomic_store_n(&r->write_errno, errno, __ATOMIC_RELAXED);
+			return;
+		}
+		while (iovcnt && (size_t)wr >= iov->iov_len) {
+			wr -= (ssize_t)iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + wr;
+			iov->iov_len -= (size_t)wr;
+		}
+	}
+}
+
+/* (called by writer thread with mutex held, which is released while writing)
+ * returns 1 if anything was written */
+static int accesslog_ring_drain(struct accesslog_ring *r, pthread_mutex_t *mutex) {
+	const size_t mask = r->size - 1;
+	const size_t tail = r->tail;
+	size_t head, off;
+	struct iovec iov[2];
+	int iovcnt = 1;
+	int fd;
+
+	if (-1 != r->fd_next) {
+		if (-1 != r->fd) close(r->fd);
+		r->fd = r->fd_next;
+		r->fd_next = -1;
+	}
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if (head == tail) return 0;
+
+	off = tail & mask;
+	iov[0].iov_base = r->buf + off;
+	iov[0].iov_len = head - tail;
+	if (off + (head - tail) > r->size) {
+		iov[0].iov_len = r->size - off;
+		iov[1].iov_base = r->buf;
+		iov[1].iov_len = (head - tail) - iov[0].iov_len;
+		iovcnt = 2;
+	}
+	fd = r->fd;
+
+	pthread_mutex_unlock(mutex);
+	accesslog_ring_writev(r, fd, iov, iovcnt);
+	pthread_mutex_lock(mutex);
+
+	__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void * accesslog_async_writer(void *arg) {
+	struct accesslog_async * const a = arg;
+
+	pthread_mutex_lock(&a->mutex);
+	for (;;) {
+		struct accesslog_ring *r;
+		struct timespec ts;
+		int n = 0;
+
+		for (r = a->rings; r; r = r->next) n |= accesslog_ring_drain(r, &a->mutex);
+		if (n) {
+			pthread_cond_broadcast(&a->cond_space);
+			continue;
+		}
+		if (a->stop) break;
+
+		/* the server signals only once a ring starts to fill up,
+		 * so wake up at least once a second to write out the rest */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&a->cond_data, &a->mutex, &ts);
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	return NULL;
+}
+
+static struct accesslog_async * accesslog_async_init(int drop) {
+	struct accesslog_async * const a = calloc(1, sizeof(*a));
+	force_assert(a);
+	pthread_mutex_init(&a->mutex, NULL);
+	pthread_cond_init(&a->cond_data, NULL);
+	pthread_cond_init(&a->cond_space, NULL);
+	a->drop = drop;
+	return a;
+}
+
+static struct accesslog_ring * accesslog_async_ring(struct accesslog_async *a, size_t size, int fd) {
+	struct accesslog_ring * const r = calloc(1, sizeof(*r));
+	force_assert(r);
+	r->buf = malloc(size);
+	force_assert(r->buf);
+	r->size = size;
+	r->fd = fd;
+	r->fd_next = -1;
+	r->next = a->rings;
+	a->rings = r;
+	return r;
+}
+
+/* start writer thread on first use, i.e. in the process which writes the log
+ * (after daemonizing and after forking server.max-worker) */
+static int accesslog_async_start(server *srv, struct accesslog_async *a) {
+	sigset_t sigs, osigs;
+	int rc;
+
+	/* signals are for the server thread */
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_SETMASK, &sigs, &osigs);
+	rc = pthread_create(&a->thread, NULL, accesslog_async_writer, a);
+	pthread_sigmask(SIG_SETMASK, &osigs, NULL);
+
+	if (0 != rc) {
+		log_error_write(srv, __FILE__, __LINE__, "ss",
+			"starting access log writer thread failed; writing log directly:", strerror(rc));
+		return (a->started = -1);
+	}
+
+	return (a->started = 1);
+}
+
+static void accesslog_async_push(struct accesslog_async *a, struct accesslog_ring *r, const char *s, size_t len) {
+	const size_t mask = r->size - 1;
+	const size_t head = r->head;
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t off, n;
+
+	if (len > r->size - (head - tail)) {
+		if (a->drop || len > r->size) {
+			++r->dropped;
+			return;
+		}
+		pthread_mutex_lock(&a->mutex);
+		while (len > r->size - (head - (tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)))) {
+			pthread_cond_signal(&a->cond_data);
+			pthread_cond_wait(&a->cond_space, &a->mutex);
+		}
+		pthread_mutex_unlock(&a->mutex);
+	}
+
+	off = head & mask;
+	n = r->size - off;
+	if (n >= len) {
+		memcpy(r->buf + off, s, len);
+	} else {
+		memcpy(r->buf + off, s, n);
+		memcpy(r->buf, s + n, len - n);
+	}
+	__atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+
+	/* wake the writer as the ring fills past 1/8 */
+	if (head - tail < (r->size >> 3) && head + len - tail >= (r->size >> 3)) {
+		pthread_cond_signal(&a->cond_data);
+	}
+}
+
+/* SIGHUP: hand newly opened log to writer thread, which closes the old one */
+static int accesslog_async_cycle(struct accesslog_async *a, struct accesslog_ring *r, const char *logger) {
+	const int fd = fdevent_open_logger(logger);
+	if (-1 == fd) return -1;
+	pthread_mutex_lock(&a->mutex);
+	if (-1 != r->fd_next) close(r->fd_next);
+	r->fd_next = fd;
+	pthread_mutex_unlock(&a->mutex);
+	pthread_cond_signal(&a->cond_data);
+	return fd;
+}
+
+/* stop writer thread after it wrote out all rings */
+static void accesslog_async_stop(struct accesslog_async *a) {
+	struct accesslog_ring *r;
+
+	if (1 == a->started) {
+		pthread_mutex_lock(&a->mutex);
+		a->stop = 1;
+		pthread_cond_signal(&a->cond_data);
+		pthread_mutex_unlock(&a->mutex);
+		pthread_join(a->thread, NULL);
+		a->started = 0;
+	}
+
+	for (r = a->rings; r; r = r->next) {
+		if (-1 != r->fd_next) {
+			if (-1 != r->fd) close(r->fd);
+			r->fd = r->fd_next;
+			r->fd_next = -1;
+		}
+	}
+}
+
+static void accesslog_async_free(struct accesslog_async *a) {
+	struct accesslog_ring *r;
+	while ((r = a->rings)) {
+		a->rings = r->next;
+		free(r->buf);
+		free(r);
+	}
+	pthread_cond_destroy(&a->cond_space);
+	pthread_cond_destroy(&a->cond_data);
+	pthread_mutex_destroy(&a->mutex);
+	free(a);
+}
+
+/* report write errors and dropped lines of writer thread */
+static void accesslog_async_report(server *srv, plugin_data *p) {
+	struct accesslog_async * const a = p->async;
+	size_t i;
+
+	for (i = 0; i < srv->config_context->used; i++) {
+		plugin_config *s = p->config_storage[i];
+		struct accesslog_ring * const r = s->ring;
+		int err;
+
+		if (NULL == r) continue;
+
+		err = __atomic_exchange_n(&r->write_errno, 0, __ATOMIC_RELAXED);
+		if (err) {
+			log_error_write(srv, __FILE__, __LINE__, "sbs",
+				"writing access log entry failed:", s->access_logfile, strerror(err));
+		}
+
+		if (r->dropped) {
+			log_error_write(srv, __FILE__, __LINE__, "sbsd",
+				"access log buffer full:", s->access_logfile, "dropped lines:", (int)r->dropped);
+			a->dropped_total += (int)r->dropped;
+			r->dropped = 0;
+			status_counter_set(srv, CONST_STR_LEN("accesslog.dropped-lines"), a->dropped_total);
+		}
+	}
+}
+
+#endif
+
+/* length of the prefix of s[0..len) which is logged as-is,
+ * i.e. printable ASCII other than '"' and '\\' */
+static size_t accesslog_scan_safe(const char *s, size_t len) {
+	size_t i = 0;
+      #if defined(__SSE2__)
+	/* 16 bytes at a time: 0x1f < c < 0x7f (signed compare: c >= 0x80 is < 0) */
+	const __m128i lo = _mm_set1_epi8(0x1f);
+	const __m128i hi = _mm_set1_epi8(0x7f);
+	const __m128i dq = _mm_set1_epi8('"');
+	const __m128i bs = _mm_set1_epi8('\\');
+	for (; i + 16 <= len; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		const __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi));
+		const __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(x, dq), _mm_cmpeq_epi8(x, bs));
+		const int m = _mm_movemask_epi8(_mm_andnot_si128(bad, ok));
+		if (m != 0xffff) return i + (size_t)__builtin_ctz(~(unsigned int)m);
+	}
+      #endif
+	for (; i < len; ++i) {
+		const unsigned char c = (unsigned char)s[i];
+		if (c < ' ' || c > '~' || c == '"' || c == '\\') break;
+	}
+	return i;
+}
+
+/* copy s[0..len) to d, which must have space for 4*len bytes; returns end */
+static char * accesslog_escape(char *d, const char *s, size_t len) {
+	const char * const end = s + len;
 
 	/* replaces non-printable chars with \xHH where HH is the hex representation of the byte */
 	/* exceptions: " => \", \ => \\, whitespace chars => \n \t etc. */
-	if (buffer_string_is_empty(str)) return;
-	buffer_string_prepare_append(dest, buffer_string_length(str));
+	for (;;) {
+		const size_t n = accesslog_scan_safe(s, (size_t)(end - s));
+		memcpy(d, s, n);
+		d += n;
+		s += n;
+		if (s == end) return d;
+
+		*d++ = '\\';
+		switch (*s) {
+		case '"':  *d++ = '"';  break;
+		case '\\': *d++ = '\\'; break;
+		case '\b': *d++ = 'b';  break;
+		case '\n': *d++ = 'n';  break;
+		case '\r': *d++ = 'r';  break;
+		case '\t': *d++ = 't';  break;
+		case '\v': *d++ = 'v';  break;
+		default: {
+				/* non printable char => \xHH */
+				const unsigned char c = (unsigned char)*s;
+				*d++ = 'x';
+				*d++ = "0123456789ABCDEF"[c >> 4];
+				*d++ = "0123456789ABCDEF"[c & 0xF];
+			}
+			break;
+		}
+		++s;
+	}
+}
 
-	for (ptr = start = str->ptr, end = str->ptr + buffer_string_length(str); ptr < end; ptr++) {
-		unsigned char const c = (unsigned char) *ptr;
-		if (c >= ' ' && c <= '~' && c != '"' && c != '\\') {
-			/* nothing to change, add later as one block */
-		} else {
-			/* copy previous part */
-			if (start < ptr) {
-				buffer_append_string_len(dest, start, ptr - start);
+/* length of the prefix of s[0..len) which is copied to JSON as-is,
+ * i.e. other than control chars, '"' and '\\' */
+static size_t accesslog_scan_json_safe(const char *s, size_t len) {
+	size_t i = 0;
+      #if defined(__SSE2__)
+	/* 16 bytes at a time: c > 0x1f (unsigned compare) */
+	const __m128i ctl = _mm_set1_epi8(0x1f);
+	const __m128i dq = _mm_set1_epi8('"');
+	const __m128i bs = _mm_set1_epi8('\\');
+	for (; i + 16 <= len; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		const __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x),
+		                    _mm_or_si128(_mm_cmpeq_epi8(x, dq), _mm_cmpeq_epi8(x, bs)));
+		const int m = _mm_movemask_epi8(bad);
+		if (m) return i + (size_t)__builtin_ctz((unsigned int)m);
+	}
+      #endif
+	for (; i < len; ++i) {
+		const unsigned char c = (unsigned char)s[i];
+		if (c < ' ' || c == '"' || c == '\\') break;
+	}
+	return i;
+}
+
+/* copy s[0..len) to d as contents of JSON string, d must have space for
+ * 6*len bytes; returns end.  (bytes >= 0x80 are copied as-is and are not
+ * checked to be valid UTF-8) */
+static char * accesslog_escape_json(char *d, const char *s, size_t len) {
+	const char * const end = s + len;
+
+	for (;;) {
+		const size_t n = accesslog_scan_json_safe(s, (size_t)(end - s));
+		memcpy(d, s, n);
+		d += n;
+		s += n;
+		if (s == end) return d;
+
+		*d++ = '\\';
+		switch (*s) {
+		case '"':  *d++ = '"';  break;
+		case '\\': *d++ = '\\'; break;
+		case '\b': *d++ = 'b';  break;
+		case '\n': *d++ = 'n';  break;
+		case '\r': *d++ = 'r';  break;
+		case '\t': *d++ = 't';  break;
+		default: {
+				/* other control chars => \u00HH */
+				const unsigned char c = (unsigned char)*s;
+				*d++ = 'u';
+				*d++ = '0';
+				*d++ = '0';
+				*d++ = "0123456789ABCDEF"[c >> 4];
+				*d++ = "0123456789ABCDEF"[c & 0xF];
 			}
-			start = ptr + 1;
+			break;
+		}
+		++s;
+	}
+}
 
-			switch (c) {
-			case '"':
-				BUFFER_APPEND_STRING_CONST(dest, "\\\"");
-				break;
-			case '\\':
-				BUFFER_APPEND_STRING_CONST(dest, "\\\\");
-				break;
-			case '\b':
-				BUFFER_APPEND_STRING_CONST(dest, "\\b");
-				break;
-			case '\n':
-				BUFFER_APPEND_STRING_CONST(dest, "\\n");
-				break;
-			case '\r':
-				BUFFER_APPEND_STRING_CONST(dest, "\\r");
-				break;
-			case '\t':
-				BUFFER_APPEND_STRING_CONST(dest, "\\t");
+/* append n with at least width digits to d, which must have space for
+ * LI_ITOSTRING_LENGTH bytes; returns end */
+static char * accesslog_append_int(char *d, intmax_t n, size_t width) {
+	char buf[LI_ITOSTRING_LENGTH];
+	char * const end = buf + sizeof(buf);
+	char *ptr = end;
+	uintmax_t u = n < 0 ? -(uintmax_t)n : (uintmax_t)n;
+	do { *--ptr = (char)('0' + u % 10); } while (u /= 10);
+	while ((size_t)(end - ptr) < width) *--ptr = '0';
+	if (n < 0) *--ptr = '-';
+	memcpy(d, ptr, (size_t)(end - ptr));
+	return d + (end - ptr);
+}
+
+/* append u as varint (binary log) to d, which must have space for 10 bytes */
+static char * accesslog_append_varint(char *d, uintmax_t u) {
+	while (u >= 0x80) {
+		*d++ = (char)(u | 0x80);
+		u >>= 7;
+	}
+	*d++ = (char)u;
+	return d;
+}
+
+static void accesslog_value_str(accesslog_value *v, const char *s, size_t len, int type) {
+	v->ptr = s;
+	v->len = len;
+	v->type = type;
+}
+
+static void accesslog_value_buf(accesslog_value *v, const buffer *b, int type) {
+	accesslog_value_str(v, b->ptr, buffer_string_length(b), type);
+}
+
+static void accesslog_value_int(accesslog_value *v, intmax_t n) {
+	v->n = n;
+	v->len = 0;
+	v->type = ACCESSLOG_VALUE_INT;
+}
+
+static void accesslog_value_dash(accesslog_value *v) {
+	accesslog_value_str(v, CONST_STR_LEN("-"), ACCESSLOG_VALUE_NONE);
+}
+
+static const struct timespec * accesslog_req_ts(accesslog_req *r) {
+	if (0 == r->ts.tv_sec) log_clock_gettime_realtime(&r->ts);
+	return &r->ts;
+}
+
+static void accesslog_field_none(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	UNUSED(r);
+	accesslog_value_str(v, "", 0, ACCESSLOG_VALUE_STR);
+}
+
+static void accesslog_field_string(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(r);
+	accesslog_value_buf(v, f->string, ACCESSLOG_VALUE_STR);
+}
+
+static void accesslog_field_percent(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	UNUSED(r);
+	accesslog_value_str(v, CONST_STR_LEN("%"), ACCESSLOG_VALUE_STR);
+}
+
+static void accesslog_field_dash(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	UNUSED(r);
+	accesslog_value_dash(v);
+}
+
+static void accesslog_field_timestamp_sec(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	accesslog_value_int(v, (intmax_t)((!(f->opt & FORMAT_FLAG_TIME_BEGIN)) ? r->srv->cur_ts : r->con->request_start));
+}
+
+static void accesslog_field_timestamp_hp(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const struct timespec * const ts = (!(f->opt & FORMAT_FLAG_TIME_BEGIN))
+	  ? accesslog_req_ts(r)
+	  : &r->con->request_start_hp;
+	off_t t = (off_t)ts->tv_sec; /*(expected to be 64-bit since large file support enabled)*/
+	const long ns = ts->tv_nsec;
+	if (f->opt & FORMAT_FLAG_TIME_MSEC) {
+		t *= 1000;
+		t += (ns + 999999) / 1000000; /* ceil */
+	} else if (f->opt & FORMAT_FLAG_TIME_USEC) {
+		t *= 1000000;
+		t += (ns + 999) / 1000; /* ceil */
+	} else {/*(f->opt & FORMAT_FLAG_TIME_NSEC)*/
+		t *= 1000000000;
+		t += ns;
+	}
+	accesslog_value_int(v, (intmax_t)t);
+}
+
+static void accesslog_field_timestamp_frac(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	long ns = (!(f->opt & FORMAT_FLAG_TIME_BEGIN))
+	  ? accesslog_req_ts(r)->tv_nsec
+	  : r->con->request_start_hp.tv_nsec;
+	size_t n;
+	/*assert(t < 1000000000);*/
+	/* (ceil, but not up to the next second, which is a different field) */
+	if (f->opt & FORMAT_FLAG_TIME_MSEC_FRAC) {
+		ns +=  999999; /* ceil */
+		ns /= 1000000;
+		if (ns > 999) ns = 999;
+		n = 3;
+	} else if (f->opt & FORMAT_FLAG_TIME_USEC_FRAC) {
+		ns +=  999; /* ceil */
+		ns /= 1000;
+		if (ns > 999999) ns = 999999;
+		n = 6;
+	} else {/*(f->opt & FORMAT_FLAG_TIME_NSEC_FRAC)*/
+		n = 9;
+	}
+	accesslog_value_int(v, ns);
+	v->len = n;
+}
+
+static void accesslog_field_timestamp_strftime(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	plugin_config * const conf = r->conf;
+	buffer * const ts_str = conf->ts_accesslog_str;
+	struct tm *tmptr;
+	time_t t;
+      #if defined(HAVE_STRUCT_TM_GMTOFF)
+      # ifdef HAVE_LOCALTIME_R
+	struct tm tm;
+      # endif /* HAVE_LOCALTIME_R */
+      #else /* HAVE_STRUCT_TM_GMTOFF */
+      # ifdef HAVE_GMTIME_R
+	struct tm tm;
+      # endif /* HAVE_GMTIME_R */
+      #endif /* HAVE_STRUCT_TM_GMTOFF */
+
+	/* cache the generated timestamp (only if ! FORMAT_FLAG_TIME_BEGIN) */
+	if (!(f->opt & FORMAT_FLAG_TIME_BEGIN)) {
+		if (r->srv->cur_ts == *(conf->last_generated_accesslog_ts_ptr)) {
+			accesslog_value_buf(v, ts_str, ACCESSLOG_VALUE_STR);
+			return;
+		}
+		t = *(conf->last_generated_accesslog_ts_ptr) = r->srv->cur_ts;
+		r->newts = 1;
+	} else {
+		t = r->con->request_start;
+	}
+
+      #if defined(HAVE_STRUCT_TM_GMTOFF)
+      # ifdef HAVE_LOCALTIME_R
+	tmptr = localtime_r(&t, &tm);
+      # else /* HAVE_LOCALTIME_R */
+	tmptr = localtime(&t);
+      # endif /* HAVE_LOCALTIME_R */
+      #else /* HAVE_STRUCT_TM_GMTOFF */
+      # ifdef HAVE_GMTIME_R
+	tmptr = gmtime_r(&t, &tm);
+      # else /* HAVE_GMTIME_R */
+	tmptr = gmtime(&t);
+      # endif /* HAVE_GMTIME_R */
+      #endif /* HAVE_STRUCT_TM_GMTOFF */
+
+	buffer_string_prepare_copy(ts_str, 255);
+
+	if (buffer_string_is_empty(f->string)) {
+	      #if defined(HAVE_STRUCT_TM_GMTOFF)
+		long scd, hrs, min;
+		buffer_append_strftime(ts_str, "[%d/%b/%Y:%H:%M:%S ", tmptr);
+		buffer_append_string_len(ts_str, tmptr->tm_gmtoff >= 0 ? "+" : "-", 1);
+
+		scd = labs(tmptr->tm_gmtoff);
+		hrs = scd / 3600;
+		min = (scd % 3600) / 60;
+
+		/* hours */
+		if (hrs < 10) buffer_append_string_len(ts_str, CONST_STR_LEN("0"));
+		buffer_append_int(ts_str, hrs);
+
+		if (min < 10) buffer_append_string_len(ts_str, CONST_STR_LEN("0"));
+		buffer_append_int(ts_str, min);
+		buffer_append_string_len(ts_str, CONST_STR_LEN("]"));
+	      #else
+		buffer_append_strftime(ts_str, "[%d/%b/%Y:%H:%M:%S +0000]", tmptr);
+	      #endif /* HAVE_STRUCT_TM_GMTOFF */
+	} else {
+		buffer_append_strftime(ts_str, f->string->ptr, tmptr);
+	}
+
+	accesslog_value_buf(v, ts_str, ACCESSLOG_VALUE_STR);
+}
+
+static void accesslog_field_time_used_sec(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_int(v, (intmax_t)(r->srv->cur_ts - r->con->request_start));
+}
+
+static void accesslog_field_time_used_hp(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const struct timespec * const bs = &r->con->request_start_hp;
+	const struct timespec * const ts = accesslog_req_ts(r);
+	off_t tdiff; /*(expected to be 64-bit since large file support enabled)*/
+	tdiff = (off_t)(ts->tv_sec - bs->tv_sec)*1000000000 + (ts->tv_nsec - bs->tv_nsec);
+	if (tdiff <= 0) {
+		/* sanity check for time moving backwards
+		 * (daylight savings adjustment or leap seconds or ?) */
+		tdiff  = -1;
+	} else if (f->opt & FORMAT_FLAG_TIME_MSEC) {
+		tdiff +=  999999; /* ceil */
+		tdiff /= 1000000;
+	} else if (f->opt & FORMAT_FLAG_TIME_USEC) {
+		tdiff +=  999; /* ceil */
+		tdiff /= 1000;
+	} /* else (f->opt & FORMAT_FLAG_TIME_NSEC) */
+	accesslog_value_int(v, (intmax_t)tdiff);
+}
+
+static void accesslog_field_remote_addr(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_buf(v, r->con->dst_addr_buf, ACCESSLOG_VALUE_STR);
+}
+
+static void accesslog_field_remote_user(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	data_string *ds;
+	UNUSED(f);
+	if (NULL != (ds = (data_string *)array_get_element(r->con->environment, "REMOTE_USER")) && !buffer_string_is_empty(ds->value)) {
+		accesslog_value_buf(v, ds->value, ACCESSLOG_VALUE_ESC);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_request_line(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_buf(v, r->con->request.request_line, ACCESSLOG_VALUE_ESC);
+}
+
+static void accesslog_field_status(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_int(v, r->con->http_status);
+}
+
+static void accesslog_field_bytes_out_no_header(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	connection * const con = r->con;
+	UNUSED(f);
+	if (con->bytes_written > 0) {
+		accesslog_value_int(v,
+			con->bytes_written - con->bytes_header <= 0 ? 0 : con->bytes_written - con->bytes_header);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_header_value(accesslog_value *v, array *a, const buffer *k) {
+	data_string *ds;
+	if (NULL != (ds = (data_string *)array_get_element_klen(a, CONST_BUF_LEN(k)))) {
+		accesslog_value_buf(v, ds->value, ACCESSLOG_VALUE_ESC);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_header(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	accesslog_field_header_value(v, r->con->request.headers, f->string);
+}
+
+static void accesslog_field_response_header(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	accesslog_field_header_value(v, r->con->response.headers, f->string);
+}
+
+static void accesslog_field_env(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	accesslog_field_header_value(v, r->con->environment, f->string);
+}
+
+static void accesslog_field_filename(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (!buffer_string_is_empty(r->con->physical.path)) {
+		accesslog_value_buf(v, r->con->physical.path, ACCESSLOG_VALUE_STR);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_bytes_out(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (r->con->bytes_written > 0) {
+		accesslog_value_int(v, r->con->bytes_written);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_bytes_in(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (r->con->bytes_read > 0) {
+		accesslog_value_int(v, r->con->bytes_read);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_server_name(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (!buffer_string_is_empty(r->con->server_name)) {
+		accesslog_value_buf(v, r->con->server_name, ACCESSLOG_VALUE_STR);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_http_host(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (!buffer_string_is_empty(r->con->uri.authority)) {
+		accesslog_value_buf(v, r->con->uri.authority, ACCESSLOG_VALUE_ESC);
+	} else {
+		accesslog_value_dash(v);
+	}
+}
+
+static void accesslog_field_request_protocol(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_str(v,
+		r->con->request.http_version == HTTP_VERSION_1_1 ? "HTTP/1.1" : "HTTP/1.0", 8, 0);
+}
+
+static void accesslog_field_request_method(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const char * const m = get_http_method_name(r->con->request.http_method);
+	UNUSED(f);
+	accesslog_value_str(v, m ? m : "", m ? strlen(m) : 0, ACCESSLOG_VALUE_STR);
+}
+
+/* (perf: not using getsockname() and inet_ntop_cache_get_ip())
+ * (still useful if admin has configured explicit listen IPs) */
+static const char * accesslog_srv_token_colon(const buffer *srvtoken) {
+	return (srvtoken->ptr[0] == '[')
+	  ? strstr(srvtoken->ptr, "]:")
+	  : strchr(srvtoken->ptr, ':');
+}
+
+static void accesslog_field_local_addr(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const buffer * const srvtoken = r->con->srv_socket->srv_token;
+	const char * const colon = accesslog_srv_token_colon(srvtoken);
+	UNUSED(f);
+	if (colon) {
+		accesslog_value_str(v, srvtoken->ptr, (size_t)(colon - srvtoken->ptr), ACCESSLOG_VALUE_STR);
+	} else {
+		accesslog_value_buf(v, srvtoken, ACCESSLOG_VALUE_STR);
+	}
+}
+
+static void accesslog_field_server_port(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const buffer * const srvtoken = r->con->srv_socket->srv_token;
+	const char * const colon = accesslog_srv_token_colon(srvtoken);
+	UNUSED(f);
+	if (colon) {
+		accesslog_value_str(v, colon+1, strlen(colon+1), ACCESSLOG_VALUE_STR);
+	} else {
+		accesslog_value_int(v, r->srv->srvconf.port);
+	}
+}
+
+static void accesslog_field_query_string(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_buf(v, r->con->uri.query, ACCESSLOG_VALUE_ESC);
+}
+
+static void accesslog_field_url(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_buf(v, r->con->uri.path_raw, ACCESSLOG_VALUE_ESC);
+}
+
+static void accesslog_field_connection_status(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	if (r->con->state == CON_STATE_RESPONSE_END) {
+		accesslog_value_str(v, 0 == r->con->keep_alive ? "-" : "+", 1, ACCESSLOG_VALUE_STR);
+	} else { /* CON_STATE_ERROR */
+		accesslog_value_str(v, CONST_STR_LEN("X"), ACCESSLOG_VALUE_STR);
+	}
+}
+
+static void accesslog_field_keepalive_count(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	UNUSED(f);
+	accesslog_value_int(v, r->con->request_count > 1 ? (intmax_t)(r->con->request_count-1) : 0);
+}
+
+static void accesslog_field_stage_time(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	const int64_t usec = connection_timing_usec(r->con, (con_timing_t)f->opt);
+	if (usec >= 0) {
+		accesslog_value_int(v, (intmax_t)usec);
+	} else {
+		accesslog_value_dash(v); /* stage not reached */
+	}
+}
+
+static void accesslog_field_cookie(accesslog_value *v, const format_field *f, accesslog_req *r) {
+	data_string * const ds = http_header_request_get(r->con, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie"));
+	accesslog_value_str(v, "", 0, ACCESSLOG_VALUE_STR);
+	if (NULL != ds) {
+		const char *str = ds->value->ptr;
+		const size_t len = buffer_string_length(f->string);
+		do {
+			while (*str == ' ' || *str == '\t') ++str;
+			if (0 == strncmp(str, f->string->ptr, len) && str[len] == '=') {
+				const char * const val = str+len+1;
+				for (str = val; *str != '\0' && *str != ';'; ++str) ;
+				if (str == val) break;
+				do { --str; } while (str > val && (*str == ' ' || *str == '\t'));
+				accesslog_value_str(v, val, (size_t)(str - val + 1), ACCESSLOG_VALUE_ESC);
 				break;
-			case '\v':
-				BUFFER_APPEND_STRING_CONST(dest, "\\v");
+			} else {
+				do { ++str; } while (*str != ' ' && *str != '\t' && *str != '\0');
+			}
+			while (*str == ' ' || *str == '\t') ++str;
+		} while (*str++ == ';');
+	}
+}
+
+static void accesslog_append_text(buffer *b, const format_fields *ff, const accesslog_value *values) {
+	size_t j, len = 1; /*('\n')*/
+	char *d, *d0;
+
+	for (j = 0; j < ff->used; j++) {
+		const accesslog_value * const v = values + j;
+		switch (v->type) {
+		case ACCESSLOG_VALUE_STR:  len += v->len; break;
+		case ACCESSLOG_VALUE_ESC:  len += v->len * 4; break;
+		case ACCESSLOG_VALUE_INT:  len += LI_ITOSTRING_LENGTH; break;
+		default:                   len += 1; break;
+		}
+	}
+
+	d = d0 = buffer_string_prepare_append(b, len);
+	for (j = 0; j < ff->used; j++) {
+		const accesslog_value * const v = values + j;
+		switch (v->type) {
+		case ACCESSLOG_VALUE_STR:
+			memcpy(d, v->ptr, v->len);
+			d += v->len;
+			break;
+		case ACCESSLOG_VALUE_ESC:
+			d = accesslog_escape(d, v->ptr, v->len);
+			break;
+		case ACCESSLOG_VALUE_INT:
+			d = accesslog_append_int(d, v->n, v->len);
+			break;
+		default:
+			*d++ = '-';
+			break;
+		}
+	}
+	buffer_commit(b, (size_t)(d - d0));
+}
+
+/* {"name":value,...} of the fields, without the literal strings of the format */
+static void accesslog_append_json(buffer *b, const format_fields *ff, const accesslog_value *values) {
+	size_t j, len = 3; /*('{' '}' '\n')*/
+	char *d, *d0;
+
+	for (j = 0; j < ff->used; j++) {
+		const format_field * const f = ff->ptr[j];
+		const accesslog_value * const v = values + j;
+		if (!f->key) continue;
+		len += 1 + buffer_string_length(f->json_key);
+		switch (v->type) {
+		case ACCESSLOG_VALUE_STR:
+		case ACCESSLOG_VALUE_ESC:  len += 2 + v->len * 6; break;
+		case ACCESSLOG_VALUE_INT:  len += LI_ITOSTRING_LENGTH; break;
+		default:                   len += 4; break;
+		}
+	}
+
+	d = d0 = buffer_string_prepare_append(b, len);
+	*d++ = '{';
+	for (j = 0; j < ff->used; j++) {
+		const format_field * const f = ff->ptr[j];
+		const accesslog_value * const v = values + j;
+		if (!f->key) continue;
+		if (d - d0 > 1) *d++ = ',';
+		memcpy(d, f->json_key->ptr, buffer_string_length(f->json_key));
+		d += buffer_string_length(f->json_key);
+		switch (v->type) {
+		case ACCESSLOG_VALUE_STR:
+		case ACCESSLOG_VALUE_ESC:
+			*d++ = '"';
+			d = accesslog_escape_json(d, v->ptr, v->len);
+			*d++ = '"';
+			break;
+		case ACCESSLOG_VALUE_INT:
+			d = accesslog_append_int(d, v->n, 0);
+			break;
+		default:
+			memcpy(d, "null", 4);
+			d += 4;
+			break;
+		}
+	}
+	*d++ = '}';
+	buffer_commit(b, (size_t)(d - d0));
+}
+
+/* binary record of the fields (see mod_accesslog.h) */
+static void accesslog_append_binary(buffer *b, const format_fields *ff, const accesslog_value *values) {
+	size_t j, len = 4;
+	uint32_t rlen;
+	char *d, *d0;
+
+	for (j = 0; j < ff->used; j++) {
+		const format_field * const f = ff->ptr[j];
+		const accesslog_value * const v = values + j;
+		if (!f->key) continue;
+		len += 3 + 255 + 10;
+		if (v->type == ACCESSLOG_VALUE_STR || v->type == ACCESSLOG_VALUE_ESC) len += v->len;
+	}
+
+	d = d0 = buffer_string_prepare_append(b, len);
+	d += 4;
+	for (j = 0; j < ff->used; j++) {
+		const format_field * const f = ff->ptr[j];
+		const accesslog_value * const v = values + j;
+		size_t nlen;
+		int type;
+		if (!f->key) continue;
+
+		switch (v->type) {
+		case ACCESSLOG_VALUE_STR:
+		case ACCESSLOG_VALUE_ESC: type = ACCESSLOG_BIN_STR; break;
+		case ACCESSLOG_VALUE_INT: type = ACCESSLOG_BIN_INT; break;
+		default:                  type = ACCESSLOG_BIN_NONE; break;
+		}
+
+		nlen = f->string ? buffer_string_length(f->string) : 0;
+		if (nlen > 255) nlen = 255;
+		*d++ = (char)(nlen ? type | ACCESSLOG_BIN_NAME : type);
+		*d++ = (char)f->key;
+		if (nlen) {
+			*d++ = (char)nlen;
+			memcpy(d, f->string->ptr, nlen);
+			d += nlen;
+		}
+
+		if (ACCESSLOG_BIN_INT == type) {
+			/* zigzag: 0, -1, 1, -2, ... => 0, 1, 2, 3, ... */
+			const uintmax_t u = (uintmax_t)v->n;
+			d = accesslog_append_varint(d, v->n < 0 ? ~(u << 1) : u << 1);
+		} else if (ACCESSLOG_BIN_STR == type) {
+			d = accesslog_append_varint(d, v->len);
+			memcpy(d, v->ptr, v->len);
+			d += v->len;
+		}
+	}
+
+	rlen = (uint32_t)(d - d0 - 4);
+	d0[0] = (char)(rlen);
+	d0[1] = (char)(rlen >> 8);
+	d0[2] = (char)(rlen >> 16);
+	d0[3] = (char)(rlen >> 24);
+	buffer_commit(b, (size_t)(d - d0));
+}
+
+/* select the function which sets the value of each field,
+ * so that writing a log line does not need to dispatch on field and opt */
+static void accesslog_compile_format(format_fields *fields) {
+	size_t j;
+	for (j = 0; j < fields->used; ++j) {
+		format_field * const f = fields->ptr[j];
+		accesslog_field_fn fn = accesslog_field_none;
+
+		if (FIELD_STRING == f->type) {
+			fn = accesslog_field_string;
+		} else if (FIELD_FORMAT == f->type) {
+			switch (f->field) {
+			case FORMAT_TIMESTAMP:
+				if (f->opt & FORMAT_FLAG_TIME_SEC)
+					fn = accesslog_field_timestamp_sec;
+				else if (f->opt & (FORMAT_FLAG_TIME_MSEC|FORMAT_FLAG_TIME_USEC|FORMAT_FLAG_TIME_NSEC))
+					fn = accesslog_field_timestamp_hp;
+				else if (f->opt & (FORMAT_FLAG_TIME_MSEC_FRAC|FORMAT_FLAG_TIME_USEC_FRAC|FORMAT_FLAG_TIME_NSEC_FRAC))
+					fn = accesslog_field_timestamp_frac;
+				else
+					fn = accesslog_field_timestamp_strftime;
 				break;
-			default: {
-					/* non printable char => \xHH */
-					char hh[5] = {'\\','x',0,0,0};
-					char h = c / 16;
-					hh[2] = (h > 9) ? (h - 10 + 'A') : (h + '0');
-					h = c % 16;
-					hh[3] = (h > 9) ? (h - 10 + 'A') : (h + '0');
-					buffer_append_string_len(dest, &hh[0], 4);
-				}
+			case FORMAT_TIME_USED:
+			case FORMAT_TIME_USED_US:
+				fn = (f->opt & FORMAT_FLAG_TIME_SEC)
+				  ? accesslog_field_time_used_sec
+				  : accesslog_field_time_used_hp;
 				break;
+			case FORMAT_REMOTE_ADDR:
+			case FORMAT_REMOTE_HOST:        fn = accesslog_field_remote_addr; break;
+			case FORMAT_REMOTE_IDENT:       fn = accesslog_field_dash; break;
+			case FORMAT_REMOTE_USER:        fn = accesslog_field_remote_user; break;
+			case FORMAT_REQUEST_LINE:       fn = accesslog_field_request_line; break;
+			case FORMAT_STATUS:             fn = accesslog_field_status; break;
+			case FORMAT_BYTES_OUT_NO_HEADER:fn = accesslog_field_bytes_out_no_header; break;
+			case FORMAT_HEADER:             fn = accesslog_field_header; break;
+			case FORMAT_RESPONSE_HEADER:    fn = accesslog_field_response_header; break;
+			case FORMAT_ENV:
+			case FORMAT_NOTE:               fn = accesslog_field_env; break;
+			case FORMAT_FILENAME:           fn = accesslog_field_filename; break;
+			case FORMAT_BYTES_OUT:          fn = accesslog_field_bytes_out; break;
+			case FORMAT_BYTES_IN:           fn = accesslog_field_bytes_in; break;
+			case FORMAT_SERVER_NAME:        fn = accesslog_field_server_name; break;
+			case FORMAT_HTTP_HOST:          fn = accesslog_field_http_host; break;
+			case FORMAT_REQUEST_PROTOCOL:   fn = accesslog_field_request_protocol; break;
+			case FORMAT_REQUEST_METHOD:     fn = accesslog_field_request_method; break;
+			case FORMAT_PERCENT:            fn = accesslog_field_percent; break;
+			case FORMAT_LOCAL_ADDR:         fn = accesslog_field_local_addr; break;
+			case FORMAT_SERVER_PORT:        fn = accesslog_field_server_port; break;
+			case FORMAT_QUERY_STRING:       fn = accesslog_field_query_string; break;
+			case FORMAT_URL:                fn = accesslog_field_url; break;
+			case FORMAT_CONNECTION_STATUS:  fn = accesslog_field_connection_status; break;
+			case FORMAT_KEEPALIVE_COUNT:    fn = accesslog_field_keepalive_count; break;
+			case FORMAT_COOKIE:             fn = accesslog_field_cookie; break;
+			case FORMAT_STAGE_TIME_US:      fn = accesslog_field_stage_time; break;
+			default: break;
 			}
 		}
-	}
 
-	if (start < end) {
-		buffer_append_string_len(dest, start, end - start);
+		f->fn = fn;
+
+		/* name of field in JSON and binary records */
+		f->key = 0;
+		f->json_key = NULL;
+		if (FIELD_FORMAT == f->type) {
+			const char *name = NULL;
+			size_t i;
+			for (i = 0; fmap[i].key != '\0'; ++i) {
+				if ((int)fmap[i].type == f->field) {
+					name = accesslog_field_name(fmap[i].key);
+					break;
+				}
+			}
+			if (NULL != name) {
+				char *d;
+				f->key = fmap[i].key;
+				f->json_key = buffer_init();
+				buffer_copy_string_len(f->json_key, CONST_STR_LEN("\""));
+				buffer_append_string(f->json_key, name);
+				if (!buffer_string_is_empty(f->string)) {
+					buffer_append_string_len(f->json_key, CONST_STR_LEN(":"));
+					d = buffer_string_prepare_append(f->json_key, buffer_string_length(f->string) * 6);
+					d = accesslog_escape_json(d, CONST_BUF_LEN(f->string));
+					buffer_commit(f->json_key, (size_t)(d - (f->json_key->ptr + buffer_string_length(f->json_key))));
+				}
+				buffer_append_string_len(f->json_key, CONST_STR_LEN("\":"));
+			}
+		}
 	}
 }
 
@@ -432,6 +1488,10 @@ FREE_FUNC(mod_accesslog_free) {
 
 	if (!p) return HANDLER_GO_ON;
 
+#ifdef ACCESSLOG_ASYNC
+	if (p->async) accesslog_async_stop(p->async);
+#endif
+
 	if (p->config_storage) {
 
 		for (i = 0; i < srv->config_context->used; i++) {
@@ -439,6 +1499,10 @@ FREE_FUNC(mod_accesslog_free) {
 
 			if (NULL == s) continue;
 
+#ifdef ACCESSLOG_ASYNC
+			if (s->ring) s->log_access_fd = s->ring->fd;
+#endif
+
 			if (!buffer_string_is_empty(s->access_logbuffer)) {
 				if (s->log_access_fd != -1) {
 					accesslog_write_all(srv, s->access_logfile, s->log_access_fd, CONST_BUF_LEN(s->access_logbuffer));
@@ -454,12 +1518,15 @@ FREE_FUNC(mod_accesslog_free) {
 			buffer_free(s->ts_accesslog_str);
 			buffer_free(s->access_logbuffer);
 			buffer_free(s->format);
+			buffer_free(s->format_type_str);
 			buffer_free(s->access_logfile);
+			buffer_free(s->async_overflow);
 
 			if (s->parsed_format) {
 				size_t j;
 				for (j = 0; j < s->parsed_format->used; j++) {
 					if (s->parsed_format->ptr[j]->string) buffer_free(s->parsed_format->ptr[j]->string);
+					if (s->parsed_format->ptr[j]->json_key) buffer_free(s->parsed_format->ptr[j]->json_key);
 					free(s->parsed_format->ptr[j]);
 				}
 				free(s->parsed_format->ptr);
@@ -473,6 +1540,10 @@ FREE_FUNC(mod_accesslog_free) {
 	}
 
 	if (p->syslog_logbuffer) buffer_free(p->syslog_logbuffer);
+#ifdef ACCESSLOG_ASYNC
+	if (p->async) accesslog_async_free(p->async);
+#endif
+	free(p->values);
 	free(p);
 
 	return HANDLER_GO_ON;
@@ -487,6 +1558,10 @@ SETDEFAULTS_FUNC(log_access_open) {
 		{ "accesslog.use-syslog",           NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
 		{ "accesslog.format",               NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
 		{ "accesslog.syslog-level",         NULL, T_CONFIG_SHORT, T_CONFIG_SCOPE_CONNECTION },
+		{ "accesslog.async",                NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_SERVER },
+		{ "accesslog.async-buffer-size",    NULL, T_CONFIG_INT, T_CONFIG_SCOPE_SERVER },
+		{ "accesslog.async-overflow",       NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_SERVER },
+		{ "accesslog.format-type",          NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
 		{ NULL,                             NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -501,18 +1576,24 @@ SETDEFAULTS_FUNC(log_access_open) {
 		s = calloc(1, sizeof(plugin_config));
 		s->access_logfile = buffer_init();
 		s->format = buffer_init();
+		s->format_type_str = buffer_init();
 		s->access_logbuffer = buffer_init();
 		s->ts_accesslog_str = buffer_init();
 		s->log_access_fd = -1;
 		s->last_generated_accesslog_ts = 0;
 		s->last_generated_accesslog_ts_ptr = &(s->last_generated_accesslog_ts);
 		s->syslog_level = LOG_INFO;
-
+		s->async_buffer_size = 1024;
+		s->async_overflow = buffer_init();
 
 		cv[0].destination = s->access_logfile;
 		cv[1].destination = &(s->use_syslog);
 		cv[2].destination = s->format;
 		cv[3].destination = &(s->syslog_level);
+		cv[4].destination = &(s->async);
+		cv[5].destination = &(s->async_buffer_size);
+		cv[6].destination = s->async_overflow;
+		cv[7].destination = s->format_type_str;
 
 		p->config_storage[i] = s;
 
@@ -520,6 +1601,51 @@ SETDEFAULTS_FUNC(log_access_open) {
 			return HANDLER_ERROR;
 		}
 
+		if (i == 0 && s->async) {
+			int drop;
+			if (buffer_string_is_empty(s->async_overflow)
+			    || buffer_is_equal_string(s->async_overflow, CONST_STR_LEN("block"))) {
+				drop = 0;
+			} else if (buffer_is_equal_string(s->async_overflow, CONST_STR_LEN("drop"))) {
+				drop = 1;
+			} else {
+				log_error_write(srv, __FILE__, __LINE__, "sb",
+					"accesslog.async-overflow must be \"block\" or \"drop\", not:", s->async_overflow);
+				return HANDLER_ERROR;
+			}
+			if (s->async_buffer_size < 64 || s->async_buffer_size > 1024*1024) {
+				log_error_write(srv, __FILE__, __LINE__, "sd",
+					"accesslog.async-buffer-size must be between 64 and 1048576 (kbytes), not:", (int)s->async_buffer_size);
+				return HANDLER_ERROR;
+			}
+		      #ifdef ACCESSLOG_ASYNC
+			p->async = accesslog_async_init(drop);
+		      #else
+			UNUSED(drop);
+			log_error_write(srv, __FILE__, __LINE__, "s",
+				"accesslog.async is not supported on this platform");
+			return HANDLER_ERROR;
+		      #endif
+		}
+
+		if (buffer_string_is_empty(s->format_type_str)
+		    || buffer_is_equal_string(s->format_type_str, CONST_STR_LEN("text"))) {
+			s->format_type = ACCESSLOG_FORMAT_TEXT;
+		} else if (buffer_is_equal_string(s->format_type_str, CONST_STR_LEN("json"))) {
+			s->format_type = ACCESSLOG_FORMAT_JSON;
+		} else if (buffer_is_equal_string(s->format_type_str, CONST_STR_LEN("binary"))) {
+			s->format_type = ACCESSLOG_FORMAT_BINARY;
+			if (s->use_syslog) {
+				log_error_write(srv, __FILE__, __LINE__, "s",
+					"accesslog.format-type = \"binary\" can not be used with accesslog.use-syslog");
+				return HANDLER_ERROR;
+			}
+		} else {
+			log_error_write(srv, __FILE__, __LINE__, "sb",
+				"accesslog.format-type must be \"text\", \"json\" or \"binary\", not:", s->format_type_str);
+			return HANDLER_ERROR;
+		}
+
 		if (i == 0 && buffer_string_is_empty(s->format)) {
 			/* set a default logfile string */
 
@@ -602,9 +1728,29 @@ SETDEFAULTS_FUNC(log_access_open) {
 					if (f->opt & ~(FORMAT_FLAG_TIME_SEC)) srv->srvconf.high_precision_timestamps = 1;
 				} else if (FORMAT_COOKIE == f->field) {
 					if (buffer_string_is_empty(f->string)) f->type = FIELD_STRING; /*(blank)*/
+				} else if (FORMAT_STAGE_TIME_US == f->field) {
+					const int t = buffer_string_is_empty(f->string)
+					  ? -1
+					  : connection_timing_from_name(CONST_BUF_LEN(f->string));
+					if (t < 0) {
+						log_error_write(srv, __FILE__, __LINE__, "sb",
+							"invalid stage in %{STAGE}S:", s->format);
+
+						return HANDLER_ERROR;
+					}
+					f->opt = t;
+					srv->srvconf.request_timing = 1;
+					srv->srvconf.high_precision_timestamps = 1;
 				}
 			}
 
+			accesslog_compile_format(s->parsed_format);
+			if (p->nvalues < s->parsed_format->used) {
+				p->nvalues = s->parsed_format->used;
+				p->values = realloc(p->values, p->nvalues * sizeof(*p->values));
+				force_assert(p->values);
+			}
+
 #if 0
 			/* debugging */
 			for (j = 0; j < s->parsed_format->used; j++) {
@@ -640,6 +1786,15 @@ SETDEFAULTS_FUNC(log_access_open) {
 					"' failed: ", strerror(errno));
 			return HANDLER_ERROR;
 		}
+
+	      #ifdef ACCESSLOG_ASYNC
+		if (p->async) {
+			/* ring size rounded up to power of 2 */
+			size_t sz = 65536;
+			while (sz < (size_t)p->config_storage[0]->async_buffer_size << 10) sz <<= 1;
+			s->ring = accesslog_async_ring(p->async, sz, s->log_access_fd);
+		}
+	      #endif
 	}
 
 	return HANDLER_GO_ON;
@@ -669,6 +1824,9 @@ static void log_access_flush(server *srv, void *p_d) {
 TRIGGER_FUNC(log_access_periodic_flush) {
 	/* flush buffered access logs every 4 seconds */
 	if (0 == (srv->cur_ts & 3)) log_access_flush(srv, p_d);
+      #ifdef ACCESSLOG_ASYNC
+	if (((plugin_data *)p_d)->async) accesslog_async_report(srv, p_d);
+      #endif
 	return HANDLER_GO_ON;
 }
 
@@ -686,10 +1844,23 @@ SIGHUP_FUNC(log_access_cycle) {
 			&& !buffer_string_is_empty(s->access_logfile)
 			&& s->access_logfile->ptr[0] != '|') {
 
+		      #ifdef ACCESSLOG_ASYNC
+			if (s->ring && 1 == p->async->started) {
+				if (-1 == accesslog_async_cycle(p->async, s->ring, s->access_logfile->ptr)) {
+					log_error_write(srv, __FILE__, __LINE__, "ss", "cycling access-log failed:", strerror(errno));
+					return HANDLER_ERROR;
+				}
+				continue;
+			}
+		      #endif
+
 			if (-1 == fdevent_cycle_logger(s->access_logfile->ptr, &s->log_access_fd)) {
 				log_error_write(srv, __FILE__, __LINE__, "ss", "cycling access-log failed:", strerror(errno));
 				return HANDLER_ERROR;
 			}
+		      #ifdef ACCESSLOG_ASYNC
+			if (s->ring) s->ring->fd = s->log_access_fd;
+		      #endif
 		}
 	}
 
@@ -706,8 +1877,10 @@ static int mod_accesslog_patch_connection(server *srv, connection *con, plugin_d
 	PATCH(log_access_fd);
 	PATCH(last_generated_accesslog_ts_ptr);
 	PATCH(access_logbuffer);
+	PATCH(ring);
 	PATCH(ts_accesslog_str);
 	PATCH(parsed_format);
+	PATCH(format_type);
 	PATCH(use_syslog);
 	PATCH(syslog_level);
 
@@ -727,10 +1900,13 @@ static int mod_accesslog_patch_connection(server *srv, connection *con, plugin_d
 				PATCH(access_logfile);
 				PATCH(log_access_fd);
 				PATCH(access_logbuffer);
+				PATCH(ring);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.format"))) {
 				PATCH(parsed_format);
 				PATCH(last_generated_accesslog_ts_ptr);
 				PATCH(ts_accesslog_str);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.format-type"))) {
+				PATCH(format_type);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.use-syslog"))) {
 				PATCH(use_syslog);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("accesslog.syslog-level"))) {
@@ -747,10 +1923,8 @@ REQUESTDONE_FUNC(log_access_write) {
 	plugin_data *p = p_d;
 	buffer *b;
 	size_t j;
-
-	int newts = 0;
-	data_string *ds;
-	struct timespec ts = { 0, 0 };
+	format_fields *ff;
+	accesslog_req r;
 
 	mod_accesslog_patch_connection(srv, con, p);
 
@@ -763,347 +1937,34 @@ REQUESTDONE_FUNC(log_access_write) {
 		b = p->conf.access_logbuffer;
 	}
 
-	if (buffer_is_empty(b)) {
-		buffer_string_set_length(b, 0);
+	r.srv = srv;
+	r.con = con;
+	r.conf = &p->conf;
+	r.ts.tv_sec = 0;
+	r.ts.tv_nsec = 0;
+	r.newts = 0;
+
+	/* collect field values, then append the line to b
+	 * (with a single allocation, since the max length is known) */
+	ff = p->conf.parsed_format;
+	for (j = 0; j < ff->used; j++) {
+		const format_field * const f = ff->ptr[j];
+		f->fn(p->values + j, f, &r);
 	}
 
-	for (j = 0; j < p->conf.parsed_format->used; j++) {
-		const format_field * const f = p->conf.parsed_format->ptr[j];
-		switch(f->type) {
-		case FIELD_STRING:
-			buffer_append_string_buffer(b, f->string);
-			break;
-		case FIELD_FORMAT:
-			switch(f->field) {
-			case FORMAT_TIMESTAMP:
-
-				if (f->opt & ~(FORMAT_FLAG_TIME_BEGIN|FORMAT_FLAG_TIME_END)) {
-					if (f->opt & FORMAT_FLAG_TIME_SEC) {
-						time_t t = (!(f->opt & FORMAT_FLAG_TIME_BEGIN)) ? srv->cur_ts : con->request_start;
-						buffer_append_int(b, (intmax_t)t);
-					} else if (f->opt & (FORMAT_FLAG_TIME_MSEC|FORMAT_FLAG_TIME_USEC|FORMAT_FLAG_TIME_NSEC)) {
-						off_t t; /*(expected to be 64-bit since large file support enabled)*/
-						long ns;
-						if (!(f->opt & FORMAT_FLAG_TIME_BEGIN)) {
-							if (0 == ts.tv_sec) log_clock_gettime_realtime(&ts);
-							t = (off_t)ts.tv_sec;
-							ns = ts.tv_nsec;
-						} else {
-							t = (off_t)con->request_start_hp.tv_sec;
-							ns = con->request_start_hp.tv_nsec;
-						}
-						if (f->opt & FORMAT_FLAG_TIME_MSEC) {
-							t *= 1000;
-							t += (ns + 999999) / 1000000; /* ceil */
-						} else if (f->opt & FORMAT_FLAG_TIME_USEC) {
-							t *= 1000000;
-							t += (ns + 999) / 1000; /* ceil */
-						} else {/*(f->opt & FORMAT_FLAG_TIME_NSEC)*/
-							t *= 1000000000;
-							t += ns;
-						}
-						buffer_append_int(b, (intmax_t)t);
-					} else { /*(FORMAT_FLAG_TIME_MSEC_FRAC|FORMAT_FLAG_TIME_USEC_FRAC|FORMAT_FLAG_TIME_NSEC_FRAC)*/
-						long ns;
-						char *ptr;
-						if (!(f->opt & FORMAT_FLAG_TIME_BEGIN)) {
-							if (0 == ts.tv_sec) log_clock_gettime_realtime(&ts);
-							ns = ts.tv_nsec;
-						} else {
-							ns = con->request_start_hp.tv_nsec;
-						}
-						/*assert(t < 1000000000);*/
-						if (f->opt & FORMAT_FLAG_TIME_MSEC_FRAC) {
-							ns +=  999999; /* ceil */
-							ns /= 1000000;
-							buffer_append_string_len(b, CONST_STR_LEN("000"));
-						} else if (f->opt & FORMAT_FLAG_TIME_USEC_FRAC) {
-							ns +=  999; /* ceil */
-							ns /= 1000;
-							buffer_append_string_len(b, CONST_STR_LEN("000000"));
-						} else {/*(f->opt & FORMAT_FLAG_TIME_NSEC_FRAC)*/
-							buffer_append_string_len(b, CONST_STR_LEN("000000000"));
-						}
-						for (ptr = b->ptr + buffer_string_length(b); ns > 0; ns /= 10)
-							*--ptr = (ns % 10) + '0';
-					}
-				} else if (!(f->opt & FORMAT_FLAG_TIME_BEGIN) && srv->cur_ts == *(p->conf.last_generated_accesslog_ts_ptr)) {
-					buffer_append_string_buffer(b, p->conf.ts_accesslog_str);
-				} else {
-					/* cache the generated timestamp (only if ! FORMAT_FLAG_TIME_BEGIN) */
-					struct tm *tmptr;
-					time_t t;
-				      #if defined(HAVE_STRUCT_TM_GMTOFF)
-				      # ifdef HAVE_LOCALTIME_R
-					struct tm tm;
-				      # endif /* HAVE_LOCALTIME_R */
-				      #else /* HAVE_STRUCT_TM_GMTOFF */
-				      # ifdef HAVE_GMTIME_R
-					struct tm tm;
-				      # endif /* HAVE_GMTIME_R */
-				      #endif /* HAVE_STRUCT_TM_GMTOFF */
-
-					if (!(f->opt & FORMAT_FLAG_TIME_BEGIN)) {
-						t = *(p->conf.last_generated_accesslog_ts_ptr) = srv->cur_ts;
-						newts = 1;
-					} else {
-						t = con->request_start;
-					}
-
-				      #if defined(HAVE_STRUCT_TM_GMTOFF)
-				      # ifdef HAVE_LOCALTIME_R
-					tmptr = localtime_r(&t, &tm);
-				      # else /* HAVE_LOCALTIME_R */
-					tmptr = localtime(&t);
-				      # endif /* HAVE_LOCALTIME_R */
-				      #else /* HAVE_STRUCT_TM_GMTOFF */
-				      # ifdef HAVE_GMTIME_R
-					tmptr = gmtime_r(&t, &tm);
-				      # else /* HAVE_GMTIME_R */
-					tmptr = gmtime(&t);
-				      # endif /* HAVE_GMTIME_R */
-				      #endif /* HAVE_STRUCT_TM_GMTOFF */
-
-					buffer_string_prepare_copy(p->conf.ts_accesslog_str, 255);
-
-					if (buffer_string_is_empty(f->string)) {
-					      #if defined(HAVE_STRUCT_TM_GMTOFF)
-						long scd, hrs, min;
-						buffer_append_strftime(p->conf.ts_accesslog_str, "[%d/%b/%Y:%H:%M:%S ", tmptr);
-						buffer_append_string_len(p->conf.ts_accesslog_str, tmptr->tm_gmtoff >= 0 ? "+" : "-", 1);
-
-						scd = labs(tmptr->tm_gmtoff);
-						hrs = scd / 3600;
-						min = (scd % 3600) / 60;
-
-						/* hours */
-						if (hrs < 10) buffer_append_string_len(p->conf.ts_accesslog_str, CONST_STR_LEN("0"));
-						buffer_append_int(p->conf.ts_accesslog_str, hrs);
-
-						if (min < 10) buffer_append_string_len(p->conf.ts_accesslog_str, CONST_STR_LEN("0"));
-						buffer_append_int(p->conf.ts_accesslog_str, min);
-						buffer_append_string_len(p->conf.ts_accesslog_str, CONST_STR_LEN("]"));
-					      #else
-						buffer_append_strftime(p->conf.ts_accesslog_str, "[%d/%b/%Y:%H:%M:%S +0000]", tmptr);
-					      #endif /* HAVE_STRUCT_TM_GMTOFF */
-					} else {
-						buffer_append_strftime(p->conf.ts_accesslog_str, f->string->ptr, tmptr);
-					}
-
-					buffer_append_string_buffer(b, p->conf.ts_accesslog_str);
-				}
-				break;
-			case FORMAT_TIME_USED:
-			case FORMAT_TIME_USED_US:
-				if (f->opt & FORMAT_FLAG_TIME_SEC) {
-					buffer_append_int(b, srv->cur_ts - con->request_start);
-				} else {
-					const struct timespec * const bs = &con->request_start_hp;
-					off_t tdiff; /*(expected to be 64-bit since large file support enabled)*/
-					if (0 == ts.tv_sec) log_clock_gettime_realtime(&ts);
-					tdiff = (off_t)(ts.tv_sec - bs->tv_sec)*1000000000 + (ts.tv_nsec - bs->tv_nsec);
-					if (tdiff <= 0) {
-						/* sanity check for time moving backwards
-						 * (daylight savings adjustment or leap seconds or ?) */
-						tdiff  = -1;
-					} else if (f->opt & FORMAT_FLAG_TIME_MSEC) {
-						tdiff +=  999999; /* ceil */
-						tdiff /= 1000000;
-					} else if (f->opt & FORMAT_FLAG_TIME_USEC) {
-						tdiff +=  999; /* ceil */
-						tdiff /= 1000;
-					} /* else (f->opt & FORMAT_FLAG_TIME_NSEC) */
-					buffer_append_int(b, (intmax_t)tdiff);
-				}
-				break;
-			case FORMAT_REMOTE_ADDR:
-			case FORMAT_REMOTE_HOST:
-				buffer_append_string_buffer(b, con->dst_addr_buf);
-				break;
-			case FORMAT_REMOTE_IDENT:
-				/* ident */
-				buffer_append_string_len(b, CONST_STR_LEN("-"));
-				break;
-			case FORMAT_REMOTE_USER:
-				if (NULL != (ds = (data_string *)array_get_element(con->environment, "REMOTE_USER")) && !buffer_string_is_empty(ds->value)) {
-					accesslog_append_escaped(b, ds->value);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_REQUEST_LINE:
-				if (!buffer_string_is_empty(con->request.request_line)) {
-					accesslog_append_escaped(b, con->request.request_line);
-				}
-				break;
-			case FORMAT_STATUS:
-				buffer_append_int(b, con->http_status);
-				break;
-
-			case FORMAT_BYTES_OUT_NO_HEADER:
-				if (con->bytes_written > 0) {
-					buffer_append_int(b,
-							    con->bytes_written - con->bytes_header <= 0 ? 0 : con->bytes_written - con->bytes_header);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_HEADER:
-				if (NULL != (ds = (data_string *)array_get_element_klen(con->request.headers, CONST_BUF_LEN(f->string)))) {
-					accesslog_append_escaped(b, ds->value);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_RESPONSE_HEADER:
-				if (NULL != (ds = (data_string *)array_get_element_klen(con->response.headers, CONST_BUF_LEN(f->string)))) {
-					accesslog_append_escaped(b, ds->value);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_ENV:
-			case FORMAT_NOTE:
-				if (NULL != (ds = (data_string *)array_get_element_klen(con->environment, CONST_BUF_LEN(f->string)))) {
-					accesslog_append_escaped(b, ds->value);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_FILENAME:
-				if (!buffer_string_is_empty(con->physical.path)) {
-					buffer_append_string_buffer(b, con->physical.path);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_BYTES_OUT:
-				if (con->bytes_written > 0) {
-					buffer_append_int(b, con->bytes_written);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_BYTES_IN:
-				if (con->bytes_read > 0) {
-					buffer_append_int(b, con->bytes_read);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_SERVER_NAME:
-				if (!buffer_string_is_empty(con->server_name)) {
-					buffer_append_string_buffer(b, con->server_name);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_HTTP_HOST:
-				if (!buffer_string_is_empty(con->uri.authority)) {
-					accesslog_append_escaped(b, con->uri.authority);
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("-"));
-				}
-				break;
-			case FORMAT_REQUEST_PROTOCOL:
-				buffer_append_string_len(b,
-					con->request.http_version == HTTP_VERSION_1_1 ? "HTTP/1.1" : "HTTP/1.0", 8);
-				break;
-			case FORMAT_REQUEST_METHOD:
-				buffer_append_string(b, get_http_method_name(con->request.http_method));
-				break;
-			case FORMAT_PERCENT:
-				buffer_append_string_len(b, CONST_STR_LEN("%"));
-				break;
-			case FORMAT_LOCAL_ADDR:
-				{
-					/* (perf: not using getsockname() and inet_ntop_cache_get_ip())
-					 * (still useful if admin has configured explicit listen IPs) */
-					const char *colon;
-					buffer *srvtoken = con->srv_socket->srv_token;
-					if (srvtoken->ptr[0] == '[') {
-						colon = strstr(srvtoken->ptr, "]:");
-					} else {
-						colon = strchr(srvtoken->ptr, ':');
-					}
-					if (colon) {
-						buffer_append_string_len(b, srvtoken->ptr, (size_t)(colon - srvtoken->ptr));
-					} else {
-						buffer_append_string_buffer(b, srvtoken);
-					}
-				}
-				break;
-			case FORMAT_SERVER_PORT:
-				{
-					const char *colon;
-					buffer *srvtoken = ((server_socket*)(con->srv_socket))->srv_token;
-					if (srvtoken->ptr[0] == '[') {
-						colon = strstr(srvtoken->ptr, "]:");
-					} else {
-						colon = strchr(srvtoken->ptr, ':');
-					}
-					if (colon) {
-						buffer_append_string(b, colon+1);
-					} else {
-						buffer_append_int(b, srv->srvconf.port);
-					}
-				}
-				break;
-			case FORMAT_QUERY_STRING:
-				accesslog_append_escaped(b, con->uri.query);
-				break;
-			case FORMAT_URL:
-				accesslog_append_escaped(b, con->uri.path_raw);
-				break;
-			case FORMAT_CONNECTION_STATUS:
-				if (con->state == CON_STATE_RESPONSE_END) {
-					if (0 == con->keep_alive) {
-						buffer_append_string_len(b, CONST_STR_LEN("-"));
-					} else {
-						buffer_append_string_len(b, CONST_STR_LEN("+"));
-					}
-				} else { /* CON_STATE_ERROR */
-					buffer_append_string_len(b, CONST_STR_LEN("X"));
-				}
-				break;
-			case FORMAT_KEEPALIVE_COUNT:
-				if (con->request_count > 1) {
-					buffer_append_int(b, (intmax_t)(con->request_count-1));
-				} else {
-					buffer_append_string_len(b, CONST_STR_LEN("0"));
-				}
-				break;
-			case FORMAT_COOKIE:
-				if (NULL != (ds = (data_string *)array_get_element(con->request.headers, "Cookie"))) {
-					char *str = ds->value->ptr;
-					size_t len = buffer_string_length(f->string);
-					do {
-						while (*str == ' ' || *str == '\t') ++str;
-						if (0 == strncmp(str, f->string->ptr, len) && str[len] == '=') {
-							char *v = str+len+1;
-							buffer *bstr;
-							for (str = v; *str != '\0' && *str != ';'; ++str) ;
-							if (str == v) break;
-							do { --str; } while (str > v && (*str == ' ' || *str == '\t'));
-							bstr = buffer_init();
-							buffer_copy_string_len(bstr, v, str - v + 1);
-							accesslog_append_escaped(b, bstr);
-							buffer_free(bstr);
-							break;
-						} else {
-							do { ++str; } while (*str != ' ' && *str != '\t' && *str != '\0');
-						}
-						while (*str == ' ' || *str == '\t') ++str;
-					} while (*str++ == ';');
-				}
-				break;
-			default:
-				break;
-			}
-			break;
-		default:
+	switch (p->conf.format_type) {
+	case ACCESSLOG_FORMAT_JSON:
+		accesslog_append_json(b, ff, p->values);
+		break;
+	case ACCESSLOG_FORMAT_BINARY:
+		if (!p->conf.use_syslog) {
+			accesslog_append_binary(b, ff, p->values);
 			break;
 		}
+		/* fall through *//*(not with syslog)*/
+	default:
+		accesslog_append_text(b, ff, p->values);
+		break;
 	}
 
 	if (p->conf.use_syslog) { /* syslog doesn't cache */
@@ -1117,10 +1978,22 @@ REQUESTDONE_FUNC(log_access_write) {
 		return HANDLER_GO_ON;
 	}
 
-	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+	if (ACCESSLOG_FORMAT_BINARY != p->conf.format_type) {
+		buffer_append_string_len(b, CONST_STR_LEN("\n")); /*(space reserved above)*/
+	}
+
+      #ifdef ACCESSLOG_ASYNC
+	if (p->conf.ring
+	    && (1 == p->async->started
+	        || (0 == p->async->started && 1 == accesslog_async_start(srv, p->async)))) {
+		accesslog_async_push(p->async, p->conf.ring, CONST_BUF_LEN(b));
+		buffer_reset(b);
+		return HANDLER_GO_ON;
+	}
+      #endif
 
 	if ((!buffer_string_is_empty(p->conf.access_logfile) && p->conf.access_logfile->ptr[0] == '|') || /* pipes don't cache */
-	    newts ||
+	    r.newts ||
 	    buffer_string_length(b) >= BUFFER_MAX_REUSE_SIZE) {
 		if (p->conf.log_access_fd >= 0) {
 			accesslog_write_all(srv, p->conf.access_logfile, p->conf.log_access_fd, CONST_BUF_LEN(b));
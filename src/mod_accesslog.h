@@ -0,0 +1,70 @@
+#ifndef INCLUDED_MOD_ACCESSLOG_H
+#define INCLUDED_MOD_ACCESSLOG_H
+#include "first.h"
+
+#include <stddef.h>
+
+/*
+ * binary access log records (accesslog.format-type = "binary")
+ *
+ * record := length field*
+ *   length: uint32, little-endian; number of bytes of the fields following
+ * field  := type key [namelen name] value
+ *   type:   uint8, ACCESSLOG_BIN_* value type, | ACCESSLOG_BIN_NAME if the
+ *           format-specifier has a {name}, e.g. %{User-Agent}i
+ *   key:    uint8, format-specifier char, e.g. 'h' for %h
+ *   name:   uint8 length followed by that many bytes (at most 255)
+ *   value:  ACCESSLOG_BIN_NONE: (nothing; "-" in text log)
+ *           ACCESSLOG_BIN_INT:  zigzag-encoded signed integer, as varint
+ *           ACCESSLOG_BIN_STR:  varint length followed by that many bytes
+ *   varint: 7 bits per byte, least significant first; high bit set if more
+ *
+ * Literal strings of accesslog.format are not stored.  Strings are stored
+ * as-is, without escaping.
+ */
+enum {
+	ACCESSLOG_BIN_NONE = 0,
+	ACCESSLOG_BIN_INT  = 1,
+	ACCESSLOG_BIN_STR  = 2,
+	ACCESSLOG_BIN_NAME = 0x80
+};
+
+/* name of format-specifier (key in JSON and in output of
+ * lighttpd-accesslog-cat), or NULL if not a field */
+static inline const char * accesslog_field_name(int key) {
+	switch (key) {
+	case 'a': return "remote_addr";
+	case 'A': return "local_addr";
+	case 'b':
+	case 'B': return "bytes_body";
+	case 'C': return "cookie";
+	case 'D': return "time_used_us";
+	case 'e': return "env";
+	case 'f': return "filename";
+	case 'h': return "remote_host";
+	case 'H': return "protocol";
+	case 'i': return "request_header";
+	case 'I': return "bytes_in";
+	case 'k': return "keepalive_count";
+	case 'l': return "remote_ident";
+	case 'm': return "method";
+	case 'n': return "note";
+	case 'o': return "response_header";
+	case 'O': return "bytes_out";
+	case 'p': return "server_port";
+	case 'q': return "query_string";
+	case 'r': return "request_line";
+	case 's': return "status";
+	case 'S': return "stage_time_us";
+	case 't': return "time";
+	case 'T': return "time_used";
+	case 'u': return "remote_user";
+	case 'U': return "url";
+	case 'v': return "server_name";
+	case 'V': return "host";
+	case 'X': return "connection_status";
+	default:  return NULL; /* %% and unsupported %P */
+	}
+}
+
+#endif
@@ -462,7 +462,7 @@ static handler_t mod_auth_send_401_unauthorized_basic(server *srv, connection *c
 }
 
 static handler_t mod_auth_check_basic(server *srv, connection *con, void *p_d, const struct http_auth_require_t *require, const struct http_auth_backend_t *backend) {
-	data_string *ds = (data_string *)array_get_element(con->request.headers, "Authorization");
+	data_string *ds = http_header_request_get(con, HTTP_HEADER_AUTHORIZATION, CONST_STR_LEN("Authorization"));
 	buffer *username;
 	buffer *b;
 	char *pw;
@@ -549,7 +549,7 @@ typedef struct {
 static handler_t mod_auth_send_401_unauthorized_digest(server *srv, connection *con, buffer *realm, int nonce_stale);
 
 static handler_t mod_auth_check_digest(server *srv, connection *con, void *p_d, const struct http_auth_require_t *require, const struct http_auth_backend_t *backend) {
-	data_string *ds = (data_string *)array_get_element(con->request.headers, "Authorization");
+	data_string *ds = http_header_request_get(con, HTTP_HEADER_AUTHORIZATION, CONST_STR_LEN("Authorization"));
 
 	char a1[33];
 	char a2[33];
@@ -249,7 +249,7 @@ static int mod_authn_gssapi_create_krb5_ccache(server *srv, connection *con, plu
         con->plugin_ctx[p->id] = kccname;
 
         array_set_key_value(con->environment, CONST_STR_LEN("KRB5CCNAME"), ccname, ccnamelen);
-        array_set_key_value(con->request.headers, CONST_STR_LEN("X-Forwarded-Keytab"), ccname, ccnamelen);
+        http_header_request_set(con, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Forwarded-Keytab"), ccname, ccnamelen);
 
         return 0;
 
@@ -465,7 +465,7 @@ static handler_t mod_authn_gssapi_check_spnego(server *srv, connection *con, plu
 static handler_t mod_authn_gssapi_check (server *srv, connection *con, void *p_d, const struct http_auth_require_t *require, const struct http_auth_backend_t *backend)
 {
     data_string * const ds =
-      (data_string *)array_get_element(con->request.headers, "Authorization");
+      http_header_request_get(con, HTTP_HEADER_AUTHORIZATION, CONST_STR_LEN("Authorization"));
 
     UNUSED(backend);
     if (NULL == ds || buffer_is_empty(ds->value)) {
@@ -994,7 +994,7 @@ URIHANDLER_FUNC(cgi_is_handled) {
 		hctx->conf.upgrade =
 		  hctx->conf.upgrade
 		  && con->request.http_version == HTTP_VERSION_1_1
-		  && NULL != array_get_element_klen(con->request.headers, CONST_STR_LEN("Upgrade"));
+		  && NULL != http_header_request_get(con, HTTP_HEADER_UPGRADE, CONST_STR_LEN("Upgrade"));
 		hctx->opts.fdfmt = S_IFIFO;
 		hctx->opts.backend = BACKEND_CGI;
 		hctx->opts.authorizer = 0;
@@ -293,7 +293,7 @@ int cache_parse_lua(server *srv, connection *con, plugin_data *p, buffer *fn) {
 
 			con->file_finished = 1;
 
-			ds = (data_string *)array_get_element(con->response.headers, "Last-Modified");
+			ds = http_header_response_get(con, HTTP_HEADER_LAST_MODIFIED, CONST_STR_LEN("Last-Modified"));
 			if (0 == mtime) mtime = time(NULL); /* default last-modified to now */
 
 			/* no Last-Modified specified */
@@ -302,7 +302,7 @@ int cache_parse_lua(server *srv, connection *con, plugin_data *p, buffer *fn) {
 				strftime(timebuf, sizeof(timebuf), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&mtime));
 
 				response_header_overwrite(srv, con, CONST_STR_LEN("Last-Modified"), timebuf, sizeof(timebuf) - 1);
-				ds = (data_string *)array_get_element(con->response.headers, "Last-Modified");
+				ds = http_header_response_get(con, HTTP_HEADER_LAST_MODIFIED, CONST_STR_LEN("Last-Modified"));
 				force_assert(NULL != ds);
 			}
 
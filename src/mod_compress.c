@@ -900,7 +900,7 @@ PHYSICALPATH_FUNC(mod_compress_physical) {
 			/* the response might change according to Accept-Encoding */
 			response_header_insert(srv, con, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
 
-			if (NULL != (ds = (data_string *)array_get_element(con->request.headers, "Accept-Encoding"))) {
+			if (NULL != (ds = http_header_request_get(con, HTTP_HEADER_ACCEPT_ENCODING, CONST_STR_LEN("Accept-Encoding")))) {
 				int accept_encoding = 0;
 				char *value = ds->value->ptr;
 				int matched_encodings = 0;
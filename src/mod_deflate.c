@@ -1080,11 +1080,11 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 	}
 
 	/* Check if response has a Content-Encoding. */
-	ds = (data_string *)array_get_element(con->response.headers, "Content-Encoding");
+	ds = http_header_response_get(con, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding"));
 	if (NULL != ds) return HANDLER_GO_ON;
 
 	/* Check Accept-Encoding for supported encoding. */
-	ds = (data_string *)array_get_element(con->request.headers, "Accept-Encoding");
+	ds = http_header_request_get(con, HTTP_HEADER_ACCEPT_ENCODING, CONST_STR_LEN("Accept-Encoding"));
 	if (NULL == ds) return HANDLER_GO_ON;
 
 	/* find matching encodings */
@@ -1092,7 +1092,7 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 	if (!compression_type) return HANDLER_GO_ON;
 
 	/* Check mimetype in response header "Content-Type" */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, "Content-Type"))) {
+	if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_CONTENT_TYPE, CONST_STR_LEN("Content-Type")))) {
 		int found = 0;
 		size_t m;
 		for (m = 0; m < p->conf.mimetypes->used; ++m) {
@@ -1120,7 +1120,7 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 	}
 
 	/* Vary: Accept-Encoding (response might change according to request Accept-Encoding) */
-	if (NULL != (ds = (data_string *)array_get_element(con->response.headers, "Vary"))) {
+	if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_VARY, CONST_STR_LEN("Vary")))) {
 		if (NULL == strstr(ds->value->ptr, "Accept-Encoding")) {
 			buffer_append_string_len(ds->value, CONST_STR_LEN(",Accept-Encoding"));
 		}
@@ -1131,7 +1131,7 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 
 	/* check ETag as is done in http_response_handle_cachable()
 	 * (slightly imperfect (close enough?) match of ETag "000000" to "000000-gzip") */
-	ds = (data_string *)array_get_element(con->response.headers, "ETag");
+	ds = http_header_response_get(con, HTTP_HEADER_ETAG, CONST_STR_LEN("ETag"));
 	if (NULL != ds) {
 		etaglen = buffer_string_length(ds->value);
 		if (etaglen
@@ -1192,7 +1192,7 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 		chunkqueue_reset(con->write_queue);
 		if (con->parsed_response & HTTP_CONTENT_LENGTH) {
 			con->parsed_response &= ~HTTP_CONTENT_LENGTH;
-			if (NULL != (ds = (data_string*) array_get_element(con->response.headers, "Content-Length"))) {
+			if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length")))) {
 				buffer_reset(ds->value); /* headers with empty values are ignored for output */
 			}
 		}
@@ -1221,7 +1221,7 @@ CONNECTION_FUNC(mod_deflate_handle_response_start) {
 			ds->value->ptr[etaglen-1] = '"'; /*(overwrite '-')*/
 			buffer_string_set_length(ds->value, etaglen);
 		}
-		ds = (data_string *)array_get_element(con->response.headers, "Content-Encoding");
+		ds = http_header_response_get(con, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding"));
 		if (ds) buffer_reset(ds->value); /* headers with empty values are ignored for output */
 		return HANDLER_GO_ON;
 	}
@@ -329,7 +329,7 @@ CONNECTION_FUNC(mod_expire_handler) {
 	if (   con->request.http_method != HTTP_METHOD_GET
 	    && con->request.http_method != HTTP_METHOD_HEAD) return HANDLER_GO_ON;
 	/* Add caching headers only if not already present */
-	ds = (data_string *)array_get_element(con->response.headers, "Cache-Control");
+	ds = http_header_response_get(con, HTTP_HEADER_CACHE_CONTROL, CONST_STR_LEN("Cache-Control"));
 	if (NULL != ds && !buffer_string_is_empty(ds->value)) return HANDLER_GO_ON;
 
 	if (buffer_is_empty(con->uri.path)) return HANDLER_GO_ON;
@@ -354,7 +354,7 @@ CONNECTION_FUNC(mod_expire_handler) {
 	/* check expire.mimetypes (if no match with expire.url) */
 	if (k == p->conf.expire_url->used) {
 		const char *mimetype;
-		ds = (data_string *)array_get_element(con->response.headers, "Content-Type");
+		ds = http_header_response_get(con, HTTP_HEADER_CONTENT_TYPE, CONST_STR_LEN("Content-Type"));
 		if (NULL != ds && !buffer_string_is_empty(ds->value)) {
 			mimetype = ds->value->ptr;
 			s_len = buffer_string_length(ds->value);
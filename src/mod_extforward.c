@@ -522,7 +522,7 @@ static handler_t mod_extforward_X_Forwarded_For(server *srv, connection *con, pl
 		 *   (not done: walking backwards in X-Forwarded-Proto the same num of steps
 		 *    as in X-Forwarded-For to find proto set by last trusted proxy)
 		 */
-		data_string *x_forwarded_proto = (data_string *)array_get_element(con->request.headers, "X-Forwarded-Proto");
+		data_string *x_forwarded_proto = http_header_request_get(con, HTTP_HEADER_X_FORWARDED_PROTO, CONST_STR_LEN("X-Forwarded-Proto"));
 		if (mod_extforward_set_addr(srv, con, p, real_remote_addr) && NULL != x_forwarded_proto) {
 			mod_extforward_set_proto(srv, con, CONST_BUF_LEN(x_forwarded_proto->value));
 		}
@@ -890,7 +890,7 @@ static handler_t mod_extforward_Forwarded (server *srv, connection *con, plugin_
 
   #if 0
     if ((p->conf.opts & PROXY_FORWARDED_CREATE_XFF)
-        && NULL == array_get_element(con->request.headers, "X-Forwarded-For")) {
+        && NULL == http_header_request_get(con, HTTP_HEADER_X_FORWARDED_FOR, CONST_STR_LEN("X-Forwarded-For"))) {
         /* create X-Forwarded-For if not present
          * (and at least original connecting IP is a trusted proxy) */
         buffer *xff;
@@ -898,7 +898,7 @@ static handler_t mod_extforward_Forwarded (server *srv, connection *con, plugin_
           array_get_unused_element(con->request.headers, TYPE_STRING);
         if (NULL == dsxff) dsxff = data_string_init();
         buffer_copy_string_len(dsxff->key, CONST_STR_LEN("X-Forwarded-For"));
-        array_insert_unique(con->request.headers, (data_unset *)dsxff);
+        http_header_request_insert(con, HTTP_HEADER_X_FORWARDED_FOR, dsxff);
         xff = dsxff->value;
         for (j = 0; j < used; ) {
             if (-1 == offsets[j]) { ++j; continue; }
@@ -235,7 +235,9 @@ static handler_t fcgi_create_env(server *srv, handler_ctx *hctx) {
 	fcgi_header(&(beginRecord.header), FCGI_BEGIN_REQUEST, request_id, sizeof(beginRecord.body), 0);
 	beginRecord.body.roleB0 = hctx->gw_mode;
 	beginRecord.body.roleB1 = 0;
-	beginRecord.body.flags = 0;
+	/* ask backend to leave connection open after FCGI_END_REQUEST
+	 * so that it can be returned to the idle connection pool */
+	beginRecord.body.flags = host->keep_alive_max_idle ? FCGI_KEEP_CONN : 0;
 	memset(beginRecord.body.reserved, 0, sizeof(beginRecord.body.reserved));
 
 	/* send FCGI_PARAMS */
@@ -369,6 +371,11 @@ static handler_t fcgi_recv_parse(server *srv, connection *con, struct http_respo
 
 	if (0 == n) {
 		if (!(fdevent_event_get_interest(srv->ev, hctx->fd) & FDEVENT_IN)) return HANDLER_GO_ON;
+		/* idle connection closed by backend just as it was reused;
+		 * (request is retried on a new connection by gw_backend) */
+		if (hctx->reused && 0 == con->file_started
+		    && buffer_string_is_empty(hctx->response)
+		    && chunkqueue_is_empty(hctx->rb)) return HANDLER_ERROR;
 		log_error_write(srv, __FILE__, __LINE__, "ssdsb",
 				"unexpected end-of-file (perhaps the fastcgi process died):",
 				"pid:", hctx->proc->pid,
@@ -437,6 +444,15 @@ static handler_t fcgi_recv_parse(server *srv, connection *con, struct http_respo
 			break;
 		case FCGI_END_REQUEST:
 			fin = 1;
+			/* connection may be reused if FCGI_KEEP_CONN was sent and
+			 * backend sent nothing past the end of this request */
+			if (hctx->host->keep_alive_max_idle
+			    && packet.request_id == hctx->request_id
+			    && buffer_string_length(packet.b) >= sizeof(FCGI_EndRequestBody)
+			    && ((FCGI_EndRequestBody *)packet.b->ptr)->protocolStatus == FCGI_REQUEST_COMPLETE
+			    && chunkqueue_is_empty(hctx->rb)) {
+				hctx->keep_alive = 1;
+			}
 			break;
 		default:
 			log_error_write(srv, __FILE__, __LINE__, "sd",
@@ -447,15 +447,12 @@ static int magnet_reqhdr_pairs(lua_State *L) {
 }
 
 static int magnet_status_get(lua_State *L) {
-	data_integer *di;
 	server *srv = magnet_get_server(L);
 
 	/* __index: param 1 is the (empty) table the value was not found in */
 	const_buffer key = magnet_checkconstbuffer(L, 2);
 
-	di = status_counter_get_counter(srv, key.ptr, key.len);
-
-	lua_pushinteger(L, (lua_Integer)di->value);
+	lua_pushinteger(L, (lua_Integer)status_counter_get(srv, key.ptr, key.len));
 
 	return 1;
 }
@@ -475,7 +472,7 @@ static int magnet_status_set(lua_State *L) {
 static int magnet_status_pairs(lua_State *L) {
 	server *srv = magnet_get_server(L);
 
-	return magnet_array_pairs(L, srv->status);
+	return magnet_array_pairs(L, status_counter_totals(srv));
 }
 
 typedef struct {
@@ -1,8 +1,19 @@
 #include "first.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "sys-mmap.h"
+
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #ifndef USE_OPENSSL_KERBEROS
 #ifndef OPENSSL_NO_KRB5
@@ -14,6 +25,12 @@
 #include <openssl/bn.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L \
+ && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
 #ifndef OPENSSL_NO_DH
 #include <openssl/dh.h>
 #endif
@@ -28,9 +45,17 @@
 #endif
 #endif
 
+#if defined(HAVE_PTHREAD_H) && OPENSSL_VERSION_NUMBER >= 0x10101000L \
+ && !defined(LIBRESSL_VERSION_NUMBER) && !defined(OPENSSL_NO_TLSEXT)
+#define MOD_OPENSSL_HANDSHAKE_THREADS
+#endif
+
 #include "base.h"
+#include "fdevent.h"
+#include "joblist.h"
 #include "log.h"
 #include "plugin.h"
+#include "status_counter.h"
 
 typedef struct {
     SSL_CTX *ssl_ctx; /* not patched */
@@ -48,11 +73,19 @@ typedef struct {
     unsigned short ssl_disable_client_renegotiation;
     unsigned short ssl_read_ahead;
     unsigned short ssl_log_noise;
+    unsigned int ssl_record_size_initial;  /* 0: TLS records up to 16k */
+    unsigned int ssl_record_size_threshold;
+    unsigned short ssl_record_size_idle;
 
     /*(used only during startup; not patched)*/
     unsigned short ssl_enabled; /* only interesting for setting up listening sockets. don't use at runtime */
     unsigned short ssl_honor_cipher_order; /* determine SSL cipher in server-preferred order, not client-order */
     unsigned short ssl_empty_fragments; /* whether to not set SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS */
+    unsigned short ssl_ktls; /* whether to set SSL_OP_ENABLE_KTLS (kernel TLS offload) */
+    unsigned int ssl_session_cache_size; /* global scope only */
+    unsigned int ssl_stek_rotate;        /* global scope only */
+    buffer *ssl_stek_file;               /* global scope only */
+    unsigned int ssl_handshake_threads;  /* global scope only */
     unsigned short ssl_use_sslv2;
     unsigned short ssl_use_sslv3;
     buffer *ssl_pemfile;
@@ -76,13 +109,26 @@ static plugin_data *plugin_data_singleton;
 #define LOCAL_SEND_BUFSIZE (64 * 1024)
 static char *local_send_buffer;
 
-typedef struct {
+typedef struct handler_ctx {
     SSL *ssl;
     connection *con;
     unsigned int renegotiations; /* count of SSL_CB_HANDSHAKE_START */
     int request_env_patched;
     plugin_config conf;
     server *srv;
+    off_t record_bytes;       /* bytes sent since start or idle gap */
+    time_t record_ts;         /* time of last write */
+    size_t record_retry;      /* length of SSL_write() to be repeated */
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    int handshake_job;       /* MOD_OPENSSL_HANDSHAKE_* */
+    int handshake_offloaded; /* handshake has been handed to a thread */
+    int handshake_sni;       /* SNI done in client hello callback */
+    int handshake_ret;       /* results of SSL_do_handshake() in thread */
+    int handshake_ssl_r;
+    int handshake_errno;
+    unsigned long handshake_err[4];
+    struct handler_ctx *handshake_next;
+  #endif
 } handler_ctx;
 
 
@@ -103,6 +149,733 @@ handler_ctx_free (handler_ctx *hctx)
 }
 
 
+/* TLS session cache and session ticket encryption keys (STEK) are kept in
+ * shared memory, which is created before workers are forked
+ * (server.max-worker), so that a session can be resumed on any worker */
+
+#define MOD_OPENSSL_STEK_MAX  4 /* keys in ssl.stek-file */
+#define MOD_OPENSSL_STEK_KEEP 3 /* generated keys kept for decryption */
+
+typedef struct {
+    unsigned char name[16];
+    unsigned char hmac_key[32];
+    unsigned char aes_key[32];
+} mod_openssl_stek; /* 80 bytes, as in ssl.stek-file */
+
+#define MOD_OPENSSL_SESSION_DATA 1920 /* larger sessions are not cached */
+
+typedef struct {
+    uint32_t hnext;  /* next in hash bucket or free list (index+1) */
+    uint32_t prev;   /* LRU list (index+1), towards most recently used */
+    uint32_t next;   /* LRU list (index+1), towards least recently used */
+    uint32_t id_len;
+    unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    time_t expires;
+    uint32_t len;
+    unsigned char data[MOD_OPENSSL_SESSION_DATA]; /* DER encoded session */
+} mod_openssl_session;
+
+typedef struct {
+  #ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+  #endif
+    time_t stek_ts;  /* next rotation, or mtime of ssl.stek-file */
+    ino_t stek_ino;
+    uint32_t nstek;
+    mod_openssl_stek stek[MOD_OPENSSL_STEK_MAX]; /* stek[0] encrypts */
+
+    uint32_t nsessions;
+    uint32_t head;   /* most recently used (index+1) */
+    uint32_t tail;   /* least recently used (index+1) */
+    uint32_t free;   /* free list (index+1) */
+    /* uint32_t buckets[nsessions]; mod_openssl_session sessions[nsessions];*/
+} mod_openssl_shm;
+
+#if defined(HAVE_PTHREAD_H) && defined(EOWNERDEAD) \
+ && defined(_POSIX_THREAD_ROBUST_PRIO_INHERIT)
+#define MOD_OPENSSL_SHM_ROBUST
+#endif
+
+static mod_openssl_shm *ssl_shm;
+static size_t ssl_shm_size;
+static int ssl_shm_mapped;
+static uint32_t *ssl_shm_buckets;
+static mod_openssl_session *ssl_shm_sessions;
+static int ssl_stat_hits, ssl_stat_misses, ssl_stat_stores, ssl_stat_evictions;
+
+
+static void
+mod_openssl_session_reset (void)
+{
+    mod_openssl_shm * const shm = ssl_shm;
+    memset(ssl_shm_buckets, 0, shm->nsessions * sizeof(uint32_t));
+    shm->head = shm->tail = 0;
+    shm->free = shm->nsessions ? 1 : 0;
+    for (uint32_t i = 0; i < shm->nsessions; ++i) {
+        ssl_shm_sessions[i].hnext = (i + 1 < shm->nsessions) ? i + 2 : 0;
+    }
+}
+
+
+static void
+mod_openssl_shm_lock (void)
+{
+  #ifdef HAVE_PTHREAD_H
+    int rc = pthread_mutex_lock(&ssl_shm->lock);
+   #ifdef MOD_OPENSSL_SHM_ROBUST
+    if (EOWNERDEAD == rc) {
+        /* a worker died while holding the lock; session cache might be
+         * inconsistent (keys are copied as a whole and are left as is) */
+        mod_openssl_session_reset();
+        pthread_mutex_consistent(&ssl_shm->lock);
+        rc = 0;
+    }
+   #endif
+    force_assert(0 == rc);
+  #endif
+}
+
+
+static void
+mod_openssl_shm_unlock (void)
+{
+  #ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&ssl_shm->lock);
+  #endif
+}
+
+
+static uint32_t *
+mod_openssl_session_find (const unsigned char *id, uint32_t len)
+{
+    /* returns link to entry (index+1), or to 0 at end of hash bucket chain */
+    uint32_t h = 5381; /* djbhash */
+    uint32_t *x;
+    for (uint32_t i = 0; i < len; ++i) h = ((h << 5) + h) ^ id[i];
+    x = ssl_shm_buckets + (h % ssl_shm->nsessions);
+    while (*x) {
+        mod_openssl_session * const e = ssl_shm_sessions + *x - 1;
+        if (e->id_len == len && 0 == memcmp(e->id, id, len)) break;
+        x = &e->hnext;
+    }
+    return x;
+}
+
+
+static void
+mod_openssl_session_lru_unlink (uint32_t n)
+{
+    mod_openssl_session * const e = ssl_shm_sessions + n - 1;
+    if (e->prev)
+        ssl_shm_sessions[e->prev - 1].next = e->next;
+    else
+        ssl_shm->head = e->next;
+    if (e->next)
+        ssl_shm_sessions[e->next - 1].prev = e->prev;
+    else
+        ssl_shm->tail = e->prev;
+}
+
+
+static void
+mod_openssl_session_lru_push (uint32_t n)
+{
+    mod_openssl_session * const e = ssl_shm_sessions + n - 1;
+    e->prev = 0;
+    e->next = ssl_shm->head;
+    if (ssl_shm->head)
+        ssl_shm_sessions[ssl_shm->head - 1].prev = n;
+    else
+        ssl_shm->tail = n;
+    ssl_shm->head = n;
+}
+
+
+static void
+mod_openssl_session_remove (uint32_t *x)
+{
+    const uint32_t n = *x;
+    mod_openssl_session * const e = ssl_shm_sessions + n - 1;
+    *x = e->hnext;
+    mod_openssl_session_lru_unlink(n);
+    e->hnext = ssl_shm->free;
+    ssl_shm->free = n;
+}
+
+
+static int
+mod_openssl_session_new_cb (SSL *ssl, SSL_SESSION *sess)
+{
+    handler_ctx *hctx = (handler_ctx *) SSL_get_app_data(ssl);
+    unsigned char buf[MOD_OPENSSL_SESSION_DATA];
+    unsigned char *d = buf;
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    int len;
+    uint32_t *x, n;
+
+  #ifdef TLS1_3_VERSION
+    /* TLS 1.3 resumes with (stateless) session tickets instead */
+    if (SSL_version(ssl) >= TLS1_3_VERSION
+        && !(SSL_get_options(ssl) & SSL_OP_NO_TICKET)) return 0;
+  #endif
+
+    len = i2d_SSL_SESSION(sess, NULL);
+    if (len <= 0 || len > (int)sizeof(buf)
+        || 0 == id_len || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) return 0;
+    if (len != i2d_SSL_SESSION(sess, &d)) return 0;
+
+    mod_openssl_shm_lock();
+    x = mod_openssl_session_find(id, id_len);
+    if (*x) mod_openssl_session_remove(x);
+    if (0 == ssl_shm->free) {
+        /* evict least recently used session */
+        mod_openssl_session * const t = ssl_shm_sessions + ssl_shm->tail - 1;
+        mod_openssl_session_remove(mod_openssl_session_find(t->id,t->id_len));
+        status_counter_slot_add(hctx->srv, ssl_stat_evictions, 1);
+    }
+    n = ssl_shm->free;
+    {
+        mod_openssl_session * const e = ssl_shm_sessions + n - 1;
+        ssl_shm->free = e->hnext;
+        e->id_len = id_len;
+        memcpy(e->id, id, id_len);
+        e->expires = (time_t)(SSL_SESSION_get_time(sess)
+                              + SSL_SESSION_get_timeout(sess));
+        e->len = (uint32_t)len;
+        memcpy(e->data, buf, (size_t)len);
+        x = mod_openssl_session_find(id, id_len); /*(end of bucket chain)*/
+        e->hnext = 0;
+        *x = n;
+        mod_openssl_session_lru_push(n);
+    }
+    /*(counters updated under lock; callbacks may run in handshake threads)*/
+    status_counter_slot_add(hctx->srv, ssl_stat_stores, 1);
+    mod_openssl_shm_unlock();
+
+    return 0; /* no reference to sess is kept */
+}
+
+
+static SSL_SESSION *
+mod_openssl_session_get_cb (SSL *ssl,
+                          #if OPENSSL_VERSION_NUMBER >= 0x10100000L
+                            const
+                          #endif
+                            unsigned char *id, int id_len, int *copy)
+{
+    handler_ctx *hctx = (handler_ctx *) SSL_get_app_data(ssl);
+    unsigned char buf[MOD_OPENSSL_SESSION_DATA];
+    const unsigned char *d = buf;
+    SSL_SESSION *sess = NULL;
+    uint32_t len = 0;
+
+    *copy = 0;
+    if (id_len > 0 && id_len <= SSL_MAX_SSL_SESSION_ID_LENGTH) {
+        uint32_t *x;
+        mod_openssl_shm_lock();
+        x = mod_openssl_session_find(id, (uint32_t)id_len);
+        if (*x) {
+            const uint32_t n = *x;
+            mod_openssl_session * const e = ssl_shm_sessions + n - 1;
+            if (e->expires > hctx->srv->cur_ts) {
+                len = e->len;
+                memcpy(buf, e->data, len);
+                mod_openssl_session_lru_unlink(n);
+                mod_openssl_session_lru_push(n);
+            }
+            else {
+                mod_openssl_session_remove(x);
+            }
+        }
+        if (len) sess = d2i_SSL_SESSION(NULL, &d, (long)len);
+        status_counter_slot_add(hctx->srv,
+                                sess ? ssl_stat_hits : ssl_stat_misses, 1);
+        mod_openssl_shm_unlock();
+    }
+    else {
+        mod_openssl_shm_lock();
+        status_counter_slot_add(hctx->srv, ssl_stat_misses, 1);
+        mod_openssl_shm_unlock();
+    }
+
+    return sess;
+}
+
+
+static void
+mod_openssl_session_remove_cb (SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(sess, &id_len);
+    uint32_t *x;
+    UNUSED(ctx);
+
+    if (0 == id_len || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH) return;
+
+    mod_openssl_shm_lock();
+    x = mod_openssl_session_find(id, id_len);
+    if (*x) mod_openssl_session_remove(x);
+    mod_openssl_shm_unlock();
+}
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L \
+ && !defined(LIBRESSL_VERSION_NUMBER)
+#define MOD_OPENSSL_STEK_CB
+static int
+mod_openssl_stek_cb (SSL *ssl, unsigned char *name, unsigned char *iv,
+                     EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *mctx, int enc)
+#elif defined(SSL_CTX_set_tlsext_ticket_key_cb)
+#define MOD_OPENSSL_STEK_CB
+static int
+mod_openssl_stek_cb (SSL *ssl, unsigned char *name, unsigned char *iv,
+                     EVP_CIPHER_CTX *ectx, HMAC_CTX *mctx, int enc)
+#endif
+#ifdef MOD_OPENSSL_STEK_CB
+{
+    mod_openssl_stek k;
+    int rc = 0;
+    UNUSED(ssl);
+
+    mod_openssl_shm_lock();
+    if (enc) {
+        if (ssl_shm->nstek) {
+            k = ssl_shm->stek[0];
+            rc = 1;
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < ssl_shm->nstek; ++i) {
+            if (0 == memcmp(ssl_shm->stek[i].name, name, sizeof(k.name))) {
+                k = ssl_shm->stek[i];
+                rc = (0 == i) ? 1 : 2; /* 2: renew ticket with current key */
+                break;
+            }
+        }
+    }
+    mod_openssl_shm_unlock();
+    if (0 == rc) return 0; /* unknown (or expired) key: full handshake */
+
+    if (enc) {
+        memcpy(name, k.name, sizeof(k.name));
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+            rc = -1;
+    }
+    if (rc > 0 && 1 != EVP_CipherInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+                                         k.aes_key, iv, enc))
+        rc = -1;
+    if (rc > 0) {
+      #if OPENSSL_VERSION_NUMBER >= 0x30000000L \
+       && !defined(LIBRESSL_VERSION_NUMBER)
+        OSSL_PARAM params[2];
+        params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                     (char *)"sha256", 0);
+        params[1] = OSSL_PARAM_construct_end();
+        if (1 != EVP_MAC_init(mctx, k.hmac_key, sizeof(k.hmac_key), params))
+            rc = -1;
+      #else
+        if (1 != HMAC_Init_ex(mctx, k.hmac_key, sizeof(k.hmac_key),
+                              EVP_sha256(), NULL))
+            rc = -1;
+      #endif
+    }
+
+    OPENSSL_cleanse(&k, sizeof(k));
+    return rc;
+}
+#endif
+
+
+static int
+mod_openssl_stek_load (server *srv, const buffer *fn)
+{
+    unsigned char buf[sizeof(mod_openssl_stek) * MOD_OPENSSL_STEK_MAX + 1];
+    struct stat st;
+    ssize_t rd = -1;
+    int fd = fdevent_open_cloexec(fn->ptr, O_RDONLY, 0);
+
+    if (-1 == fd || 0 != fstat(fd, &st)
+        || -1 == (rd = read(fd, buf, sizeof(buf)))) {
+        log_error_write(srv, __FILE__, __LINE__, "sbss",
+                        "SSL: reading ssl.stek-file", fn, "failed:",
+                        strerror(errno));
+        if (-1 != fd) close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (0 == rd || 0 != rd % sizeof(mod_openssl_stek)
+        || rd > (ssize_t)(sizeof(mod_openssl_stek) * MOD_OPENSSL_STEK_MAX)) {
+        log_error_write(srv, __FILE__, __LINE__, "sbsds",
+                        "SSL: ssl.stek-file", fn, "must contain 1 to",
+                        MOD_OPENSSL_STEK_MAX, "keys of 80 bytes each");
+        OPENSSL_cleanse(buf, sizeof(buf));
+        return -1;
+    }
+
+    mod_openssl_shm_lock();
+    memcpy(ssl_shm->stek, buf, (size_t)rd);
+    ssl_shm->nstek = (uint32_t)(rd / sizeof(mod_openssl_stek));
+    ssl_shm->stek_ts = st.st_mtime;
+    ssl_shm->stek_ino = st.st_ino;
+    mod_openssl_shm_unlock();
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return 0;
+}
+
+
+static int
+mod_openssl_stek_rotate (server *srv, unsigned int interval)
+{
+    mod_openssl_stek k;
+
+    if (RAND_bytes((unsigned char *)&k, sizeof(k)) <= 0) {
+        log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+                        "generating session ticket key failed");
+        return -1;
+    }
+
+    mod_openssl_shm_lock();
+    /* another worker might have rotated the keys already */
+    if (srv->cur_ts >= ssl_shm->stek_ts) {
+        uint32_t n = ssl_shm->nstek < MOD_OPENSSL_STEK_KEEP
+          ? ssl_shm->nstek
+          : MOD_OPENSSL_STEK_KEEP - 1;
+        memmove(ssl_shm->stek+1, ssl_shm->stek, n * sizeof(mod_openssl_stek));
+        ssl_shm->stek[0] = k;
+        ssl_shm->nstek = n + 1;
+        ssl_shm->stek_ts = srv->cur_ts + interval;
+    }
+    mod_openssl_shm_unlock();
+
+    OPENSSL_cleanse(&k, sizeof(k));
+    return 0;
+}
+
+
+static int
+mod_openssl_shm_init (server *srv, plugin_config *s)
+{
+    const uint32_t n = s->ssl_session_cache_size;
+    const size_t hdr_size = (sizeof(mod_openssl_shm) + 63) & ~(size_t)63;
+    const size_t buckets_size = (n * sizeof(uint32_t) + 63) & ~(size_t)63;
+    void *p = MAP_FAILED;
+
+    ssl_shm_size = hdr_size + buckets_size + n * sizeof(mod_openssl_session);
+  #if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANON) && defined(HAVE_PTHREAD_H)
+    p = mmap(NULL, ssl_shm_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANON, -1, 0);
+  #endif
+    if (MAP_FAILED == p) {
+        /* sessions and keys are not shared between workers */
+        p = calloc(1, ssl_shm_size);
+        force_assert(p);
+        ssl_shm_mapped = 0;
+    }
+    else {
+        ssl_shm_mapped = 1;
+    }
+
+    ssl_shm = p;
+    ssl_shm_buckets = (uint32_t *)((char *)p + hdr_size);
+    ssl_shm_sessions = (mod_openssl_session *)
+      ((char *)p + hdr_size + buckets_size);
+
+  #ifdef HAVE_PTHREAD_H
+    {
+        pthread_mutexattr_t attr;
+        int rc;
+        pthread_mutexattr_init(&attr);
+        if (ssl_shm_mapped)
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+       #ifdef MOD_OPENSSL_SHM_ROBUST
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+       #endif
+        rc = pthread_mutex_init(&ssl_shm->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if (0 != rc) {
+            log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
+                            "initializing session cache lock failed");
+            return -1;
+        }
+    }
+  #endif
+
+    ssl_shm->nsessions = n;
+    mod_openssl_session_reset();
+
+    if (n) {
+        ssl_stat_hits =
+          status_counter_slot(srv, CONST_STR_LEN("ssl.session-cache.hits"));
+        ssl_stat_misses =
+          status_counter_slot(srv, CONST_STR_LEN("ssl.session-cache.misses"));
+        ssl_stat_stores =
+          status_counter_slot(srv, CONST_STR_LEN("ssl.session-cache.stores"));
+        ssl_stat_evictions =
+          status_counter_slot(srv, CONST_STR_LEN("ssl.session-cache.evictions"));
+    }
+
+    return (!buffer_string_is_empty(s->ssl_stek_file))
+      ? mod_openssl_stek_load(srv, s->ssl_stek_file)
+      : mod_openssl_stek_rotate(srv, s->ssl_stek_rotate);
+}
+
+
+static void
+mod_openssl_shm_free (void)
+{
+    if (NULL == ssl_shm) return;
+    if (!ssl_shm_mapped) {
+        OPENSSL_cleanse(ssl_shm->stek, sizeof(ssl_shm->stek));
+        free(ssl_shm);
+    }
+  #ifdef HAVE_SYS_MMAN_H
+    else
+        munmap((void *)ssl_shm, ssl_shm_size);
+  #endif
+    ssl_shm = NULL;
+}
+
+
+#ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+
+/* ssl.handshake-threads: after the ClientHello has been read (and SNI has
+ * been processed) in the server thread, the handshake is continued in a
+ * handshake thread up to the end of the first server flight, which includes
+ * the private key operation.  The handshake thread returns the connection
+ * to the server thread through a pipe registered in fdevents.  The rest of
+ * the handshake (e.g. client Finished) is cheap and done as before. */
+
+enum {
+    MOD_OPENSSL_HANDSHAKE_NONE,
+    MOD_OPENSSL_HANDSHAKE_QUEUED,  /* in ssl_handshakes.queue */
+    MOD_OPENSSL_HANDSHAKE_RUNNING, /* in a handshake thread */
+    MOD_OPENSSL_HANDSHAKE_DONE,    /* in ssl_handshakes.done */
+    MOD_OPENSSL_HANDSHAKE_RESULT   /* back in server thread; result unused */
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;
+    pthread_cond_t done_cond;
+    handler_ctx *queue;
+    handler_ctx *queue_last;
+    handler_ctx *done;
+    pthread_t *threads;
+    unsigned int nthreads;
+    int shutdown;
+    int failed;
+    int fds[2];
+    int fde_ndx;
+} ssl_handshakes;
+
+
+static void *
+mod_openssl_handshake_thread (void *arg)
+{
+    UNUSED(arg);
+
+    pthread_mutex_lock(&ssl_handshakes.mutex);
+    for (;;) {
+        handler_ctx *hctx;
+        int r, e;
+
+        while (NULL == ssl_handshakes.queue && !ssl_handshakes.shutdown)
+            pthread_cond_wait(&ssl_handshakes.queued, &ssl_handshakes.mutex);
+        if (ssl_handshakes.shutdown) break;
+
+        hctx = ssl_handshakes.queue;
+        ssl_handshakes.queue = hctx->handshake_next;
+        if (NULL == ssl_handshakes.queue) ssl_handshakes.queue_last = NULL;
+        hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_RUNNING;
+        pthread_mutex_unlock(&ssl_handshakes.mutex);
+
+        /* (OpenSSL error queue is per thread) */
+        ERR_clear_error();
+        errno = 0;
+        r = SSL_do_handshake(hctx->ssl);
+        e = errno;
+        hctx->handshake_ret = r;
+        hctx->handshake_ssl_r = (1 == r)
+          ? SSL_ERROR_NONE
+          : SSL_get_error(hctx->ssl, r);
+        hctx->handshake_errno = e;
+        for (size_t i = 0; i < sizeof(hctx->handshake_err)/sizeof(*hctx->handshake_err); ++i)
+            hctx->handshake_err[i] = ERR_get_error();
+        ERR_clear_error();
+
+        pthread_mutex_lock(&ssl_handshakes.mutex);
+        hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_DONE;
+        hctx->handshake_next = ssl_handshakes.done;
+        ssl_handshakes.done = hctx;
+        pthread_cond_broadcast(&ssl_handshakes.done_cond);
+        if (hctx->handshake_next == NULL) {
+            /* wake server thread (pipe is non-blocking; already woken if
+             * pipe is full or if the list was not empty) */
+            ssize_t wr = write(ssl_handshakes.fds[1], "", 1);
+            UNUSED(wr);
+        }
+    }
+    pthread_mutex_unlock(&ssl_handshakes.mutex);
+
+    return NULL;
+}
+
+
+static handler_t
+mod_openssl_handshake_fdevent (server *srv, void *ctx, int revents)
+{
+    handler_ctx *hctx;
+    char buf[64];
+    UNUSED(ctx);
+    UNUSED(revents);
+
+    while (read(ssl_handshakes.fds[0], buf, sizeof(buf)) > 0) ;
+
+    pthread_mutex_lock(&ssl_handshakes.mutex);
+    hctx = ssl_handshakes.done;
+    ssl_handshakes.done = NULL;
+    for (handler_ctx *h = hctx; NULL != h; h = h->handshake_next)
+        h->handshake_job = MOD_OPENSSL_HANDSHAKE_RESULT;
+    pthread_mutex_unlock(&ssl_handshakes.mutex);
+
+    for (; NULL != hctx; hctx = hctx->handshake_next) {
+        hctx->con->is_readable = 1;
+        joblist_append(srv, hctx->con);
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
+static int
+mod_openssl_handshake_start (server *srv, unsigned int nthreads)
+{
+    sigset_t sigs, osigs;
+
+    if (0 != pipe(ssl_handshakes.fds)) {
+        log_error_write(srv, __FILE__, __LINE__, "ss",
+                        "SSL: ssl.handshake-threads: pipe failed:",
+                        strerror(errno));
+        return -1;
+    }
+    fdevent_fcntl_set_nb_cloexec(srv->ev, ssl_handshakes.fds[0]);
+    fdevent_fcntl_set_nb_cloexec(srv->ev, ssl_handshakes.fds[1]);
+
+    pthread_mutex_init(&ssl_handshakes.mutex, NULL);
+    pthread_cond_init(&ssl_handshakes.queued, NULL);
+    pthread_cond_init(&ssl_handshakes.done_cond, NULL);
+    ssl_handshakes.threads = calloc(nthreads, sizeof(pthread_t));
+    force_assert(ssl_handshakes.threads);
+
+    /* signals are for the server thread */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &osigs);
+    for (unsigned int i = 0; i < nthreads; ++i) {
+        int rc = pthread_create(ssl_handshakes.threads + i, NULL,
+                                mod_openssl_handshake_thread, NULL);
+        if (0 != rc) {
+            log_error_write(srv, __FILE__, __LINE__, "ss",
+                            "SSL: starting handshake thread failed:",
+                            strerror(rc));
+            break;
+        }
+        ++ssl_handshakes.nthreads;
+    }
+    pthread_sigmask(SIG_SETMASK, &osigs, NULL);
+
+    ssl_handshakes.fde_ndx = -1;
+    fdevent_register(srv->ev, ssl_handshakes.fds[0],
+                     mod_openssl_handshake_fdevent, NULL);
+    fdevent_event_set(srv->ev, &ssl_handshakes.fde_ndx,
+                      ssl_handshakes.fds[0], FDEVENT_IN);
+
+    return 0 != ssl_handshakes.nthreads ? 0 : -1;
+}
+
+
+static void
+mod_openssl_handshake_stop (server *srv)
+{
+    if (NULL == ssl_handshakes.threads) return;
+
+    pthread_mutex_lock(&ssl_handshakes.mutex);
+    ssl_handshakes.shutdown = 1;
+    pthread_cond_broadcast(&ssl_handshakes.queued);
+    pthread_mutex_unlock(&ssl_handshakes.mutex);
+    for (unsigned int i = 0; i < ssl_handshakes.nthreads; ++i)
+        pthread_join(ssl_handshakes.threads[i], NULL);
+
+    fdevent_event_del(srv->ev, &ssl_handshakes.fde_ndx, ssl_handshakes.fds[0]);
+    fdevent_unregister(srv->ev, ssl_handshakes.fds[0]);
+    close(ssl_handshakes.fds[0]);
+    close(ssl_handshakes.fds[1]);
+    pthread_cond_destroy(&ssl_handshakes.done_cond);
+    pthread_cond_destroy(&ssl_handshakes.queued);
+    pthread_mutex_destroy(&ssl_handshakes.mutex);
+    free(ssl_handshakes.threads);
+    memset(&ssl_handshakes, 0, sizeof(ssl_handshakes));
+}
+
+
+static void
+mod_openssl_handshake_submit (handler_ctx *hctx)
+{
+    hctx->handshake_offloaded = 1;
+    hctx->handshake_next = NULL;
+
+    pthread_mutex_lock(&ssl_handshakes.mutex);
+    hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_QUEUED;
+    if (ssl_handshakes.queue_last)
+        ssl_handshakes.queue_last->handshake_next = hctx;
+    else
+        ssl_handshakes.queue = hctx;
+    ssl_handshakes.queue_last = hctx;
+    pthread_cond_signal(&ssl_handshakes.queued);
+    pthread_mutex_unlock(&ssl_handshakes.mutex);
+}
+
+
+/* wait for handshake thread to release hctx (before SSL or hctx is used) */
+static void
+mod_openssl_handshake_wait (handler_ctx *hctx)
+{
+    handler_ctx **h;
+
+    switch (hctx->handshake_job) {
+    case MOD_OPENSSL_HANDSHAKE_NONE:
+        return;
+    case MOD_OPENSSL_HANDSHAKE_RESULT:
+        hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_NONE;
+        return;
+    default:
+        break;
+    }
+
+    pthread_mutex_lock(&ssl_handshakes.mutex);
+    if (MOD_OPENSSL_HANDSHAKE_QUEUED == hctx->handshake_job) {
+        handler_ctx *prev = NULL;
+        for (h = &ssl_handshakes.queue; *h != hctx; h = &(*h)->handshake_next)
+            prev = *h;
+        *h = hctx->handshake_next;
+        if (ssl_handshakes.queue_last == hctx)
+            ssl_handshakes.queue_last = prev;
+    }
+    while (MOD_OPENSSL_HANDSHAKE_RUNNING == hctx->handshake_job)
+        pthread_cond_wait(&ssl_handshakes.done_cond, &ssl_handshakes.mutex);
+    if (MOD_OPENSSL_HANDSHAKE_DONE == hctx->handshake_job) {
+        for (h = &ssl_handshakes.done; *h != hctx; h = &(*h)->handshake_next) ;
+        *h = hctx->handshake_next;
+    }
+    hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_NONE;
+    pthread_mutex_unlock(&ssl_handshakes.mutex);
+}
+
+#endif
+
+
 INIT_FUNC(mod_openssl_init)
 {
     plugin_data_singleton = (plugin_data *)calloc(1, sizeof(plugin_data));
@@ -115,6 +888,10 @@ FREE_FUNC(mod_openssl_free)
     plugin_data *p = p_d;
     if (!p) return HANDLER_GO_ON;
 
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    mod_openssl_handshake_stop(srv);
+  #endif
+
     if (p->config_storage) {
         for (size_t i = 0; i < srv->config_context->used; ++i) {
             plugin_config *s = p->config_storage[i];
@@ -129,6 +906,7 @@ FREE_FUNC(mod_openssl_free)
             buffer_free(s->ssl_dh_file);
             buffer_free(s->ssl_ec_curve);
             buffer_free(s->ssl_verifyclient_username);
+            buffer_free(s->ssl_stek_file);
             if (copy) continue;
             SSL_CTX_free(s->ssl_ctx);
             EVP_PKEY_free(s->ssl_pemfile_pkey);
@@ -164,6 +942,8 @@ FREE_FUNC(mod_openssl_free)
         free(local_send_buffer);
     }
 
+    mod_openssl_shm_free();
+
     free(p);
 
     return HANDLER_GO_ON;
@@ -297,16 +1077,13 @@ verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 static int mod_openssl_patch_connection (server *srv, connection *con, handler_ctx *hctx);
 
 static int
-network_ssl_servername_callback (SSL *ssl, int *al, server *srv)
+mod_openssl_SNI (SSL *ssl, server *srv, handler_ctx *hctx,
+                 const char *servername, size_t len)
 {
-    const char *servername;
-    handler_ctx *hctx = (handler_ctx *) SSL_get_app_data(ssl);
     connection *con = hctx->con;
-    UNUSED(al);
 
     buffer_copy_string(con->uri.scheme, "https");
 
-    servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
     if (NULL == servername) {
 #if 0
         /* this "error" just means the client didn't support it */
@@ -316,7 +1093,7 @@ network_ssl_servername_callback (SSL *ssl, int *al, server *srv)
         return SSL_TLSEXT_ERR_NOACK;
     }
     /* use SNI to patch mod_openssl config and then reset COMP_HTTP_HOST */
-    buffer_copy_string(con->uri.authority, servername);
+    buffer_copy_string_len(con->uri.authority, servername, len);
     buffer_to_lower(con->uri.authority);
 
     con->conditional_is_valid[COMP_HTTP_SCHEME] = 1;
@@ -382,6 +1159,62 @@ network_ssl_servername_callback (SSL *ssl, int *al, server *srv)
 
     return SSL_TLSEXT_ERR_OK;
 }
+
+static int
+network_ssl_servername_callback (SSL *ssl, int *al, server *srv)
+{
+    handler_ctx *hctx = (handler_ctx *) SSL_get_app_data(ssl);
+    const char *servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    UNUSED(al);
+
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    /* already done by mod_openssl_client_hello_cb() in the server thread */
+    if (hctx->handshake_sni)
+        return NULL != servername ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
+  #endif
+
+    return mod_openssl_SNI(ssl, srv, hctx, servername,
+                           NULL != servername ? strlen(servername) : 0);
+}
+
+#ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+static int
+mod_openssl_client_hello_cb (SSL *ssl, int *al, void *arg)
+{
+    handler_ctx *hctx = (handler_ctx *) SSL_get_app_data(ssl);
+    const unsigned char *p;
+    const char *servername = NULL;
+    size_t len = 0, n;
+    UNUSED(arg);
+
+    /* called again in the handshake thread when handshake is continued */
+    if (hctx->handshake_offloaded) return SSL_CLIENT_HELLO_SUCCESS;
+
+    /* SNI patches the connection config (config_check_cond() and logging
+     * use shared server buffers), so SNI is processed in the server thread,
+     * before the handshake is handed to a handshake thread */
+    if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_server_name, &p, &n)) {
+        /* server_name_list: length(2), name_type(1), length(2), HostName */
+        if (n < 5 || (size_t)((p[0] << 8) | p[1]) + 2 != n
+            || TLSEXT_NAMETYPE_host_name != p[2]
+            || (len = (size_t)((p[3] << 8) | p[4])) + 5 > n
+            || 0 == len || NULL != memchr(p + 5, '\0', len)) {
+            *al = SSL_AD_DECODE_ERROR;
+            return SSL_CLIENT_HELLO_ERROR;
+        }
+        servername = (const char *)p + 5;
+    }
+
+    if (SSL_TLSEXT_ERR_OK != mod_openssl_SNI(ssl,hctx->srv,hctx,servername,len)
+        && NULL != servername) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+
+    hctx->handshake_sni = 1;
+    return SSL_CLIENT_HELLO_RETRY;
+}
+#endif
 #endif
 
 
@@ -638,6 +1471,10 @@ network_init_ssl (server *srv, void *p_d)
 
         if (buffer_string_is_empty(s->ssl_pemfile) || !s->ssl_enabled) continue;
 
+        if (NULL == ssl_shm
+            && 0 != mod_openssl_shm_init(srv, p->config_storage[0]))
+            return -1;
+
         if (NULL == (s->ssl_ctx = SSL_CTX_new(SSLv23_server_method()))) {
             log_error_write(srv, __FILE__, __LINE__, "ss", "SSL:",
                             ERR_error_string(ERR_get_error(), NULL));
@@ -654,6 +1491,22 @@ network_init_ssl (server *srv, void *p_d)
             return -1;
         }
 
+        if (ssl_shm->nsessions) {
+            SSL_CTX_set_session_cache_mode(s->ssl_ctx, SSL_SESS_CACHE_SERVER
+                                         | SSL_SESS_CACHE_NO_INTERNAL);
+            SSL_CTX_sess_set_new_cb(s->ssl_ctx, mod_openssl_session_new_cb);
+            SSL_CTX_sess_set_get_cb(s->ssl_ctx, mod_openssl_session_get_cb);
+            SSL_CTX_sess_set_remove_cb(s->ssl_ctx,
+                                       mod_openssl_session_remove_cb);
+        }
+
+      #if OPENSSL_VERSION_NUMBER >= 0x30000000L \
+       && !defined(LIBRESSL_VERSION_NUMBER)
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(s->ssl_ctx, mod_openssl_stek_cb);
+      #elif defined(MOD_OPENSSL_STEK_CB)
+        SSL_CTX_set_tlsext_ticket_key_cb(s->ssl_ctx, mod_openssl_stek_cb);
+      #endif
+
         if (s->ssl_empty_fragments) {
           #ifdef SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS
             ssloptions &= ~SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
@@ -665,6 +1518,16 @@ network_init_ssl (server *srv, void *p_d)
           #endif
         }
 
+        if (s->ssl_ktls) {
+          #if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+            ssloptions |= SSL_OP_ENABLE_KTLS;
+          #else
+            log_error_write(srv, __FILE__, __LINE__, "ss", "WARNING: SSL:",
+                            "'ktls' not supported by the openssl version "
+                            "used to compile lighttpd with");
+          #endif
+        }
+
         SSL_CTX_set_options(s->ssl_ctx, ssloptions);
         SSL_CTX_set_info_callback(s->ssl_ctx, ssl_info_callback);
 
@@ -881,8 +1744,23 @@ network_init_ssl (server *srv, void *p_d)
             return -1;
         }
       #endif
+
+      #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+        if (p->config_storage[0]->ssl_handshake_threads)
+            SSL_CTX_set_client_hello_cb(s->ssl_ctx,
+                                        mod_openssl_client_hello_cb, NULL);
+      #endif
     }
 
+  #ifndef MOD_OPENSSL_HANDSHAKE_THREADS
+    if (p->config_storage[0]->ssl_handshake_threads) {
+        log_error_write(srv, __FILE__, __LINE__, "ss", "WARNING: SSL:",
+                        "'handshake-threads' not supported by the openssl "
+                        "version used to compile lighttpd with (or without "
+                        "pthreads); handshakes are done in the server thread");
+    }
+  #endif
+
     return 0;
 }
 
@@ -911,6 +1789,14 @@ SETDEFAULTS_FUNC(mod_openssl_set_defaults)
         { "ssl.use-sslv3",                     NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 17 */
         { "ssl.ca-crl-file",                   NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_CONNECTION }, /* 18 */
         { "ssl.ca-dn-file",                    NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_CONNECTION }, /* 19 */
+        { "ssl.ktls",                          NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 20 */
+        { "ssl.session-cache-size",            NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER },     /* 21 */
+        { "ssl.stek-file",                     NULL, T_CONFIG_STRING,  T_CONFIG_SCOPE_SERVER },     /* 22 */
+        { "ssl.stek-rotate",                   NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER },     /* 23 */
+        { "ssl.handshake-threads",             NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_SERVER },     /* 24 */
+        { "ssl.record-size-initial",           NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_CONNECTION }, /* 25 */
+        { "ssl.record-size-threshold",         NULL, T_CONFIG_INT,     T_CONFIG_SCOPE_CONNECTION }, /* 26 */
+        { "ssl.record-size-idle",              NULL, T_CONFIG_SHORT,   T_CONFIG_SCOPE_CONNECTION }, /* 27 */
         { NULL,                         NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
     };
 
@@ -932,6 +1818,14 @@ SETDEFAULTS_FUNC(mod_openssl_set_defaults)
         s->ssl_ec_curve  = buffer_init();
         s->ssl_honor_cipher_order = 1;
         s->ssl_empty_fragments = 0;
+        s->ssl_ktls = 0;
+        s->ssl_session_cache_size = 0;
+        s->ssl_stek_rotate = 3600;
+        s->ssl_stek_file = buffer_init();
+        s->ssl_handshake_threads = 0;
+        s->ssl_record_size_initial = 0;
+        s->ssl_record_size_threshold = 65536;
+        s->ssl_record_size_idle = 1;
         s->ssl_use_sslv2 = 0;
         s->ssl_use_sslv3 = 0;
         s->ssl_verifyclient = 0;
@@ -964,6 +1858,14 @@ SETDEFAULTS_FUNC(mod_openssl_set_defaults)
         cv[17].destination = &(s->ssl_use_sslv3);
         cv[18].destination = s->ssl_ca_crl_file;
         cv[19].destination = s->ssl_ca_dn_file;
+        cv[20].destination = &(s->ssl_ktls);
+        cv[21].destination = &(s->ssl_session_cache_size);
+        cv[22].destination = s->ssl_stek_file;
+        cv[23].destination = &(s->ssl_stek_rotate);
+        cv[24].destination = &(s->ssl_handshake_threads);
+        cv[25].destination = &(s->ssl_record_size_initial);
+        cv[26].destination = &(s->ssl_record_size_threshold);
+        cv[27].destination = &(s->ssl_record_size_idle);
 
         p->config_storage[i] = s;
 
@@ -971,6 +1873,15 @@ SETDEFAULTS_FUNC(mod_openssl_set_defaults)
             return HANDLER_ERROR;
         }
 
+        if (s->ssl_record_size_initial
+            && (s->ssl_record_size_initial < 512
+                || s->ssl_record_size_initial > 16384)) {
+            log_error_write(srv, __FILE__, __LINE__, "sd",
+                            "ssl.record-size-initial must be 0 or between "
+                            "512 and 16384:", s->ssl_record_size_initial);
+            return HANDLER_ERROR;
+        }
+
         if (0 != i && s->ssl_enabled && buffer_string_is_empty(s->ssl_pemfile)){
             /* inherit ssl settings from global scope (in network_init_ssl())
              * (if only ssl.engine = "enable" and no other ssl.* settings)*/
@@ -1015,6 +1926,7 @@ mod_openssl_patch_connection (server *srv, connection *con, handler_ctx *hctx)
     /*PATCH(ssl_ec_curve);*//*(not patched)*/
     /*PATCH(ssl_honor_cipher_order);*//*(not patched)*/
     /*PATCH(ssl_empty_fragments);*//*(not patched)*/
+    /*PATCH(ssl_ktls);*//*(not patched)*/
     /*PATCH(ssl_use_sslv2);*//*(not patched)*/
     /*PATCH(ssl_use_sslv3);*//*(not patched)*/
 
@@ -1025,6 +1937,9 @@ mod_openssl_patch_connection (server *srv, connection *con, handler_ctx *hctx)
     PATCH(ssl_verifyclient_export_cert);
     PATCH(ssl_disable_client_renegotiation);
     PATCH(ssl_read_ahead);
+    PATCH(ssl_record_size_initial);
+    PATCH(ssl_record_size_threshold);
+    PATCH(ssl_record_size_idle);
 
     PATCH(ssl_log_noise);
 
@@ -1064,6 +1979,12 @@ mod_openssl_patch_connection (server *srv, connection *con, handler_ctx *hctx)
                 PATCH(ssl_disable_client_renegotiation);
             } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.read-ahead"))) {
                 PATCH(ssl_read_ahead);
+            } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.record-size-initial"))) {
+                PATCH(ssl_record_size_initial);
+            } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.record-size-threshold"))) {
+                PATCH(ssl_record_size_threshold);
+            } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.record-size-idle"))) {
+                PATCH(ssl_record_size_idle);
             } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("debug.log-ssl-noise"))) {
                 PATCH(ssl_log_noise);
           #if 0 /*(not patched)*/
@@ -1073,6 +1994,8 @@ mod_openssl_patch_connection (server *srv, connection *con, handler_ctx *hctx)
                 PATCH(ssl_honor_cipher_order);
             } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.empty-fragments"))) {
                 PATCH(ssl_empty_fragments);
+            } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.ktls"))) {
+                PATCH(ssl_ktls);
             } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.use-sslv2"))) {
                 PATCH(ssl_use_sslv2);
             } else if (buffer_is_equal_string(du->key, CONST_STR_LEN("ssl.use-sslv3"))) {
@@ -1175,30 +2098,92 @@ connection_write_cq_ssl (server *srv, connection *con,
     handler_ctx *hctx = con->plugin_ctx[plugin_data_singleton->id];
     SSL *ssl = hctx->ssl;
 
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    /* SSL is in use by handshake thread (or its result is not yet checked) */
+    if (MOD_OPENSSL_HANDSHAKE_NONE != hctx->handshake_job) return 0;
+  #endif
+
     if (con->keep_alive == 0) {
         SSL_set_shutdown(ssl, SSL_RECEIVED_SHUTDOWN);
     }
 
     chunkqueue_remove_finished_chunks(cq);
 
+    /* dynamic TLS record size: small records (fitting into a TCP segment)
+     * can be decrypted by the client as soon as they arrive, which matters
+     * while the TCP congestion window is small, i.e. on new connections and
+     * after an idle period.  Switch to full-size records (fewer records and
+     * MAC operations) once ssl.record-size-threshold bytes have been sent */
+    if (hctx->conf.ssl_record_size_initial && NULL != cq->first) {
+        if (srv->cur_ts - hctx->record_ts > hctx->conf.ssl_record_size_idle
+            && 0 == hctx->record_retry)
+            hctx->record_bytes = 0;
+        hctx->record_ts = srv->cur_ts;
+    }
+
     while (max_bytes > 0 && NULL != cq->first) {
         const char *data;
         size_t data_len;
+        off_t record_max = max_bytes;
         int r;
 
-        if (0 != load_next_chunk(srv,cq,max_bytes,&data,&data_len)) return -1;
+        if (hctx->record_retry) {
+            /* SSL_write() must be repeated with the same length (a shorter
+             * one is rejected, the record is already encrypted); if that
+             * exceeds max_bytes (traffic shaping), retry in the next second */
+            if ((off_t)hctx->record_retry > max_bytes) {
+                con->traffic_limit_reached = 1;
+                return 0;
+            }
+            record_max = (off_t)hctx->record_retry;
+        }
+        else if (hctx->conf.ssl_record_size_initial
+                 && hctx->record_bytes
+                    < (off_t)hctx->conf.ssl_record_size_threshold
+                 && record_max > (off_t)hctx->conf.ssl_record_size_initial) {
+            record_max = (off_t)hctx->conf.ssl_record_size_initial;
+        }
 
-        /**
-         * SSL_write man-page
-         *
-         * WARNING
-         *        When an SSL_write() operation has to be repeated because of
-         *        SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE, it must be
-         *        repeated with the same arguments.
-         */
+      #if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+        /* kernel encrypts TLS records on socket (kTLS send enabled in
+         * OpenSSL after handshake); send file chunks with sendfile() instead
+         * of reading into local_send_buffer and SSL_write()
+         * (SSL_sendfile() is only usable once kTLS send is active) */
+        if (cq->first->type == FILE_CHUNK
+            && BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+            chunk * const c = cq->first;
+            off_t toSend;
 
-        ERR_clear_error();
-        r = SSL_write(ssl, data, data_len);
+            if (0 != chunkqueue_open_file_chunk(srv, cq)) return -1;
+
+            force_assert(c->offset >= 0 && c->offset <= c->file.length);
+            toSend = c->file.length - c->offset;
+            if (toSend > record_max) toSend = record_max;
+            if (toSend > INT_MAX) toSend = INT_MAX;
+
+            data_len = (size_t)toSend;
+            ERR_clear_error();
+            r = (int)SSL_sendfile(ssl, c->file.fd, c->file.start + c->offset,
+                                  data_len, 0);
+        }
+        else
+      #endif
+        {
+            if (0 != load_next_chunk(srv,cq,record_max,&data,&data_len))
+                return -1;
+
+            /**
+             * SSL_write man-page
+             *
+             * WARNING
+             *        When an SSL_write() operation has to be repeated because
+             *        of SSL_ERROR_WANT_READ or SSL_ERROR_WANT_WRITE, it must be
+             *        repeated with the same arguments.
+             */
+
+            ERR_clear_error();
+            r = SSL_write(ssl, data, data_len);
+        }
 
         if (hctx->renegotiations > 1
             && hctx->conf.ssl_disable_client_renegotiation) {
@@ -1214,9 +2199,11 @@ connection_write_cq_ssl (server *srv, connection *con,
             switch ((ssl_r = SSL_get_error(ssl, r))) {
             case SSL_ERROR_WANT_READ:
                 con->is_readable = -1;
+                hctx->record_retry = data_len;
                 return 0; /* try again later */
             case SSL_ERROR_WANT_WRITE:
                 con->is_writable = -1;
+                hctx->record_retry = data_len;
                 return 0; /* try again later */
             case SSL_ERROR_SYSCALL:
                 /* perhaps we have error waiting in our error-queue */
@@ -1265,6 +2252,8 @@ connection_write_cq_ssl (server *srv, connection *con,
 
         chunkqueue_mark_written(cq, r);
         max_bytes -= r;
+        hctx->record_bytes += r;
+        hctx->record_retry = 0;
 
         if ((size_t) r < data_len) break; /* try again later */
     }
@@ -1273,6 +2262,65 @@ connection_write_cq_ssl (server *srv, connection *con,
 }
 
 
+static int
+mod_openssl_err_is_noise (unsigned long ssl_err)
+{
+    switch (ERR_GET_REASON(ssl_err)) {
+    case SSL_R_SSL_HANDSHAKE_FAILURE:
+      #ifdef SSL_R_TLSV1_ALERT_UNKNOWN_CA
+    case SSL_R_TLSV1_ALERT_UNKNOWN_CA:
+      #endif
+      #ifdef SSL_R_SSLV3_ALERT_CERTIFICATE_UNKNOWN
+    case SSL_R_SSLV3_ALERT_CERTIFICATE_UNKNOWN:
+      #endif
+      #ifdef SSL_R_SSLV3_ALERT_BAD_CERTIFICATE
+    case SSL_R_SSLV3_ALERT_BAD_CERTIFICATE:
+      #endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+
+#ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+/* check result of handshake in handshake thread
+ * (error queue of handshake thread was saved in hctx->handshake_err[]) */
+static int
+mod_openssl_handshake_result (server *srv, handler_ctx *hctx)
+{
+    const int r = hctx->handshake_ssl_r;
+    int logged = 0;
+    hctx->handshake_job = MOD_OPENSSL_HANDSHAKE_NONE;
+
+    switch (r) {
+    case SSL_ERROR_NONE:
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        return 0; /* continue with SSL_read() */
+    default:
+        break;
+    }
+
+    for (size_t i = 0; i < sizeof(hctx->handshake_err)/sizeof(*hctx->handshake_err); ++i) {
+        const unsigned long ssl_err = hctx->handshake_err[i];
+        if (0 == ssl_err) break;
+        logged = 1;
+        if (r != SSL_ERROR_SYSCALL && mod_openssl_err_is_noise(ssl_err)
+            && !hctx->conf.ssl_log_noise) continue;
+        log_error_write(srv, __FILE__, __LINE__, "sds", "SSL:",
+                        r, ERR_error_string(ssl_err, NULL));
+    }
+    if (r == SSL_ERROR_SYSCALL && !logged && 0 != hctx->handshake_errno) {
+        log_error_write(srv, __FILE__, __LINE__, "sddds", "SSL:",
+                        hctx->handshake_ret, r, hctx->handshake_errno,
+                        strerror(hctx->handshake_errno));
+    }
+    return -1;
+}
+#endif
+
+
 static int
 connection_read_cq_ssl (server *srv, connection *con,
                         chunkqueue *cq, off_t max_bytes)
@@ -1286,6 +2334,19 @@ connection_read_cq_ssl (server *srv, connection *con,
     force_assert(cq == con->read_queue);
     UNUSED(max_bytes);
 
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    switch (hctx->handshake_job) {
+    case MOD_OPENSSL_HANDSHAKE_NONE:
+        break;
+    case MOD_OPENSSL_HANDSHAKE_RESULT:
+        if (0 != mod_openssl_handshake_result(srv, hctx)) return -1;
+        break;
+    default: /* handshake in progress in handshake thread */
+        con->is_readable = 0;
+        return 0;
+    }
+  #endif
+
     ERR_clear_error();
     do {
         chunkqueue_get_memory(con->read_queue, &mem, &mem_len, 0,
@@ -1327,6 +2388,19 @@ connection_read_cq_ssl (server *srv, connection *con,
              */
 
             return 0;
+      #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+        case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+            /* ClientHello (and SNI) processed by mod_openssl_client_hello_cb;
+             * continue handshake in handshake thread */
+            if (0 == ssl_handshakes.nthreads) {
+                /*(handshake threads failed to start; continue here)*/
+                hctx->handshake_offloaded = 1;
+                return connection_read_cq_ssl(srv, con, cq, max_bytes);
+            }
+            mod_openssl_handshake_submit(hctx);
+            con->is_readable = 0;
+            return 0;
+      #endif
         case SSL_ERROR_SYSCALL:
             /**
              * man SSL_get_error()
@@ -1366,22 +2440,8 @@ connection_read_cq_ssl (server *srv, connection *con,
             /* fall thourgh */
         default:
             while((ssl_err = ERR_get_error())) {
-                switch (ERR_GET_REASON(ssl_err)) {
-                case SSL_R_SSL_HANDSHAKE_FAILURE:
-                  #ifdef SSL_R_TLSV1_ALERT_UNKNOWN_CA
-                case SSL_R_TLSV1_ALERT_UNKNOWN_CA:
-                  #endif
-                  #ifdef SSL_R_SSLV3_ALERT_CERTIFICATE_UNKNOWN
-                case SSL_R_SSLV3_ALERT_CERTIFICATE_UNKNOWN:
-                  #endif
-                  #ifdef SSL_R_SSLV3_ALERT_BAD_CERTIFICATE
-                case SSL_R_SSLV3_ALERT_BAD_CERTIFICATE:
-                  #endif
-                    if (!hctx->conf.ssl_log_noise) continue;
-                    break;
-                default:
-                    break;
-                }
+                if (mod_openssl_err_is_noise(ssl_err)
+                    && !hctx->conf.ssl_log_noise) continue;
                 /* get all errors from the error-queue */
                 log_error_write(srv, __FILE__, __LINE__, "sds", "SSL:",
                                 r, ERR_error_string(ssl_err, NULL));
@@ -1407,6 +2467,17 @@ CONNECTION_FUNC(mod_openssl_handle_con_accept)
     server_socket *srv_sock = con->srv_socket;
     if (!srv_sock->is_ssl) return HANDLER_GO_ON;
 
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    /* started with first connection (threads do not survive fork()
+     * for server.max-worker) */
+    if (p->config_storage[0]->ssl_handshake_threads
+        && NULL == ssl_handshakes.threads && !ssl_handshakes.failed) {
+        if (0 != mod_openssl_handshake_start(srv,
+                                     p->config_storage[0]->ssl_handshake_threads))
+            ssl_handshakes.failed = 1;
+    }
+  #endif
+
     hctx = handler_ctx_init();
     hctx->con = con;
     hctx->srv = srv;
@@ -1443,6 +2514,10 @@ CONNECTION_FUNC(mod_openssl_handle_con_shut_wr)
     handler_ctx *hctx = con->plugin_ctx[p->id];
     if (NULL == hctx) return HANDLER_GO_ON;
 
+  #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+    mod_openssl_handshake_wait(hctx);
+  #endif
+
     if (SSL_is_init_finished(hctx->ssl)) {
         int ret, ssl_r;
         unsigned long err;
@@ -1515,6 +2590,9 @@ CONNECTION_FUNC(mod_openssl_handle_con_close)
     plugin_data *p = p_d;
     handler_ctx *hctx = con->plugin_ctx[p->id];
     if (NULL != hctx) {
+      #ifdef MOD_OPENSSL_HANDSHAKE_THREADS
+        mod_openssl_handshake_wait(hctx);
+      #endif
         handler_ctx_free(hctx);
         con->plugin_ctx[p->id] = NULL;
     }
@@ -1725,6 +2803,32 @@ CONNECTION_FUNC(mod_openssl_handle_request_reset)
 }
 
 
+TRIGGER_FUNC(mod_openssl_handle_trigger)
+{
+    plugin_data *p = p_d;
+    plugin_config *s;
+    if (NULL == ssl_shm) return HANDLER_GO_ON;
+
+    s = p->config_storage[0];
+    if (!buffer_string_is_empty(s->ssl_stek_file)) {
+        /* check once a minute if ssl.stek-file has been replaced */
+        static time_t stek_check_ts;
+        struct stat st;
+        if (srv->cur_ts - stek_check_ts < 60) return HANDLER_GO_ON;
+        stek_check_ts = srv->cur_ts;
+        if (0 == stat(s->ssl_stek_file->ptr, &st)
+            && (st.st_mtime != ssl_shm->stek_ts
+                || st.st_ino != ssl_shm->stek_ino))
+            mod_openssl_stek_load(srv, s->ssl_stek_file);
+    }
+    else if (s->ssl_stek_rotate && srv->cur_ts >= ssl_shm->stek_ts) {
+        mod_openssl_stek_rotate(srv, s->ssl_stek_rotate);
+    }
+
+    return HANDLER_GO_ON;
+}
+
+
 int mod_openssl_plugin_init (plugin *p);
 int mod_openssl_plugin_init (plugin *p)
 {
@@ -1740,6 +2844,7 @@ int mod_openssl_plugin_init (plugin *p)
     p->handle_uri_raw            = mod_openssl_handle_uri_raw;
     p->handle_request_env        = mod_openssl_handle_request_env;
     p->connection_reset          = mod_openssl_handle_request_reset;
+    p->handle_trigger            = mod_openssl_handle_trigger;
 
     p->data         = NULL;
 
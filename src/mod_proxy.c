@@ -7,6 +7,7 @@
 #include "base.h"
 #include "array.h"
 #include "buffer.h"
+#include "http_chunk.h"
 #include "inet_ntop_cache.h"
 #include "keyvalue.h"
 #include "log.h"
@@ -17,8 +18,8 @@
  *
  * HTTP reverse proxy
  *
- * TODO:      - HTTP/1.1
- *            - HTTP/1.1 persistent connection with upstream servers
+ * HTTP/1.1 persistent connections with upstream servers are used if
+ * "keep-alive-max-idle" is set for the backend host (see gw_backend.c)
  */
 
 /* (future: might split struct and move part to http-header-glue.c) */
@@ -62,11 +63,25 @@ typedef struct {
 
 static int proxy_check_extforward;
 
+typedef enum {
+	PROXY_CHUNK_NONE,      /* response not Transfer-Encoding: chunked */
+	PROXY_CHUNK_SIZE,      /* reading chunk-size line */
+	PROXY_CHUNK_DATA,      /* reading chunk-data (body_len remaining) */
+	PROXY_CHUNK_DATA_END,  /* reading CRLF following chunk-data */
+	PROXY_CHUNK_TRAILER    /* reading trailer lines after last-chunk */
+} proxy_chunk_state_t;
+
 typedef struct {
 	gw_handler_ctx gw;
 	http_response_opts opts;
 	http_header_remap_opts remap_hdrs;
 	plugin_config conf;
+
+	/* response framing; used with persistent connections to backend */
+	off_t body_len;     /* remaining body or chunk-data; -1 if read to EOF */
+	int chunked;        /* proxy_chunk_state_t */
+	int backend_keep_alive; /* backend response permits connection reuse */
+	int forwarded;      /* Forwarded, X-Forwarded-* added to request headers */
 } handler_ctx;
 
 
@@ -490,7 +505,7 @@ static void proxy_append_header(connection *con, const char *key, const size_t k
 
 	buffer_copy_string_len(ds_dst->key, key, klen);
 	buffer_copy_string_len(ds_dst->value, value, vlen);
-	array_insert_unique(con->request.headers, (data_unset *)ds_dst);
+	http_header_request_insert(con, http_header_hkey_get(key, klen), ds_dst);
 }
 
 static void buffer_append_string_backslash_escaped(buffer *b, const char *s, size_t len) {
@@ -528,8 +543,7 @@ static void proxy_set_Forwarded(connection *con, const unsigned int flags) {
     /* note: set "Forwarded" prior to updating X-Forwarded-For (below) */
 
     if (flags)
-        ds = (data_string *)
-          array_get_element(con->request.headers, "Forwarded");
+        ds = http_header_request_get(con, HTTP_HEADER_FORWARDED, CONST_STR_LEN("Forwarded"));
 
     if (flags && NULL == ds) {
         data_string *xff;
@@ -537,9 +551,8 @@ static void proxy_set_Forwarded(connection *con, const unsigned int flags) {
           array_get_unused_element(con->request.headers, TYPE_STRING);
         if (NULL == ds) ds = data_string_init();
         buffer_copy_string_len(ds->key, CONST_STR_LEN("Forwarded"));
-        array_insert_unique(con->request.headers, (data_unset *)ds);
-        xff = (data_string *)
-          array_get_element(con->request.headers, "X-Forwarded-For");
+        http_header_request_insert(con, HTTP_HEADER_FORWARDED, ds);
+        xff = http_header_request_get(con, HTTP_HEADER_X_FORWARDED_FOR, CONST_STR_LEN("X-Forwarded-For"));
         if (NULL != xff && !buffer_string_is_empty(xff->value)) {
             /* use X-Forwarded-For contents to seed Forwarded */
             char *s = xff->value->ptr;
@@ -714,6 +727,253 @@ static void proxy_set_Forwarded(connection *con, const unsigned int flags) {
 }
 
 
+static int proxy_header_token(const char *v, const char *tok, size_t tlen) {
+	/* check for token in comma-separated list (header value ending at EOL) */
+	for (;;) {
+		while (*v == ' ' || *v == '\t' || *v == ',') ++v;
+		if (0 == strncasecmp(v, tok, tlen)) {
+			switch (v[tlen]) {
+			case ',': case ' ': case '\t': case '\r': case '\n': case '\0':
+				return 1;
+			default:
+				break;
+			}
+		}
+		while (*v != ',' && *v != '\n' && *v != '\0') ++v;
+		if (*v != ',') return 0;
+	}
+}
+
+static size_t proxy_response_header_len(const buffer *b) {
+	/* length of response headers including blank line; 0 if incomplete */
+	const char *n;
+	for (const char *s = b->ptr; NULL != (n = strchr(s, '\n')); s = n + 1) {
+		if (n[1] == '\n') return (size_t)(n - b->ptr) + 2;
+		if (n[1] == '\r' && n[2] == '\n') return (size_t)(n - b->ptr) + 3;
+	}
+	return 0;
+}
+
+static void proxy_response_scan_headers(handler_ctx *hctx, const char *h) {
+	/* (Connection and Transfer-Encoding are not passed on to client, so
+	 *  check them here to determine response framing and connection reuse)*/
+	int keep_alive = (0 == strncmp(h, "HTTP/1.1 ", sizeof("HTTP/1.1 ")-1));
+	int te = 0;
+	hctx->chunked = PROXY_CHUNK_NONE;
+	for (const char *k = strchr(h, '\n'); NULL != k; k = strchr(k, '\n')) {
+		++k;
+		if (0 == strncasecmp(k, CONST_STR_LEN("Connection:"))) {
+			k += sizeof("Connection:")-1;
+			if (proxy_header_token(k, CONST_STR_LEN("close")))
+				keep_alive = 0;
+			else if (proxy_header_token(k, CONST_STR_LEN("keep-alive")))
+				keep_alive = 1;
+		}
+		else if (0 == strncasecmp(k, CONST_STR_LEN("Transfer-Encoding:"))) {
+			k += sizeof("Transfer-Encoding:")-1;
+			te = 1;
+			if (proxy_header_token(k, CONST_STR_LEN("chunked")))
+				hctx->chunked = PROXY_CHUNK_SIZE;
+		}
+	}
+	/* (other transfer-codings without chunked are delimited by close) */
+	if (te && hctx->chunked == PROXY_CHUNK_NONE) keep_alive = 0;
+	hctx->backend_keep_alive = keep_alive;
+}
+
+static void proxy_response_framing(connection *con, handler_ctx *hctx) {
+	/* response headers just parsed; determine how response body ends */
+	if (con->parsed_response & HTTP_UPGRADE) {
+		/* transparent proxy after 101 Switching Protocols */
+		hctx->chunked = PROXY_CHUNK_NONE;
+		hctx->body_len = -1;
+		hctx->backend_keep_alive = 0;
+	}
+	else if (con->request.http_method == HTTP_METHOD_HEAD
+		 || con->http_status < 200
+		 || con->http_status == 204 || con->http_status == 304) {
+		hctx->chunked = PROXY_CHUNK_NONE;
+		hctx->body_len = 0;
+	}
+	else if (hctx->chunked != PROXY_CHUNK_NONE) {
+		hctx->body_len = 0;
+		if (con->parsed_response & HTTP_CONTENT_LENGTH) {
+			/* Transfer-Encoding overrides Content-Length */
+			data_string *ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
+			if (ds) buffer_reset(ds->value); /*(do not send to client)*/
+			con->parsed_response &= ~HTTP_CONTENT_LENGTH;
+		}
+	}
+	else if (con->parsed_response & HTTP_CONTENT_LENGTH) {
+		hctx->body_len = (off_t)con->response.content_length;
+	}
+	else {
+		hctx->body_len = -1;
+		hctx->backend_keep_alive = 0;
+	}
+}
+
+static int proxy_response_chunked(server *srv, connection *con, handler_ctx *hctx, buffer *b, size_t off) {
+	/* decode Transfer-Encoding: chunked response body from b starting at off;
+	 * return 1 if complete, 0 if more data is needed, -1 if error
+	 * (a partial line is kept at the beginning of b) */
+	char *s = b->ptr + off;
+	char * const end = b->ptr + buffer_string_length(b);
+	while (s < end) {
+		if (hctx->chunked == PROXY_CHUNK_DATA) {
+			size_t len = (size_t)(end - s);
+			if ((off_t)len > hctx->body_len) len = (size_t)hctx->body_len;
+			if (0 != http_chunk_append_mem(srv, con, s, len)) return -1;
+			s += len;
+			hctx->body_len -= (off_t)len;
+			if (0 == hctx->body_len) hctx->chunked = PROXY_CHUNK_DATA_END;
+		}
+		else {
+			char *n = memchr(s, '\n', (size_t)(end - s));
+			if (NULL == n) {
+				if (end - s > 1024) break; /* line too long */
+				memmove(b->ptr, s, (size_t)(end - s));
+				buffer_string_set_length(b, (size_t)(end - s));
+				return 0;
+			}
+			switch (hctx->chunked) {
+			case PROXY_CHUNK_SIZE: {
+				off_t len = 0;
+				char *p = s;
+				for (unsigned char u; (u = (unsigned char)hex2int(*p)) != 0xFF; ++p) {
+					if (len >> (sizeof(off_t)*8 - 5)) return -1; /*overflow*/
+					len = (len << 4) | u;
+				}
+				/* (chunk-ext after ';' is ignored) */
+				if (p == s || (*p != ';' && *p != ' ' && *p != '\t'
+					       && *p != '\r' && *p != '\n'))
+					return -1;
+				hctx->body_len = len;
+				hctx->chunked = (0 == len)
+				  ? PROXY_CHUNK_TRAILER
+				  : PROXY_CHUNK_DATA;
+				break;
+			}
+			case PROXY_CHUNK_DATA_END:
+				if (n != s && !(n == s+1 && *s == '\r')) return -1;
+				hctx->chunked = PROXY_CHUNK_SIZE;
+				break;
+			case PROXY_CHUNK_TRAILER:
+				/* (trailers are not passed on to client) */
+				if (n == s || (n == s+1 && *s == '\r')) {
+					/* (any excess data is unexpected) */
+					if (n + 1 != end) hctx->backend_keep_alive = 0;
+					buffer_string_set_length(b, 0);
+					return 1;
+				}
+				break;
+			default:
+				return -1;
+			}
+			s = n + 1;
+		}
+	}
+
+	if (s < end) return -1;
+	buffer_string_set_length(b, 0);
+	return 0;
+}
+
+static handler_t proxy_response_body(server *srv, connection *con, handler_ctx *hctx, buffer *b, size_t off) {
+	if (hctx->chunked != PROXY_CHUNK_NONE) {
+		switch (proxy_response_chunked(srv, con, hctx, b, off)) {
+		case 0:
+			return HANDLER_GO_ON;
+		case 1:
+			break;
+		default:
+			log_error_write(srv, __FILE__, __LINE__, "sb",
+					"invalid chunked response from backend:",
+					hctx->gw.proc->connection_name);
+			return HANDLER_ERROR;
+		}
+	}
+	else {
+		size_t len = buffer_string_length(b) - off;
+		if (hctx->body_len >= 0 && (off_t)len >= hctx->body_len) {
+			/* (any excess data is unexpected) */
+			if ((off_t)len > hctx->body_len) hctx->backend_keep_alive = 0;
+			len = (size_t)hctx->body_len;
+			hctx->body_len = 0;
+		}
+		else if (hctx->body_len > 0) {
+			hctx->body_len -= (off_t)len;
+		}
+
+		if (0 == off && len == buffer_string_length(b)) {
+			if (0 != http_chunk_append_buffer(srv, con, b)) return HANDLER_ERROR;
+		}
+		else if (len) {
+			if (0 != http_chunk_append_mem(srv, con, b->ptr+off, len)) return HANDLER_ERROR;
+		}
+		buffer_string_set_length(b, 0);
+		if (0 != hctx->body_len) return HANDLER_GO_ON;
+	}
+
+	/* response complete; connection may be returned to idle pool */
+	hctx->gw.keep_alive = hctx->backend_keep_alive;
+	return HANDLER_FINISHED;
+}
+
+static handler_t proxy_recv_parse(server *srv, connection *con, struct http_response_opts_t *opts, buffer *b, size_t n) {
+	handler_ctx *hctx = (handler_ctx *)opts->pdata;
+	size_t hlen = 0;
+
+	if (0 == n) {
+		if (!con->file_started) {
+			/* backend may have closed reused idle connection;
+			 * return error so that gw_backend.c might retry request */
+			if (hctx->gw.reused && buffer_string_is_empty(b))
+				return HANDLER_ERROR;
+			return HANDLER_FINISHED;
+		}
+		if (-1 == hctx->body_len) return HANDLER_FINISHED;
+		log_error_write(srv, __FILE__, __LINE__, "sb",
+				"unexpected end-of-file from backend:",
+				hctx->gw.proc->connection_name);
+		return HANDLER_ERROR;
+	}
+
+	while (0 == con->file_started) {
+		buffer *hdrs;
+		handler_t rc;
+
+		hlen = proxy_response_header_len(b);
+		if (0 == hlen) {
+			/*(checks for invalid or excessively large response headers)*/
+			return http_response_parse_headers(srv, con, opts, b);
+		}
+
+		if (0 == strncmp(b->ptr, "HTTP/1.", sizeof("HTTP/1.")-1)
+		    && b->ptr[8] == ' ' && b->ptr[9] == '1'
+		    && !(b->ptr[10] == '0' && b->ptr[11] == '1')) {
+			/* discard interim 1xx response (other than 101) */
+			size_t blen = buffer_string_length(b) - hlen;
+			memmove(b->ptr, b->ptr+hlen, blen);
+			buffer_string_set_length(b, blen);
+			if (0 == blen) return HANDLER_GO_ON;
+			continue;
+		}
+
+		/* parse headers separately so that body is framed here */
+		hdrs = buffer_init();
+		buffer_copy_string_len(hdrs, b->ptr, hlen);
+		proxy_response_scan_headers(hctx, hdrs->ptr);
+		rc = http_response_parse_headers(srv, con, opts, hdrs);
+		buffer_free(hdrs);
+		if (rc != HANDLER_GO_ON) return rc;
+		if (0 == con->file_started) return HANDLER_GO_ON; /*(not expected)*/
+		proxy_response_framing(con, hctx);
+	}
+
+	return proxy_response_body(srv, con, hctx, b, hlen);
+}
+
 static handler_t proxy_create_env(server *srv, gw_handler_ctx *gwhctx) {
 	handler_ctx *hctx = (handler_ctx *)gwhctx;
 	connection *con = hctx->gw.remote_conn;
@@ -721,9 +981,17 @@ static handler_t proxy_create_env(server *srv, gw_handler_ctx *gwhctx) {
 	const int remap_headers = (NULL != hctx->remap_hdrs.urlpaths
 				   || NULL != hctx->remap_hdrs.hosts_request);
 	const int upgrade = hctx->remap_hdrs.upgrade
-			    && (NULL != array_get_element(con->request.headers, "Upgrade"));
+			    && (NULL != http_header_request_get(con, HTTP_HEADER_UPGRADE, CONST_STR_LEN("Upgrade")));
+	const int keep_alive = !upgrade && 0 != hctx->gw.host->keep_alive_max_idle;
 	buffer_string_prepare_copy(b, 8192-1);
 
+	/* response is framed (and connection might be reused) only when
+	 * persistent connection is requested from backend */
+	hctx->gw.opts.parse = keep_alive ? proxy_recv_parse : NULL;
+	hctx->body_len = -1;
+	hctx->chunked = PROXY_CHUNK_NONE;
+	hctx->backend_keep_alive = 0;
+
 	/* build header */
 
 	/* request line */
@@ -732,7 +1000,7 @@ static handler_t proxy_create_env(server *srv, gw_handler_ctx *gwhctx) {
 	buffer_append_string_buffer(b, con->request.uri);
 	if (remap_headers)
 		http_header_remap_uri(b, buffer_string_length(b) - buffer_string_length(con->request.uri), &hctx->remap_hdrs, 1);
-	if (!upgrade)
+	if (!upgrade && !keep_alive)
 		buffer_append_string_len(b, CONST_STR_LEN(" HTTP/1.0\r\n"));
 	else
 		buffer_append_string_len(b, CONST_STR_LEN(" HTTP/1.1\r\n"));
@@ -753,17 +1021,24 @@ static handler_t proxy_create_env(server *srv, gw_handler_ctx *gwhctx) {
 			http_header_remap_host(b, buffer_string_length(b) - alen, &hctx->remap_hdrs, 1, alen);
 		}
 		buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
+	} else if (keep_alive) {
+		/* HTTP/1.1 requires Host (empty if client did not send one) */
+		buffer_append_string_len(b, CONST_STR_LEN("Host:\r\n"));
 	}
 
-	/* "Forwarded" and legacy X- headers */
-	proxy_set_Forwarded(con, hctx->conf.forwarded);
+	/* "Forwarded" and legacy X- headers
+	 * (once; request is created again if resent on a new connection) */
+	if (!hctx->forwarded) {
+		hctx->forwarded = 1;
+		proxy_set_Forwarded(con, hctx->conf.forwarded);
+	}
 
 	if (HTTP_METHOD_GET != con->request.http_method
 	    && HTTP_METHOD_HEAD != con->request.http_method
 	    && con->request.content_length >= 0) {
 		/* set Content-Length if client sent Transfer-Encoding: chunked
 		 * and not streaming to backend (request body has been fully received) */
-		data_string *ds = (data_string *) array_get_element(con->request.headers, "Content-Length");
+		data_string *ds = http_header_request_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
 		if (NULL == ds || buffer_string_is_empty(ds->value)) {
 			char buf[LI_ITOSTRING_LENGTH];
 			li_itostrn(buf, sizeof(buf), con->request.content_length);
@@ -839,7 +1114,9 @@ static handler_t proxy_create_env(server *srv, gw_handler_ctx *gwhctx) {
 		http_header_remap_uri(b, buffer_string_length(b) - vlen - 2, &hctx->remap_hdrs, 1);
 	}
 
-	if (!upgrade)
+	if (keep_alive)
+		buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
+	else if (!upgrade)
 		buffer_append_string_len(b, CONST_STR_LEN("Connection: close\r\n\r\n"));
 	else
 		buffer_append_string_len(b, CONST_STR_LEN("Connection: close, upgrade\r\n\r\n"));
@@ -944,18 +1221,15 @@ static handler_t proxy_response_headers(server *srv, connection *con, struct htt
         return HANDLER_GO_ON;
 
     if (con->parsed_response & HTTP_LOCATION) {
-        data_string *ds = (data_string *)
-          array_get_element(con->response.headers, "Location");
+        data_string *ds = http_header_response_get(con, HTTP_HEADER_LOCATION, CONST_STR_LEN("Location"));
         if (ds) http_header_remap_uri(ds->value, 0, &hctx->remap_hdrs, 0);
     }
     if (con->parsed_response & HTTP_CONTENT_LOCATION) {
-        data_string *ds = (data_string *)
-          array_get_element(con->response.headers, "Content-Location");
+        data_string *ds = http_header_response_get(con, HTTP_HEADER_CONTENT_LOCATION, CONST_STR_LEN("Content-Location"));
         if (ds) http_header_remap_uri(ds->value, 0, &hctx->remap_hdrs, 0);
     }
     if (con->parsed_response & HTTP_SET_COOKIE) {
-        data_string *ds = (data_string *)
-          array_get_element(con->response.headers, "Set-Cookie");
+        data_string *ds = http_header_response_get(con, HTTP_HEADER_SET_COOKIE, CONST_STR_LEN("Set-Cookie"));
         if (ds) http_header_remap_setcookie(ds->value, 0, &hctx->remap_hdrs);
     }
 
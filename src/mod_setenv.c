@@ -230,12 +230,12 @@ URIHANDLER_FUNC(mod_setenv_uri_handler) {
 		buffer_copy_buffer(ds_dst->key, ds->key);
 		buffer_copy_buffer(ds_dst->value, ds->value);
 
-		array_insert_unique(con->request.headers, (data_unset *)ds_dst);
+		http_header_request_insert(con, http_header_hkey_get(CONST_BUF_LEN(ds->key)), ds_dst);
 	}
 
 	for (k = 0; k < hctx->conf.set_request_header->used; ++k) {
 		data_string *ds = (data_string *)hctx->conf.set_request_header->data[k];
-		array_set_key_value(con->request.headers, CONST_BUF_LEN(ds->key), CONST_BUF_LEN(ds->value));
+		http_header_request_set(con, http_header_hkey_get(CONST_BUF_LEN(ds->key)), CONST_BUF_LEN(ds->key), CONST_BUF_LEN(ds->value));
 	}
 
 	return HANDLER_GO_ON;
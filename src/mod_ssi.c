@@ -173,7 +173,7 @@ static int build_ssi_cgi_vars(server *srv, connection *con, handler_ctx *p) {
 	http_cgi_opts opts = { 0, 0, NULL, NULL };
 	/* temporarily remove Authorization from request headers
 	 * so that Authorization does not end up in SSI environment */
-	data_string *ds_auth = (data_string *)array_get_element(con->request.headers, "Authorization");
+	data_string *ds_auth = http_header_request_get(con, HTTP_HEADER_AUTHORIZATION, CONST_STR_LEN("Authorization"));
 	buffer *b_auth = NULL;
 	if (ds_auth) {
 		b_auth = ds_auth->value;
@@ -9,6 +9,11 @@
 #include "etag.h"
 #include "http_chunk.h"
 #include "response.h"
+#include "stat_cache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "sys-strings.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -26,22 +31,48 @@ typedef struct {
 	array *exclude_ext;
 	unsigned short etags_used;
 	unsigned short disable_pathinfo;
+	array *precompressed;
 } plugin_config;
 
 typedef struct {
 	PLUGIN_DATA;
 
+	buffer *tmp_buf;
+
 	plugin_config **config_storage;
 
 	plugin_config conf;
 } plugin_data;
 
+/* encodings of precompressed files (static-file.precompressed) */
+static const struct {
+	const char *encoding;
+	size_t elen;
+	const char *ext;
+	size_t xlen;
+} precompressed_types[] = {
+	{ CONST_STR_LEN("br"),   CONST_STR_LEN(".br") },
+	{ CONST_STR_LEN("zstd"), CONST_STR_LEN(".zst") },
+	{ CONST_STR_LEN("gzip"), CONST_STR_LEN(".gz") },
+	{ NULL, 0, NULL, 0 }
+};
+
+static int mod_staticfile_precompressed_type(buffer *encoding) {
+	int i;
+	for (i = 0; NULL != precompressed_types[i].encoding; ++i) {
+		if (buffer_is_equal_string(encoding, precompressed_types[i].encoding, precompressed_types[i].elen)) return i;
+	}
+	return -1;
+}
+
 /* init the plugin data */
 INIT_FUNC(mod_staticfile_init) {
 	plugin_data *p;
 
 	p = calloc(1, sizeof(*p));
 
+	p->tmp_buf = buffer_init();
+
 	return p;
 }
 
@@ -61,12 +92,15 @@ FREE_FUNC(mod_staticfile_free) {
 			if (NULL == s) continue;
 
 			array_free(s->exclude_ext);
+			array_free(s->precompressed);
 
 			free(s);
 		}
 		free(p->config_storage);
 	}
 
+	buffer_free(p->tmp_buf);
+
 	free(p);
 
 	return HANDLER_GO_ON;
@@ -82,6 +116,7 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 		{ "static-file.exclude-extensions", NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },       /* 0 */
 		{ "static-file.etags",    NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 1 */
 		{ "static-file.disable-pathinfo", NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION }, /* 2 */
+		{ "static-file.precompressed", NULL, T_CONFIG_ARRAY, T_CONFIG_SCOPE_CONNECTION },      /* 3 */
 		{ NULL,                         NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -97,10 +132,12 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 		s->exclude_ext    = array_init();
 		s->etags_used     = 1;
 		s->disable_pathinfo = 0;
+		s->precompressed  = array_init();
 
 		cv[0].destination = s->exclude_ext;
 		cv[1].destination = &(s->etags_used);
 		cv[2].destination = &(s->disable_pathinfo);
+		cv[3].destination = s->precompressed;
 
 		p->config_storage[i] = s;
 
@@ -113,6 +150,21 @@ SETDEFAULTS_FUNC(mod_staticfile_set_defaults) {
 					"unexpected value for static-file.exclude-extensions; expected list of \"ext\"");
 			return HANDLER_ERROR;
 		}
+
+		if (!array_is_vlist(s->precompressed)) {
+			log_error_write(srv, __FILE__, __LINE__, "s",
+					"unexpected value for static-file.precompressed; expected list of \"encoding\"");
+			return HANDLER_ERROR;
+		}
+
+		for (size_t j = 0; j < s->precompressed->used; ++j) {
+			data_string *ds = (data_string *)s->precompressed->data[j];
+			if (-1 == mod_staticfile_precompressed_type(ds->value)) {
+				log_error_write(srv, __FILE__, __LINE__, "sb",
+						"unknown encoding in static-file.precompressed (expected \"br\", \"zstd\" or \"gzip\"):", ds->value);
+				return HANDLER_ERROR;
+			}
+		}
 	}
 
 	return HANDLER_GO_ON;
@@ -127,6 +179,7 @@ static int mod_staticfile_patch_connection(server *srv, connection *con, plugin_
 	PATCH(exclude_ext);
 	PATCH(etags_used);
 	PATCH(disable_pathinfo);
+	PATCH(precompressed);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -146,6 +199,8 @@ static int mod_staticfile_patch_connection(server *srv, connection *con, plugin_
 				PATCH(etags_used);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("static-file.disable-pathinfo"))) {
 				PATCH(disable_pathinfo);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("static-file.precompressed"))) {
+				PATCH(precompressed);
 			}
 		}
 	}
@@ -154,10 +209,108 @@ static int mod_staticfile_patch_connection(server *srv, connection *con, plugin_
 }
 #undef PATCH
 
+/* check if encoding is in Accept-Encoding and not excluded with q=0
+ * (a wildcard "*" is not taken as acceptance of a precompressed encoding) */
+static int mod_staticfile_accept_encoding(const char *s, const char *encoding, size_t len) {
+	while (*s) {
+		const char *t;
+		while (*s == ',' || *s == ' ' || *s == '\t') ++s;
+		t = s;
+		while (*s && *s != ',' && *s != ';' && *s != ' ' && *s != '\t') ++s;
+		if ((size_t)(s - t) == len && 0 == strncasecmp(t, encoding, len)) {
+			for (;;) {
+				while (*s == ' ' || *s == '\t') ++s;
+				if (*s != ';') return 1;
+				do { ++s; } while (*s == ' ' || *s == '\t');
+				if ((*s == 'q' || *s == 'Q') && s[1] == '=') {
+					s += 2;
+					if (*s != '0') return 1;
+					do { ++s; } while (*s == '0' || *s == '.');
+					return (*s >= '1' && *s <= '9');
+				}
+				while (*s && *s != ',' && *s != ';') ++s;
+			}
+		}
+		while (*s && *s != ',') ++s;
+	}
+	return 0;
+}
+
+/* serve file.br, file.zst or file.gz in place of file, if accepted by the
+ * client and not older than file; returns path of precompressed file */
+static buffer * mod_staticfile_precompressed(server *srv, connection *con, plugin_data *p) {
+	stat_cache_entry *sce = NULL;
+	data_string *ds;
+	const char *accept = NULL;
+	buffer *path = NULL;
+	int vary = 0;
+	time_t mtime;
+	size_t i;
+
+	if (NULL != http_header_response_get(con, HTTP_HEADER_CONTENT_ENCODING, CONST_STR_LEN("Content-Encoding"))) return NULL;
+
+	if (HANDLER_ERROR == stat_cache_get_entry(srv, con, con->physical.path, &sce)) return NULL;
+	if (!S_ISREG(sce->st.st_mode)) return NULL;
+	mtime = sce->st.st_mtime;
+
+	ds = http_header_request_get(con, HTTP_HEADER_ACCEPT_ENCODING, CONST_STR_LEN("Accept-Encoding"));
+	if (NULL != ds) accept = ds->value->ptr;
+
+	for (i = 0; i < p->conf.precompressed->used; ++i) {
+		stat_cache_entry *sce_enc = NULL;
+		int k = mod_staticfile_precompressed_type(((data_string *)p->conf.precompressed->data[i])->value);
+		if (-1 == k) continue;
+
+		buffer_copy_buffer(p->tmp_buf, con->physical.path);
+		buffer_append_string_len(p->tmp_buf, precompressed_types[k].ext, precompressed_types[k].xlen);
+		if (HANDLER_ERROR == stat_cache_get_entry(srv, con, p->tmp_buf, &sce_enc)) continue;
+		if (!S_ISREG(sce_enc->st.st_mode)) continue;
+	  #ifdef HAVE_LSTAT
+		if (sce_enc->is_symlink && !con->conf.follow_symlink) continue;
+	  #endif
+		/* stale precompressed file (original has been modified since) */
+		if (sce_enc->st.st_mtime < mtime) continue;
+
+		/* the response depends on Accept-Encoding */
+		vary = 1;
+
+		if (NULL == accept) break;
+		if (!mod_staticfile_accept_encoding(accept, precompressed_types[k].encoding, precompressed_types[k].elen)) continue;
+
+		if (con->conf.log_request_handling) {
+			log_error_write(srv, __FILE__, __LINE__,  "sb",  "-- serving precompressed file", p->tmp_buf);
+		}
+
+		/* Content-Type of the original file; ETag and Last-Modified are
+		 * those of the precompressed file (set in http_response_send_file()) */
+		if (buffer_string_is_empty(sce->content_type)) {
+			response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/octet-stream"));
+		} else {
+			response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"), CONST_BUF_LEN(sce->content_type));
+		}
+		response_header_overwrite(srv, con, CONST_STR_LEN("Content-Encoding"), precompressed_types[k].encoding, precompressed_types[k].elen);
+		path = p->tmp_buf;
+		break;
+	}
+
+	if (vary) {
+		if (NULL != (ds = http_header_response_get(con, HTTP_HEADER_VARY, CONST_STR_LEN("Vary")))) {
+			if (NULL == strstr(ds->value->ptr, "Accept-Encoding")) {
+				buffer_append_string_len(ds->value, CONST_STR_LEN(",Accept-Encoding"));
+			}
+		} else {
+			response_header_insert(srv, con, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
+		}
+	}
+
+	return path;
+}
+
 URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	plugin_data *p = p_d;
 	size_t k;
 	data_string *ds;
+	buffer *path;
 
 	/* someone else has done a decision for us */
 	if (con->http_status != 0) return HANDLER_GO_ON;
@@ -206,7 +359,12 @@ URIHANDLER_FUNC(mod_staticfile_subrequest) {
 	}
 
 	if (!p->conf.etags_used) con->etag_flags = 0;
-	http_response_send_file(srv, con, con->physical.path);
+	path = con->physical.path;
+	if (0 != p->conf.precompressed->used) {
+		buffer *path_enc = mod_staticfile_precompressed(srv, con, p);
+		if (NULL != path_enc) path = path_enc;
+	}
+	http_response_send_file(srv, con, path);
 
 	return HANDLER_FINISHED;
 }
@@ -6,6 +6,7 @@
 #include "connections.h"
 #include "fdevent.h"
 #include "log.h"
+#include "status_counter.h"
 
 #include "plugin.h"
 
@@ -22,6 +23,9 @@ typedef struct {
 	buffer *config_url;
 	buffer *status_url;
 	buffer *statistics_url;
+	buffer *metrics_url;
+	buffer *server_name; /* server.name (not con->server_name from Host) */
+	int     vhost;       /* index of server_name into vhost_durations */
 
 	int     sort;
 } plugin_config;
@@ -46,6 +50,17 @@ typedef struct {
 
 	buffer *module_list;
 
+	/* status counters for status.metrics-url (if configured) */
+	int metrics;
+	int stat_requests;
+	int stat_bytes_in;
+	int stat_bytes_out;
+	array *vhosts; /* server.name => index into vhost_durations */
+	status_counter_histogram *vhost_durations;
+	status_counter_histogram stage_durations[CON_TIMING_MAX];
+	status_counter_sum *sums; /* see mod_status_handle_server_metrics() */
+	size_t sums_size;
+
 	plugin_config **config_storage;
 
 	plugin_config conf;
@@ -62,6 +77,7 @@ INIT_FUNC(mod_status_init) {
 	p->abs_traffic_out = p->abs_requests = 0;
 	p->bytes_written = 0;
 	p->module_list = buffer_init();
+	p->vhosts = array_init();
 
 	for (i = 0; i < 5; i++) {
 		p->mod_5s_traffic_out[i] = p->mod_5s_requests[i] = 0;
@@ -78,6 +94,9 @@ FREE_FUNC(mod_status_free) {
 	if (!p) return HANDLER_GO_ON;
 
 	buffer_free(p->module_list);
+	array_free(p->vhosts);
+	free(p->vhost_durations);
+	free(p->sums);
 
 	if (p->config_storage) {
 		size_t i;
@@ -88,6 +107,7 @@ FREE_FUNC(mod_status_free) {
 			buffer_free(s->status_url);
 			buffer_free(s->statistics_url);
 			buffer_free(s->config_url);
+			buffer_free(s->metrics_url);
 
 			free(s);
 		}
@@ -100,6 +120,34 @@ FREE_FUNC(mod_status_free) {
 	return HANDLER_GO_ON;
 }
 
+/* register histogram of request durations of vhost (server.name, if
+ * configured; not the Host of the request, which would add counters for any
+ * Host) before workers are forked; returns index into vhost_durations */
+static int mod_status_vhost_durations(server *srv, plugin_data *p, const buffer *vhost) {
+	const size_t len = buffer_string_length(vhost);
+	data_integer *di = (data_integer *)array_get_element_klen(p->vhosts, len ? vhost->ptr : "", len);
+	buffer *b;
+	int rc;
+
+	if (NULL != di) return di->value;
+
+	p->vhost_durations = realloc(p->vhost_durations, (p->vhosts->used + 1) * sizeof(*p->vhost_durations));
+	force_assert(p->vhost_durations);
+
+	b = buffer_init_string("status.vhost.");
+	buffer_append_string_buffer(b, vhost);
+	rc = status_counter_histogram_init(srv, p->vhost_durations + p->vhosts->used, CONST_BUF_LEN(b));
+	buffer_free(b);
+	if (0 != rc) return -1;
+
+	di = data_integer_init();
+	buffer_copy_buffer(di->key, vhost);
+	di->value = (int)p->vhosts->used;
+	array_insert_unique(p->vhosts, (data_unset *)di);
+
+	return di->value;
+}
+
 SETDEFAULTS_FUNC(mod_status_set_defaults) {
 	plugin_data *p = p_d;
 	size_t i;
@@ -109,6 +157,7 @@ SETDEFAULTS_FUNC(mod_status_set_defaults) {
 		{ "status.config-url",           NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
 		{ "status.enable-sort",          NULL, T_CONFIG_BOOLEAN, T_CONFIG_SCOPE_CONNECTION },
 		{ "status.statistics-url",       NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
+		{ "status.metrics-url",          NULL, T_CONFIG_STRING, T_CONFIG_SCOPE_CONNECTION },
 		{ NULL,                          NULL, T_CONFIG_UNSET, T_CONFIG_SCOPE_UNSET }
 	};
 
@@ -125,17 +174,48 @@ SETDEFAULTS_FUNC(mod_status_set_defaults) {
 		s->status_url    = buffer_init();
 		s->sort          = 1;
 		s->statistics_url    = buffer_init();
+		s->metrics_url   = buffer_init();
 
 		cv[0].destination = s->status_url;
 		cv[1].destination = s->config_url;
 		cv[2].destination = &(s->sort);
 		cv[3].destination = s->statistics_url;
+		cv[4].destination = s->metrics_url;
+		s->server_name = srv->config_storage[i]->server_name;
 
 		p->config_storage[i] = s;
 
 		if (0 != config_insert_values_global(srv, config->value, cv, i == 0 ? T_CONFIG_SCOPE_SERVER : T_CONFIG_SCOPE_CONNECTION)) {
 			return HANDLER_ERROR;
 		}
+
+		if (!buffer_string_is_empty(s->metrics_url)) p->metrics = 1;
+	}
+
+	if (p->metrics) {
+		/* request durations are measured from con->request_start_hp,
+		 * durations of request stages from con->timing */
+		srv->srvconf.high_precision_timestamps = 1;
+		srv->srvconf.request_timing = 1;
+
+		for (i = 0; i < CON_TIMING_MAX; ++i) {
+			buffer * const b = buffer_init_string("status.stage.");
+			int rc;
+			buffer_append_string(b, connection_timing_name((con_timing_t)i));
+			rc = status_counter_histogram_init(srv, p->stage_durations + i, CONST_BUF_LEN(b));
+			buffer_free(b);
+			if (0 != rc) return HANDLER_ERROR;
+		}
+
+		for (i = 0; i < srv->config_context->used; ++i) {
+			plugin_config * const s = p->config_storage[i];
+			s->vhost = mod_status_vhost_durations(srv, p, s->server_name);
+			if (-1 == s->vhost) return HANDLER_ERROR;
+		}
+
+		p->stat_requests  = status_counter_slot(srv, CONST_STR_LEN("status.requests"));
+		p->stat_bytes_in  = status_counter_slot(srv, CONST_STR_LEN("status.bytes-in"));
+		p->stat_bytes_out = status_counter_slot(srv, CONST_STR_LEN("status.bytes-out"));
 	}
 
 	return HANDLER_GO_ON;
@@ -746,7 +826,7 @@ static handler_t mod_status_handle_server_status_json(server *srv, connection *c
 static handler_t mod_status_handle_server_statistics(server *srv, connection *con, void *p_d) {
 	buffer *b;
 	size_t i;
-	array *st = srv->status;
+	array *st = status_counter_totals(srv); /* all workers */
 	UNUSED(p_d);
 
 	if (0 == st->used) {
@@ -779,6 +859,217 @@ static handler_t mod_status_handle_server_statistics(server *srv, connection *co
 }
 
 
+/* OpenMetrics text format (status.metrics-url) */
+
+static void mod_status_metrics_seconds(buffer *b, int64_t usec) {
+	char frac[16];
+	buffer_append_int(b, usec / 1000000);
+	snprintf(frac, sizeof(frac), ".%06d", (int)(usec % 1000000));
+	buffer_append_string(b, frac);
+}
+
+static void mod_status_metrics_family(buffer *b, const char *name, const char *type, const char *unit, const char *help) {
+	buffer_append_string_len(b, CONST_STR_LEN("# TYPE "));
+	buffer_append_string(b, name);
+	buffer_append_string_len(b, CONST_STR_LEN(" "));
+	buffer_append_string(b, type);
+	if (unit) {
+		buffer_append_string_len(b, CONST_STR_LEN("\n# UNIT "));
+		buffer_append_string(b, name);
+		buffer_append_string_len(b, CONST_STR_LEN(" "));
+		buffer_append_string(b, unit);
+	}
+	buffer_append_string_len(b, CONST_STR_LEN("\n# HELP "));
+	buffer_append_string(b, name);
+	buffer_append_string_len(b, CONST_STR_LEN(" "));
+	buffer_append_string(b, help);
+	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+}
+
+/* <name><suffix>{<label>="<value>"[,le="<le>"]} */
+static void mod_status_metrics_sample(buffer *b, const char *name, const char *suffix, const char *label, const char *value, size_t vlen, const char *le) {
+	size_t i;
+	buffer_append_string(b, name);
+	buffer_append_string(b, suffix);
+	if (label) {
+		buffer_append_string_len(b, CONST_STR_LEN("{"));
+		buffer_append_string(b, label);
+		buffer_append_string_len(b, CONST_STR_LEN("=\""));
+		for (i = 0; i < vlen; ++i) {
+			switch (value[i]) {
+			case '\\': buffer_append_string_len(b, CONST_STR_LEN("\\\\")); break;
+			case '"':  buffer_append_string_len(b, CONST_STR_LEN("\\\"")); break;
+			case '\n': buffer_append_string_len(b, CONST_STR_LEN("\\n")); break;
+			default:   buffer_append_string_len(b, value+i, 1); break;
+			}
+		}
+		buffer_append_string_len(b, CONST_STR_LEN("\""));
+		if (le) {
+			buffer_append_string_len(b, CONST_STR_LEN(",le=\""));
+			buffer_append_string(b, le);
+			buffer_append_string_len(b, CONST_STR_LEN("\""));
+		}
+		buffer_append_string_len(b, CONST_STR_LEN("}"));
+	}
+	buffer_append_string_len(b, CONST_STR_LEN(" "));
+}
+
+/* label of histogram counter <prefix><label>.duration-us.sum, or NULL */
+static const char * mod_status_metrics_label(const status_counter_sum *t, const char *prefix, size_t plen, size_t *len) {
+	static const char suffix[] = ".duration-us.sum";
+	if (t->len < plen + sizeof(suffix)-1
+	    || 0 != memcmp(t->name, prefix, plen)
+	    || 0 != memcmp(t->name + t->len - (sizeof(suffix)-1), suffix, sizeof(suffix)-1)) {
+		return NULL;
+	}
+	*len = t->len - plen - (sizeof(suffix)-1);
+	return t->name + plen;
+}
+
+static void mod_status_metrics_histograms(buffer *b, const status_counter_sum *sums, size_t nsums, const char *prefix, const char *name, const char *label, const char *help) {
+	buffer * const k = buffer_init();
+	const size_t plen = strlen(prefix);
+	size_t i;
+	int first = 1;
+
+	for (i = 0; i < nsums; ++i) {
+		const char *v;
+		size_t vlen, klen;
+		int64_t n = 0;
+		char le[32];
+		int j;
+
+		v = mod_status_metrics_label(sums + i, prefix, plen, &vlen);
+		if (NULL == v) continue;
+		if (first) {
+			mod_status_metrics_family(b, name, "histogram", "seconds", help);
+			first = 0;
+		}
+
+		buffer_copy_string_len(k, prefix, plen);
+		buffer_append_string_len(k, v, vlen);
+		buffer_append_string_len(k, CONST_STR_LEN(".duration-us."));
+		klen = buffer_string_length(k);
+
+		for (j = 0; j <= STATUS_COUNTER_HISTOGRAM_BOUNDS; ++j) {
+			buffer_string_set_length(k, klen);
+			if (j < STATUS_COUNTER_HISTOGRAM_BOUNDS) {
+				const uint64_t bound = status_counter_histogram_bound(j);
+				buffer_append_string_len(k, CONST_STR_LEN("le."));
+				buffer_append_int(k, (intmax_t)bound);
+				snprintf(le, sizeof(le), "%d.%06d",
+				         (int)(bound / 1000000), (int)(bound % 1000000));
+			} else {
+				buffer_append_string_len(k, CONST_STR_LEN("le.inf"));
+				memcpy(le, "+Inf", sizeof("+Inf"));
+			}
+			n += status_counter_sums_get(sums, nsums, CONST_BUF_LEN(k));
+			mod_status_metrics_sample(b, name, "_bucket", label, v, vlen, le);
+			buffer_append_int(b, n);
+			buffer_append_string_len(b, CONST_STR_LEN("\n"));
+		}
+
+		mod_status_metrics_sample(b, name, "_count", label, v, vlen, NULL);
+		buffer_append_int(b, n);
+		buffer_append_string_len(b, CONST_STR_LEN("\n"));
+
+		buffer_string_set_length(k, klen);
+		buffer_append_string_len(k, CONST_STR_LEN("sum"));
+		mod_status_metrics_sample(b, name, "_sum", label, v, vlen, NULL);
+		mod_status_metrics_seconds(b, status_counter_sums_get(sums, nsums, CONST_BUF_LEN(k)));
+		buffer_append_string_len(b, CONST_STR_LEN("\n"));
+	}
+
+	buffer_free(k);
+}
+
+/* counter gw.backend.<backend><tag> of each backend with a duration histogram */
+static void mod_status_metrics_backends(buffer *b, const status_counter_sum *sums, size_t nsums, const char *name, const char *type, const char *suffix, const char *tag, const char *help) {
+	buffer * const k = buffer_init();
+	size_t i;
+	int first = 1;
+
+	for (i = 0; i < nsums; ++i) {
+		const char *v;
+		size_t vlen;
+
+		v = mod_status_metrics_label(sums + i, CONST_STR_LEN("gw.backend."), &vlen);
+		if (NULL == v) continue;
+		if (first) {
+			mod_status_metrics_family(b, name, type, NULL, help);
+			first = 0;
+		}
+
+		buffer_copy_string_len(k, CONST_STR_LEN("gw.backend."));
+		buffer_append_string_len(k, v, vlen);
+		buffer_append_string(k, tag);
+		mod_status_metrics_sample(b, name, suffix, "backend", v, vlen, NULL);
+		buffer_append_int(b, status_counter_sums_get(sums, nsums, CONST_BUF_LEN(k)));
+		buffer_append_string_len(b, CONST_STR_LEN("\n"));
+	}
+
+	buffer_free(k);
+}
+
+static handler_t mod_status_handle_server_metrics(server *srv, connection *con, void *p_d) {
+	plugin_data *p = p_d;
+	buffer *b = buffer_init();
+	/* counters of all workers, summed once per request */
+	const size_t n = status_counter_sums(srv, &p->sums, &p->sums_size);
+	const status_counter_sum * const sums = p->sums;
+
+	mod_status_metrics_family(b, "lighttpd_requests", "counter", NULL,
+		"Requests handled.");
+	mod_status_metrics_sample(b, "lighttpd_requests", "_total", NULL, NULL, 0, NULL);
+	buffer_append_int(b, status_counter_sums_get(sums, n, CONST_STR_LEN("status.requests")));
+	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+
+	mod_status_metrics_family(b, "lighttpd_received_bytes", "counter", "bytes",
+		"Bytes received from clients, including request headers.");
+	mod_status_metrics_sample(b, "lighttpd_received_bytes", "_total", NULL, NULL, 0, NULL);
+	buffer_append_int(b, status_counter_sums_get(sums, n, CONST_STR_LEN("status.bytes-in")));
+	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+
+	mod_status_metrics_family(b, "lighttpd_sent_bytes", "counter", "bytes",
+		"Bytes sent to clients, including response headers.");
+	mod_status_metrics_sample(b, "lighttpd_sent_bytes", "_total", NULL, NULL, 0, NULL);
+	buffer_append_int(b, status_counter_sums_get(sums, n, CONST_STR_LEN("status.bytes-out")));
+	buffer_append_string_len(b, CONST_STR_LEN("\n"));
+
+	mod_status_metrics_histograms(b, sums, n, "status.vhost.",
+		"lighttpd_request_duration_seconds", "vhost",
+		"Duration of requests by server.name, from the start of the request until the response was sent.");
+	mod_status_metrics_histograms(b, sums, n, "status.stage.",
+		"lighttpd_request_stage_duration_seconds", "stage",
+		"Duration of request stages: read (request headers), parse (request line and headers), body (request body, unless streamed), config (config conditions), uri (handle_uri_raw/handle_uri_clean), physical (handle_docroot/handle_physical), handler (handle_subrequest_start), backend (until the response is available), response-start (response headers), write (response).");
+	mod_status_metrics_histograms(b, sums, n, "gw.backend.",
+		"lighttpd_backend_request_duration_seconds", "backend",
+		"Duration of requests by backend, from the start of the request until the backend response was complete.");
+	mod_status_metrics_backends(b, sums, n,
+		"lighttpd_backend_load", "gauge", "", ".load",
+		"Requests assigned to the backend.");
+	mod_status_metrics_backends(b, sums, n,
+		"lighttpd_backend_connect_errors", "counter", "_total", ".connect-errors",
+		"Failed connections to the backend.");
+	mod_status_metrics_backends(b, sums, n,
+		"lighttpd_backend_spawns", "counter", "_total", ".spawned",
+		"Backend processes spawned.");
+
+	buffer_append_string_len(b, CONST_STR_LEN("# EOF\n"));
+
+	chunkqueue_append_buffer(con->write_queue, b);
+	buffer_free(b);
+
+	response_header_overwrite(srv, con, CONST_STR_LEN("Content-Type"),
+		CONST_STR_LEN("application/openmetrics-text; version=1.0.0; charset=utf-8"));
+
+	con->http_status = 200;
+	con->file_finished = 1;
+
+	return HANDLER_FINISHED;
+}
+
+
 static handler_t mod_status_handle_server_status(server *srv, connection *con, void *p_d) {
 
 	if (buffer_is_equal_string(con->uri.query, CONST_STR_LEN("auto"))) {
@@ -907,6 +1198,9 @@ static int mod_status_patch_connection(server *srv, connection *con, plugin_data
 	PATCH(config_url);
 	PATCH(sort);
 	PATCH(statistics_url);
+	PATCH(metrics_url);
+	PATCH(server_name);
+	PATCH(vhost);
 
 	/* skip the first, the global context */
 	for (i = 1; i < srv->config_context->used; i++) {
@@ -928,6 +1222,11 @@ static int mod_status_patch_connection(server *srv, connection *con, plugin_data
 				PATCH(sort);
 			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("status.statistics-url"))) {
 				PATCH(statistics_url);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("status.metrics-url"))) {
+				PATCH(metrics_url);
+			} else if (buffer_is_equal_string(du->key, CONST_STR_LEN("server.name"))) {
+				PATCH(server_name);
+				PATCH(vhost);
 			}
 		}
 	}
@@ -951,6 +1250,9 @@ static handler_t mod_status_handler(server *srv, connection *con, void *p_d) {
 	} else if (!buffer_string_is_empty(p->conf.statistics_url) &&
 	    buffer_is_equal(p->conf.statistics_url, con->uri.path)) {
 		return mod_status_handle_server_statistics(srv, con, p_d);
+	} else if (!buffer_string_is_empty(p->conf.metrics_url) &&
+	    buffer_is_equal(p->conf.metrics_url, con->uri.path)) {
+		return mod_status_handle_server_metrics(srv, con, p_d);
 	}
 
 	return HANDLER_GO_ON;
@@ -958,14 +1260,9 @@ static handler_t mod_status_handler(server *srv, connection *con, void *p_d) {
 
 TRIGGER_FUNC(mod_status_trigger) {
 	plugin_data *p = p_d;
-	size_t i;
 
-	/* check all connections */
-	for (i = 0; i < srv->conns->used; i++) {
-		connection *c = srv->conns->ptr[i];
-
-		p->bytes_written += c->bytes_written_cur_second;
-	}
+	/* all connections (reset by server after triggers) */
+	p->bytes_written += srv->bytes_written_cur_second;
 
 	/* a sliding average */
 	p->mod_5s_traffic_out[p->mod_5s_ndx] = p->bytes_written;
@@ -988,14 +1285,26 @@ TRIGGER_FUNC(mod_status_trigger) {
 REQUESTDONE_FUNC(mod_status_account) {
 	plugin_data *p = p_d;
 
-	UNUSED(srv);
-
 	p->requests++;
 	p->rel_requests++;
 	p->abs_requests++;
 
 	p->bytes_written += con->bytes_written_cur_second;
 
+	if (p->metrics) {
+		size_t i;
+		status_counter_slot_add(srv, p->stat_requests, 1);
+		status_counter_slot_add(srv, p->stat_bytes_in, con->bytes_read);
+		status_counter_slot_add(srv, p->stat_bytes_out, con->bytes_written);
+		mod_status_patch_connection(srv, con, p);
+		status_counter_histogram_since(srv, p->vhost_durations + p->conf.vhost,
+		                               &con->request_start_hp);
+		for (i = 0; i < CON_TIMING_MAX; ++i) {
+			const int64_t usec = connection_timing_usec(con, (con_timing_t)i);
+			if (usec >= 0) status_counter_histogram_add(srv, p->stage_durations + i, (uint64_t)usec);
+		}
+	}
+
 	return HANDLER_GO_ON;
 }
 
@@ -191,7 +191,7 @@ URIHANDLER_FUNC(mod_usertrack_uri_handler) {
 
 	mod_usertrack_patch_connection(srv, con, p);
 
-	if (NULL != (ds = (data_string *)array_get_element(con->request.headers, "Cookie"))) {
+	if (NULL != (ds = http_header_request_get(con, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie")))) {
 		char *g;
 		/* we have a cookie, does it contain a valid name ? */
 
@@ -246,7 +246,7 @@ URIHANDLER_FUNC(mod_usertrack_uri_handler) {
 	/* usertrack.cookie-attrs, if set, replaces all other attrs */
 	if (!buffer_string_is_empty(p->conf.cookie_attrs)) {
 		buffer_append_string_buffer(ds->value, p->conf.cookie_attrs);
-		array_insert_unique(con->response.headers, (data_unset *)ds);
+		http_header_response_insert(con, HTTP_HEADER_SET_COOKIE, ds);
 		return HANDLER_GO_ON;
 	}
 
@@ -263,7 +263,7 @@ URIHANDLER_FUNC(mod_usertrack_uri_handler) {
 		buffer_append_int(ds->value, p->conf.cookie_max_age);
 	}
 
-	array_insert_unique(con->response.headers, (data_unset *)ds);
+	http_header_response_insert(con, HTTP_HEADER_SET_COOKIE, ds);
 
 	return HANDLER_GO_ON;
 }
@@ -546,7 +546,6 @@ static handler_t wstunnel_handler_setup (server *srv, connection *con, plugin_da
 
 static handler_t mod_wstunnel_check_extension(server *srv, connection *con, void *p_d) {
     plugin_data *p = p_d;
-    array *hdrs = con->request.headers;
     data_string *dsconnection, *dsupgrade;
     handler_t rc;
 
@@ -561,11 +560,11 @@ static handler_t mod_wstunnel_check_extension(server *srv, connection *con, void
      * Connection: upgrade, keep-alive, ...
      * Upgrade: WebSocket, ...
      */
-    dsupgrade = (data_string *)array_get_element(hdrs, "Upgrade");
+    dsupgrade = http_header_request_get(con, HTTP_HEADER_UPGRADE, CONST_STR_LEN("Upgrade"));
     if (NULL == dsupgrade
         || !header_contains_token(dsupgrade->value, CONST_STR_LEN("websocket")))
         return HANDLER_GO_ON;
-    dsconnection = (data_string *)array_get_element(hdrs, "Connection");
+    dsconnection = http_header_request_get(con, HTTP_HEADER_CONNECTION, CONST_STR_LEN("Connection"));
     if (NULL == dsconnection
         || !header_contains_token(dsconnection->value,CONST_STR_LEN("upgrade")))
         return HANDLER_GO_ON;
@@ -775,7 +774,7 @@ static int create_response_ietf_00(handler_ctx *hctx) {
         buffer_copy_string_len(ds->value, CONST_STR_LEN("ws://"));
     buffer_append_string_buffer(ds->value, con->request.http_host);
     buffer_append_string_buffer(ds->value, con->uri.path);
-    array_insert_unique(hdrs, (data_unset *)ds);
+    http_header_response_insert(con, HTTP_HEADER_OTHER, ds);
 
     return 0;
 }
@@ -823,7 +822,7 @@ static int create_response_rfc_6455(handler_ctx *hctx) {
     if (NULL == ds) ds = data_string_init();
     buffer_copy_string_len(ds->key, CONST_STR_LEN("Sec-WebSocket-Accept"));
     buffer_append_base64_encode(ds->value, sha_digest, SHA_DIGEST_LENGTH, BASE64_STANDARD);
-    array_insert_unique(hdrs, (data_unset *)ds);
+    http_header_response_insert(con, HTTP_HEADER_OTHER, ds);
 
     /*(admin can set "Sec-WebSocket-Protocol" response hdr using mod_setenv)*/
 
@@ -69,7 +69,7 @@ static handler_t network_server_handle_fdevent(server *srv, void *context, int r
 	return HANDLER_GO_ON;
 }
 
-static int network_server_init(server *srv, buffer *host_token, size_t sidx) {
+static int network_server_init(server *srv, buffer *host_token, size_t sidx, unsigned short worker) {
 	int val;
 	socklen_t addr_len;
 	server_socket *srv_socket;
@@ -100,6 +100,7 @@ static int network_server_init(server *srv, buffer *host_token, size_t sidx) {
 	srv_socket->fd = -1;
 	srv_socket->fde_ndx = -1;
 	srv_socket->sidx = sidx;
+	srv_socket->worker = worker;
 
 	srv_socket->srv_token = buffer_init();
 	buffer_copy_buffer(srv_socket->srv_token, host_token);
@@ -247,6 +248,16 @@ static int network_server_init(server *srv, buffer *host_token, size_t sidx) {
 		goto error_free_socket;
 	}
 
+#ifdef SO_REUSEPORT
+	if (worker) {
+		val = 1;
+		if (setsockopt(srv_socket->fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) < 0) {
+			log_error_write(srv, __FILE__, __LINE__, "ss", "socketsockopt(SO_REUSEPORT) failed:", strerror(errno));
+			goto error_free_socket;
+		}
+	}
+#endif
+
 	if (srv_socket->addr.plain.sa_family != AF_UNIX) {
 		val = 1;
 		if (setsockopt(srv_socket->fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) < 0) {
@@ -347,6 +358,63 @@ error_free_socket:
 	return err; /* -1 if error; 0 if srv->srvconf.preflight_check successful */
 }
 
+static int network_server_init_workers(server *srv, buffer *host_token, size_t sidx) {
+	/* with server.reuse-port, create a separate listening socket for each
+	 * worker (before privileges are dropped), and let the kernel distribute
+	 * new connections between them instead of waking all workers */
+	unsigned short nworkers = 0, n;
+	unsigned char *have;
+	size_t i, j;
+	int rc = 0;
+
+	if (srv->srvconf.reuse_port && srv->srvconf.max_worker > 1
+	    && !buffer_string_is_empty(host_token) && host_token->ptr[0] != '/') {
+	      #ifdef SO_REUSEPORT
+		nworkers = srv->srvconf.max_worker;
+	      #else
+		log_error_write(srv, __FILE__, __LINE__, "s",
+				"warning: server.reuse-port not supported on this platform; ignoring");
+	      #endif
+	}
+
+	/* sockets kept over a graceful restart were created for the previous
+	 * config; keep those which still match the current server.max-worker
+	 * and server.reuse-port, close the others and create what is missing */
+	have = calloc(nworkers + 1, 1);
+	force_assert(NULL != have);
+	for (i = 0, j = 0; i < srv->srv_sockets.used; ++i) {
+		server_socket *srv_socket = srv->srv_sockets.ptr[i];
+		if (!buffer_is_equal(srv_socket->srv_token, host_token)
+		    || (srv_socket->worker <= nworkers
+			&& (0 == srv_socket->worker) == (0 == nworkers)
+			&& !have[srv_socket->worker])) {
+			if (buffer_is_equal(srv_socket->srv_token, host_token)) {
+				have[srv_socket->worker] = 1;
+			}
+			srv->srv_sockets.ptr[j++] = srv_socket;
+			continue;
+		}
+		if (srv_socket->fd != -1) {
+			network_unregister_sock(srv, srv_socket);
+			close(srv_socket->fd);
+		}
+		buffer_free(srv_socket->srv_token);
+		free(srv_socket);
+	}
+	srv->srv_sockets.used = j;
+
+	if (0 == nworkers) {
+		if (!have[0]) rc = network_server_init(srv, host_token, sidx, 0);
+	} else {
+		for (n = 1; n <= nworkers && 0 == rc; ++n) {
+			if (!have[n]) rc = network_server_init(srv, host_token, sidx, n);
+		}
+	}
+
+	free(have);
+	return rc;
+}
+
 int network_close(server *srv) {
 	size_t i;
 	for (i = 0; i < srv->srv_sockets.used; i++) {
@@ -378,7 +446,7 @@ typedef enum {
 
 int network_init(server *srv) {
 	buffer *b;
-	size_t i, j;
+	size_t i;
 	network_backend_t backend;
 
 	struct nb_map {
@@ -411,17 +479,10 @@ int network_init(server *srv) {
 	buffer_append_string_len(b, CONST_STR_LEN(":"));
 	buffer_append_int(b, srv->srvconf.port);
 
-	/* check if we already know this socket, and if yes, don't init it */
-	for (j = 0; j < srv->srv_sockets.used; j++) {
-		if (buffer_is_equal(srv->srv_sockets.ptr[j]->srv_token, b)) {
-			break;
-		}
-	}
-	if (j == srv->srv_sockets.used) {
-		if (0 != network_server_init(srv, b, 0)) {
-			buffer_free(b);
-			return -1;
-		}
+	/* sockets already known (graceful restart) are reused */
+	if (0 != network_server_init_workers(srv, b, 0)) {
+		buffer_free(b);
+		return -1;
 	}
 	buffer_free(b);
 
@@ -475,22 +536,32 @@ int network_init(server *srv) {
 
 		if (dc->cond != CONFIG_COND_EQ) continue;
 
-		/* check if we already know this socket,
-		 * if yes, don't init it */
-		for (j = 0; j < srv->srv_sockets.used; j++) {
-			if (buffer_is_equal(srv->srv_sockets.ptr[j]->srv_token, dc->string)) {
-				break;
-			}
-		}
-
-		if (j == srv->srv_sockets.used) {
-			if (0 != network_server_init(srv, dc->string, i)) return -1;
-		}
+		/* sockets already known (graceful restart) are reused */
+		if (0 != network_server_init_workers(srv, dc->string, i)) return -1;
 	}
 
 	return 0;
 }
 
+void network_worker_sockets(server *srv, unsigned short worker) {
+	/* close listening sockets reserved for other workers (server.reuse-port)*/
+	size_t i, j;
+	for (i = 0, j = 0; i < srv->srv_sockets.used; ++i) {
+		server_socket *srv_socket = srv->srv_sockets.ptr[i];
+		if (0 == srv_socket->worker || worker == srv_socket->worker) {
+			srv->srv_sockets.ptr[j++] = srv_socket;
+			continue;
+		}
+		if (srv_socket->fd != -1) {
+			network_unregister_sock(srv, srv_socket);
+			close(srv_socket->fd);
+		}
+		buffer_free(srv_socket->srv_token);
+		free(srv_socket);
+	}
+	srv->srv_sockets.used = j;
+}
+
 void network_unregister_sock(server *srv, server_socket *srv_socket) {
 	if (-1 == srv_socket->fd || -1 == srv_socket->fde_ndx) return;
 	fdevent_event_del(srv->ev, &srv_socket->fde_ndx, srv_socket->fd);
@@ -504,6 +575,12 @@ int network_register_fdevents(server *srv) {
 		return -1;
 	}
 
+      #if defined(USE_LINUX_IOURING)
+	if (FDEVENT_HANDLER_LINUX_IOURING == srv->event_handler) {
+		network_write_iouring_init(srv);
+	}
+      #endif
+
 	if (srv->sockets_disabled) return 0; /* lighttpd -1 (one-shot mode) */
 
 	/* register fdevents after reset */
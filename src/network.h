@@ -9,6 +9,7 @@ void network_accept_tcp_nagle_disable(int fd);
 int network_init(server *srv);
 int network_close(server *srv);
 
+void network_worker_sockets(server *srv, unsigned short worker);
 int network_register_fdevents(server *srv);
 void network_unregister_sock(server *srv, server_socket *srv_socket);
 
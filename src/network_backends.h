@@ -58,6 +58,7 @@
 #endif
 
 #include "base.h"
+#include "fdevent.h"
 
 /* return values:
  * >= 0 : no error
@@ -75,6 +76,14 @@ int network_write_chunkqueue_writev(server *srv, connection *con, int fd, chunkq
 int network_write_chunkqueue_sendfile(server *srv, connection *con, int fd, chunkqueue *cq, off_t max_bytes); /* fallback to write */
 #endif
 
+#if defined(USE_LINUX_IOURING)
+/* server.event-handler = "linux-iouring": batch writes of memory chunks and
+ * small file chunks; larger file chunks are sent with the backend selected
+ * before (see network.c) */
+void network_write_iouring_init(server *srv);
+int network_write_chunkqueue_iouring(server *srv, connection *con, int fd, chunkqueue *cq, off_t max_bytes);
+#endif
+
 /* write next chunk(s); finished chunks are removed afterwards after successful writes.
  * return values: similar as backends (0 succes, -1 error, -2 remote close, -3 try again later (EINTR/EAGAIN)) */
 /* next chunk must be MEM_CHUNK. use write()/send() */
@@ -0,0 +1,134 @@
+#include "first.h"
+
+#include "network_backends.h"
+
+#if defined(USE_LINUX_IOURING)
+
+#include "log.h"
+
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* memory chunks and small file chunks are copied and queued as one write
+ * on the io_uring of the event handler; the writes of all connections are
+ * submitted together with the wait for events in one io_uring_enter() (see
+ * fdevent_linux_iouring.c).  queued data counts as written.  larger file
+ * chunks are sent with the configured server.network-backend, once the
+ * write queued before has completed. */
+
+/* (same limit as network_writev.c) */
+#define MAX_CHUNKS 32
+
+/* file chunks up to this size are read and copied into the write,
+ * (e.g. response headers and a small static file in one write) */
+#define MAX_FILE_COPY (16*1024)
+
+static int (* network_write_iouring_file)(server *srv, connection *con, int fd, chunkqueue *cq, off_t max_bytes);
+
+void network_write_iouring_init(server *srv) {
+	if (srv->network_backend_write == network_write_chunkqueue_iouring) return;
+	network_write_iouring_file = srv->network_backend_write;
+	srv->network_backend_write = network_write_chunkqueue_iouring;
+}
+
+static ssize_t network_read_file_chunk(server *srv, chunk *c, char *buf, size_t len) {
+	ssize_t r;
+
+	if (-1 == c->file.fd) {
+		if (-1 == (c->file.fd = fdevent_open_cloexec(c->file.name->ptr, O_RDONLY, 0))) {
+			log_error_write(srv, __FILE__, __LINE__, "ssb", "open failed:", strerror(errno), c->file.name);
+			return -1;
+		}
+	}
+
+	do {
+		r = pread(c->file.fd, buf, len, c->file.start + c->offset);
+	} while (-1 == r && errno == EINTR);
+
+	if (-1 == r) {
+		log_error_write(srv, __FILE__, __LINE__, "ssb", "read failed:", strerror(errno), c->file.name);
+		return -1;
+	}
+	if ((size_t)r != len) {
+		log_error_write(srv, __FILE__, __LINE__, "sb", "file shrunk:", c->file.name);
+		return -1;
+	}
+
+	return r;
+}
+
+int network_write_chunkqueue_iouring(server *srv, connection *con, int fd, chunkqueue *cq, off_t max_bytes) {
+	struct iovec chunks[MAX_CHUNKS];
+	size_t num_chunks;
+	off_t toSend;
+	ssize_t r;
+	chunk *c;
+
+	chunkqueue_remove_finished_chunks(cq);
+	if (NULL == cq->first || max_bytes <= 0) return 0;
+
+	if (FILE_CHUNK == cq->first->type
+	    && cq->first->file.length - cq->first->offset > MAX_FILE_COPY) {
+		if (fdevent_linux_iouring_write_pending(srv->ev, fd)) return 0;
+		return network_write_iouring_file(srv, con, fd, cq, max_bytes);
+	}
+
+	toSend = 0;
+	num_chunks = 0;
+	for (c = cq->first; NULL != c && num_chunks < MAX_CHUNKS && toSend < max_bytes; c = c->next) {
+		size_t c_len;
+
+		if (MEM_CHUNK == c->type) {
+			force_assert(c->offset >= 0 && c->offset <= (off_t)buffer_string_length(c->mem));
+			c_len = buffer_string_length(c->mem) - c->offset;
+			if (0 == c_len) continue;
+			if ((off_t)c_len > max_bytes - toSend) c_len = max_bytes - toSend;
+
+			chunks[num_chunks].iov_base = c->mem->ptr + c->offset;
+		} else {
+			/* copy at most one (small) file chunk, into srv->tmp_buf */
+			force_assert(c->offset >= 0 && c->offset <= c->file.length);
+			c_len = c->file.length - c->offset;
+			if (0 == c_len) continue;
+			if (c_len > MAX_FILE_COPY) break;
+			if ((off_t)c_len > max_bytes - toSend) c_len = max_bytes - toSend;
+
+			buffer_string_prepare_copy(srv->tmp_buf, c_len);
+			if (-1 == network_read_file_chunk(srv, c, srv->tmp_buf->ptr, c_len)) return -1;
+
+			chunks[num_chunks].iov_base = srv->tmp_buf->ptr;
+			c = NULL; /* stop after file chunk */
+		}
+
+		chunks[num_chunks].iov_len = c_len;
+		toSend += c_len;
+		++num_chunks;
+		if (NULL == c) break;
+	}
+
+	if (0 == num_chunks) return 0;
+
+	r = fdevent_linux_iouring_write(srv->ev, fd, chunks, (int)num_chunks);
+	if (r < 0) switch (errno) {
+	case EAGAIN: /* previous write still in flight */
+	case EINTR:
+		return 0;
+	case EPIPE:
+	case ECONNRESET:
+		return -2;
+	default:
+		log_error_write(srv, __FILE__, __LINE__, "ssd",
+				"write failed:", strerror(errno), fd);
+		return -1;
+	}
+
+	chunkqueue_mark_written(cq, r);
+
+	return 0;
+}
+
+#endif /* USE_LINUX_IOURING */
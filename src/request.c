@@ -1,6 +1,7 @@
 #include "first.h"
 
 #include "request.h"
+#include "http_header.h"
 #include "keyvalue.h"
 #include "log.h"
 #include "inet_ntop_cache.h"
@@ -398,6 +399,20 @@ static int http_request_split_value(array *vals, buffer *b) {
 	return 0;
 }
 
+static int http_request_header_invalid(server *srv, connection *con, const char *msg) {
+	if (srv->srvconf.log_request_header_on_error) {
+		if (msg) log_error_write(srv, __FILE__, __LINE__, "s", msg);
+		log_error_write(srv, __FILE__, __LINE__, "Sb",
+				"request-header:\n",
+				con->request.request);
+	}
+
+	con->http_status = 400;
+	con->keep_alive = 0;
+	con->response.keep_alive = 0;
+	return 0;
+}
+
 static int request_uri_is_valid_char(unsigned char c) {
 	if (c <= 32) return 0;
 	if (c == 127) return 0;
@@ -408,8 +423,8 @@ static int request_uri_is_valid_char(unsigned char c) {
 
 int http_request_parse(server *srv, connection *con) {
 	char *uri = NULL, *proto = NULL, *method = NULL, con_length_set;
-	int is_key = 1, key_len = 0, is_ws_after_key = 0, in_folding;
-	char *value = NULL, *key = NULL;
+	char *key = NULL; /* previous header key (for line-folding) */
+	size_t key_len = 0;
 	char *reqline_host = NULL;
 	int reqline_hostlen = 0;
 
@@ -683,8 +698,6 @@ int http_request_parse(server *srv, connection *con) {
 		}
 	}
 
-	in_folding = 0;
-
 	if (buffer_string_is_empty(con->request.uri)) {
 		con->http_status = 400;
 		con->response.keep_alive = 0;
@@ -709,428 +722,297 @@ int http_request_parse(server *srv, connection *con) {
 
 		buffer_copy_string_len(ds->key, CONST_STR_LEN("Host"));
 		buffer_copy_string_len(ds->value, reqline_host, reqline_hostlen);
-		array_insert_unique(con->request.headers, (data_unset *)ds);
+		http_header_request_insert(con, HTTP_HEADER_HOST, ds);
 		con->request.http_host = ds->value;
 	}
 
-	for (; i <= ilen && !done; i++) {
-		char *cur = con->parse_request->ptr + i;
+	for (i = first; !done; ) {
+		char * const k = con->parse_request->ptr + i;
+		const size_t klen = ilen - i;
+		char *value, *colon;
+		size_t eol, j, w, vlen;
+
+		/* find CRLF ending this line; reject other control chars
+		 * (other than HTAB) if http_header_strict, and always reject
+		 * '\0' and CR without LF */
+		for (eol = 0; ; ++eol) {
+			eol += http_header_scan_ctl(k + eol, klen - eol);
+			if (eol == klen || k[eol] == '\0') {
+				return http_request_header_invalid(srv, con, "invalid char in header -> 400");
+			}
+			if (k[eol] == '\r') {
+				if (k[eol+1] == '\n') break;
+				return http_request_header_invalid(srv, con, "CR without LF -> 400");
+			}
+			if (http_header_strict) {
+				if (srv->srvconf.log_request_header_on_error) {
+					log_error_write(srv, __FILE__, __LINE__, "sds",
+							"invalid char in header", (int)k[eol], "-> 400");
+				}
+				return http_request_header_invalid(srv, con, NULL);
+			}
+		}
+
+		/* \r\n -> \0\0 */
+		k[eol] = '\0';
+		k[eol+1] = '\0';
+		i += eol + 2;
 
-		if (is_key) {
-			size_t j;
-			int got_colon = 0;
+		if (0 == eol) {
+			/* End of Header */
+			done = 1;
+			break;
+		}
 
-			/**
-			 * 1*<any CHAR except CTLs or separators>
-			 * CTLs == 0-31 + 127, CHAR = 7-bit ascii (0..127)
+		if (k[0] == ' ' || k[0] == '\t') {
+			/* line-folding: append the line (incl. leading whitespace)
+			 * to the value of the previous header
 			 *
-			 */
-			switch(*cur) {
-			case ':':
-				is_key = 0;
-
-				value = cur + 1;
+			 * (look up previous key again as array_insert_unique()
+			 *  might have merged the previous data_string and freed it) */
+			data_string *ds;
 
-				if (is_ws_after_key == 0) {
-					key_len = i - first;
-				}
-				is_ws_after_key = 0;
+			if (!key || !key_len) {
+				return http_request_header_invalid(srv, con, "WS at the start of first line -> 400");
+			}
 
-				break;
-			case '(':
-			case ')':
-			case '<':
-			case '>':
-			case '@':
-			case ',':
-			case ';':
-			case '\\':
-			case '\"':
-			case '/':
-			case '[':
-			case ']':
-			case '?':
-			case '=':
-			case '{':
-			case '}':
-				con->http_status = 400;
-				con->keep_alive = 0;
-				con->response.keep_alive = 0;
+			if (NULL != (ds = (data_string *)array_get_element_klen(con->request.headers, key, key_len))) {
+				buffer_append_string_len(ds->value, k, eol);
+			}
+			continue;
+		}
 
+		/**
+		 * 1*<any CHAR except CTLs or separators>
+		 * CTLs == 0-31 + 127, CHAR = 7-bit ascii (0..127)
+		 *
+		 */
+		if (NULL == (colon = memchr(k, ':', eol))) {
+			return http_request_header_invalid(srv, con, "missing ':' in header line -> 400");
+		}
+		key = k;
+		key_len = colon - k;
+		for (j = 0; j < key_len; ++j) {
+			switch (k[j]) {
+			case '(': case ')': case '<': case '>': case '@':
+			case ',': case ';': case '\\': case '\"': case '/':
+			case '[': case ']': case '?': case '=': case '{': case '}':
 				if (srv->srvconf.log_request_header_on_error) {
 					log_error_write(srv, __FILE__, __LINE__, "sbsds",
-						"invalid character in key", con->request.request, cur, *cur, "-> 400");
-
-					log_error_write(srv, __FILE__, __LINE__, "Sb",
-						"request-header:\n",
-						con->request.request);
+						"invalid character in key", con->request.request, k+j, k[j], "-> 400");
 				}
-				return 0;
+				return http_request_header_invalid(srv, con, NULL);
 			case ' ':
 			case '\t':
-				if (i == first) {
-					is_key = 0;
-					in_folding = 1;
-					value = cur;
-
-					break;
+				/* only WS may follow up to the ':' */
+				for (w = j; w < key_len; ++w) {
+					if (k[w] != ' ' && k[w] != '\t') {
+						return http_request_header_invalid(srv, con, "WS character in key -> 400");
+					}
+				}
+				key_len = j;
+				break;
+			default:
+				if (http_header_strict && (k[j] < 32 || ((unsigned char)k[j]) >= 127)) {
+					if (srv->srvconf.log_request_header_on_error) {
+						log_error_write(srv, __FILE__, __LINE__, "sbsds",
+							"invalid character in key", con->request.request, k+j, k[j], "-> 400");
+					}
+					return http_request_header_invalid(srv, con, NULL);
 				}
+				break;
+			}
+		}
 
+		/* strip leading and trailing white-spaces */
+		value = colon + 1;
+		vlen = eol - (size_t)(value - k);
+		while (vlen && (*value == ' ' || *value == '\t')) { ++value; --vlen; }
+		while (vlen && (value[vlen-1] == ' ' || value[vlen-1] == '\t')) --vlen;
+		value[vlen] = '\0';
+
+		if (vlen > 0) {
+			const enum http_header_e id = http_header_hkey_get(key, key_len);
+			data_string *ds;
+			if (NULL == (ds = (data_string *)array_get_unused_element(con->request.headers, TYPE_STRING))) {
+				ds = data_string_init();
+			}
+			buffer_copy_string_len(ds->key, key, key_len);
+			buffer_copy_string_len(ds->value, value, vlen);
 
-				key_len = i - first;
+			switch (id) {
+			case HTTP_HEADER_CONNECTION: {
+				array *vals;
+				size_t vi;
 
-				/* skip every thing up to the : */
-				for (j = 1; !got_colon; j++) {
-					switch(con->parse_request->ptr[j + i]) {
-					case ' ':
-					case '\t':
-						/* skip WS */
-						continue;
-					case ':':
-						/* ok, done; handle the colon the usual way */
+				/* split on , */
 
-						i += j - 1;
-						got_colon = 1;
-						is_ws_after_key = 1; /* we already know the key length */
+				vals = srv->split_vals;
 
-						break;
-					default:
-						/* error */
+				array_reset(vals);
 
-						if (srv->srvconf.log_request_header_on_error) {
-							log_error_write(srv, __FILE__, __LINE__, "s", "WS character in key -> 400");
-							log_error_write(srv, __FILE__, __LINE__, "Sb",
-								"request-header:\n",
-								con->request.request);
-						}
+				http_request_split_value(vals, ds->value);
 
-						con->http_status = 400;
-						con->response.keep_alive = 0;
-						con->keep_alive = 0;
+				for (vi = 0; vi < vals->used; vi++) {
+					data_string *dsv = (data_string *)vals->data[vi];
 
-						return 0;
+					if (0 == buffer_caseless_compare(CONST_BUF_LEN(dsv->value), CONST_STR_LEN("keep-alive"))) {
+						keep_alive_set = HTTP_CONNECTION_KEEPALIVE;
+
+						break;
+					} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(dsv->value), CONST_STR_LEN("close"))) {
+						keep_alive_set = HTTP_CONNECTION_CLOSE;
+
+						break;
 					}
 				}
-
 				break;
-			case '\r':
-				if (con->parse_request->ptr[i+1] == '\n' && i == first) {
-					/* End of Header */
-					con->parse_request->ptr[i] = '\0';
-					con->parse_request->ptr[i+1] = '\0';
+			}
+			case HTTP_HEADER_CONTENT_LENGTH: {
+				char *err;
+				off_t r;
 
-					i++;
+				if (con_length_set) {
+					con->http_status = 400;
+					con->keep_alive = 0;
 
-					done = 1;
-				} else {
 					if (srv->srvconf.log_request_header_on_error) {
-						log_error_write(srv, __FILE__, __LINE__, "s", "CR without LF -> 400");
+						log_error_write(srv, __FILE__, __LINE__, "s",
+								"duplicate Content-Length-header -> 400");
 						log_error_write(srv, __FILE__, __LINE__, "Sb",
-							"request-header:\n",
-							con->request.request);
+								"request-header:\n",
+								con->request.request);
 					}
+					http_header_request_insert(con, id, ds);
+					return 0;
+				}
+
+				r = strtoll(ds->value->ptr, &err, 10);
+
+				if (*err == '\0' && r >= 0) {
+					con_length_set = 1;
+					con->request.content_length = r;
+				} else {
+					log_error_write(srv, __FILE__, __LINE__, "sbs",
+							"content-length broken:", ds->value, "-> 400");
 
 					con->http_status = 400;
 					con->keep_alive = 0;
-					con->response.keep_alive = 0;
+
+					http_header_request_insert(con, id, ds);
 					return 0;
 				}
 				break;
-			default:
-				if (http_header_strict ? (*cur < 32 || ((unsigned char)*cur) >= 127) : *cur == '\0') {
+			}
+			case HTTP_HEADER_CONTENT_TYPE:
+				/* if dup, only the first one will survive */
+				if (!con->request.http_content_type) {
+					con->request.http_content_type = ds->value->ptr;
+				} else {
 					con->http_status = 400;
 					con->keep_alive = 0;
-					con->response.keep_alive = 0;
 
 					if (srv->srvconf.log_request_header_on_error) {
-						log_error_write(srv, __FILE__, __LINE__, "sbsds",
-							"invalid character in key", con->request.request, cur, *cur, "-> 400");
-
+						log_error_write(srv, __FILE__, __LINE__, "s",
+								"duplicate Content-Type-header -> 400");
 						log_error_write(srv, __FILE__, __LINE__, "Sb",
-							"request-header:\n",
-							con->request.request);
+								"request-header:\n",
+								con->request.request);
 					}
-
+					http_header_request_insert(con, id, ds);
 					return 0;
 				}
-				/* ok */
 				break;
-			}
-		} else {
-			switch(*cur) {
-			case '\r':
-				if (con->parse_request->ptr[i+1] == '\n') {
-					data_string *ds = NULL;
-
-					/* End of Headerline */
-					con->parse_request->ptr[i] = '\0';
-					con->parse_request->ptr[i+1] = '\0';
-
-					if (in_folding) {
-						/**
-						 * we use a evil hack to handle the line-folding
-						 * 
-						 * As array_insert_unique() deletes 'ds' in the case of a duplicate
-						 * ds points somewhere and we get a evil crash. As a solution we keep the old
-						 * "key" and get the current value from the hash and append us
-						 *
-						 * */
-
-						if (!key || !key_len) {
-							/* 400 */
-
-							if (srv->srvconf.log_request_header_on_error) {
-								log_error_write(srv, __FILE__, __LINE__, "s", "WS at the start of first line -> 400");
-
-								log_error_write(srv, __FILE__, __LINE__, "Sb",
-									"request-header:\n",
-									con->request.request);
-							}
-
-
-							con->http_status = 400;
-							con->keep_alive = 0;
-							con->response.keep_alive = 0;
-							return 0;
-						}
-
-						if (NULL != (ds = (data_string *)array_get_element_klen(con->request.headers, key, key_len))) {
-							buffer_append_string(ds->value, value);
-						}
-					} else {
-						int s_len;
-						key = con->parse_request->ptr + first;
-
-						s_len = cur - value;
-
-						/* strip trailing white-spaces */
-						for (; s_len > 0 && 
-								(value[s_len - 1] == ' ' || 
-								 value[s_len - 1] == '\t'); s_len--);
-
-						value[s_len] = '\0';
-
-						if (s_len > 0) {
-							int cmp = 0;
-							if (NULL == (ds = (data_string *)array_get_unused_element(con->request.headers, TYPE_STRING))) {
-								ds = data_string_init();
-							}
-							buffer_copy_string_len(ds->key, key, key_len);
-							buffer_copy_string_len(ds->value, value, s_len);
-
-							/* retreive values
-							 *
-							 *
-							 * the list of options is sorted to simplify the search
-							 */
-
-							if (0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Connection")))) {
-								array *vals;
-								size_t vi;
-
-								/* split on , */
-
-								vals = srv->split_vals;
-
-								array_reset(vals);
-
-								http_request_split_value(vals, ds->value);
-
-								for (vi = 0; vi < vals->used; vi++) {
-									data_string *dsv = (data_string *)vals->data[vi];
-
-									if (0 == buffer_caseless_compare(CONST_BUF_LEN(dsv->value), CONST_STR_LEN("keep-alive"))) {
-										keep_alive_set = HTTP_CONNECTION_KEEPALIVE;
-
-										break;
-									} else if (0 == buffer_caseless_compare(CONST_BUF_LEN(dsv->value), CONST_STR_LEN("close"))) {
-										keep_alive_set = HTTP_CONNECTION_CLOSE;
-
-										break;
-									}
-								}
-
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Content-Length")))) {
-								char *err;
-								off_t r;
-
-								if (con_length_set) {
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									if (srv->srvconf.log_request_header_on_error) {
-										log_error_write(srv, __FILE__, __LINE__, "s",
-												"duplicate Content-Length-header -> 400");
-										log_error_write(srv, __FILE__, __LINE__, "Sb",
-												"request-header:\n",
-												con->request.request);
-									}
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-
-								r = strtoll(ds->value->ptr, &err, 10);
-
-								if (*err == '\0' && r >= 0) {
-									con_length_set = 1;
-									con->request.content_length = r;
-								} else {
-									log_error_write(srv, __FILE__, __LINE__, "sbs",
-											"content-length broken:", ds->value, "-> 400");
-
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Content-Type")))) {
-								/* if dup, only the first one will survive */
-								if (!con->request.http_content_type) {
-									con->request.http_content_type = ds->value->ptr;
-								} else {
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									if (srv->srvconf.log_request_header_on_error) {
-										log_error_write(srv, __FILE__, __LINE__, "s",
-												"duplicate Content-Type-header -> 400");
-										log_error_write(srv, __FILE__, __LINE__, "Sb",
-												"request-header:\n",
-												con->request.request);
-									}
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Host")))) {
-								if (reqline_host) {
-									/* ignore all host: headers as we got the host in the request line */
-									ds->free((data_unset*) ds);
-									ds = NULL;
-								} else if (!con->request.http_host) {
-									con->request.http_host = ds->value;
-								} else {
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									if (srv->srvconf.log_request_header_on_error) {
-										log_error_write(srv, __FILE__, __LINE__, "s",
-												"duplicate Host-header -> 400");
-										log_error_write(srv, __FILE__, __LINE__, "Sb",
-												"request-header:\n",
-												con->request.request);
-									}
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-Modified-Since")))) {
-								/* Proxies sometimes send dup headers
-								 * if they are the same we ignore the second
-								 * if not, we raise an error */
-								if (!con->request.http_if_modified_since) {
-									con->request.http_if_modified_since = ds->value->ptr;
-								} else if (0 == strcasecmp(con->request.http_if_modified_since,
-											ds->value->ptr)) {
-									/* ignore it if they are the same */
-
-									ds->free((data_unset *)ds);
-									ds = NULL;
-								} else {
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									if (srv->srvconf.log_request_header_on_error) {
-										log_error_write(srv, __FILE__, __LINE__, "s",
-												"duplicate If-Modified-Since header -> 400");
-										log_error_write(srv, __FILE__, __LINE__, "Sb",
-												"request-header:\n",
-												con->request.request);
-									}
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("If-None-Match")))) {
-								/* if dup, only the first one will survive */
-								if (!con->request.http_if_none_match) {
-									con->request.http_if_none_match = ds->value->ptr;
-								} else {
-									ds->free((data_unset*) ds);
-									ds = NULL;
-								}
-							} else if (cmp > 0 && 0 == (cmp = buffer_caseless_compare(CONST_BUF_LEN(ds->key), CONST_STR_LEN("Range")))) {
-								if (!con->request.http_range) {
-									/* bytes=.*-.* */
-
-									if (0 == strncasecmp(ds->value->ptr, "bytes=", 6) &&
-									    NULL != strchr(ds->value->ptr+6, '-')) {
-
-										/* if dup, only the first one will survive */
-										con->request.http_range = ds->value->ptr + 6;
-									}
-								} else {
-									con->http_status = 400;
-									con->keep_alive = 0;
-
-									if (srv->srvconf.log_request_header_on_error) {
-										log_error_write(srv, __FILE__, __LINE__, "s",
-												"duplicate Range-header -> 400");
-										log_error_write(srv, __FILE__, __LINE__, "Sb",
-												"request-header:\n",
-												con->request.request);
-									}
-									array_insert_unique(con->request.headers, (data_unset *)ds);
-									return 0;
-								}
-							}
-
-							if (ds) array_insert_unique(con->request.headers, (data_unset *)ds);
-						} else {
-							/* empty header-fields are not allowed by HTTP-RFC, we just ignore them */
-						}
-					}
-
-					i++;
-					first = i+1;
-					is_key = 1;
-					value = NULL;
-#if 0
-					/**
-					 * for Bug 1230 keep the key_len a live
-					 */
-					key_len = 0; 
-#endif
-					in_folding = 0;
+			case HTTP_HEADER_HOST:
+				if (reqline_host) {
+					/* ignore all host: headers as we got the host in the request line */
+					ds->free((data_unset*) ds);
+					ds = NULL;
+				} else if (!con->request.http_host) {
+					con->request.http_host = ds->value;
 				} else {
+					con->http_status = 400;
+					con->keep_alive = 0;
+
 					if (srv->srvconf.log_request_header_on_error) {
-						log_error_write(srv, __FILE__, __LINE__, "sbs",
-								"CR without LF", con->request.request, "-> 400");
+						log_error_write(srv, __FILE__, __LINE__, "s",
+								"duplicate Host-header -> 400");
+						log_error_write(srv, __FILE__, __LINE__, "Sb",
+								"request-header:\n",
+								con->request.request);
 					}
-
+					http_header_request_insert(con, id, ds);
+					return 0;
+				}
+				break;
+			case HTTP_HEADER_IF_MODIFIED_SINCE:
+				/* Proxies sometimes send dup headers
+				 * if they are the same we ignore the second
+				 * if not, we raise an error */
+				if (!con->request.http_if_modified_since) {
+					con->request.http_if_modified_since = ds->value->ptr;
+				} else if (0 == strcasecmp(con->request.http_if_modified_since,
+							ds->value->ptr)) {
+					/* ignore it if they are the same */
+
+					ds->free((data_unset *)ds);
+					ds = NULL;
+				} else {
 					con->http_status = 400;
 					con->keep_alive = 0;
-					con->response.keep_alive = 0;
+
+					if (srv->srvconf.log_request_header_on_error) {
+						log_error_write(srv, __FILE__, __LINE__, "s",
+								"duplicate If-Modified-Since header -> 400");
+						log_error_write(srv, __FILE__, __LINE__, "Sb",
+								"request-header:\n",
+								con->request.request);
+					}
+					http_header_request_insert(con, id, ds);
 					return 0;
 				}
 				break;
-			case ' ':
-			case '\t':
-				/* strip leading WS */
-				if (value == cur) value = cur+1;
+			case HTTP_HEADER_IF_NONE_MATCH:
+				/* if dup, only the first one will survive */
+				if (!con->request.http_if_none_match) {
+					con->request.http_if_none_match = ds->value->ptr;
+				} else {
+					ds->free((data_unset*) ds);
+					ds = NULL;
+				}
 				break;
-			default:
-				if (http_header_strict ? (*cur >= 0 && *cur < 32) : *cur == '\0') {
-					if (srv->srvconf.log_request_header_on_error) {
-						log_error_write(srv, __FILE__, __LINE__, "sds",
-								"invalid char in header", (int)*cur, "-> 400");
-					}
+			case HTTP_HEADER_RANGE:
+				if (!con->request.http_range) {
+					/* bytes=.*-.* */
 
+					if (0 == strncasecmp(ds->value->ptr, "bytes=", 6) &&
+					    NULL != strchr(ds->value->ptr+6, '-')) {
+
+						/* if dup, only the first one will survive */
+						con->request.http_range = ds->value->ptr + 6;
+					}
+				} else {
 					con->http_status = 400;
 					con->keep_alive = 0;
 
+					if (srv->srvconf.log_request_header_on_error) {
+						log_error_write(srv, __FILE__, __LINE__, "s",
+								"duplicate Range-header -> 400");
+						log_error_write(srv, __FILE__, __LINE__, "Sb",
+								"request-header:\n",
+								con->request.request);
+					}
+					http_header_request_insert(con, id, ds);
 					return 0;
 				}
 				break;
+			default:
+				break;
 			}
+
+			if (ds) http_header_request_insert(con, id, ds);
+		} else {
+			/* empty header-fields are not allowed by HTTP-RFC, we just ignore them */
 		}
 	}
 
@@ -1194,7 +1076,7 @@ int http_request_parse(server *srv, connection *con) {
 	}
 
 	{
-		data_string *ds = (data_string *)array_get_element(con->request.headers, "Transfer-Encoding");
+		data_string *ds = http_header_request_get(con, HTTP_HEADER_TRANSFER_ENCODING, CONST_STR_LEN("Transfer-Encoding"));
 		if (NULL != ds) {
 			if (con->request.http_version == HTTP_VERSION_1_0) {
 				log_error_write(srv, __FILE__, __LINE__, "s",
@@ -1220,7 +1102,7 @@ int http_request_parse(server *srv, connection *con) {
 			con->request.content_length = -1;
 
 			/*(note: ignore whether or not Content-Length was provided)*/
-			ds = (data_string *)array_get_element(con->request.headers, "Content-Length");
+			ds = http_header_request_get(con, HTTP_HEADER_CONTENT_LENGTH, CONST_STR_LEN("Content-Length"));
 			if (NULL != ds) buffer_reset(ds->value); /* headers with empty values are ignored */
 		}
 	}
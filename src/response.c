@@ -8,6 +8,7 @@
 #include "chunk.h"
 
 #include "configfile.h"
+#include "connections.h"
 
 #include "plugin.h"
 
@@ -25,17 +26,8 @@ int http_response_write_header(server *srv, connection *con) {
 	size_t i;
 	int have_date = 0;
 	int have_server = 0;
-
-	b = buffer_init();
-
-	if (con->request.http_version == HTTP_VERSION_1_1) {
-		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.1 "));
-	} else {
-		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.0 "));
-	}
-	buffer_append_int(b, con->http_status);
-	buffer_append_string_len(b, CONST_STR_LEN(" "));
-	buffer_append_string(b, get_http_status_name(con->http_status));
+	const char *status_line;
+	size_t status_len;
 
 	/* disable keep-alive if requested */
 	if (con->request_count > con->conf.max_keep_alive_requests || 0 == con->conf.max_keep_alive_idle) {
@@ -52,6 +44,22 @@ int http_response_write_header(server *srv, connection *con) {
 		response_header_overwrite(srv, con, CONST_STR_LEN("Connection"), CONST_STR_LEN("keep-alive"));
 	}
 
+	/* build the header block in place in a (pooled) chunk of the write queue */
+	b = chunkqueue_prepend_buffer_open(con->write_queue);
+
+	if (con->request.http_version == HTTP_VERSION_1_1) {
+		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.1 "));
+	} else {
+		buffer_copy_string_len(b, CONST_STR_LEN("HTTP/1.0 "));
+	}
+	status_line = get_http_status_line(con->http_status, &status_len);
+	if (NULL != status_line) {
+		buffer_append_string_len(b, status_line, status_len);
+	} else {
+		buffer_append_int(b, con->http_status);
+		buffer_append_string_len(b, CONST_STR_LEN(" "));
+	}
+
 	/* add all headers */
 	for (i = 0; i < con->response.headers->used; i++) {
 		data_string *ds;
@@ -59,46 +67,60 @@ int http_response_write_header(server *srv, connection *con) {
 		ds = (data_string *)con->response.headers->data[i];
 
 		if (buffer_string_is_empty(ds->value) || buffer_string_is_empty(ds->key)) continue;
-		if (0 == strncasecmp(ds->key->ptr, CONST_STR_LEN("X-Sendfile"))) continue;
-		if (0 == strncasecmp(ds->key->ptr, CONST_STR_LEN("X-LIGHTTPD-"))) {
-			if (0 == strncasecmp(ds->key->ptr+sizeof("X-LIGHTTPD-")-1, CONST_STR_LEN("KBytes-per-second"))) {
-				/* "X-LIGHTTPD-KBytes-per-second" */
-				long limit = strtol(ds->value->ptr, NULL, 10);
-				if (limit > 0
-				    && (limit < con->conf.kbytes_per_second
-				        || 0 == con->conf.kbytes_per_second)) {
-					if (limit > USHRT_MAX) limit= USHRT_MAX;
-					con->conf.kbytes_per_second = limit;
+		switch (ds->ext) {
+		case HTTP_HEADER_DATE:
+			have_date = 1;
+			break;
+		case HTTP_HEADER_SERVER:
+			have_server = 1;
+			break;
+		case HTTP_HEADER_CONTENT_ENCODING:
+			if (304 == con->http_status) continue;
+			break;
+		case HTTP_HEADER_X_SENDFILE:
+		case HTTP_HEADER_X_SENDFILE2:
+		case HTTP_HEADER_X_LIGHTTPD_SEND_FILE:
+			continue;
+		case HTTP_HEADER_OTHER:
+			if ((ds->key->ptr[0] | 0x20) != 'x') break;
+			if (0 == strncasecmp(ds->key->ptr, CONST_STR_LEN("X-Sendfile"))) continue;
+			if (0 == strncasecmp(ds->key->ptr, CONST_STR_LEN("X-LIGHTTPD-"))) {
+				if (0 == strncasecmp(ds->key->ptr+sizeof("X-LIGHTTPD-")-1, CONST_STR_LEN("KBytes-per-second"))) {
+					/* "X-LIGHTTPD-KBytes-per-second" */
+					long limit = strtol(ds->value->ptr, NULL, 10);
+					if (limit > 0
+					    && (limit < con->conf.kbytes_per_second
+					        || 0 == con->conf.kbytes_per_second)) {
+						if (limit > USHRT_MAX) limit= USHRT_MAX;
+						con->conf.kbytes_per_second = limit;
+					}
 				}
+				continue;
 			}
-			continue;
-		} else {
-			if (0 == strcasecmp(ds->key->ptr, "Date")) have_date = 1;
-			if (0 == strcasecmp(ds->key->ptr, "Server")) have_server = 1;
-			if (0 == strcasecmp(ds->key->ptr, "Content-Encoding") && 304 == con->http_status) continue;
+			break;
+		default:
+			break;
+		}
 
-			buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
-			buffer_append_string_buffer(b, ds->key);
-			buffer_append_string_len(b, CONST_STR_LEN(": "));
+		buffer_append_string_len(b, CONST_STR_LEN("\r\n"));
+		buffer_append_string_buffer(b, ds->key);
+		buffer_append_string_len(b, CONST_STR_LEN(": "));
 #if 0
-			/** 
-			 * the value might contain newlines, encode them with at least one white-space
-			 */
-			buffer_append_string_encoded(b, CONST_BUF_LEN(ds->value), ENCODING_HTTP_HEADER);
+		/** 
+		 * the value might contain newlines, encode them with at least one white-space
+		 */
+		buffer_append_string_encoded(b, CONST_BUF_LEN(ds->value), ENCODING_HTTP_HEADER);
 #else
-			buffer_append_string_buffer(b, ds->value);
+		buffer_append_string_buffer(b, ds->value);
 #endif
-		}
 	}
 
 	if (!have_date) {
 		/* HTTP/1.1 requires a Date: header */
-		buffer_append_string_len(b, CONST_STR_LEN("\r\nDate: "));
 
-		/* cache the generated timestamp */
+		/* cache the generated header (changes once a second) */
 		if (srv->cur_ts != srv->last_generated_date_ts) {
-			buffer_string_prepare_copy(srv->ts_date_str, 255);
-
+			buffer_copy_string_len(srv->ts_date_str, CONST_STR_LEN("\r\nDate: "));
 			buffer_append_strftime(srv->ts_date_str, "%a, %d %b %Y %H:%M:%S GMT", gmtime(&(srv->cur_ts)));
 
 			srv->last_generated_date_ts = srv->cur_ts;
@@ -108,23 +130,19 @@ int http_response_write_header(server *srv, connection *con) {
 	}
 
 	if (!have_server) {
-		if (!buffer_string_is_empty(con->conf.server_tag)) {
-			buffer_append_string_len(b, CONST_STR_LEN("\r\nServer: "));
-			buffer_append_string_encoded(b, CONST_BUF_LEN(con->conf.server_tag), ENCODING_HTTP_HEADER);
-		}
+		/* (pre-rendered and encoded at startup; empty if server.tag = "") */
+		buffer_append_string_buffer(b, con->conf.server_tag_hdr);
 	}
 
 	buffer_append_string_len(b, CONST_STR_LEN("\r\n\r\n"));
 
 	con->bytes_header = buffer_string_length(b);
+	chunkqueue_prepend_buffer_commit(con->write_queue);
 
 	if (con->conf.log_response_header) {
 		log_error_write(srv, __FILE__, __LINE__, "sSb", "Response-Header:", "\n", b);
 	}
 
-	chunkqueue_prepend_buffer(con->write_queue, b);
-	buffer_free(b);
-
 	return 0;
 }
 
@@ -158,6 +176,8 @@ handler_t http_response_prepare(server *srv, connection *con) {
 		 *
 		 *  */
 
+		connection_timing(srv, con, CON_TIMING_BODY);
+
 		config_cond_cache_reset(srv, con);
 		config_setup_connection(srv, con); /* Perhaps this could be removed at other places. */
 
@@ -233,6 +253,7 @@ handler_t http_response_prepare(server *srv, connection *con) {
 		con->conditional_is_valid[COMP_HTTP_QUERY_STRING] = 1;   /* HTTPqs */
 		con->conditional_is_valid[COMP_HTTP_REQUEST_HEADER] = 1; /* HTTP request header */
 		config_patch_connection(srv, con);
+		connection_timing(srv, con, CON_TIMING_CONFIG);
 
 		/* do we have to downgrade to 1.0 ? */
 		if (!con->conf.allow_http11) {
@@ -291,7 +312,9 @@ handler_t http_response_prepare(server *srv, connection *con) {
 		 *
 		 */
 
-		switch(r = plugins_call_handle_uri_clean(srv, con)) {
+		r = plugins_call_handle_uri_clean(srv, con);
+		connection_timing(srv, con, CON_TIMING_URI);
+		switch(r) {
 		case HANDLER_GO_ON:
 			break;
 		case HANDLER_FINISHED:
@@ -441,7 +464,9 @@ handler_t http_response_prepare(server *srv, connection *con) {
 			log_error_write(srv, __FILE__, __LINE__,  "sb", "Path         :", con->physical.path);
 		}
 
-		switch(r = plugins_call_handle_physical(srv, con)) {
+		r = plugins_call_handle_physical(srv, con);
+		connection_timing(srv, con, CON_TIMING_PHYSICAL);
+		switch(r) {
 		case HANDLER_GO_ON:
 			break;
 		case HANDLER_FINISHED:
@@ -651,7 +676,9 @@ handler_t http_response_prepare(server *srv, connection *con) {
 		}
 
 		/* call the handlers */
-		switch(r = plugins_call_handle_subrequest_start(srv, con)) {
+		r = plugins_call_handle_subrequest_start(srv, con);
+		connection_timing(srv, con, CON_TIMING_HANDLER);
+		switch(r) {
 		case HANDLER_GO_ON:
 			/* request was not handled */
 			break;
@@ -18,6 +18,7 @@
 #include "plugin.h"
 #include "joblist.h"
 #include "network_backends.h"
+#include "status_counter.h"
 
 #ifdef HAVE_VERSIONSTAMP_H
 # include "versionstamp.h"
@@ -244,6 +245,7 @@ static server *server_init(void) {
 	CLEAN(srvconf.event_handler);
 	CLEAN(srvconf.pid_file);
 	CLEAN(srvconf.syslog_facility);
+	CLEAN(srvconf.statistics_file);
 
 	CLEAN(tmp_chunk_len);
 #undef CLEAN
@@ -254,6 +256,7 @@ static server *server_init(void) {
 	CLEAN(config_context);
 	CLEAN(config_touched);
 	CLEAN(status);
+	CLEAN(status_totals);
 #undef CLEAN
 
 	for (i = 0; i < FILE_CACHE_MAX; i++) {
@@ -265,6 +268,7 @@ static server *server_init(void) {
 
 	srv->cur_ts = time(NULL);
 	srv->startup_ts = srv->cur_ts;
+	srv->timer_wheel_ts = srv->cur_ts;
 
 	srv->conns = calloc(1, sizeof(*srv->conns));
 	force_assert(srv->conns);
@@ -286,13 +290,18 @@ static server *server_init(void) {
 	srv->srvconf.http_host_normalize = 0;
 	srv->srvconf.high_precision_timestamps = 0;
 	srv->srvconf.max_request_field_size = 8192;
+	srv->srvconf.stat_cache_max_entries = 65536;
+	srv->srvconf.stat_cache_content_memory = 64 * 1024; /* 64 MB */
 	srv->srvconf.loadavg[0] = 0.0;
 	srv->srvconf.loadavg[1] = 0.0;
 	srv->srvconf.loadavg[2] = 0.0;
 
+	srv->status_fd = -1;
+
 	/* use syslog */
 	srv->errorlog_fd = STDERR_FILENO;
 	srv->errorlog_mode = ERRORLOG_FD;
+	srv->errorlog_st = log_error_st_init();
 
 	srv->split_vals = array_init();
 	srv->request_env = plugins_call_handle_request_env;
@@ -336,10 +345,14 @@ static void server_free(server *srv) {
 	CLEAN(srvconf.network_backend);
 	CLEAN(srvconf.xattr_name);
 	CLEAN(srvconf.syslog_facility);
+	CLEAN(srvconf.statistics_file);
 
 	CLEAN(tmp_chunk_len);
 #undef CLEAN
 
+	log_error_st_free(srv->errorlog_st);
+	status_counter_close(srv);
+
 #if 0
 	fdevent_unregister(srv->ev, srv->fd);
 #endif
@@ -356,6 +369,7 @@ static void server_free(server *srv) {
 			buffer_free(s->document_root);
 			buffer_free(s->server_name);
 			buffer_free(s->server_tag);
+			buffer_free(s->server_tag_hdr);
 			buffer_free(s->error_handler);
 			buffer_free(s->error_handler_404);
 			buffer_free(s->errorfile_prefix);
@@ -373,6 +387,7 @@ static void server_free(server *srv) {
 	CLEAN(config_context);
 	CLEAN(config_touched);
 	CLEAN(status);
+	CLEAN(status_totals);
 	CLEAN(srvconf.upload_tempdirs);
 #undef CLEAN
 
@@ -383,6 +398,8 @@ static void server_free(server *srv) {
 		stat_cache_free(srv->stat_cache);
 	}
 
+	chunkqueue_chunk_pool_clear();
+
 	array_free(srv->srvconf.modules);
 	array_free(srv->split_vals);
 
@@ -559,6 +576,11 @@ static void show_features (void) {
 #else
       "\t- epoll (Linux 2.6)\n"
 #endif
+#ifdef USE_LINUX_IOURING
+      "\t+ io_uring (Linux 5.11)\n"
+#else
+      "\t- io_uring (Linux 5.11)\n"
+#endif
 #ifdef USE_SOLARIS_DEVPOLL
       "\t+ /dev/poll (Solaris)\n"
 #else
@@ -884,18 +906,25 @@ static int log_error_cycle(server *srv) {
 
     if (srv->errorlog_mode == ERRORLOG_FILE) {
         const char *logfile = srv->srvconf.errorlog_file->ptr;
+        /* writer thread must not write to the fd while it is replaced */
+        const int async = log_error_async_stop(srv);
         if (-1 == fdevent_cycle_logger(logfile, &srv->errorlog_fd)) {
             /* write to old log */
             log_error_write(srv, __FILE__, __LINE__, "SSSS",
                             "cycling errorlog '", logfile,
                             "' failed: ", strerror(errno));
         }
+        if (async) log_error_async_start(srv);
     }
 
     return 0;
 }
 
 static int log_error_close(server *srv) {
+    /* report pending repeated messages and flush writer thread */
+    log_error_trigger(srv);
+    log_error_async_stop(srv);
+
     switch(srv->errorlog_mode) {
     case ERRORLOG_PIPE:
     case ERRORLOG_FILE:
@@ -982,8 +1011,8 @@ static void server_graceful_shutdown_maint (server *srv) {
              * (from zero) *up to* one more second, but no more */
             if (HTTP_LINGER_TIMEOUT > 1)
                 con->close_timeout_ts -= (HTTP_LINGER_TIMEOUT - 1);
-            if (srv->cur_ts - con->close_timeout_ts > HTTP_LINGER_TIMEOUT)
-                changed = 1;
+            /* (always run state machine to reschedule connection timer) */
+            changed = 1;
         }
         else if (con->state == CON_STATE_READ && con->request_count > 1
                  && chunkqueue_is_empty(con->read_queue)) {
@@ -1325,6 +1354,11 @@ static int server_main (server * const srv, int argc, char **argv) {
 		return -1;
 	}
 
+	/* create server.statistics-file (see status_counter_share() below) */
+	if (0 != status_counter_open(srv)) {
+		return -1;
+	}
+
 	if (i_am_root) {
 #ifdef HAVE_PWD_H
 		/* set user and group */
@@ -1511,6 +1545,15 @@ static int server_main (server * const srv, int argc, char **argv) {
 		buffer_copy_string_len(srv->config_storage[0]->server_tag, CONST_STR_LEN(PACKAGE_DESC));
 	}
 
+	/* pre-render Server response header of each config context */
+	for (i = 0; i < srv->config_context->used; ++i) {
+		specific_config *s = srv->config_storage[i];
+		buffer_reset(s->server_tag_hdr);
+		if (buffer_string_is_empty(s->server_tag)) continue;
+		buffer_copy_string_len(s->server_tag_hdr, CONST_STR_LEN("\r\nServer: "));
+		buffer_append_string_encoded(s->server_tag_hdr, CONST_BUF_LEN(s->server_tag), ENCODING_HTTP_HEADER);
+	}
+
 	if (HANDLER_GO_ON != plugins_call_set_defaults(srv)) {
 		log_error_write(srv, __FILE__, __LINE__, "s", "Configuration of plugins failed. Going down.");
 		return -1;
@@ -1560,6 +1603,12 @@ static int server_main (server * const srv, int argc, char **argv) {
 		return 0;
 	}
 
+	/* status counters are shared with workers (and external tools);
+	 * sized for the counters registered by plugins in set_defaults */
+	if (0 != status_counter_share(srv)) {
+		return -1;
+	}
+
 
 #ifdef HAVE_FORK
 	/**
@@ -1584,9 +1633,13 @@ static int server_main (server * const srv, int argc, char **argv) {
 		pid_t pid;
 		const int npids = num_childs;
 		int child = 0;
+		int worker = 0;
 		for (int n = 0; n < npids; ++n) pids[n] = -1;
 		while (!child && !srv_shutdown && !graceful_shutdown) {
 			if (num_childs > 0) {
+				/* worker slot; also selects server.reuse-port sockets */
+				for (worker = 0; worker < npids && -1 != pids[worker]; ++worker) ;
+				force_assert(worker < npids);
 				switch ((pid = fork())) {
 				case -1:
 					return -1;
@@ -1595,12 +1648,7 @@ static int server_main (server * const srv, int argc, char **argv) {
 					break;
 				default:
 					num_childs--;
-					for (int n = 0; n < npids; ++n) {
-						if (-1 == pids[n]) {
-							pids[n] = pid;
-							break;
-						}
-					}
+					pids[worker] = pid;
 					break;
 				}
 			} else {
@@ -1691,6 +1739,10 @@ static int server_main (server * const srv, int argc, char **argv) {
 		}
 		buffer_reset(srv->srvconf.pid_file);
 
+		network_worker_sockets(srv, worker+1);
+
+		status_counter_worker(srv, worker+1);
+
 		li_rand_reseed();
 	}
 #endif
@@ -1757,6 +1809,11 @@ static int server_main (server * const srv, int argc, char **argv) {
 		oneshot_fd = -1;
 	}
 
+	/* start error log writer thread in the process running the main loop */
+	if (srv->srvconf.errorlog_async) {
+		log_error_async_start(srv);
+	}
+
 	/* main-loop */
 	while (!srv_shutdown) {
 		int n;
@@ -1810,10 +1867,6 @@ static int server_main (server * const srv, int argc, char **argv) {
 			min_ts = time(NULL);
 
 			if (min_ts != srv->cur_ts) {
-#ifdef DEBUG_CONNECTION_STATES
-				int cs = 0;
-#endif
-				connections *conns = srv->conns;
 				handler_t r;
 
 				switch(r = plugins_call_handle_trigger(srv)) {
@@ -1851,8 +1904,16 @@ static int server_main (server * const srv, int argc, char **argv) {
 				}
 			      #endif
 
+				/* report coalesced, rate-limited and dropped error log messages */
+				log_error_trigger(srv);
+				if (srv->errorlog_dropped) {
+					status_counter_set(srv, CONST_STR_LEN("errorlog.dropped-lines"), (int)srv->errorlog_dropped);
+				}
+
 				/* cleanup stat-cache */
 				stat_cache_trigger_cleanup(srv);
+				/* free chunks not needed recently */
+				chunkqueue_chunk_pool_trim();
 				/* reset global/aggregate rate limit counters */
 				for (i = 0; i < srv->config_context->used; ++i) {
 					srv->config_storage[i]->global_bytes_per_second_cnt = 0;
@@ -1861,113 +1922,9 @@ static int server_main (server * const srv, int argc, char **argv) {
 				if (!graceful_shutdown && !srv_shutdown && 0 == srv->srvconf.max_worker) fdevent_waitpid_logger_pipes(min_ts);
 				/* if graceful_shutdown, accelerate cleanup of recently completed request/responses */
 				if (graceful_shutdown && !srv_shutdown) server_graceful_shutdown_maint(srv);
-				/**
-				 * check all connections for timeouts
-				 *
-				 */
-				for (ndx = 0; ndx < conns->used; ndx++) {
-					connection * const con = conns->ptr[ndx];
-					const int waitevents = fdevent_event_get_interest(srv->ev, con->fd);
-					int changed = 0;
-					int t_diff;
-
-					if (con->state == CON_STATE_CLOSE) {
-						if (srv->cur_ts - con->close_timeout_ts > HTTP_LINGER_TIMEOUT) {
-							changed = 1;
-						}
-					} else if (waitevents & FDEVENT_IN) {
-						if (con->request_count == 1 || con->state != CON_STATE_READ) { /* e.g. CON_STATE_READ_POST || CON_STATE_WRITE */
-							if (srv->cur_ts - con->read_idle_ts > con->conf.max_read_idle) {
-								/* time - out */
-								if (con->conf.log_request_handling) {
-									log_error_write(srv, __FILE__, __LINE__, "sd",
-										"connection closed - read timeout:", con->fd);
-								}
-
-								connection_set_state(srv, con, CON_STATE_ERROR);
-								changed = 1;
-							}
-						} else {
-							if (srv->cur_ts - con->read_idle_ts > con->keep_alive_idle) {
-								/* time - out */
-								if (con->conf.log_request_handling) {
-									log_error_write(srv, __FILE__, __LINE__, "sd",
-										"connection closed - keep-alive timeout:", con->fd);
-								}
-
-								connection_set_state(srv, con, CON_STATE_ERROR);
-								changed = 1;
-							}
-						}
-					}
-
-					/* max_write_idle timeout currently functions as backend timeout,
-					 * too, after response has been started.
-					 * future: have separate backend timeout, and then change this
-					 * to check for write interest before checking for timeout */
-					/*if (waitevents & FDEVENT_OUT)*/
-					if ((con->state == CON_STATE_WRITE) &&
-					    (con->write_request_ts != 0)) {
-#if 0
-						if (srv->cur_ts - con->write_request_ts > 60) {
-							log_error_write(srv, __FILE__, __LINE__, "sdd",
-									"connection closed - pre-write-request-timeout:", con->fd, srv->cur_ts - con->write_request_ts);
-						}
-#endif
-
-						if (srv->cur_ts - con->write_request_ts > con->conf.max_write_idle) {
-							/* time - out */
-							if (con->conf.log_timeouts) {
-								log_error_write(srv, __FILE__, __LINE__, "sbsbsosds",
-									"NOTE: a request from",
-									con->dst_addr_buf,
-									"for",
-									con->request.uri,
-									"timed out after writing",
-									con->bytes_written,
-									"bytes. We waited",
-									(int)con->conf.max_write_idle,
-									"seconds. If this a problem increase server.max-write-idle");
-							}
-							connection_set_state(srv, con, CON_STATE_ERROR);
-							changed = 1;
-						}
-					}
-
-					/* we don't like div by zero */
-					if (0 == (t_diff = srv->cur_ts - con->connection_start)) t_diff = 1;
-
-					if (con->traffic_limit_reached &&
-					    (con->conf.kbytes_per_second == 0 ||
-					     ((con->bytes_written / t_diff) < con->conf.kbytes_per_second * 1024))) {
-						/* enable connection again */
-						con->traffic_limit_reached = 0;
-
-						changed = 1;
-					}
-
-					con->bytes_written_cur_second = 0;
-
-					if (changed) {
-						connection_state_machine(srv, con);
-					}
-
-#if DEBUG_CONNECTION_STATES
-					if (cs == 0) {
-						fprintf(stderr, "connection-state: ");
-						cs = 1;
-					}
-
-					fprintf(stderr, "c[%d,%d]: %s ",
-						con->fd,
-						con->fcgi.fd,
-						connection_get_state(con->state));
-#endif
-				}
-
-#ifdef DEBUG_CONNECTION_STATES
-				if (cs == 1) fprintf(stderr, "\n");
-#endif
+				/* check connections with expiring timeouts */
+				connection_periodic_maint(srv, min_ts);
+				srv->bytes_written_cur_second = 0;
 			}
 		}
 
@@ -2110,13 +2067,14 @@ int main (int argc, char **argv) {
         /* clean-up */
         remove_pid_file(srv);
         log_error_close(srv);
-        fdevent_close_logger_pipes();
         if (graceful_restart)
             server_sockets_save(srv);
         else
             network_close(srv);
         connections_free(srv);
         plugins_free(srv);
+        /*(after plugins_free() so that plugins can flush logs to pipes)*/
+        fdevent_close_logger_pipes();
         server_free(srv);
 
         if (0 != rc || !graceful_restart) break;
@@ -12,7 +12,8 @@
 
 #define BV(x) (1 << x)
 
-#define FILE_CACHE_MAX      16
+/* slots of the (direct-mapped) Last-Modified string cache; power of 2 */
+#define FILE_CACHE_MAX      64
 
 /**
  * max size of a buffer which will just be reset
@@ -45,4 +46,10 @@ typedef enum { HANDLER_UNSET,
 
 #define HTTP_LINGER_TIMEOUT 5
 
+/**
+ * number of one-second slots in the connection timer wheel
+ * (must be a power of 2; deadlines further out wrap around)
+ */
+#define CONNECTION_TIMER_SLOTS 256
+
 #endif
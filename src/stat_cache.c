@@ -4,7 +4,10 @@
 #include "stat_cache.h"
 #include "fdevent.h"
 #include "etag.h"
+#include "status_counter.h"
+#ifdef HAVE_FAM_H
 #include "splaytree.h"
+#endif
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,12 +30,16 @@
 # include <fam.h>
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
 #ifndef HAVE_LSTAT
 # define lstat stat
 #endif
 
 #if 0
-/* enables debug code for testing if all nodes in the stat-cache as accessable */
+/* enables debug logging of the symlink checks */
 #define DEBUG_STAT_CACHE
 #endif
 
@@ -58,6 +65,19 @@
  * if file is deleted, directory is dirty, file is rechecked ...
  * if directory is deleted, directory mapping is removed
  *
+ * the inotify engine works the same way: each directory is watched by an
+ * inotify watch on a fdevent-registered inotify fd, and every event on
+ * the directory (or one of its entries) bumps its version.
+ * versions are taken from a global counter, so a re-created directory
+ * never repeats an old version.
+ * the file entries in the table count the directory they are bound to;
+ * the periodic cleanup releases the watch of a directory no entry is
+ * bound to anymore, so the number of watches follows the table size.
+ * a directory which is gone lives on (unwatched, not found by name)
+ * until its last entry is unbound.
+ * a directory reached by several names (symlinks) has one entry per name,
+ * all with the wd of the one watch the kernel keeps for the directory.
+ *
  * */
 
 #ifdef HAVE_FAM_H
@@ -70,32 +90,73 @@ typedef struct {
 } fam_dir_entry;
 #endif
 
-/* the directory name is too long to always compare on it
- * - we need a hash
- * - the hash-key is used as sorting criteria for a tree
- * - a splay-tree is used as we can use the caching effect of it
+#ifdef HAVE_SYS_INOTIFY_H
+typedef struct inotify_dir_entry {
+	struct inotify_dir_entry *name_next; /* hash chain by name */
+	struct inotify_dir_entry *wd_next;   /* hash chain by watch descriptor */
+
+	buffer *name;
+	uint32_t hash;
+
+	int wd;      /* -1 once the watch is gone */
+	int version;
+	size_t nfiles; /* file entries bound to the directory */
+} inotify_dir_entry;
+
+#define STAT_CACHE_INOTIFY_MASK \
+	(IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY \
+	| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+/* the file entries are kept in an open-addressing hash table
+ * - linear probing, the full key (name + follow-symlink flag) is compared,
+ *   so hash collisions no longer evict each other
+ * - lookups do not modify the table (besides setting the reference bit)
+ * - deletion uses backward shifting, no tombstones
+ *
+ * the table is limited to server.stat-cache-max-entries; when it is full
+ * a CLOCK hand walks the slots, clears reference bits and evicts the
+ * first entry which has not been referenced since the last pass.
+ * entries used in the current second are never evicted, as callers may
+ * still hold a pointer to them.
+ *
+ * the same hand is used by the periodic cleanup, which only visits a
+ * part of the table per call instead of walking all entries.
  */
 
-/* we want to cleanup the stat-cache every few seconds, let's say 10
+/* open read-only fds of regular files can be kept in the entries
+ * (server.stat-cache-max-fds). FILE_CHUNKs share the fd by taking a
+ * reference on the entry; an entry removed from the table lives on until
+ * the last chunk is done with it. If a re-stat() shows the file changed,
+ * the fd is dropped (or the entry is replaced, if the fd is still in use).
  *
- * - remove entries which are outdated since 30s
- * - remove entries which are fresh but havn't been used since 60s
- * - if we don't have a stat-cache entry for a directory, release it from the monitor
+ * the same holds for the content of small files kept in memory
+ * (server.stat-cache-content-max-size), which is shared by MEM_CHUNKs.
+ * when the memory budget is used up, the CLOCK hand drops the content
+ * of entries which have not been used recently.
  */
 
-#ifdef DEBUG_STAT_CACHE
+#define STAT_CACHE_TABLE_MIN_SIZE 1024
+/* fraction (as shift) of the table visited per stat_cache_trigger_cleanup() */
+#define STAT_CACHE_CLEANUP_SHIFT  3
+
 typedef struct {
-	int *ptr;
+	stat_cache_entry **ptr;
 
+	size_t size; /* power of 2 */
 	size_t used;
-	size_t size;
-} fake_keys;
+	size_t max;  /* max entries */
+	size_t hand; /* CLOCK hand */
 
-static fake_keys ctrl;
-#endif
+	size_t evictions;
+} stat_cache_table;
 
 typedef struct stat_cache {
-	splay_tree *files; /* the nodes of the tree are stat_cache_entry's */
+	stat_cache_table files;
+	size_t max_fds;
+	size_t content_max_size; /* max size of a file kept in memory */
+	size_t content_limit;    /* memory budget for file contents */
+	size_t content_evictions;
 
 	buffer *dir_name; /* for building the dirname from the filename */
 #ifdef HAVE_FAM_H
@@ -103,6 +164,19 @@ typedef struct stat_cache {
 
 	FAMConnection fam;
 	int    fam_fcce_ndx;
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+	inotify_dir_entry **inotify_by_name;
+	inotify_dir_entry **inotify_by_wd;
+	size_t inotify_size; /* power of 2 */
+	size_t inotify_used;
+
+	int    inotify_fd;
+	int    inotify_fde_ndx;
+	int    inotify_version; /* last assigned directory version */
+	int    inotify_enospc;  /* out of watches: add none until the next cleanup */
+	int    inotify_enospc_logged;
+	size_t inotify_hand;    /* cleanup position in inotify_by_name */
 #endif
 	buffer *hash_key;  /* temp-store for the hash-key */
 } stat_cache;
@@ -110,6 +184,10 @@ typedef struct stat_cache {
 #ifdef HAVE_FAM_H
 static handler_t stat_cache_handle_fdevent(server *srv, void *_fce, int revent);
 #endif
+#ifdef HAVE_SYS_INOTIFY_H
+static handler_t stat_cache_handle_inotify(server *srv, void *_fce, int revent);
+static void inotify_dir_unbind(stat_cache *sc, stat_cache_entry *sce);
+#endif
 
 stat_cache *stat_cache_init(server *srv) {
 	stat_cache *sc = NULL;
@@ -121,12 +199,20 @@ stat_cache *stat_cache_init(server *srv) {
 	sc->dir_name = buffer_init();
 	sc->hash_key = buffer_init();
 
+	sc->files.max = srv->srvconf.stat_cache_max_entries;
+	if (0 == sc->files.max) sc->files.max = 1;
+	if (srv->srvconf.stat_cache_engine != STAT_CACHE_ENGINE_NONE) {
+		sc->max_fds = srv->srvconf.stat_cache_max_fds;
+		sc->content_max_size = srv->srvconf.stat_cache_content_max_size;
+		sc->content_limit = (size_t)srv->srvconf.stat_cache_content_memory << 10;
+	}
+
 #ifdef HAVE_FAM_H
 	sc->fam_fcce_ndx = -1;
 #endif
-
-#ifdef DEBUG_STAT_CACHE
-	ctrl.size = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+	sc->inotify_fd = -1;
+	sc->inotify_fde_ndx = -1;
 #endif
 
 #ifdef HAVE_FAM_H
@@ -148,6 +234,24 @@ stat_cache *stat_cache_init(server *srv) {
 	}
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+	/* setup inotify */
+	if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_INOTIFY) {
+		if (-1 == (sc->inotify_fd = inotify_init())) {
+			log_error_write(srv, __FILE__, __LINE__, "ss",
+					"could not open an inotify fd, dieing:", strerror(errno));
+			buffer_free(sc->dir_name);
+			buffer_free(sc->hash_key);
+			free(sc);
+			return NULL;
+		}
+
+		fdevent_fcntl_set_nb_cloexec(srv->ev, sc->inotify_fd);
+		fdevent_register(srv->ev, sc->inotify_fd, stat_cache_handle_inotify, NULL);
+		fdevent_event_set(srv->ev, &(sc->inotify_fde_ndx), sc->inotify_fd, FDEVENT_IN);
+	}
+#endif
+
 	return sc;
 }
 
@@ -160,14 +264,41 @@ static stat_cache_entry * stat_cache_entry_init(void) {
 	sce->name = buffer_init();
 	sce->etag = buffer_init();
 	sce->content_type = buffer_init();
+	sce->fd = -1;
+	sce->refcnt = 1;
 
 	return sce;
 }
 
+/* number of fds and content bytes held by entries (including detached ones) */
+static size_t stat_cache_open_fds;
+static size_t stat_cache_content_bytes;
+static size_t stat_cache_content_entries;
+
+static void stat_cache_entry_close_fd(stat_cache_entry *sce) {
+	if (-1 == sce->fd) return;
+	close(sce->fd);
+	sce->fd = -1;
+	--stat_cache_open_fds;
+}
+
+static void stat_cache_entry_free_content(stat_cache_entry *sce) {
+	if (NULL == sce->content) return;
+	stat_cache_content_bytes -= sce->content->size;
+	--stat_cache_content_entries;
+	buffer_free(sce->content);
+	sce->content = NULL;
+}
+
 static void stat_cache_entry_free(void *data) {
 	stat_cache_entry *sce = data;
 	if (!sce) return;
 
+	/* still referenced by FILE_CHUNKs */
+	if (--sce->refcnt > 0) return;
+
+	stat_cache_entry_close_fd(sce);
+	stat_cache_entry_free_content(sce);
 	buffer_free(sce->etag);
 	buffer_free(sce->name);
 	buffer_free(sce->content_type);
@@ -201,22 +332,376 @@ static void fam_dir_entry_free(FAMConnection *fc, void *data) {
 }
 #endif
 
-void stat_cache_free(stat_cache *sc) {
-	while (sc->files) {
-		int osize;
-		splay_tree *node = sc->files;
+/* the famous DJB hash function for strings;
+ * the highest bit is replaced by the follow-symlink flag */
+static uint32_t stat_cache_hash(const buffer *name, int follow_symlink) {
+	uint32_t hash = 5381;
+	const char *s = name->ptr;
+	const char * const end = s + buffer_string_length(name);
+	for (; s != end; ++s) {
+		hash = ((hash << 5) + hash) + *s;
+	}
+
+	hash &= ~(((uint32_t)1) << 31);
+	if (follow_symlink) hash |= ((uint32_t)1) << 31;
+
+	return hash;
+}
+
+static size_t stat_cache_table_find(const stat_cache_table *t, const buffer *name, uint32_t hash) {
+	const size_t mask = t->size - 1;
+	size_t i;
+
+	if (0 == t->size) return 0;
+
+	for (i = hash & mask; NULL != t->ptr[i]; i = (i + 1) & mask) {
+		const stat_cache_entry *sce = t->ptr[i];
+		if (sce->hash == hash && buffer_is_equal(sce->name, name)) break;
+	}
+
+	return i; /* matching or empty slot */
+}
+
+static void stat_cache_table_resize(stat_cache_table *t, size_t size) {
+	stat_cache_entry **optr = t->ptr;
+	const size_t osize = t->size;
+	const size_t mask = size - 1;
+	size_t i;
+
+	t->ptr = calloc(size, sizeof(*t->ptr));
+	force_assert(NULL != t->ptr);
+	t->size = size;
+	t->hand = 0;
+
+	for (i = 0; i < osize; ++i) {
+		stat_cache_entry *sce = optr[i];
+		size_t j;
+		if (NULL == sce) continue;
+		for (j = sce->hash & mask; NULL != t->ptr[j]; j = (j + 1) & mask) ;
+		t->ptr[j] = sce;
+	}
+
+	free(optr);
+}
+
+static void stat_cache_table_delete(server *srv, stat_cache_table *t, size_t i) {
+	const size_t mask = t->size - 1;
+	size_t j = i;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	inotify_dir_unbind(srv->stat_cache, t->ptr[i]);
+#else
+	UNUSED(srv);
+#endif
+	stat_cache_entry_free(t->ptr[i]);
+	--t->used;
+
+	/* backward shift deletion: move following entries of the probe
+	 * sequence into the hole unless they already sit at or after their
+	 * home slot (cyclically) */
+	for (;;) {
+		size_t k;
+		j = (j + 1) & mask;
+		if (NULL == t->ptr[j]) break;
+		k = t->ptr[j]->hash & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+		t->ptr[i] = t->ptr[j];
+		i = j;
+	}
+
+	t->ptr[i] = NULL;
+}
+
+/* evict one entry which was not referenced since the CLOCK hand passed
+ * it the last time; returns 0 if all entries are in use */
+static int stat_cache_table_evict(server *srv, stat_cache_table *t) {
+	size_t n;
+
+	for (n = 0; n < 2 * t->size; ++n) {
+		stat_cache_entry *sce;
+		const size_t i = t->hand;
+		t->hand = (t->hand + 1) & (t->size - 1);
+		if (NULL == (sce = t->ptr[i])) continue;
+		if (sce->stat_ts == srv->cur_ts) continue;
+		if (sce->referenced) {
+			sce->referenced = 0;
+			continue;
+		}
+
+		stat_cache_table_delete(srv, t, i);
+		++t->evictions;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* returns the empty slot for an entry with the given hash,
+ * after making room for it */
+static size_t stat_cache_table_reserve(server *srv, stat_cache_table *t, uint32_t hash) {
+	const size_t mask = t->size - 1;
+	size_t i;
+
+	if (t->used >= t->max) stat_cache_table_evict(srv, t);
+
+	/* keep the load factor <= 1/2 */
+	if (2 * (t->used + 1) > t->size) {
+		stat_cache_table_resize(t, t->size ? 2 * t->size : STAT_CACHE_TABLE_MIN_SIZE);
+		return stat_cache_table_reserve(srv, t, hash);
+	}
+
+	for (i = hash & mask; NULL != t->ptr[i]; i = (i + 1) & mask) ;
+	return i;
+}
 
-		osize = sc->files->size;
+#ifdef HAVE_SYS_INOTIFY_H
+static inotify_dir_entry * inotify_dir_find(const stat_cache *sc, const buffer *name, uint32_t hash) {
+	inotify_dir_entry *d;
 
-		stat_cache_entry_free(node->data);
-		sc->files = splaytree_delete(sc->files, node->key);
+	if (0 == sc->inotify_size) return NULL;
 
-		force_assert(osize - 1 == splaytree_size(sc->files));
+	for (d = sc->inotify_by_name[hash & (sc->inotify_size - 1)]; d; d = d->name_next) {
+		if (-1 == d->wd) continue;
+		if (d->hash == hash && buffer_is_equal(d->name, name)) return d;
 	}
 
+	return NULL;
+}
+
+static inotify_dir_entry * inotify_dir_find_wd(const stat_cache *sc, int wd) {
+	inotify_dir_entry *d;
+
+	if (0 == sc->inotify_size) return NULL;
+
+	for (d = sc->inotify_by_wd[(size_t)wd & (sc->inotify_size - 1)]; d; d = d->wd_next) {
+		if (d->wd == wd) return d;
+	}
+
+	return NULL;
+}
+
+static void inotify_dir_link(stat_cache *sc, inotify_dir_entry *d) {
+	const size_t mask = sc->inotify_size - 1;
+	inotify_dir_entry **p;
+
+	p = &sc->inotify_by_name[d->hash & mask];
+	d->name_next = *p;
+	*p = d;
+
+	if (-1 == d->wd) return;
+	p = &sc->inotify_by_wd[(size_t)d->wd & mask];
+	d->wd_next = *p;
+	*p = d;
+}
+
+static void inotify_dir_insert(stat_cache *sc, inotify_dir_entry *d) {
+	if (sc->inotify_used == sc->inotify_size) {
+		inotify_dir_entry **by_name = sc->inotify_by_name;
+		const size_t osize = sc->inotify_size;
+		size_t i;
+
+		sc->inotify_size = osize ? 2 * osize : 64;
+		sc->inotify_by_name = calloc(sc->inotify_size, sizeof(*sc->inotify_by_name));
+		force_assert(NULL != sc->inotify_by_name);
+		free(sc->inotify_by_wd);
+		sc->inotify_by_wd = calloc(sc->inotify_size, sizeof(*sc->inotify_by_wd));
+		force_assert(NULL != sc->inotify_by_wd);
+
+		for (i = 0; i < osize; ++i) {
+			inotify_dir_entry *e = by_name[i], *next;
+			for (; e; e = next) {
+				next = e->name_next;
+				inotify_dir_link(sc, e);
+			}
+		}
+		free(by_name);
+	}
+
+	inotify_dir_link(sc, d);
+	++sc->inotify_used;
+}
+
+static void inotify_dir_free(stat_cache *sc, inotify_dir_entry *d) {
+	if (-1 != sc->inotify_fd && -1 != d->wd) inotify_rm_watch(sc->inotify_fd, d->wd);
+	buffer_free(d->name);
+	free(d);
+}
+
+/* stop watching the directory (the watch itself is removed with the last
+ * name sharing it); it is freed once no entry is bound to it */
+static void inotify_dir_remove(stat_cache *sc, inotify_dir_entry *d) {
+	const size_t mask = sc->inotify_size - 1;
+	inotify_dir_entry **p;
+
+	if (-1 != d->wd) {
+		for (p = &sc->inotify_by_wd[(size_t)d->wd & mask]; *p != d; p = &(*p)->wd_next) ;
+		*p = d->wd_next;
+		if (-1 != sc->inotify_fd && NULL == inotify_dir_find_wd(sc, d->wd)) {
+			inotify_rm_watch(sc->inotify_fd, d->wd);
+		}
+		d->wd = -1;
+	}
+
+	if (0 != d->nfiles) return;
+
+	for (p = &sc->inotify_by_name[d->hash & mask]; *p != d; p = &(*p)->name_next) ;
+	*p = d->name_next;
+	--sc->inotify_used;
+
+	inotify_dir_free(sc, d);
+}
+
+static void inotify_dir_unbind(stat_cache *sc, stat_cache_entry *sce) {
+	inotify_dir_entry *d = sce->inotify_dir;
+
+	if (NULL == d) return;
+	sce->inotify_dir = NULL;
+
+	/* a watched directory is released by inotify_dir_cleanup() */
+	if (0 == --d->nfiles && -1 == d->wd) inotify_dir_remove(sc, d);
+}
+
+static void inotify_dir_bind(stat_cache *sc, stat_cache_entry *sce, inotify_dir_entry *d) {
+	if (sce->inotify_dir == d) return;
+	inotify_dir_unbind(sc, sce);
+	if (NULL == d) return;
+	sce->inotify_dir = d;
+	++d->nfiles;
+}
+
+/* release the watches of directories no file entry is bound to anymore
+ * (the entries were evicted, or the lookups failed); only a part of the
+ * directories is visited per call. running out of watches blocks adding
+ * new ones until the next call. */
+static void inotify_dir_cleanup(stat_cache *sc) {
+	size_t n;
+
+	sc->inotify_enospc = 0;
+
+	if (0 == sc->inotify_used) return;
+
+	for (n = (sc->inotify_size >> STAT_CACHE_CLEANUP_SHIFT) + 1; n > 0; --n) {
+		inotify_dir_entry *d = sc->inotify_by_name[sc->inotify_hand], *next;
+		for (; d; d = next) {
+			next = d->name_next;
+			if (0 == d->nfiles) inotify_dir_remove(sc, d);
+		}
+		sc->inotify_hand = (sc->inotify_hand + 1) & (sc->inotify_size - 1);
+	}
+}
+
+static inotify_dir_entry * inotify_dir_watch(server *srv, stat_cache *sc, const buffer *name, uint32_t hash) {
+	inotify_dir_entry *d;
+	int wd;
+
+	if (sc->inotify_enospc) return NULL;
+
+	wd = inotify_add_watch(sc->inotify_fd, name->ptr, STAT_CACHE_INOTIFY_MASK);
+	if (-1 == wd) {
+		switch (errno) {
+		case ENOENT:
+		case ENOTDIR:
+		case EACCES:
+			break;
+		case ENOSPC:
+			sc->inotify_enospc = 1;
+			if (sc->inotify_enospc_logged) break;
+			sc->inotify_enospc_logged = 1;
+			log_error_write(srv, __FILE__, __LINE__, "sbs",
+					"monitoring dir failed:", name,
+					"(out of inotify watches, see fs.inotify.max_user_watches)");
+			break;
+		default:
+			log_error_write(srv, __FILE__, __LINE__, "sbs",
+					"monitoring dir failed:", name, strerror(errno));
+			break;
+		}
+		return NULL;
+	}
+
+	/* the same directory reached by another name (e.g. through a symlink)
+	 * returns the wd of the existing watch; the names share the watch */
+
+	d = calloc(1, sizeof(*d));
+	force_assert(NULL != d);
+	d->name = buffer_init_buffer(name);
+	d->hash = hash;
+	d->wd = wd;
+	d->version = ++sc->inotify_version;
+	inotify_dir_insert(sc, d);
+
+	return d;
+}
+#endif
+
+static int stat_cache_st_changed(const struct stat *a, const struct stat *b) {
+	return a->st_ino   != b->st_ino
+	    || a->st_dev   != b->st_dev
+	    || a->st_size  != b->st_size
+	    || a->st_mtime != b->st_mtime
+	    || a->st_ctime != b->st_ctime
+	  #ifdef HAVE_STRUCT_STAT_ST_MTIM
+	    /* a file rewritten within the same second, or with its mtime
+	     * restored (cp -p, rsync -t, touch -r), still gets a new ctime */
+	    || a->st_mtim.tv_nsec != b->st_mtim.tv_nsec
+	    || a->st_ctim.tv_nsec != b->st_ctim.tv_nsec
+	  #endif
+	    ;
+}
+
+/* forget the cached fd and content of the entry in slot ndx; if chunks
+ * still use them, the entry is replaced by a fresh one and left to the chunks */
+static stat_cache_entry * stat_cache_entry_drop_cached(stat_cache *sc, size_t ndx, stat_cache_entry *sce) {
+	stat_cache_entry *nsce;
+
+	if (1 == sce->refcnt) {
+		stat_cache_entry_close_fd(sce);
+		stat_cache_entry_free_content(sce);
+		return sce;
+	}
+
+	nsce = stat_cache_entry_init();
+	buffer_copy_buffer(nsce->name, sce->name);
+	nsce->hash = sce->hash;
+	nsce->referenced = sce->referenced;
+#ifdef HAVE_SYS_INOTIFY_H
+	nsce->inotify_dir = sce->inotify_dir;
+	sce->inotify_dir = NULL;
+#endif
+	sc->files.ptr[ndx] = nsce;
+	stat_cache_entry_free(sce);
+
+	return nsce;
+}
+
+void stat_cache_free(stat_cache *sc) {
+	size_t i;
+
+	for (i = 0; i < sc->files.size; ++i) {
+		stat_cache_entry_free(sc->files.ptr[i]);
+	}
+	free(sc->files.ptr);
+
 	buffer_free(sc->dir_name);
 	buffer_free(sc->hash_key);
 
+#ifdef HAVE_SYS_INOTIFY_H
+	for (i = 0; i < sc->inotify_size; ++i) {
+		inotify_dir_entry *d = sc->inotify_by_name[i], *next;
+		for (; d; d = next) {
+			next = d->name_next;
+			inotify_dir_free(sc, d);
+		}
+	}
+	free(sc->inotify_by_name);
+	free(sc->inotify_by_wd);
+
+	if (-1 != sc->inotify_fd) {
+		/* fd events already gone */
+		close(sc->inotify_fd);
+	}
+#endif
+
 #ifdef HAVE_FAM_H
 	while (sc->dirs) {
 		int osize;
@@ -319,6 +804,7 @@ const buffer * stat_cache_mimetype_by_ext(const connection *con, const char *nam
     return NULL;
 }
 
+#ifdef HAVE_FAM_H
 /* the famous DJB hash function for strings */
 static uint32_t hashme(buffer *str) {
 	uint32_t hash = 5381;
@@ -332,7 +818,6 @@ static uint32_t hashme(buffer *str) {
 	return hash;
 }
 
-#ifdef HAVE_FAM_H
 static handler_t stat_cache_handle_fdevent(server *srv, void *_fce, int revent) {
 	size_t i;
 	stat_cache *sc = srv->stat_cache;
@@ -403,7 +888,69 @@ static handler_t stat_cache_handle_fdevent(server *srv, void *_fce, int revent)
 
 	return HANDLER_GO_ON;
 }
+#endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+static handler_t stat_cache_handle_inotify(server *srv, void *_fce, int revent) {
+	stat_cache *sc = srv->stat_cache;
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	ssize_t len;
+
+	UNUSED(_fce);
+
+	if (revent & FDEVENT_IN) {
+		while ((len = read(sc->inotify_fd, u.buf, sizeof(u.buf))) > 0) {
+			char *p;
+			for (p = u.buf; p < u.buf + len; ) {
+				struct inotify_event *ev = (struct inotify_event *)(void *)p;
+				inotify_dir_entry *d, *next;
+				p += sizeof(struct inotify_event) + ev->len;
+
+				if (ev->mask & IN_Q_OVERFLOW) {
+					/* events were lost, invalidate every directory */
+					size_t i;
+					for (i = 0; i < sc->inotify_size; ++i) {
+						for (d = sc->inotify_by_name[i]; d; d = d->name_next) {
+							d->version = ++sc->inotify_version;
+						}
+					}
+					continue;
+				}
+
+				/* every name of the directory shares the watch */
+				if (0 == sc->inotify_size) continue;
+				d = sc->inotify_by_wd[(size_t)ev->wd & (sc->inotify_size - 1)];
+				for (; d; d = next) {
+					next = d->wd_next;
+					if (d->wd != ev->wd) continue;
+
+					d->version = ++sc->inotify_version;
+
+					/* directory is gone; the kernel removes the watch itself */
+					if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+						inotify_dir_remove(sc, d);
+					}
+				}
+			}
+		}
+	}
+
+	if (revent & (FDEVENT_HUP | FDEVENT_ERR)) {
+		fdevent_event_del(srv->ev, &(sc->inotify_fde_ndx), sc->inotify_fd);
+		fdevent_unregister(srv->ev, sc->inotify_fd);
+
+		close(sc->inotify_fd);
+		sc->inotify_fd = -1;
+	}
+
+	return HANDLER_GO_ON;
+}
+#endif
+
+#if defined(HAVE_FAM_H) || defined(HAVE_SYS_INOTIFY_H)
 static int buffer_copy_dirname(buffer *dst, buffer *file) {
 	size_t i;
 
@@ -447,17 +994,17 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 #ifdef HAVE_FAM_H
 	fam_dir_entry *fam_dir = NULL;
 	int dir_ndx = -1;
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+	inotify_dir_entry *inotify_dir = NULL;
 #endif
 	stat_cache_entry *sce = NULL;
 	stat_cache *sc;
 	struct stat st;
 	int fd;
 	struct stat lst;
-#ifdef DEBUG_STAT_CACHE
-	size_t i;
-#endif
-
-	int file_ndx;
+	uint32_t file_hash;
+	size_t file_ndx;
 
 	*ret_sce = NULL;
 
@@ -467,50 +1014,21 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 
 	sc = srv->stat_cache;
 
-	buffer_copy_buffer(sc->hash_key, name);
-	buffer_append_int(sc->hash_key, con->conf.follow_symlink);
-
-	file_ndx = hashme(sc->hash_key);
-	sc->files = splaytree_splay(sc->files, file_ndx);
-
-#ifdef DEBUG_STAT_CACHE
-	for (i = 0; i < ctrl.used; i++) {
-		if (ctrl.ptr[i] == file_ndx) break;
-	}
-#endif
-
-	if (sc->files && (sc->files->key == file_ndx)) {
-#ifdef DEBUG_STAT_CACHE
-		/* it was in the cache */
-		force_assert(i < ctrl.used);
-#endif
+	file_hash = stat_cache_hash(name, con->conf.follow_symlink);
+	file_ndx = stat_cache_table_find(&sc->files, name, file_hash);
 
+	if (sc->files.size && NULL != (sce = sc->files.ptr[file_ndx])) {
 		/* we have seen this file already and
 		 * don't stat() it again in the same second */
 
-		sce = sc->files->data;
-
-		/* check if the name is the same, we might have a collision */
+		if (!sce->referenced) sce->referenced = 1;
 
-		if (buffer_is_equal(name, sce->name)) {
-			if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_SIMPLE) {
-				if (sce->stat_ts == srv->cur_ts && con->conf.follow_symlink) {
-					*ret_sce = sce;
-					return HANDLER_GO_ON;
-				}
+		if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_SIMPLE) {
+			if (sce->stat_ts == srv->cur_ts && con->conf.follow_symlink) {
+				*ret_sce = sce;
+				return HANDLER_GO_ON;
 			}
-		} else {
-			/* collision, forget about the entry */
-			sce = NULL;
 		}
-	} else {
-#ifdef DEBUG_STAT_CACHE
-		if (i != ctrl.used) {
-			log_error_write(srv, __FILE__, __LINE__, "xSB",
-				file_ndx, "was already inserted but not found in cache, ", name);
-		}
-		force_assert(i == ctrl.used);
-#endif
 	}
 
 #ifdef HAVE_FAM_H
@@ -537,6 +1055,7 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 				/* test whether a found file cache entry is still ok */
 				if ((NULL != sce) && (fam_dir->version == sce->dir_version)) {
 					/* the stat()-cache entry is still ok */
+					sce->stat_ts = srv->cur_ts;
 
 					*ret_sce = sce;
 					return HANDLER_GO_ON;
@@ -549,6 +1068,36 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 	}
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+	/* dir-check */
+	if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_INOTIFY
+	    && -1 != sc->inotify_fd) {
+		uint32_t dir_hash;
+
+		if (0 != buffer_copy_dirname(sc->dir_name, name)) {
+			log_error_write(srv, __FILE__, __LINE__, "sb",
+				"no '/' found in filename:", name);
+			return HANDLER_ERROR;
+		}
+
+		dir_hash = stat_cache_hash(sc->dir_name, 0);
+
+		if (NULL != (inotify_dir = inotify_dir_find(sc, sc->dir_name, dir_hash))) {
+			/* test whether a found file cache entry is still ok */
+			if ((NULL != sce) && (inotify_dir->version == sce->dir_version)) {
+				/* the stat()-cache entry is still ok */
+				sce->stat_ts = srv->cur_ts;
+
+				*ret_sce = sce;
+				return HANDLER_GO_ON;
+			}
+		} else {
+			/* watch the directory before stat() so no change is missed */
+			inotify_dir = inotify_dir_watch(srv, sc, sc->dir_name, dir_hash);
+		}
+	}
+#endif
+
 	/*
 	 * *lol*
 	 * - open() + fstat() on a named-pipe results in a (intended) hang.
@@ -556,6 +1105,11 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 	 *
 	 * */
 	if (-1 == stat(name->ptr, &st)) {
+		if (NULL != sce && (-1 != sce->fd || NULL != sce->content)) {
+			const int errnum = errno;
+			stat_cache_entry_drop_cached(sc, file_ndx, sce);
+			errno = errnum;
+		}
 		return HANDLER_ERROR;
 	}
 
@@ -574,39 +1128,36 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 		close(fd);
 	}
 
+	if (NULL != sce && (-1 != sce->fd || NULL != sce->content)
+	    && stat_cache_st_changed(&sce->st, &st)) {
+		sce = stat_cache_entry_drop_cached(sc, file_ndx, sce);
+	}
+#ifndef HAVE_STRUCT_STAT_ST_MTIM
+	/* without sub-second timestamps a rewrite within the same second is
+	 * not visible in stat(); trust the directory event instead */
+	else if (NULL != sce && (-1 != sce->fd || NULL != sce->content)
+		 && (0
+#ifdef HAVE_FAM_H
+		     || NULL != fam_dir
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+		     || NULL != inotify_dir
+#endif
+		    )) {
+		sce = stat_cache_entry_drop_cached(sc, file_ndx, sce);
+	}
+#endif
+
 	if (NULL == sce) {
 
 		sce = stat_cache_entry_init();
 		buffer_copy_buffer(sce->name, name);
+		sce->hash = file_hash;
+		sce->referenced = 1;
 
-		/* already splayed file_ndx */
-		if ((NULL != sc->files) && (sc->files->key == file_ndx)) {
-			/* hash collision: replace old entry */
-			stat_cache_entry_free(sc->files->data);
-			sc->files->data = sce;
-		} else {
-			int osize = splaytree_size(sc->files);
-
-			sc->files = splaytree_insert(sc->files, file_ndx, sce);
-			force_assert(osize + 1 == splaytree_size(sc->files));
-
-#ifdef DEBUG_STAT_CACHE
-			if (ctrl.size == 0) {
-				ctrl.size = 16;
-				ctrl.used = 0;
-				ctrl.ptr = malloc(ctrl.size * sizeof(*ctrl.ptr));
-				force_assert(NULL != ctrl.ptr);
-			} else if (ctrl.size == ctrl.used) {
-				ctrl.size += 16;
-				ctrl.ptr = realloc(ctrl.ptr, ctrl.size * sizeof(*ctrl.ptr));
-				force_assert(NULL != ctrl.ptr);
-			}
-
-			ctrl.ptr[ctrl.used++] = file_ndx;
-#endif
-		}
-		force_assert(sc->files);
-		force_assert(sc->files->data == sce);
+		file_ndx = stat_cache_table_reserve(srv, &sc->files, file_hash);
+		sc->files.ptr[file_ndx] = sce;
+		++sc->files.used;
 	}
 
 	sce->st = st;
@@ -745,6 +1296,14 @@ handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_
 	}
 #endif
 
+#ifdef HAVE_SYS_INOTIFY_H
+	if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_INOTIFY) {
+		/* bind the directory version to the stat() cache entry */
+		sce->dir_version = (NULL != inotify_dir) ? inotify_dir->version : 0;
+		inotify_dir_bind(sc, sce, inotify_dir);
+	}
+#endif
+
 	*ret_sce = sce;
 
 	return HANDLER_GO_ON;
@@ -782,77 +1341,191 @@ int stat_cache_open_rdonly_fstat (server *srv, connection *con, buffer *name, st
 	return -1;
 }
 
-/**
- * remove stat() from cache which havn't been stat()ed for
- * more than 10 seconds
- *
- *
- * walk though the stat-cache, collect the ids which are too old
- * and remove them in a second loop
- */
+/* returns the cached fd of a regular file, opening and caching it if
+ * needed; -1 if the fd cache is disabled, full, or the file changed
+ * since it was stat()ed (caller then opens the file itself) */
+int stat_cache_entry_open(server *srv, connection *con, stat_cache_entry *sce) {
+	stat_cache *sc = srv->stat_cache;
+	struct stat st;
+	int fd;
+
+	if (-1 != sce->fd) return sce->fd;
+
+	if (stat_cache_open_fds >= sc->max_fds) return -1;
+	if (!S_ISREG(sce->st.st_mode)) return -1;
+
+	fd = stat_cache_open_rdonly_fstat(srv, con, sce->name, &st);
+	if (-1 == fd) return -1;
+
+	if (stat_cache_st_changed(&sce->st, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	fdevent_setfd_cloexec(fd);
+	sce->fd = fd;
+	++stat_cache_open_fds;
+
+	return fd;
+}
 
-static int stat_cache_tag_old_entries(server *srv, splay_tree *t, int *keys, size_t *ndx) {
-	stat_cache_entry *sce;
+/* drop the content of entries not used recently until "need" more bytes
+ * fit into the memory budget */
+static void stat_cache_content_evict(stat_cache *sc, size_t need) {
+	stat_cache_table *t = &sc->files;
+	size_t n;
+
+	for (n = 0; n < 2 * t->size; ++n) {
+		stat_cache_entry *sce;
+		if (stat_cache_content_bytes + need <= sc->content_limit) break;
+		sce = t->ptr[t->hand];
+		t->hand = (t->hand + 1) & (t->size - 1);
+		if (NULL == sce || NULL == sce->content) continue;
+		if (sce->referenced) {
+			sce->referenced = 0;
+			continue;
+		}
+		if (1 != sce->refcnt) continue; /* still being sent */
 
-	if (!t) return 0;
+		stat_cache_entry_free_content(sce);
+		++sc->content_evictions;
+	}
+}
 
-	stat_cache_tag_old_entries(srv, t->left, keys, ndx);
-	stat_cache_tag_old_entries(srv, t->right, keys, ndx);
+static size_t stat_cache_read_file(int fd, char *buf, size_t len) {
+	size_t rd = 0;
 
-	sce = t->data;
+	if (-1 == lseek(fd, 0, SEEK_SET)) return 0;
 
-	if (srv->cur_ts - sce->stat_ts > 2) {
-		keys[(*ndx)++] = t->key;
+	while (rd < len) {
+		ssize_t r = read(fd, buf + rd, len - rd);
+		if (r > 0) {
+			rd += (size_t)r;
+		} else if (-1 == r && errno == EINTR) {
+			continue;
+		} else {
+			break;
+		}
 	}
 
-	return 0;
+	return rd;
 }
 
-int stat_cache_trigger_cleanup(server *srv) {
-	stat_cache *sc;
-	size_t max_ndx = 0, i;
-	int *keys;
+/* returns the content of a small regular file, reading and caching it if
+ * needed; NULL if the content cache is disabled, the file is too large,
+ * the memory budget is used up, or reading failed */
+buffer * stat_cache_entry_content(server *srv, connection *con, stat_cache_entry *sce) {
+	stat_cache *sc = srv->stat_cache;
+	const size_t len = (size_t)sce->st.st_size;
+	struct stat st;
+	buffer *b;
+	size_t rd;
+	int fd;
 
-	sc = srv->stat_cache;
+	if (NULL != sce->content) return sce->content;
 
-	if (!sc->files) return 0;
+	if (!S_ISREG(sce->st.st_mode)) return NULL;
+	if (0 == len || len > sc->content_max_size) return NULL;
 
-	keys = calloc(1, sizeof(int) * sc->files->size);
-	force_assert(NULL != keys);
+	if (stat_cache_content_bytes + len + 1 > sc->content_limit) {
+		stat_cache_content_evict(sc, len + 1);
+		if (stat_cache_content_bytes + len + 1 > sc->content_limit) return NULL;
+	}
+
+	if (-1 != sce->fd) {
+		fd = sce->fd;
+	} else {
+		fd = stat_cache_open_rdonly_fstat(srv, con, sce->name, &st);
+		if (-1 == fd) return NULL;
+		if (stat_cache_st_changed(&sce->st, &st)) {
+			close(fd);
+			return NULL;
+		}
+	}
 
-	stat_cache_tag_old_entries(srv, sc->files, keys, &max_ndx);
+	b = buffer_init();
+	buffer_string_prepare_copy(b, len);
+	rd = stat_cache_read_file(fd, b->ptr, len);
+	if (fd != sce->fd) close(fd);
 
-	for (i = 0; i < max_ndx; i++) {
-		int ndx = keys[i];
-		splay_tree *node;
+	if (rd != len) {
+		buffer_free(b);
+		return NULL;
+	}
 
-		sc->files = splaytree_splay(sc->files, ndx);
+	buffer_commit(b, len);
+	sce->content = b;
+	stat_cache_content_bytes += b->size;
+	++stat_cache_content_entries;
 
-		node = sc->files;
+	return b;
+}
 
-		if (node && (node->key == ndx)) {
-#ifdef DEBUG_STAT_CACHE
-			size_t j;
-			int osize = splaytree_size(sc->files);
-			stat_cache_entry *sce = node->data;
+void stat_cache_entry_refchg(void *data, int mod) {
+	stat_cache_entry *sce = data;
+	if (mod < 0) {
+		stat_cache_entry_free(sce);
+	} else {
+		sce->refcnt += mod;
+	}
+}
+
+/**
+ * remove stat() from cache which havn't been stat()ed for
+ * more than 2 seconds
+ *
+ * only a part of the table is visited per call, the CLOCK hand
+ * continues where the previous call stopped
+ */
+
+int stat_cache_trigger_cleanup(server *srv) {
+	stat_cache *sc = srv->stat_cache;
+	stat_cache_table *t = &sc->files;
+	size_t n;
+
+	status_counter_set(srv, CONST_STR_LEN("stat-cache.entries"), (int)t->used);
+	status_counter_set(srv, CONST_STR_LEN("stat-cache.evictions"), (int)t->evictions);
+	if (sc->max_fds) {
+		status_counter_set(srv, CONST_STR_LEN("stat-cache.fds"), (int)stat_cache_open_fds);
+	}
+	if (sc->content_max_size) {
+		status_counter_set(srv, CONST_STR_LEN("stat-cache.content-entries"), (int)stat_cache_content_entries);
+		status_counter_set(srv, CONST_STR_LEN("stat-cache.content-kbytes"), (int)(stat_cache_content_bytes >> 10));
+		status_counter_set(srv, CONST_STR_LEN("stat-cache.content-limit-kbytes"), (int)(sc->content_limit >> 10));
+		status_counter_set(srv, CONST_STR_LEN("stat-cache.content-evictions"), (int)sc->content_evictions);
+	}
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_INOTIFY) {
+		inotify_dir_cleanup(sc);
+	}
 #endif
-			stat_cache_entry_free(node->data);
-			sc->files = splaytree_delete(sc->files, ndx);
 
-#ifdef DEBUG_STAT_CACHE
-			for (j = 0; j < ctrl.used; j++) {
-				if (ctrl.ptr[j] == ndx) {
-					ctrl.ptr[j] = ctrl.ptr[--ctrl.used];
-					break;
-				}
+	if (0 == t->used) return 0;
+
+	for (n = t->size >> STAT_CACHE_CLEANUP_SHIFT; n > 0; --n) {
+		const size_t i = t->hand;
+		stat_cache_entry *sce = t->ptr[i];
+
+#ifdef HAVE_SYS_INOTIFY_H
+		/* entries are invalidated by directory version;
+		 * unused ones are evicted only when the cache is full,
+		 * but do not keep the fds of idle entries open */
+		if (srv->srvconf.stat_cache_engine == STAT_CACHE_ENGINE_INOTIFY
+		    && -1 != sc->inotify_fd) {
+			if (NULL != sce && -1 != sce->fd && 1 == sce->refcnt
+			    && srv->cur_ts - sce->stat_ts > 2) {
+				stat_cache_entry_close_fd(sce);
 			}
-
-			force_assert(osize - 1 == splaytree_size(sc->files));
+		} else
 #endif
+		if (NULL != sce && srv->cur_ts - sce->stat_ts > 2) {
+			/* an entry shifted back into slot i is checked again */
+			stat_cache_table_delete(srv, t, i);
+			if (NULL != t->ptr[i]) continue;
 		}
+		t->hand = (i + 1) & (t->size - 1);
 	}
 
-	free(keys);
-
 	return 0;
 }
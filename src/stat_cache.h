@@ -12,6 +12,9 @@ void stat_cache_free(struct stat_cache *fc);
 const buffer * stat_cache_mimetype_by_ext(const connection *con, const char *name, size_t nlen);
 handler_t stat_cache_get_entry(server *srv, connection *con, buffer *name, stat_cache_entry **fce);
 int stat_cache_open_rdonly_fstat (server *srv, connection *con, buffer *name, struct stat *st);
+int stat_cache_entry_open(server *srv, connection *con, stat_cache_entry *sce);
+buffer * stat_cache_entry_content(server *srv, connection *con, stat_cache_entry *sce);
+void stat_cache_entry_refchg(void *data, int mod);
 
 int stat_cache_trigger_cleanup(server *srv);
 #endif
@@ -2,6 +2,16 @@
 
 #include "status_counter.h"
 #include "base.h"
+#include "fdevent.h"
+#include "log.h"
+
+#include "sys-mmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /**
  * The status array can carry all the status information you want
@@ -15,48 +25,475 @@
  *   fastcgi.backend.<key>....
  *
  *   fastcgi.backend.<key>.disconnects = ...
+ *
+ * srv->status maps the name of each counter used by this process to its
+ * slot in the shared memory segment (see status_counter.h)
  */
 
-data_integer *status_counter_get_counter(server *srv, const char *s, size_t len) {
+#ifdef __ATOMIC_ACQUIRE
+#define status_counter_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define status_counter_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define status_counter_fetch_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#else
+#define status_counter_load_acquire(p) (*(p))
+#define status_counter_store_release(p, v) (*(p) = (v))
+#define status_counter_fetch_add(p, v) ((*(p) += (v)) - (v))
+#endif
+
+#define STATUS_COUNTER_CACHE_LINE 64
+
+static size_t status_counter_hdr_size(void) {
+	return (sizeof(status_counter_hdr) + STATUS_COUNTER_CACHE_LINE - 1)
+	     & ~(size_t)(STATUS_COUNTER_CACHE_LINE - 1);
+}
+
+static size_t status_counter_block_size(uint32_t nslots) {
+	return (nslots * sizeof(int64_t) + STATUS_COUNTER_CACHE_LINE - 1)
+	     & ~(size_t)(STATUS_COUNTER_CACHE_LINE - 1);
+}
+
+static size_t status_counter_size(uint32_t nslots, uint32_t nblocks) {
+	return status_counter_hdr_size()
+	     + nslots * sizeof(status_counter_name)
+	     + nblocks * status_counter_block_size(nslots);
+}
+
+static status_counter_name * status_counter_names(status_counter_hdr *hdr) {
+	return (status_counter_name *)((char *)hdr + hdr->names_offset);
+}
+
+static int64_t * status_counter_block(status_counter_hdr *hdr, uint32_t j) {
+	return (int64_t *)((char *)hdr + hdr->blocks_offset + j * hdr->block_size);
+}
+
+/* use hdr (zeroed memory of status_counter_size(nslots, nblocks) bytes);
+ * counters registered so far are copied from the previous segment */
+static void status_counter_attach(server *srv, status_counter_hdr *hdr, uint32_t nslots, uint32_t nblocks, int mapped) {
+	status_counter_hdr * const old = srv->status_shm;
+	uint32_t block = 0;
+
+	hdr->nslots = nslots;
+	hdr->used = 1; /* slot 0 is not a counter */
+	hdr->nblocks = nblocks;
+	hdr->name_size = sizeof(status_counter_name);
+	hdr->names_offset = status_counter_hdr_size();
+	hdr->blocks_offset = hdr->names_offset + nslots * sizeof(status_counter_name);
+	hdr->block_size = status_counter_block_size(nslots);
+
+	if (NULL != old) {
+		/* (old is private memory and not used by other processes) */
+		const uint32_t used = old->used;
+		uint32_t j;
+		force_assert(used <= nslots);
+		memcpy(status_counter_names(hdr), status_counter_names(old),
+		       used * sizeof(status_counter_name));
+		for (j = 0; j < old->nblocks && j < nblocks; ++j) {
+			memcpy(status_counter_block(hdr, j), status_counter_block(old, j),
+			       used * sizeof(int64_t));
+		}
+		hdr->used = used;
+		block = (uint32_t)(((char *)srv->status_values - (char *)old - old->blocks_offset)
+		                   / old->block_size);
+		force_assert(!srv->status_shm_mapped);
+		free(old);
+	}
+
+	memcpy(hdr->magic, STATUS_COUNTER_MAGIC, sizeof(hdr->magic));
+	srv->status_shm = hdr;
+	srv->status_shm_size = status_counter_size(nslots, nblocks);
+	srv->status_shm_mapped = mapped;
+	srv->status_values = status_counter_block(hdr, block < nblocks ? block : 0);
+}
+
+/* (re)allocate private memory for nslots counters */
+static void status_counter_alloc(server *srv, uint32_t nslots) {
+	const uint32_t nblocks = srv->srvconf.max_worker + 1u;
+	void * const p = calloc(1, status_counter_size(nslots, nblocks));
+	force_assert(p);
+	status_counter_attach(srv, p, nslots, nblocks, 0);
+}
+
+/* create server.statistics-file; called before dropping privileges
+ * (the file is sized and mapped by status_counter_share()) */
+int status_counter_open(server *srv) {
+	const buffer * const fn = srv->srvconf.statistics_file;
+
+	if (buffer_string_is_empty(fn)) return 0;
+
+      #ifdef HAVE_SYS_MMAN_H
+	/* create a new file; tools still reading an old file
+	 * (e.g. before a graceful restart) keep the old inode */
+	if (0 != unlink(fn->ptr) && errno != ENOENT) {
+		log_error_write(srv, __FILE__, __LINE__, "sbss",
+			"unlink", fn, "failed:", strerror(errno));
+		return -1;
+	}
+	srv->status_fd = fdevent_open_cloexec(fn->ptr, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (-1 == srv->status_fd) {
+		log_error_write(srv, __FILE__, __LINE__, "sbss",
+			"creating server.statistics-file", fn, "failed:", strerror(errno));
+		return -1;
+	}
+	return 0;
+      #else
+	log_error_write(srv, __FILE__, __LINE__, "s",
+		"server.statistics-file is not supported on this platform");
+	return -1;
+      #endif
+}
+
+/* create shared memory segment for the counters registered so far and
+ * STATUS_COUNTER_SLOTS more; called before forking workers */
+int status_counter_share(server *srv) {
+	const uint32_t nblocks = srv->srvconf.max_worker + 1u;
+	uint32_t nslots;
+	size_t size;
+	void *p = MAP_FAILED;
+
+	if (NULL == srv->status_shm) status_counter_alloc(srv, STATUS_COUNTER_SLOTS);
+	if (srv->status_shm_mapped) return 0;
+	nslots = srv->status_shm->used + STATUS_COUNTER_SLOTS;
+	size = status_counter_size(nslots, nblocks);
+
+      #ifdef HAVE_SYS_MMAN_H
+	if (-1 != srv->status_fd) {
+		if (0 != ftruncate(srv->status_fd, (off_t)size)
+		    || MAP_FAILED == (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, srv->status_fd, 0))) {
+			log_error_write(srv, __FILE__, __LINE__, "sbss",
+				"creating server.statistics-file", srv->srvconf.statistics_file,
+				"failed:", strerror(errno));
+			close(srv->status_fd);
+			srv->status_fd = -1;
+			return -1;
+		}
+		close(srv->status_fd);
+		srv->status_fd = -1;
+	}
+      #ifdef MAP_ANON
+	else {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	}
+      #endif
+      #endif
+
+	/* if MAP_FAILED, counters are not shared between workers */
+	if (MAP_FAILED != p) status_counter_attach(srv, p, nslots, nblocks, 1);
+
+	return 0;
+}
+
+void status_counter_close(server *srv) {
+	if (-1 != srv->status_fd) {
+		close(srv->status_fd);
+		srv->status_fd = -1;
+	}
+	if (NULL == srv->status_shm) return;
+	if (srv->status_shm_mapped) {
+		munmap((void *)srv->status_shm, srv->status_shm_size);
+	} else {
+		free(srv->status_shm);
+	}
+	srv->status_shm = NULL;
+	srv->status_values = NULL;
+}
+
+/* use block of worker (1 .. server.max-worker) for counters of this process;
+ * the block is reset, since it might contain values of a previous worker */
+void status_counter_worker(server *srv, int worker) {
+	status_counter_hdr * const hdr = srv->status_shm;
+	int64_t *values;
+	if (NULL == hdr || worker <= 0 || (uint32_t)worker >= hdr->nblocks) return;
+	values = status_counter_block(hdr, (uint32_t)worker);
+	memset(values, 0, hdr->block_size);
+	srv->status_values = values;
+}
+
+/* returns slot of counter; registers counter if not found */
+int status_counter_slot(server *srv, const char *s, size_t len) {
 	data_integer *di;
+	status_counter_hdr *hdr;
+	status_counter_name *names;
+	uint32_t i, used;
 
-	if (NULL == (di = (data_integer *)array_get_element_klen(srv->status, s, len))) {
-		/* not found, create it */
+	if (len >= sizeof(names->name)) len = sizeof(names->name) - 1;
 
-		if (NULL == (di = (data_integer *)array_get_unused_element(srv->status, TYPE_INTEGER))) {
-			di = data_integer_init();
+	if (NULL != (di = (data_integer *)array_get_element_klen(srv->status, s, len))) {
+		return di->value;
+	}
+
+	if (NULL == srv->status_shm) {
+		/*(counter used before status_counter_share() in server_main())*/
+		status_counter_alloc(srv, STATUS_COUNTER_SLOTS);
+	}
+	hdr = srv->status_shm;
+	names = status_counter_names(hdr);
+
+	/* registered by another worker? */
+	used = status_counter_load_acquire(&hdr->used);
+	if (used > hdr->nslots) used = hdr->nslots;
+	for (i = 1; i < used; ++i) {
+		if (status_counter_load_acquire(&names[i].ready)
+		    && 0 == strncmp(names[i].name, s, len) && '\0' == names[i].name[len]) break;
+	}
+
+	if (i == used) {
+		/* (a worker might register the same name concurrently;
+		 *  counters are summed by name when read) */
+		if (used == hdr->nslots && !srv->status_shm_mapped) {
+			status_counter_alloc(srv, hdr->nslots * 2);
+			hdr = srv->status_shm;
+			names = status_counter_names(hdr);
+		}
+		i = status_counter_fetch_add(&hdr->used, 1);
+		if (i < hdr->nslots) {
+			memcpy(names[i].name, s, len);
+			names[i].name[len] = '\0';
+			status_counter_store_release(&names[i].ready, 1);
+		} else {
+			i = 0;
+			log_error_write(srv, __FILE__, __LINE__, "sss",
+				"no status counter slots left for", s, "(values are discarded)");
 		}
-		buffer_copy_string_len(di->key, s, len);
-		di->value = 0;
+	}
 
-		array_insert_unique(srv->status, (data_unset *)di);
+	if (NULL == (di = (data_integer *)array_get_unused_element(srv->status, TYPE_INTEGER))) {
+		di = data_integer_init();
 	}
-	return di;
+	buffer_copy_string_len(di->key, s, len);
+	di->value = (int)i;
+	array_insert_unique(srv->status, (data_unset *)di);
+
+	return (int)i;
+}
+
+/* value of counter in this process */
+int64_t status_counter_get(server *srv, const char *s, size_t len) {
+	return srv->status_values[status_counter_slot(srv, s, len)];
+}
+
+/* sum of counter over all workers
+ * (a counter might be registered in more than one slot, see above) */
+int64_t status_counter_total(server *srv, const char *s, size_t len) {
+	status_counter_hdr * const hdr = srv->status_shm;
+	status_counter_name *names;
+	int64_t sum = 0;
+	uint32_t i, j, used;
+
+	if (NULL == hdr) return 0;
+	if (len >= sizeof(names->name)) len = sizeof(names->name) - 1;
+
+	names = status_counter_names(hdr);
+	used = status_counter_load_acquire(&hdr->used);
+	if (used > hdr->nslots) used = hdr->nslots;
+	for (i = 1; i < used; ++i) {
+		if (!status_counter_load_acquire(&names[i].ready)
+		    || 0 != strncmp(names[i].name, s, len) || '\0' != names[i].name[len]) continue;
+		for (j = 0; j < hdr->nblocks; ++j) {
+			const int64_t *values = status_counter_block(hdr, j);
+			sum += values[i];
+		}
+	}
+
+	return sum;
 }
 
 /* dummies of the statistic framework functions
  * they will be moved to a statistics.c later */
 int status_counter_inc(server *srv, const char *s, size_t len) {
-	data_integer *di = status_counter_get_counter(srv, s, len);
-
-	di->value++;
+	status_counter_slot_add(srv, status_counter_slot(srv, s, len), 1);
 
 	return 0;
 }
 
 int status_counter_dec(server *srv, const char *s, size_t len) {
-	data_integer *di = status_counter_get_counter(srv, s, len);
+	int64_t * const v = srv->status_values + status_counter_slot(srv, s, len);
 
-	if (di->value > 0) di->value--;
+	if (*v > 0) --*v;
 
 	return 0;
 }
 
 int status_counter_set(server *srv, const char *s, size_t len, int val) {
-	data_integer *di = status_counter_get_counter(srv, s, len);
+	status_counter_slot_set(srv, status_counter_slot(srv, s, len), val);
+
+	return 0;
+}
+
+/* sums of all counters over all workers, by name;
+ * the array is valid until the next call */
+array * status_counter_totals(server *srv) {
+	status_counter_hdr * const hdr = srv->status_shm;
+	status_counter_name *names;
+	array * const a = srv->status_totals;
+	uint32_t i, j, used;
+
+	array_reset(a);
+	if (NULL == hdr) return a;
+
+	names = status_counter_names(hdr);
+	used = status_counter_load_acquire(&hdr->used);
+	if (used > hdr->nslots) used = hdr->nslots;
+	for (i = 1; i < used; ++i) {
+		const char *name;
+		size_t len;
+		int64_t sum = 0;
+		data_integer *di;
+
+		if (!status_counter_load_acquire(&names[i].ready)) continue;
+		for (j = 0; j < hdr->nblocks; ++j) {
+			const int64_t *values = status_counter_block(hdr, j);
+			sum += values[i];
+		}
+
+		name = names[i].name;
+		len = strlen(name);
+		if (NULL != (di = (data_integer *)array_get_element_klen(a, name, len))) {
+			di->value += (int)sum;
+			continue;
+		}
+		if (NULL == (di = (data_integer *)array_get_unused_element(a, TYPE_INTEGER))) {
+			di = data_integer_init();
+		}
+		buffer_copy_string_len(di->key, name, len);
+		di->value = (int)sum;
+		array_insert_unique(a, (data_unset *)di);
+	}
+
+	return a;
+}
+
+static int status_counter_sum_cmp(const void *a, const void *b) {
+	return strcmp(((const status_counter_sum *)a)->name,
+	              ((const status_counter_sum *)b)->name);
+}
 
-	di->value = val;
+/* sums of all counters over all workers, by name, sorted by name, into
+ * *sums (grown to *size as needed); returns the number of sums.
+ * (one pass over the slots, unlike status_counter_total() per name;
+ *  and 64-bit, unlike status_counter_totals()) */
+size_t status_counter_sums(server *srv, status_counter_sum **sums, size_t *size) {
+	status_counter_hdr * const hdr = srv->status_shm;
+	status_counter_name *names;
+	status_counter_sum *t;
+	uint32_t i, j, used;
+	size_t n = 0, k;
 
+	if (NULL == hdr) return 0;
+
+	names = status_counter_names(hdr);
+	used = status_counter_load_acquire(&hdr->used);
+	if (used > hdr->nslots) used = hdr->nslots;
+	if (*size < used) {
+		*sums = realloc(*sums, used * sizeof(**sums));
+		force_assert(NULL != *sums);
+		*size = used;
+	}
+	t = *sums;
+
+	for (i = 1; i < used; ++i) {
+		int64_t sum = 0;
+		if (!status_counter_load_acquire(&names[i].ready)) continue;
+		for (j = 0; j < hdr->nblocks; ++j) {
+			const int64_t *values = status_counter_block(hdr, j);
+			sum += values[i];
+		}
+		t[n].name = names[i].name;
+		t[n].len = strlen(names[i].name);
+		t[n].value = sum;
+		++n;
+	}
+	if (0 == n) return 0;
+
+	/* merge counters registered in more than one slot */
+	qsort(t, n, sizeof(*t), status_counter_sum_cmp);
+	for (i = 1, k = 0; i < n; ++i) {
+		if (t[i].len == t[k].len && 0 == memcmp(t[i].name, t[k].name, t[k].len)) {
+			t[k].value += t[i].value;
+		} else {
+			t[++k] = t[i];
+		}
+	}
+
+	return k + 1;
+}
+
+/* sum of counter s in the result of status_counter_sums(); 0 if none */
+int64_t status_counter_sums_get(const status_counter_sum *sums, size_t n, const char *s, size_t len) {
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const status_counter_sum * const t = sums + mid;
+		int cmp = memcmp(t->name, s, t->len < len ? t->len : len);
+		if (0 == cmp) cmp = (t->len > len) - (t->len < len);
+		if (0 == cmp) return t->value;
+		if (cmp < 0) lo = mid + 1; else hi = mid;
+	}
 	return 0;
 }
 
+uint64_t status_counter_histogram_bound(int k) {
+	return (uint64_t)((k & 1) ? 3 : 2) << (k / 2 + 6);
+}
+
+/* register the counters of histogram <s>.duration-us.*;
+ * fails if the names do not fit or if there are no slots left */
+int status_counter_histogram_init(server *srv, status_counter_histogram *h, const char *s, size_t len) {
+	buffer * const b = srv->tmp_buf;
+	size_t blen;
+	int k;
+
+	buffer_copy_string_len(b, s, len);
+	buffer_append_string_len(b, CONST_STR_LEN(".duration-us."));
+	blen = buffer_string_length(b);
+
+	/*(longest name is of the last bucket)*/
+	buffer_append_string_len(b, CONST_STR_LEN("le."));
+	buffer_append_int(b, (intmax_t)status_counter_histogram_bound(STATUS_COUNTER_HISTOGRAM_BOUNDS-1));
+	if (buffer_string_length(b) >= sizeof(((status_counter_name *)0)->name)) {
+		log_error_write(srv, __FILE__, __LINE__, "sb",
+			"status counter name too long:", b);
+		return -1;
+	}
+
+	for (k = 0; k < STATUS_COUNTER_HISTOGRAM_BOUNDS; ++k) {
+		buffer_string_set_length(b, blen);
+		buffer_append_string_len(b, CONST_STR_LEN("le."));
+		buffer_append_int(b, (intmax_t)status_counter_histogram_bound(k));
+		h->slots[k] = status_counter_slot(srv, CONST_BUF_LEN(b));
+		if (0 == h->slots[k]) return -1;
+	}
+	buffer_string_set_length(b, blen);
+	buffer_append_string_len(b, CONST_STR_LEN("le.inf"));
+	if (0 == (h->slots[k] = status_counter_slot(srv, CONST_BUF_LEN(b)))) return -1;
+	buffer_string_set_length(b, blen);
+	buffer_append_string_len(b, CONST_STR_LEN("sum"));
+	if (0 == (h->slots[k+1] = status_counter_slot(srv, CONST_BUF_LEN(b)))) return -1;
+
+	return 0;
+}
+
+void status_counter_histogram_add(server *srv, const status_counter_histogram *h, uint64_t usec) {
+	int k;
+	if (usec <= 128) {
+		k = 0;
+	} else {
+		/* x in [2^m, 2^(m+1)): bucket 3*2^(m-1) or 2^(m+1) */
+		const uint64_t x = usec - 1;
+		int m = 7;
+		while (m < 63 && (x >> (m + 1))) ++m;
+		k = 2 * (m - 7) + (x < ((uint64_t)3 << (m - 1)) ? 1 : 2);
+		if (k > STATUS_COUNTER_HISTOGRAM_BOUNDS) k = STATUS_COUNTER_HISTOGRAM_BOUNDS;
+	}
+	status_counter_slot_add(srv, h->slots[k], 1);
+	status_counter_slot_add(srv, h->slots[STATUS_COUNTER_HISTOGRAM_BOUNDS + 1], (int64_t)usec);
+}
+
+/* add duration from start (log_clock_gettime_realtime()) until now */
+void status_counter_histogram_since(server *srv, const status_counter_histogram *h, const struct timespec *start) {
+	struct timespec ts;
+	int64_t usec;
+	log_clock_gettime_realtime(&ts);
+	usec = (int64_t)(ts.tv_sec - start->tv_sec) * 1000000
+	     + (ts.tv_nsec - start->tv_nsec) / 1000;
+	status_counter_histogram_add(srv, h, usec > 0 ? (uint64_t)usec : 0);
+}
@@ -3,13 +3,104 @@
 #include "first.h"
 
 #include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
 
 #include "base_decls.h"
 #include "array.h"
 
-data_integer *status_counter_get_counter(server *srv, const char *s, size_t len);
+/**
+ * status counters are kept in a shared memory segment, so that the counters
+ * of all workers (server.max-worker) can be read by each worker (mod_status)
+ * and by external tools (lighttpd-stats) if server.statistics-file is set.
+ *
+ * Each counter has a numeric slot, registered by name.  Each worker has its
+ * own block of int64_t values, one for each slot, and only writes to its
+ * own block; the value of a counter is the sum over all blocks.  Block 0 is
+ * used by the server if there are no workers, and before workers are forked.
+ *
+ * layout:  status_counter_hdr
+ *          status_counter_name names[nslots]   at names_offset
+ *          int64_t blocks[nblocks][nslots]     at blocks_offset, each block
+ *                                              block_size bytes (padded to
+ *                                              a multiple of a cache line)
+ *
+ * Counters registered while the server starts (e.g. in set_defaults) are
+ * kept in private memory, which grows as needed.  status_counter_share()
+ * then creates the shared segment before workers are forked, sized for the
+ * registered counters plus STATUS_COUNTER_SLOTS slots for counters that are
+ * registered later.  slot 0 is not a counter; registering a counter fails
+ * with slot 0 if all slots of the shared segment are used, and values added
+ * to slot 0 are discarded.
+ */
+
+#define STATUS_COUNTER_MAGIC     "lighttpd-stats-1"
+#define STATUS_COUNTER_SLOTS     4096
+/* long enough for histograms of any server.name (see status.vhost.*) */
+#define STATUS_COUNTER_NAME_SIZE 320
+
+typedef struct status_counter_hdr {
+	char magic[16];        /* STATUS_COUNTER_MAGIC (without '\0') */
+	uint32_t nslots;
+	uint32_t used;         /* slots registered (may exceed nslots) */
+	uint32_t nblocks;
+	uint32_t name_size;    /* sizeof(status_counter_name) */
+	uint64_t names_offset;
+	uint64_t blocks_offset;
+	uint64_t block_size;
+} status_counter_hdr;
+
+typedef struct status_counter_name {
+	uint32_t ready;        /* set once name has been written */
+	char name[STATUS_COUNTER_NAME_SIZE - sizeof(uint32_t)];
+} status_counter_name;
+
+int status_counter_open(server *srv);
+int status_counter_share(server *srv);
+void status_counter_close(server *srv);
+void status_counter_worker(server *srv, int worker);
+
+int status_counter_slot(server *srv, const char *s, size_t len);
+#define status_counter_slot_add(srv, slot, n) ((srv)->status_values[(slot)] += (n))
+#define status_counter_slot_set(srv, slot, n) ((srv)->status_values[(slot)] = (n))
+
+int64_t status_counter_get(server *srv, const char *s, size_t len);
+int64_t status_counter_total(server *srv, const char *s, size_t len);
 int status_counter_inc(server *srv, const char *s, size_t len);
 int status_counter_dec(server *srv, const char *s, size_t len);
 int status_counter_set(server *srv, const char *s, size_t len, int val);
 
+array * status_counter_totals(server *srv);
+
+/* sum of a counter over all workers; name points into the counter segment */
+typedef struct status_counter_sum {
+	const char *name;
+	size_t len;
+	int64_t value;
+} status_counter_sum;
+
+size_t status_counter_sums(server *srv, status_counter_sum **sums, size_t *size);
+int64_t status_counter_sums_get(const status_counter_sum *sums, size_t n, const char *s, size_t len);
+
+/**
+ * histogram of durations with fixed log buckets, two buckets per power of 2
+ * (upper bounds 128us, 192us, 256us, 384us, 512us, ... 33.554432s, +Inf)
+ *
+ * counters: <name>.duration-us.le.<bound>  (count of bucket, not cumulative)
+ *           <name>.duration-us.le.inf
+ *           <name>.duration-us.sum         (sum of durations in usec)
+ */
+#define STATUS_COUNTER_HISTOGRAM_BOUNDS 37
+
+typedef struct status_counter_histogram {
+	int slots[STATUS_COUNTER_HISTOGRAM_BOUNDS + 2]; /* buckets, +Inf, sum */
+} status_counter_histogram;
+
+int status_counter_histogram_init(server *srv, status_counter_histogram *h, const char *s, size_t len);
+void status_counter_histogram_add(server *srv, const status_counter_histogram *h, uint64_t usec);
+void status_counter_histogram_since(server *srv, const status_counter_histogram *h, const struct timespec *start);
+uint64_t status_counter_histogram_bound(int k);
+
 #endif
@@ -0,0 +1,103 @@
+#include "mod_accesslog.c"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* (not used by the functions tested here; only to link mod_accesslog.c) */
+int config_check_cond(server *srv, connection *con, data_config *dc) {
+    UNUSED(srv); UNUSED(con); UNUSED(dc); abort();
+}
+int config_insert_values_global(server *srv, array *ca, const config_values_t cv[], config_scope_type_t scope) {
+    UNUSED(srv); UNUSED(ca); UNUSED(cv); UNUSED(scope); abort();
+}
+int64_t connection_timing_usec(const connection *con, con_timing_t t) {
+    UNUSED(con); UNUSED(t); abort();
+}
+int connection_timing_from_name(const char *name, size_t len) {
+    UNUSED(name); UNUSED(len); abort();
+}
+int fdevent_open_logger(const char *logger) {
+    UNUSED(logger); abort();
+}
+int fdevent_cycle_logger(const char *logger, int *curfd) {
+    UNUSED(logger); UNUSED(curfd); abort();
+}
+int status_counter_set(server *srv, const char *s, size_t len, int val) {
+    UNUSED(srv); UNUSED(s); UNUSED(len); UNUSED(val); abort();
+}
+
+static void run_timestamp(server *srv, connection *con, int opt, long ns, const char *expect) {
+    format_field f;
+    format_field *fp = &f;
+    format_fields ff = { &fp, 1, 1 };
+    accesslog_value v;
+    accesslog_req r;
+    buffer *b = buffer_init();
+
+    memset(&f, 0, sizeof(f));
+    f.type = FIELD_FORMAT;
+    f.field = FORMAT_TIMESTAMP;
+    f.opt = FORMAT_FLAG_TIME_BEGIN | opt;
+    accesslog_compile_format(&ff);
+
+    con->request_start_hp.tv_sec = 1500000000;
+    con->request_start_hp.tv_nsec = ns;
+    r.srv = srv;
+    r.con = con;
+    r.conf = NULL;
+    r.ts.tv_sec = 0;
+    r.ts.tv_nsec = 0;
+    r.newts = 0;
+
+    f.fn(&v, &f, &r);
+    accesslog_append_text(b, &ff, &v);
+    if (!buffer_is_equal_string(b, expect, strlen(expect))) {
+        fprintf(stderr, "%s.%d: timestamp opt %d ns %ld: expected '%s', got '%s'\n",
+                __FILE__, __LINE__, opt, ns, expect, b->ptr);
+        fflush(stderr);
+        abort();
+    }
+
+    buffer_free(b);
+}
+
+static void test_mod_accesslog_timestamp_frac(server *srv, connection *con) {
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 0, "000");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 1, "001");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 998000001, "999");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 999000000, "999");
+    /* would round up to the next second; must not overflow the field */
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 999000001, "999");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC_FRAC, 999999999, "999");
+
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC_FRAC, 0, "000000");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC_FRAC, 1001, "000002");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC_FRAC, 999999000, "999999");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC_FRAC, 999999001, "999999");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC_FRAC, 999999999, "999999");
+
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_NSEC_FRAC, 1, "000000001");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_NSEC_FRAC, 999999999, "999999999");
+}
+
+static void test_mod_accesslog_timestamp_hp(server *srv, connection *con) {
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC, 1, "1500000000001");
+    /* (rounds up into the seconds, which are part of the same value) */
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_MSEC, 999000001, "1500000001000");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_USEC, 999999001, "1500000001000000");
+    run_timestamp(srv, con, FORMAT_FLAG_TIME_NSEC, 999999999, "1500000000999999999");
+}
+
+int main (void) {
+    server srv;
+    connection con;
+
+    memset(&srv, 0, sizeof(srv));
+    memset(&con, 0, sizeof(con));
+
+    test_mod_accesslog_timestamp_frac(&srv, &con);
+    test_mod_accesslog_timestamp_hp(&srv, &con);
+
+    return 0;
+}
@@ -0,0 +1,398 @@
+#include "request.c"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static void test_request_connection_reset(connection *con)
+{
+    con->request_count = 1;
+    con->http_status = 0;
+    con->keep_alive = 0;
+    con->response.keep_alive = 0;
+    con->header_len = 0;
+    con->request.http_method = HTTP_METHOD_UNSET;
+    con->request.http_version = HTTP_VERSION_UNSET;
+    con->request.http_host = NULL;
+    con->request.http_range = NULL;
+    con->request.http_content_type = NULL;
+    con->request.http_if_modified_since = NULL;
+    con->request.http_if_none_match = NULL;
+    con->request.content_length = 0;
+    buffer_reset(con->request.uri);
+    buffer_reset(con->request.orig_uri);
+    buffer_reset(con->request.request_line);
+    http_header_reset(con->request.headers, &con->request.hindex);
+}
+
+static void run_http_request_parse(server *srv, connection *con, int line, int status, const char *desc, const char *req, size_t reqlen)
+{
+    test_request_connection_reset(con);
+    buffer_copy_string_len(con->request.request, req, reqlen);
+    http_request_parse(srv, con);
+    if (con->http_status != status) {
+        fprintf(stderr,
+                "%s.%d: %s() failed: expected '%d', got '%d' for test %s\n",
+                __FILE__, line, "http_request_parse", status, con->http_status,
+                desc);
+        fflush(stderr);
+        abort();
+    }
+}
+
+static void test_request_http_request_parse(server *srv, connection *con)
+{
+    data_string *ds;
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "hostname",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\r\n"
+                    "\r\n"));
+    assert(buffer_is_equal_string(con->request.http_host,
+                                  CONST_STR_LEN("www.example.org")));
+    assert(buffer_is_equal_string(con->request.uri, CONST_STR_LEN("/")));
+    assert(con->request.http_method == HTTP_METHOD_GET);
+    assert(con->request.http_version == HTTP_VERSION_1_0);
+    assert(con->header_len == sizeof("GET / HTTP/1.0\r\nHost: www.example.org\r\n\r\n")-1);
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "HTTP/1.1 without Host",
+      CONST_STR_LEN("GET / HTTP/1.1\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "whitespace around header key and value",
+      CONST_STR_LEN("GET / HTTP/1.1\r\n"
+                    "hOsT \t:  \twww.example.org \t \r\n"
+                    "X-Empty:  \r\n"
+                    "\r\n"));
+    assert(buffer_is_equal_string(con->request.http_host,
+                                  CONST_STR_LEN("www.example.org")));
+    assert(con->keep_alive);
+    assert(con->request.headers->used == 1);
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "line-folding",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\r\n"
+                    "Location: foo\r\n"
+                    " bar\r\n"
+                    "\tbaz\r\n"
+                    "\r\n"));
+    ds = (data_string *)array_get_element(con->request.headers, "Location");
+    assert(ds && buffer_is_equal_string(ds->value,
+                                        CONST_STR_LEN("foo bar\tbaz")));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "line-folding of first header",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    " Host: www.example.org\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "well-known headers",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\r\n"
+                    "Connection: foo, Keep-Alive\r\n"
+                    "RANGE: bytes=0-1\r\n"
+                    "If-None-Match: \"12345\"\r\n"
+                    "If-Modified-Since: Sat, 01 Jan 2000 00:00:00 GMT\r\n"
+                    "if-modified-since: Sat, 01 Jan 2000 00:00:00 GMT\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Content-Length: 0\r\n"
+                    "Content-Lengths: 5\r\n"
+                    "\r\n"));
+    assert(con->keep_alive);
+    assert(0 == strcmp(con->request.http_range, "0-1"));
+    assert(0 == strcmp(con->request.http_if_none_match, "\"12345\""));
+    assert(0 == strcmp(con->request.http_content_type, "text/plain"));
+    assert(NULL != con->request.http_if_modified_since);
+    assert(con->request.content_length == 0);
+    ds = http_header_request_get(con, HTTP_HEADER_RANGE, CONST_STR_LEN("Range"));
+    assert(ds && ds->ext == HTTP_HEADER_RANGE
+              && buffer_is_equal_string(ds->value, CONST_STR_LEN("bytes=0-1")));
+    assert(ds == (data_string *)array_get_element(con->request.headers, "Range"));
+    ds = http_header_request_get(con, HTTP_HEADER_OTHER, CONST_STR_LEN("Content-Lengths"));
+    assert(ds && ds->ext == HTTP_HEADER_OTHER);
+    assert(NULL == http_header_request_get(con, HTTP_HEADER_UPGRADE, CONST_STR_LEN("Upgrade")));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "merged duplicate headers",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Cookie: a=1\r\n"
+                    "X-Foo: 1\r\n"
+                    "cookie: b=2\r\n"
+                    "x-foo: 2\r\n"
+                    "\r\n"));
+    assert(con->request.headers->used == 2);
+    ds = http_header_request_get(con, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie"));
+    assert(ds && buffer_is_equal_string(ds->value, CONST_STR_LEN("a=1, b=2")));
+    ds = http_header_request_get(con, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Foo"));
+    assert(ds && buffer_is_equal_string(ds->value, CONST_STR_LEN("1, 2")));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "index reset between requests",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "\r\n"));
+    assert(0 == con->request.hindex.htags);
+    assert(NULL == http_header_request_get(con, HTTP_HEADER_COOKIE, CONST_STR_LEN("Cookie")));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "duplicate Host",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\r\n"
+                    "host: www.example.org\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "Host in request-line overrides Host header",
+      CONST_STR_LEN("GET http://www.example.org/ HTTP/1.1\r\n"
+                    "Host: www.example.com\r\n"
+                    "\r\n"));
+    assert(buffer_is_equal_string(con->request.http_host,
+                                  CONST_STR_LEN("www.example.org")));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "separator in header key",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Ho(st: www.example.org\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "whitespace inside header key",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Ho st: www.example.org\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "header line without ':'",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "CR without LF",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\rX: y\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "NUL in header value",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "X-Foo: a\0b\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "control char in header value (strict)",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "X-Foo: a\x01" "b\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "control char in header value after 16 bytes (strict)",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "X-Foo: 0123456789abcdef0123456789abcdef\x1f\r\n"
+                    "\r\n"));
+
+    con->conf.http_parseopts &= ~HTTP_PARSEOPT_HEADER_STRICT;
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "control char in header value (not strict)",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "X-Foo: a\x01" "b\r\n"
+                    "\r\n"));
+    ds = (data_string *)array_get_element(con->request.headers, "X-Foo");
+    assert(ds && buffer_is_equal_string(ds->value, CONST_STR_LEN("a\x01" "b")));
+    con->conf.http_parseopts |= HTTP_PARSEOPT_HEADER_STRICT;
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "header block not terminated",
+      CONST_STR_LEN("GET / HTTP/1.0\r\n"
+                    "Host: www.example.org\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 400,
+      "duplicate Content-Length",
+      CONST_STR_LEN("POST / HTTP/1.0\r\n"
+                    "Content-Length: 5\r\n"
+                    "Content-Length: 5\r\n"
+                    "\r\n"));
+
+    run_http_request_parse(srv, con, __LINE__, 0,
+      "Content-Length",
+      CONST_STR_LEN("POST / HTTP/1.0\r\n"
+                    "content-length: 12345\r\n"
+                    "\r\n"));
+    assert(con->request.content_length == 12345);
+}
+
+static void test_request_http_header_hkey_get(void)
+{
+    assert(HTTP_HEADER_HOST == http_header_hkey_get(CONST_STR_LEN("Host")));
+    assert(HTTP_HEADER_HOST == http_header_hkey_get(CONST_STR_LEN("HOST")));
+    assert(HTTP_HEADER_CONNECTION == http_header_hkey_get(CONST_STR_LEN("connection")));
+    assert(HTTP_HEADER_CONTENT_LENGTH == http_header_hkey_get(CONST_STR_LEN("Content-Length")));
+    assert(HTTP_HEADER_CONTENT_TYPE == http_header_hkey_get(CONST_STR_LEN("Content-Type")));
+    assert(HTTP_HEADER_EXPECT == http_header_hkey_get(CONST_STR_LEN("Expect")));
+    assert(HTTP_HEADER_IF_MODIFIED_SINCE == http_header_hkey_get(CONST_STR_LEN("If-Modified-Since")));
+    assert(HTTP_HEADER_IF_NONE_MATCH == http_header_hkey_get(CONST_STR_LEN("If-None-Match")));
+    assert(HTTP_HEADER_RANGE == http_header_hkey_get(CONST_STR_LEN("Range")));
+    assert(HTTP_HEADER_TRANSFER_ENCODING == http_header_hkey_get(CONST_STR_LEN("Transfer-Encoding")));
+    assert(HTTP_HEADER_UPGRADE == http_header_hkey_get(CONST_STR_LEN("Upgrade")));
+
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("Hos")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("Hosts")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("Post")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("Content_Type")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("Content\rType")));
+    assert(HTTP_HEADER_OTHER == http_header_hkey_get(CONST_STR_LEN("X-Content-Type")));
+}
+
+static void test_request_http_header_index(void)
+{
+    static const struct { const char *k; enum http_header_e id; } hdrs[] = {
+      { "Accept-Encoding",      HTTP_HEADER_ACCEPT_ENCODING }
+     ,{ "Authorization",        HTTP_HEADER_AUTHORIZATION }
+     ,{ "Cache-Control",        HTTP_HEADER_CACHE_CONTROL }
+     ,{ "Connection",           HTTP_HEADER_CONNECTION }
+     ,{ "Content-Encoding",     HTTP_HEADER_CONTENT_ENCODING }
+     ,{ "Content-Length",       HTTP_HEADER_CONTENT_LENGTH }
+     ,{ "Content-Location",     HTTP_HEADER_CONTENT_LOCATION }
+     ,{ "Content-Type",         HTTP_HEADER_CONTENT_TYPE }
+     ,{ "Cookie",               HTTP_HEADER_COOKIE }
+     ,{ "Date",                 HTTP_HEADER_DATE }
+     ,{ "ETag",                 HTTP_HEADER_ETAG }
+     ,{ "Expect",               HTTP_HEADER_EXPECT }
+     ,{ "Forwarded",            HTTP_HEADER_FORWARDED }
+     ,{ "Host",                 HTTP_HEADER_HOST }
+     ,{ "If-Modified-Since",    HTTP_HEADER_IF_MODIFIED_SINCE }
+     ,{ "If-None-Match",        HTTP_HEADER_IF_NONE_MATCH }
+     ,{ "If-Range",             HTTP_HEADER_IF_RANGE }
+     ,{ "Last-Modified",        HTTP_HEADER_LAST_MODIFIED }
+     ,{ "Location",             HTTP_HEADER_LOCATION }
+     ,{ "Range",                HTTP_HEADER_RANGE }
+     ,{ "Server",               HTTP_HEADER_SERVER }
+     ,{ "Set-Cookie",           HTTP_HEADER_SET_COOKIE }
+     ,{ "Transfer-Encoding",    HTTP_HEADER_TRANSFER_ENCODING }
+     ,{ "Upgrade",              HTTP_HEADER_UPGRADE }
+     ,{ "Vary",                 HTTP_HEADER_VARY }
+     ,{ "WWW-Authenticate",     HTTP_HEADER_WWW_AUTHENTICATE }
+     ,{ "X-Forwarded-For",      HTTP_HEADER_X_FORWARDED_FOR }
+     ,{ "X-Forwarded-Proto",    HTTP_HEADER_X_FORWARDED_PROTO }
+     ,{ "X-LIGHTTPD-send-file", HTTP_HEADER_X_LIGHTTPD_SEND_FILE }
+     ,{ "X-Sendfile",           HTTP_HEADER_X_SENDFILE }
+     ,{ "X-Sendfile2",          HTTP_HEADER_X_SENDFILE2 }
+    };
+    array *a = array_init();
+    http_header_index hx;
+    data_string *ds;
+    size_t i;
+
+    memset(&hx, 0, sizeof(hx));
+    assert(sizeof(hdrs)/sizeof(hdrs[0]) == HTTP_HEADER_MAX - 1);
+
+    for (i = 0; i < sizeof(hdrs)/sizeof(hdrs[0]); ++i) {
+        char lc[32];
+        size_t j, klen = strlen(hdrs[i].k);
+        for (j = 0; j <= klen; ++j) lc[j] = (char)tolower((unsigned char)hdrs[i].k[j]);
+        assert(hdrs[i].id == http_header_hkey_get(hdrs[i].k, klen));
+        assert(hdrs[i].id == http_header_hkey_get(lc, klen));
+        assert(hdrs[i].id != http_header_hkey_get(hdrs[i].k, klen-1));
+
+        assert(NULL == http_header_get(a, &hx, hdrs[i].id, hdrs[i].k, klen));
+        ds = http_header_set(a, &hx, hdrs[i].id, hdrs[i].k, klen, CONST_STR_LEN("1"));
+        assert(ds == http_header_get(a, &hx, hdrs[i].id, hdrs[i].k, klen));
+        assert(ds == http_header_get(a, &hx, HTTP_HEADER_OTHER, lc, klen));
+        assert(ds->ext == (int)hdrs[i].id);
+    }
+    assert(a->used == sizeof(hdrs)/sizeof(hdrs[0]));
+
+    /* set replaces, insert merges (into the indexed element) */
+    ds = http_header_set(a, &hx, HTTP_HEADER_VARY, CONST_STR_LEN("vary"), CONST_STR_LEN("Cookie"));
+    assert(buffer_is_equal_string(ds->value, CONST_STR_LEN("Cookie")));
+    ds = data_string_init();
+    buffer_copy_string_len(ds->key, CONST_STR_LEN("VARY"));
+    buffer_copy_string_len(ds->value, CONST_STR_LEN("Accept-Encoding"));
+    http_header_insert(a, &hx, HTTP_HEADER_VARY, ds);
+    ds = http_header_get(a, &hx, HTTP_HEADER_VARY, CONST_STR_LEN("Vary"));
+    assert(buffer_is_equal_string(ds->value, CONST_STR_LEN("Cookie, Accept-Encoding")));
+    assert(a->used == sizeof(hdrs)/sizeof(hdrs[0]));
+
+    /* unknown headers live only in the array */
+    http_header_set(a, &hx, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Foo"), CONST_STR_LEN("bar"));
+    ds = http_header_get(a, &hx, HTTP_HEADER_OTHER, CONST_STR_LEN("x-foo"));
+    assert(ds && ds->ext == HTTP_HEADER_OTHER);
+
+    http_header_reset(a, &hx);
+    assert(0 == a->used && 0 == hx.htags);
+    assert(NULL == http_header_get(a, &hx, HTTP_HEADER_VARY, CONST_STR_LEN("Vary")));
+    assert(NULL == http_header_get(a, &hx, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Foo")));
+
+    /* reused elements do not carry a stale id */
+    ds = http_header_set(a, &hx, HTTP_HEADER_OTHER, CONST_STR_LEN("X-Bar"), CONST_STR_LEN("baz"));
+    assert(ds->ext == HTTP_HEADER_OTHER);
+
+    array_free(a);
+}
+
+static void test_request_http_header_scan_ctl(void)
+{
+    static const char probe[] = { '\0', '\r', '\n', '\x01', '\x1f', '\x7f', '\x80', '\xff', ' ' };
+    char s[80];
+    size_t i, j, len;
+
+    /* vector and scalar scan agree for every position and length */
+    for (len = 0; len <= sizeof(s); ++len) {
+        for (j = 0; j < len; ++j) {
+            for (i = 0; i < sizeof(probe); ++i) {
+                const unsigned char c = (unsigned char)probe[i];
+                memset(s, 'a', sizeof(s));
+                s[len/3] = '\t';
+                s[j] = (char)c;
+                assert(http_header_scan_ctl(s, len) == (c < 0x20 ? j : len));
+                assert(http_header_scan_ctl_scalar(s, len) == (c < 0x20 ? j : len));
+            }
+        }
+    }
+}
+
+int main (void)
+{
+    server srv;
+    connection con;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.errorlog_mode = ERRORLOG_FD;
+    srv.errorlog_fd = -1;
+    srv.split_vals = array_init();
+
+    memset(&con, 0, sizeof(con));
+    con.proto = buffer_init_string("http");
+    con.parse_request = buffer_init();
+    con.request.request = buffer_init();
+    con.request.request_line = buffer_init();
+    con.request.orig_uri = buffer_init();
+    con.request.uri = buffer_init();
+    con.request.headers = array_init();
+    con.conf.allow_http11 = 1;
+    con.conf.http_parseopts = HTTP_PARSEOPT_HEADER_STRICT
+                            | HTTP_PARSEOPT_HOST_STRICT
+                            | HTTP_PARSEOPT_HOST_NORMALIZE;
+
+    test_request_http_header_hkey_get();
+    test_request_http_header_index();
+    test_request_http_header_scan_ctl();
+    test_request_http_request_parse(&srv, &con);
+
+    array_free(con.request.headers);
+    buffer_free(con.request.uri);
+    buffer_free(con.request.orig_uri);
+    buffer_free(con.request.request_line);
+    buffer_free(con.request.request);
+    buffer_free(con.parse_request);
+    buffer_free(con.proto);
+    array_free(srv.split_vals);
+
+    return 0;
+}
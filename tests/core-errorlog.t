@@ -0,0 +1,75 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 8;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $errorlog = $tf->{TESTDIR}.'/tmp/lighttpd/logs/errorlog.error.log';
+
+# status and body of GET <uri> (HTTP/1.0) from server on port,
+# with a wrong password for user jan
+sub get {
+	my ($port, $uri) = @_;
+	my $remote = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $port);
+	return ('', '') unless defined $remote;
+	print $remote "GET $uri HTTP/1.0\r\nHost: www.example.org\r\nAuthorization: Basic amFuOndyb25n\r\n\r\n";
+	local $/;
+	my $resp = <$remote>;
+	close $remote;
+	return ('', '') unless defined $resp && $resp =~ /^HTTP\/1\.0 (\d+).*?\r\n\r\n(.*)\z/s;
+	return ($1, $2);
+}
+
+$tf->{CONFIGFILE} = 'errorlog.conf';
+
+unlink($errorlog);
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+# identical messages are logged once, then counted
+my $n401 = grep { (get($tf->{PORT}, "/auth/repeat"))[0] eq '401' } (1..5);
+is($n401, 5, 'identical error messages');
+
+# (rate limit is per second)
+sleep(2);
+
+# more messages from one source line than server.errorlog-rate-limit
+my $flood = 50;
+$n401 = grep { (get($tf->{PORT}, "/auth/flood-$_"))[0] eq '401' } (1..$flood);
+is($n401, $flood, 'flood of error messages');
+
+# (suppressed messages and errorlog.dropped-lines are reported once a second)
+sleep(2);
+
+my ($status, $stats) = get($tf->{PORT}, "/server-statistics");
+my $dropped = $stats =~ /^errorlog\.dropped-lines: (\d+)$/m ? $1 : -1;
+
+# stop to flush the log
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+open(my $fh, '<', $errorlog) or die "$errorlog: $!";
+my @log = <$fh>;
+close($fh);
+
+is(scalar(grep { /password doesn't match for \/auth\/repeat / } @log), 1, 'identical messages logged once');
+ok(grep({ /last message repeated 4 times/ } @log), '"last message repeated N times"')
+	or diag(join('', @log));
+
+my $logged = grep { /password doesn't match for \/auth\/flood-/ } @log;
+my $suppressed = 0;
+$suppressed += $_ for map { /(\d+) messages suppressed by server\.errorlog-rate-limit/ ? $1 : () } @log;
+ok($logged >= 10 && $logged < $flood && $logged + $suppressed == $flood, 'messages over rate limit suppressed and counted')
+	or diag("logged: $logged, suppressed: $suppressed");
+
+is($dropped, $suppressed, 'errorlog.dropped-lines counter');
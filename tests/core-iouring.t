@@ -0,0 +1,105 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 7;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+my $docroot = $tf->{TESTDIR}.'/tmp/lighttpd/servers/www.example.org/pages';
+my $errorlog = $tf->{TESTDIR}.'/tmp/lighttpd/logs/lighttpd.error.log';
+
+# send request, wait delay seconds, then read the response until EOF
+sub fetch {
+	my ($port, $request, $delay) = @_;
+	my $remote = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $port);
+	return '' unless defined $remote;
+	print $remote $request;
+	sleep($delay) if $delay;
+	local $/;
+	my $resp = <$remote>;
+	close $remote;
+	return defined $resp ? $resp : '';
+}
+
+sub write_file {
+	my ($file, $size) = @_;
+	open(my $fh, '>', $file) or die "$file: $!";
+	print $fh 'x' x $size;
+	close($fh);
+}
+
+$tf->{CONFIGFILE} = 'iouring.conf';
+
+SKIP: {
+	skip "lighttpd built without io_uring", 7
+		unless `"$tf->{LIGHTTPD_PATH}" -V` =~ /^\s*\+ io_uring/m;
+
+	# (large: sent with sendfile(), small: copied into the io_uring write)
+	write_file("$docroot/iouring-large.txt", 1024*1024);
+	write_file("$docroot/iouring-small.txt", 10000);
+
+	my $logsize = -s $errorlog || 0;
+	ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+	SKIP: {
+		open(my $fh, '<', $errorlog) or die "$errorlog: $!";
+		seek($fh, $logsize, 0);
+		my $log = do { local $/; <$fh> };
+		close($fh);
+		skip "kernel without io_uring", 5
+			if defined $log && $log =~ /linux-iouring failed/;
+
+		$t->{REQUEST} = ( <<EOF
+GET /iouring-small.txt HTTP/1.0
+Connection: keep-alive
+Host: www.example.org
+
+GET /iouring-small.txt HTTP/1.0
+Host: www.example.org
+Connection: close
+EOF
+ );
+		$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'x' x 10000 } , { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'x' x 10000 } ];
+		ok($tf->handle_http($t) == 0, 'keep-alive');
+
+		my $resp = fetch($tf->{PORT}, "GET /iouring-large.txt HTTP/1.0\r\nHost: www.example.org\r\n\r\n", 0);
+		$resp =~ s/^.*?\r\n\r\n//s;
+		is(length($resp), 1024*1024, 'large file, Connection: close');
+
+		# the shutdown(SHUT_WR) after the last response waits for the
+		# writes in flight, while the client does not read yet
+		my $n = 1000;
+		my $req = "GET /iouring-small.txt HTTP/1.1\r\nHost: www.example.org\r\n\r\n" x ($n - 1)
+			. "GET /iouring-small.txt HTTP/1.1\r\nHost: www.example.org\r\nConnection: close\r\n\r\n";
+		$resp = fetch($tf->{PORT}, $req, 1);
+		my @bodies = ($resp =~ /\r\n\r\n(x{10000})/g);
+		is(scalar(@bodies), $n, 'pipelined responses, complete before shutdown');
+
+		# the client stops reading for longer than server.max-write-idle;
+		# the connection is closed with a write in flight
+		$resp = fetch($tf->{PORT}, $req, 5);
+		ok(length($resp) > 0 && length($resp) < $n * 10000, 'stalled client disconnected')
+			or diag("received ".length($resp)." bytes");
+
+		$t->{REQUEST} = ( <<EOF
+GET /iouring-small.txt HTTP/1.0
+Host: www.example.org
+EOF
+ );
+		$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'x' x 10000 } ];
+		ok($tf->handle_http($t) == 0, 'request after write to closed connection');
+	}
+
+	ok($tf->stop_proc == 0, "Stopping lighttpd");
+}
@@ -8,7 +8,7 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 14;
+use Test::More tests => 19;
 use LightyTest;
 
 my $tf = LightyTest->new();
@@ -118,5 +118,74 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 404 } ];
 ok($tf->handle_http($t) == 0, 'simple-vhost via conditionals');
 
+$t->{REQUEST}  = ( <<EOF
+GET /server-metrics HTTP/1.0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Content-Type' => 'application/openmetrics-text; version=1.0.0; charset=utf-8' } ];
+ok($tf->handle_http($t) == 0, 'OpenMetrics (status.metrics-url)');
+
+{
+	# body of the OpenMetrics response
+	my $metrics = '';
+	my $remote = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $tf->{PORT});
+	if (defined $remote) {
+		print $remote "GET /server-metrics HTTP/1.0\r\n\r\n";
+		local $/;
+		$metrics = <$remote>;
+		close $remote;
+		$metrics =~ s/^.*?\r\n\r\n//s;
+	}
+
+	# (cumulative buckets of the vhost of the requests above)
+	my $v = 'vhost="www\.example\.org"';
+	my @le = ($metrics =~ /^lighttpd_request_duration_seconds_bucket\{$v,le="([^"]+)"\} \d+$/mg);
+	my @n = ($metrics =~ /^lighttpd_request_duration_seconds_bucket\{$v,le="[^"]+"\} (\d+)$/mg);
+	my ($count) = ($metrics =~ /^lighttpd_request_duration_seconds_count\{$v\} (\d+)$/m);
+	my $sorted = (join(',', @n) eq join(',', sort { $a <=> $b } @n));
+	ok($metrics =~ /^# TYPE lighttpd_requests counter$/m
+	   && $metrics =~ /^lighttpd_requests_total [1-9]\d*$/m
+	   && $metrics =~ /^# TYPE lighttpd_request_duration_seconds histogram$/m
+	   && $metrics =~ /^# TYPE lighttpd_request_stage_duration_seconds histogram$/m
+	   && $metrics =~ /^lighttpd_request_stage_duration_seconds_bucket\{stage="read",le="0\.000128"\} \d+$/m
+	   && @le == 38 && $le[0] eq '0.000128' && $le[-1] eq '+Inf' && $sorted
+	   && defined $count && $count == $n[-1] && $count > 0
+	   && $metrics =~ /^lighttpd_request_duration_seconds_sum\{$v\} \d+\.\d{6}$/m
+	   && $metrics =~ /\n# EOF\n\z/,
+	   'OpenMetrics histograms (_bucket, _count, _sum, # EOF)')
+		or diag($metrics);
+}
+
+## static-file.precompressed
+
+$t->{REQUEST}  = ( <<EOF
+GET /precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+Accept-Encoding: gzip, br
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'br', 'Content-Encoding' => 'br', 'Vary' => 'Accept-Encoding', 'Content-Type' => 'text/plain' } ];
+ok($tf->handle_http($t) == 0, 'precompressed file, first encoding accepted');
+
+$t->{REQUEST}  = ( <<EOF
+GET /precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+Accept-Encoding: gzip, br;q=0
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'gzip', 'Content-Encoding' => 'gzip', 'Vary' => 'Accept-Encoding' } ];
+ok($tf->handle_http($t) == 0, 'precompressed file, encoding excluded with q=0');
+
+$t->{REQUEST}  = ( <<EOF
+GET /precompressed.txt HTTP/1.0
+Host: precompressed.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => "precompressed\n", '-Content-Encoding' => '', 'Vary' => 'Accept-Encoding' } ];
+ok($tf->handle_http($t) == 0, 'precompressed file, no Accept-Encoding');
+
 ok($tf->stop_proc == 0, "Stopping lighttpd");
 
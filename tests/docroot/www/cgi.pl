@@ -7,6 +7,11 @@ if ($ENV{"QUERY_STRING"} eq "internal-redir") {
 
 print "Content-Type: text/html\r\n\r\n";
 
+if ($ENV{"QUERY_STRING"} eq "remote-port") {
+    print $ENV{"REMOTE_PORT"};
+    exit 0;
+}
+
 print $ENV{"SCRIPT_NAME"};
 
 0;
@@ -0,0 +1,98 @@
+#!/usr/bin/env perl
+BEGIN {
+	# add current source dir to the include-path
+	# we need this for make distcheck
+	(my $srcdir = $0) =~ s,/[^/]+$,/,;
+	unshift @INC, $srcdir;
+}
+
+use strict;
+use IO::Socket;
+use Test::More tests => 14;
+use LightyTest;
+
+my $tf = LightyTest->new();
+my $t;
+my $logdir = $tf->{TESTDIR}.'/tmp/lighttpd/logs';
+my $cat = $tf->{BINDIR}.'/lighttpd-accesslog-cat';
+
+sub read_file {
+	my $file = shift;
+	open(my $fh, '<', $file) or return '';
+	local $/;
+	my $data = <$fh>;
+	close($fh);
+	return defined $data ? $data : '';
+}
+
+$tf->{CONFIGFILE} = 'mod-accesslog.conf';
+
+unlink(map { "$logdir/mod-accesslog.$_.log" } ('text', 'json', 'binary', 'stage'));
+
+ok($tf->start_proc == 0, "Starting lighttpd") or die();
+
+for my $host ('text.example.org', 'json.example.org', 'binary.example.org') {
+	$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Host: $host
+X-Test: a "b"\\c
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200 } ];
+	ok($tf->handle_http($t) == 0, "log a served file, $host");
+
+	$t->{REQUEST}  = ( <<EOF
+GET /nonexistent HTTP/1.0
+Host: $host
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 404 } ];
+	ok($tf->handle_http($t) == 0, "log a missing file, $host");
+}
+
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Host: stage.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200 } ];
+ok($tf->handle_http($t) == 0, 'log stage times of a served file');
+
+# rejected before request handling starts: no body stage
+$t->{REQUEST}  = ( <<EOF
+GET /index.txt HTTP/1.0
+Host: stage.example.org
+Foo bar
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 400 } ];
+ok($tf->handle_http($t) == 0, 'log stage times of a bad request');
+
+# stop to flush the logs
+ok($tf->stop_proc == 0, "Stopping lighttpd");
+
+my $text = <<'EOF';
+text.example.org GET /index.txt 200 a \"b\"\\c -
+text.example.org GET /nonexistent 404 - -
+EOF
+my $json = <<'EOF';
+{"host":"json.example.org","method":"GET","url":"/index.txt","status":200,"request_header:X-Test":"a \"b\"\\c","request_header:Referer":null}
+{"host":"json.example.org","method":"GET","url":"/nonexistent","status":404,"request_header:X-Test":null,"request_header:Referer":null}
+EOF
+my $cat_text = <<'EOF';
+"binary.example.org" "GET" "/index.txt" 200 "a \"b\"\\c" -
+"binary.example.org" "GET" "/nonexistent" 404 - -
+EOF
+
+is(read_file("$logdir/mod-accesslog.text.log")
+   .read_file("$logdir/mod-accesslog.json.log"), $text.$json,
+   'text and json access log records');
+
+my $out = `"$cat" "$logdir/mod-accesslog.binary.log"`;
+$out .= `"$cat" -j "$logdir/mod-accesslog.binary.log"`;
+(my $cat_json = $json) =~ s/json\.example\.org/binary.example.org/g;
+is($out, $cat_text.$cat_json, 'lighttpd-accesslog-cat prints binary records as text and json');
+
+my @stage = split(/\n/, read_file("$logdir/mod-accesslog.stage.log"));
+like($stage[0], qr/^200 \d+ \d+ \d+ \d+$/, '%{stage}S of a served file');
+like($stage[1], qr/^400 \d+ \d+ - \d+$/, '%{stage}S is - for a stage not reached');
@@ -7,9 +7,34 @@ BEGIN {
 }
 
 use strict;
-use Test::More tests => 59;
+use IO::Socket;
+use Test::More tests => 61;
 use LightyTest;
 
+# body of GET <uri> (HTTP/1.0) from server on port
+sub get_body {
+	my ($port, $uri) = @_;
+	my $remote = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $port);
+	return '' unless defined $remote;
+	print $remote "GET $uri HTTP/1.0\r\nHost: www.example.org\r\n\r\n";
+	local $/;
+	my $resp = <$remote>;
+	close $remote;
+	return '' unless defined $resp;
+	$resp =~ s/^.*?\r\n\r\n//s;
+	return $resp;
+}
+
+# number of connects made to the "grisu" fastcgi backend
+sub backend_connects {
+	my ($port) = @_;
+	my $stats = get_body($port, "/server-statistics");
+	return $stats =~ /^gw\.backend\.grisu\.\d+\.connected: (\d+)$/m ? $1 : -1;
+}
+
 my $tf = LightyTest->new();
 
 my $t;
@@ -348,7 +373,7 @@ EOF
 
 
 SKIP: {
-	skip "no fcgi-responder found", 10 unless -x $tf->{BASEDIR}."/tests/fcgi-responder" || -x $tf->{BASEDIR}."/tests/fcgi-responder.exe";
+	skip "no fcgi-responder found", 12 unless -x $tf->{BASEDIR}."/tests/fcgi-responder" || -x $tf->{BASEDIR}."/tests/fcgi-responder.exe";
 	
 	$tf->{CONFIGFILE} = 'fastcgi-responder.conf';
 	ok($tf->start_proc == 0, "Starting lighttpd with $tf->{CONFIGFILE}") or die();
@@ -384,6 +409,21 @@ EOF
 	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'test123' } ];
 	ok($tf->handle_http($t) == 0, 'line-ending \r\n + \r\n');
 
+	$t->{REQUEST}  = ( <<EOF
+GET /index.fcgi?crlf HTTP/1.0
+Host: www.example.org
+EOF
+ );
+	$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => 'test123' } ];
+	ok($tf->handle_http($t) == 0, 'response over persistent backend connection');
+
+	# no new connect to the backend if the idle connection is reused
+	my $connects = backend_connects($tf->{PORT});
+	my $body = get_body($tf->{PORT}, "/index.fcgi?crlf");
+	my $connects2 = backend_connects($tf->{PORT});
+	ok($body eq 'test123' && $connects > 0 && $connects == $connects2, 'backend connection reused')
+		or diag("backend connects: $connects, $connects2; body: '$body'");
+
 	$t->{REQUEST}  = ( <<EOF
 GET /abc/def/ghi?path_info HTTP/1.0
 Host: wsgi.example.org
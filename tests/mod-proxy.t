@@ -8,9 +8,26 @@ BEGIN {
 
 use strict;
 use IO::Socket;
-use Test::More tests => 9;
+use Test::More tests => 12;
 use LightyTest;
 
+# body of GET <uri> (HTTP/1.0) from server on port
+sub get_body {
+	my ($port, $uri) = @_;
+	my $remote = IO::Socket::INET->new(
+		Proto    => "tcp",
+		PeerAddr => "127.0.0.1",
+		PeerPort => $port);
+	return '' unless defined $remote;
+	print $remote "GET $uri HTTP/1.0\r\nHost: www.example.org\r\n\r\n";
+	local $/;
+	my $resp = <$remote>;
+	close $remote;
+	return '' unless defined $resp;
+	$resp =~ s/^.*?\r\n\r\n//s;
+	return $resp;
+}
+
 my $tf_real = LightyTest->new();
 my $tf_proxy = LightyTest->new();
 
@@ -53,6 +70,27 @@ EOF
 $t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'Server' => 'Apache 1.3.29' } ];
 ok($tf_proxy->handle_http($t) == 0, 'drop Server from real server');
 
+$t->{REQUEST}  = ( <<EOF
+HEAD /index.html HTTP/1.0
+Host: www.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, '-HTTP-Content' => '' } ];
+ok($tf_proxy->handle_http($t) == 0, 'HEAD over persistent backend connection');
+
+$t->{REQUEST}  = ( <<EOF
+GET /cgi.pl HTTP/1.0
+Host: www.example.org
+EOF
+ );
+$t->{RESPONSE} = [ { 'HTTP-Protocol' => 'HTTP/1.0', 'HTTP-Status' => 200, 'HTTP-Content' => '/cgi.pl' } ];
+ok($tf_proxy->handle_http($t) == 0, 'response over persistent backend connection');
+
+# the backend sees the same client port if the connection is reused
+my @ports = map { get_body($tf_proxy->{PORT}, "/cgi.pl?remote-port") } (1, 2);
+ok($ports[0] =~ /^\d+$/ && $ports[0] eq $ports[1], 'backend connection reused')
+	or diag("REMOTE_PORT seen by backend: '$ports[0]', '$ports[1]'");
+
 SKIP: {
 	skip "no PHP running on port 1026", 1 unless $tf_real->listening_on(1026);
 	$t->{REQUEST}  = ( <<EOF
@@ -58,6 +58,9 @@ touch "${tmpdir}/servers/www.example.org/pages/image.jpg" \
       "${tmpdir}/servers/evhost/e/v/evhost1/pages/index.html" \
       "${tmpdir}/servers/evhost/evhost2/pages/index.html"
 echo "12345" > "${tmpdir}/servers/www.example.org/pages/range.pdf"
+echo "precompressed" > "${tmpdir}/servers/www.example.org/pages/precompressed.txt"
+printf "gzip" > "${tmpdir}/servers/www.example.org/pages/precompressed.txt.gz"
+printf "br" > "${tmpdir}/servers/www.example.org/pages/precompressed.txt.br"
 
 printf "%-40s" "preparing infrastructure"
 